@@ -0,0 +1,475 @@
+#include <cpu/sh4_block.hh>
+#include <hle/hle_bios.hh>
+#include <lucid.hh>
+#include <algorithm>
+#include <iostream>
+
+Sh4_Branch sh4_branch_type(std::uint16_t opcode)
+{
+    switch (opcode & 0xFF00)
+    {
+        case 0x8900:    // bt
+        case 0x8B00:    // bf
+            return Sh4_Branch::Conditional;
+
+        case 0x8D00:    // bt/s
+        case 0x8F00:    // bf/s
+            return Sh4_Branch::Conditional_Delayed;
+
+        case 0xC300:    // trapa
+            return Sh4_Branch::Stop;
+    }
+
+    switch (opcode & 0xF000)
+    {
+        case 0xA000:    // bra
+        case 0xB000:    // bsr
+            return Sh4_Branch::Static_Delayed;
+    }
+
+    switch (opcode & 0xF0FF)
+    {
+        case 0x402B:    // jmp @Rn
+        case 0x400B:    // jsr @Rn
+        case 0x0023:    // braf Rn
+        case 0x0003:    // bsrf Rn
+            return Sh4_Branch::Indirect_Delayed;
+
+        case 0x400E:    // ldc Rm,SR
+        case 0x4007:    // ldc.l @Rm+,SR
+            return Sh4_Branch::Stop;
+    }
+
+    switch (opcode)
+    {
+        case 0x000B:    // rts
+        case 0x002B:    // rte
+            return Sh4_Branch::Indirect_Delayed;
+
+        case HLE_TRAP_OPCODE:   // HLE BIOS syscall, returns to PR
+            return Sh4_Branch::Stop;
+
+        case 0x001B:    // sleep
+            return Sh4_Branch::Stop;
+    }
+
+    return Sh4_Branch::None;
+}
+
+Sh4_Call sh4_call_type(std::uint16_t opcode)
+{
+    if ((opcode & 0xF000) == 0xB000 || (opcode & 0xF0FF) == 0x0003 || (opcode & 0xF0FF) == 0x400B)
+    {
+        return Sh4_Call::Call;
+    }
+
+    if (opcode == 0x000B)
+    {
+        return Sh4_Call::Return;
+    }
+
+    return Sh4_Call::None;
+}
+
+/*
+    Only meaningful for PC-relative branches (BT/BF/BT/S/BF/S/BRA/BSR)
+*/
+std::uint32_t sh4_branch_target(std::uint16_t opcode, std::uint32_t pc)
+{
+    if ((opcode & 0xE000) == 0xA000)
+    {
+        // 12 bit displacement
+        std::int32_t disp = static_cast<std::int32_t>(static_cast<std::int16_t>(opcode << 4)) >> 4;
+        return pc + 4 + (disp << 1);
+    }
+
+    return pc + 4 + (static_cast<std::int32_t>(static_cast<std::int8_t>(opcode & 0xFF)) << 1);
+}
+
+Sh4_Block_Cache::Sh4_Block_Cache(Sh4_Cpu *cpu_, Memory *memory_)
+{
+    cpu = cpu_;
+    memory = memory_;
+
+    compiled = 0;
+    invalidated = 0;
+    lookups = 0;
+    chained = 0;
+    ras_hits = 0;
+    ras_misses = 0;
+
+    ras_top = 0;
+    generation = 0;
+
+    ir_stats = {};
+    dump_ir = false;
+    tcache = nullptr;
+    jit = nullptr;
+    lazy = false;
+
+    for (auto &entry : ras)
+    {
+        entry = {UINT32_MAX, nullptr, UINT64_MAX};
+    }
+}
+
+Sh4_Block_Cache::~Sh4_Block_Cache()
+{
+}
+
+/*
+    Decodes a block starting at pc: up to the first branch (Plus its delay slot),
+    SLEEP-like instructions, BLOCK_MAX_LENGTH instructions or the end of the page
+*/
+Sh4_Block *Sh4_Block_Cache::compile(std::uint32_t pc)
+{
+    auto block = std::make_unique<Sh4_Block>();
+
+    block->start_pc = pc;
+    block->branch = Sh4_Branch::None;
+    block->call = Sh4_Call::None;
+    block->return_link = nullptr;
+    block->taken_pc = UINT32_MAX;
+    block->fallthrough_pc = UINT32_MAX;
+    block->taken_link = nullptr;
+    block->fallthrough_link = nullptr;
+    block->indirect_victim = 0;
+    block->native = nullptr;
+    block->native_generation = 0;
+    block->native_exits = {};
+    block->native_state_accesses = 0;
+    block->executions = 0;
+    block->valid = true;
+
+    for (auto &entry : block->indirect_cache)
+    {
+        entry = {UINT32_MAX, nullptr};
+    }
+
+    std::uint32_t address = pc;
+
+    while (true)
+    {
+        std::uint16_t opcode = memory->read<std::uint16_t>(address, cpu);
+        block->opcodes.push_back(opcode);
+
+        Sh4_Branch branch = sh4_branch_type(opcode);
+
+        if (branch != Sh4_Branch::None)
+        {
+            block->branch = branch;
+            block->call = sh4_call_type(opcode);
+
+            if (branch != Sh4_Branch::Indirect_Delayed && branch != Sh4_Branch::Stop)
+            {
+                block->taken_pc = sh4_branch_target(opcode, address);
+            }
+
+            // Delay slot
+            if (branch == Sh4_Branch::Conditional_Delayed || branch == Sh4_Branch::Static_Delayed ||
+                branch == Sh4_Branch::Indirect_Delayed)
+            {
+                address += 2;
+                block->opcodes.push_back(memory->read<std::uint16_t>(address, cpu));
+            }
+
+            address += 2;
+            break;
+        }
+
+        address += 2;
+
+        if (block->opcodes.size() >= BLOCK_MAX_LENGTH || (address & ((1u << BLOCK_PAGE_SHIFT) - 1)) == 0)
+        {
+            break;
+        }
+    }
+
+    block->end_pc = address;
+
+    std::uint32_t tcache_flags = 0;
+
+    if (!tcache || !tcache->find(pc, block->opcodes, block->ir, block->decoded_state_accesses, tcache_flags))
+    {
+        block->ir = sh4_ir_build(pc, block->opcodes, cpu, memory);
+        block->decoded_state_accesses = sh4_ir_state_accesses(block->ir);
+        sh4_ir_optimize(block->ir, ir_stats);
+
+        if (tcache)
+        {
+            tcache->record(block->ir, block->opcodes, block->decoded_state_accesses, 0);
+        }
+    }
+
+    block->ir_state_accesses = sh4_ir_state_accesses(block->ir);
+    block->tcache_flags = tcache_flags;
+
+    if (dump_ir)
+    {
+        lucid_out() << BOLDCYAN << sh4_ir_dump(block->ir) << RESET;
+    }
+
+    if (block->branch != Sh4_Branch::Static_Delayed && block->branch != Sh4_Branch::Indirect_Delayed)
+    {
+        block->fallthrough_pc = address;
+    }
+
+    block->first_page = (pc & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT;
+    block->last_page = ((address - 2) & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT;
+
+    for (std::uint32_t page = block->first_page; page <= block->last_page; page++)
+    {
+        pages[page].push_back(block.get());
+        memory->set_code_page(page << BLOCK_PAGE_SHIFT);
+    }
+
+    compiled++;
+
+    Sh4_Block *result = block.get();
+    blocks[pc] = std::move(block);
+
+    return result;
+}
+
+void Sh4_Block_Cache::link(Sh4_Block **slot, Sh4_Block *target)
+{
+    *slot = target;
+    target->incoming.push_back(slot);
+}
+
+void Sh4_Block_Cache::unlink(Sh4_Block **slot)
+{
+    if (*slot == nullptr)
+    {
+        return;
+    }
+
+    auto &incoming = (*slot)->incoming;
+    incoming.erase(std::find(incoming.begin(), incoming.end(), slot));
+
+    *slot = nullptr;
+}
+
+/*
+    Dispatcher path, compiles the block if it doesn't exist yet
+*/
+Sh4_Block *Sh4_Block_Cache::lookup(std::uint32_t pc)
+{
+    lookups++;
+
+    auto it = blocks.find(pc);
+
+    if (it != blocks.end())
+    {
+        return it->second.get();
+    }
+
+    return compile(pc);
+}
+
+/*
+    Existing block only, nullptr if there's none
+*/
+Sh4_Block *Sh4_Block_Cache::find(std::uint32_t pc)
+{
+    auto it = blocks.find(pc);
+
+    return it != blocks.end() ? it->second.get() : nullptr;
+}
+
+Sh4_Block *Sh4_Block_Cache::successor(std::uint32_t pc)
+{
+    return lazy ? find(pc) : lookup(pc);
+}
+
+/*
+    Picks the successor of a block that just ran (PC already updated), following
+    or creating the direct link for that exit
+*/
+Sh4_Block *Sh4_Block_Cache::next(Sh4_Block *block, std::uint32_t pc)
+{
+    Sh4_Block **slot;
+
+    if (!block->valid)
+    {
+        return successor(pc);
+    }
+
+    if (block->call == Sh4_Call::Call)
+    {
+        ras_top = (ras_top + 1) % BLOCK_RAS_SIZE;
+        ras[ras_top] = {block->end_pc, block, generation};
+    }
+    else if (block->call == Sh4_Call::Return)
+    {
+        return next_return(pc);
+    }
+
+    if (pc == block->taken_pc)
+    {
+        slot = &block->taken_link;
+    }
+    else if (pc == block->fallthrough_pc)
+    {
+        slot = &block->fallthrough_link;
+    }
+    else
+    {
+        for (auto &entry : block->indirect_cache)
+        {
+            if (entry.pc == pc && entry.block)
+            {
+                chained++;
+                return entry.block;
+            }
+        }
+
+        auto &entry = block->indirect_cache[block->indirect_victim];
+        block->indirect_victim = (block->indirect_victim + 1) % BLOCK_INDIRECT_CACHE_SIZE;
+
+        unlink(&entry.block);
+
+        Sh4_Block *target = successor(pc);
+
+        // Compiling may have invalidated the block itself (Unlikely, but it's only a cache)
+        if (block->valid && target)
+        {
+            entry.pc = pc;
+            link(&entry.block, target);
+        }
+
+        return target;
+    }
+
+    if (*slot)
+    {
+        chained++;
+        return *slot;
+    }
+
+    Sh4_Block *target = successor(pc);
+
+    if (block->valid && target)
+    {
+        link(slot, target);
+    }
+
+    return target;
+}
+
+Sh4_Block *Sh4_Block_Cache::next_return(std::uint32_t pc)
+{
+    Ras_Entry &entry = ras[ras_top];
+    ras_top = (ras_top + BLOCK_RAS_SIZE - 1) % BLOCK_RAS_SIZE;
+
+    if (entry.return_pc != pc || entry.generation != generation)
+    {
+        // Mispredicted (PR got modified, longjmp-like code, stack overflow...)
+        ras_misses++;
+        entry.return_pc = UINT32_MAX;
+        return successor(pc);
+    }
+
+    entry.return_pc = UINT32_MAX;
+    ras_hits++;
+
+    Sh4_Block *caller = entry.caller;
+
+    if (caller->return_link)
+    {
+        return caller->return_link;
+    }
+
+    Sh4_Block *target = successor(pc);
+
+    if (caller->valid && target)
+    {
+        link(&caller->return_link, target);
+    }
+
+    return target;
+}
+
+void Sh4_Block_Cache::invalidate_block(Sh4_Block *block)
+{
+    block->valid = false;
+    generation++;
+
+    if (jit)
+    {
+        jit->unlink(block);
+    }
+
+    // Nobody can jump straight into it anymore...
+    for (Sh4_Block **slot : block->incoming)
+    {
+        *slot = nullptr;
+    }
+
+    block->incoming.clear();
+
+    // ...and it doesn't hold on to anybody else either
+    unlink(&block->taken_link);
+    unlink(&block->fallthrough_link);
+    unlink(&block->return_link);
+
+    for (auto &entry : block->indirect_cache)
+    {
+        unlink(&entry.block);
+    }
+
+    for (std::uint32_t page = block->first_page; page <= block->last_page; page++)
+    {
+        auto it = pages.find(page);
+
+        if (it != pages.end())
+        {
+            auto &list = it->second;
+            list.erase(std::remove(list.begin(), list.end(), block), list.end());
+
+            if (list.empty())
+            {
+                pages.erase(it);
+            }
+        }
+    }
+
+    auto it = blocks.find(block->start_pc);
+
+    if (it != blocks.end() && it->second.get() == block)
+    {
+        retired.push_back(std::move(it->second));
+        blocks.erase(it);
+    }
+
+    invalidated++;
+}
+
+/*
+    Called when guest code writes to a page blocks were built from
+*/
+void Sh4_Block_Cache::invalidate_page(std::uint32_t p_addr)
+{
+    auto it = pages.find((p_addr & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT);
+
+    if (it == pages.end())
+    {
+        return;
+    }
+
+    // invalidate_block edits the list
+    std::vector<Sh4_Block *> list = it->second;
+
+    for (Sh4_Block *block : list)
+    {
+        invalidate_block(block);
+    }
+}
+
+void Sh4_Block_Cache::flush()
+{
+    while (!blocks.empty())
+    {
+        invalidate_block(blocks.begin()->second.get());
+    }
+}
@@ -0,0 +1,185 @@
+#include <cpu/sh4_code_cache.hh>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CODE_CACHE_PAGE_SIZE    4096
+
+Sh4_Code_Cache::Sh4_Code_Cache()
+{
+    fd = -1;
+    write_view = nullptr;
+    exec_view = nullptr;
+    size = 0;
+    generation_size = 0;
+
+    installed = 0;
+    evictions = 0;
+    flushes = 0;
+
+    map(CODE_CACHE_DEFAULT_SIZE);
+}
+
+Sh4_Code_Cache::~Sh4_Code_Cache()
+{
+    unmap();
+}
+
+void Sh4_Code_Cache::map(std::size_t size_)
+{
+    generation_size = std::max<std::size_t>(size_, CODE_CACHE_MIN_SIZE) / CODE_CACHE_GENERATIONS;
+    generation_size &= ~static_cast<std::size_t>(CODE_CACHE_PAGE_SIZE - 1);
+    size = generation_size * CODE_CACHE_GENERATIONS;
+
+    current = 0;
+    used.fill(0);
+
+    fd = memfd_create("lucid-jit", MFD_CLOEXEC);
+
+    if (fd >= 0 && ftruncate(fd, size) == 0)
+    {
+        void *writable = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        void *executable = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+
+        if (writable != MAP_FAILED && executable != MAP_FAILED)
+        {
+            write_view = static_cast<std::uint8_t *>(writable);
+            exec_view = static_cast<std::uint8_t *>(executable);
+            return;
+        }
+
+        if (writable != MAP_FAILED) munmap(writable, size);
+        if (executable != MAP_FAILED) munmap(executable, size);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    // Single mapping, pages go RW while code is copied in and back to RX
+    void *buffer = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buffer == MAP_FAILED)
+    {
+        size = generation_size = 0;
+        return;
+    }
+
+    write_view = exec_view = static_cast<std::uint8_t *>(buffer);
+}
+
+void Sh4_Code_Cache::unmap()
+{
+    if (exec_view)
+    {
+        munmap(exec_view, size);
+    }
+
+    if (write_view && write_view != exec_view)
+    {
+        munmap(write_view, size);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    fd = -1;
+    write_view = exec_view = nullptr;
+}
+
+void Sh4_Code_Cache::resize(std::size_t size_)
+{
+    // Whatever was handed out before has to be seen as dead after the remap
+    std::uint64_t next = current + CODE_CACHE_GENERATIONS;
+
+    unmap();
+    map(size_);
+
+    current = next;
+    flushes++;
+}
+
+/*
+    Moves on to the next region, the generation that was in it is gone
+*/
+void Sh4_Code_Cache::next_generation()
+{
+    current++;
+
+    std::size_t &region = used[current % CODE_CACHE_GENERATIONS];
+
+    if (region)
+    {
+        evictions++;
+    }
+
+    region = 0;
+}
+
+void Sh4_Code_Cache::write(std::size_t offset, const std::uint8_t *data, std::size_t length)
+{
+    if (dual_mapped())
+    {
+        std::memcpy(write_view + offset, data, length);
+        return;
+    }
+
+    std::size_t first = offset & ~static_cast<std::size_t>(CODE_CACHE_PAGE_SIZE - 1);
+    std::size_t last = (offset + length + CODE_CACHE_PAGE_SIZE - 1) & ~static_cast<std::size_t>(CODE_CACHE_PAGE_SIZE - 1);
+
+    mprotect(write_view + first, last - first, PROT_READ | PROT_WRITE);
+    std::memcpy(write_view + offset, data, length);
+    mprotect(write_view + first, last - first, PROT_READ | PROT_EXEC);
+}
+
+const std::uint8_t *Sh4_Code_Cache::install(const std::uint8_t *data, std::size_t length)
+{
+    if (length > generation_size)
+    {
+        return nullptr;
+    }
+
+    if (used[current % CODE_CACHE_GENERATIONS] + length > generation_size)
+    {
+        next_generation();
+    }
+
+    std::size_t &region = used[current % CODE_CACHE_GENERATIONS];
+    std::size_t offset = (current % CODE_CACHE_GENERATIONS) * generation_size + region;
+
+    write(offset, data, length);
+
+    region = std::min(generation_size, (region + length + 15) & ~static_cast<std::size_t>(15));
+    installed++;
+
+    return exec_view + offset;
+}
+
+void Sh4_Code_Cache::patch(const std::uint8_t *address, const std::uint8_t *data, std::size_t length)
+{
+    write(address - exec_view, data, length);
+}
+
+void Sh4_Code_Cache::flush()
+{
+    current += CODE_CACHE_GENERATIONS;
+    used.fill(0);
+    flushes++;
+}
+
+std::size_t Sh4_Code_Cache::occupancy() const
+{
+    std::size_t total = 0;
+
+    for (std::size_t region : used)
+    {
+        total += region;
+    }
+
+    return total;
+}
@@ -1,6 +1,8 @@
 #include <cpu/sh4_cpu.hh>
 #include <lucid.hh>
 #include <iostream>
+#include <bit>
+#include <cstring>
 
 #if __has_include(<format>)
     #include <format>
@@ -10,18 +12,18 @@
     using fmt::format;
 #endif
 
-Sh4_Cpu::Sh4_Cpu()
+Sh4_Cpu::Sh4_Cpu(std::uint32_t seed) : undefined_values(seed)
 {
     // CPU State
 
     // Bank 0 and 1 Registers R0-R7 start with undefined values
-    for (std::uint8_t i = 0; i < sizeof(registers_); i++)
+    for (std::uint8_t i = 0; i < 16; i++)
     {
         registers_[i] = 0x00;
     }
 
     // Setup R0_BANK1 through R7_BANK1 registers
-    for (std::uint8_t i = 0; i < sizeof(bank1_registers); i++)
+    for (std::uint8_t i = 0; i < 8; i++)
     {
         bank1_registers[i] = 0x00;
     }
@@ -39,12 +41,28 @@ Sh4_Cpu::Sh4_Cpu()
     procedure_register = UNDEFINED_REG_VAL;
     pc = 0xA0000000;
     delay_pc = pc + 2;
+    sleeping = false;
     fpscr = FPSCR_INITIAL_VALUE;
     fpul = UNDEFINED_REG_VAL;
 
+    // FPU registers are undefined after a reset
+    for (std::uint8_t bank = 0; bank < 2; bank++)
+    {
+        for (std::uint8_t i = 0; i < 16; i++)
+        {
+            fpu_registers_[bank][i] = UNDEFINED_REG_VAL;
+        }
+    }
+
+    remap_fpu_registers();
+
     expevt = 0x00000000;
+    intevt = 0x00000000;
+    tra = UNDEFINED_REG_VAL;
 
-    mmucr = 0x00000000;
+    interrupt_level = 0;
+    interrupt_code = 0;
+    interrupt_pending_ = false;
 
     ccr = 0x00000000;
 
@@ -70,7 +88,7 @@ Sh4_Cpu::Sh4_Cpu()
     for (std::uint8_t i = 0; i < 8; i++)
     {
         registers[i] = SR_RB_BIT ? &bank1_registers[i] : &registers_[i];
-        registers[i + 8] = &registers_[i];
+        registers[i + 8] = &registers_[i + 8];
     }
 }
 
@@ -80,47 +98,210 @@ Sh4_Cpu::~Sh4_Cpu()
 
 bool Sh4_Cpu::get_md_bit()
 {
-    return ((status_register >> 29) & 1);
+    return ((status_register >> 30) & 1);
 }
 
 void Sh4_Cpu::print_registers()
 {
-    std::cout << BOLDBLUE << "General Registers:" << RESET << std::endl;
+    lucid_out() << BOLDBLUE << "General Registers:" << RESET << std::endl;
 
     for (int i = 0; i < 8; i++)
     {
-        std::cout << "R" << i << "_BANK0: " << BOLDWHITE << "0x" << format("{:08X}", registers_[i])
+        lucid_out() << "R" << i << "_BANK0: " << BOLDWHITE << "0x" << format("{:08X}", registers_[i])
         << RESET << "        R" << i << "_BANK1: " << BOLDWHITE << "0x" << format("{:08X}", bank1_registers[i]) << RESET;
 
         if (i + 8 < 10)
         {
-            std::cout << "        R" << i + 8 << " : " << BOLDWHITE << "0x" << format("{:08X}", registers_[i]) << RESET << "\n";
+            lucid_out() << "        R" << i + 8 << " : " << BOLDWHITE << "0x" << format("{:08X}", registers_[i + 8]) << RESET << "\n";
         }
         else
         {
-            std::cout << "        R" << i + 8 << ": " << BOLDWHITE << "0x" << format("{:08X}", registers_[i]) << RESET << "\n";
+            lucid_out() << "        R" << i + 8 << ": " << BOLDWHITE << "0x" << format("{:08X}", registers_[i + 8]) << RESET << "\n";
         }
     }
 
-    std::cout << "\n" << BOLDGREEN << "Control Registers:" << RESET << "\n";
-    std::cout << "Status Register (SR):                                        " << BOLDWHITE << "0x" << format("{:08X}", status_register) << RESET << "\n";
-    std::cout << "Saved Status Register (SSR):                                 " << BOLDWHITE << "0x" << format("{:08X}", saved_status_register) << RESET << "\n";
-    std::cout << "Saved Program Counter (SPC):                                 " << BOLDWHITE << "0x" << format("{:08X}", saved_pc) << RESET << "\n";
-    std::cout << "Global Base Register (GBR):                                  " << BOLDWHITE << "0x" << format("{:08X}", global_base_register) << RESET << "\n";
-    std::cout << "Vector Base Register (VBR):                                  " << BOLDWHITE << "0x" << format("{:08X}", vector_base_register) << RESET << "\n";
-    std::cout << "Saved General Register 15 (SGR):                             " << BOLDWHITE << "0x" << format("{:08X}", saved_general_register_15) << RESET << "\n";
-    std::cout << "Debug Base Register (DBR):                                   " << BOLDWHITE << "0x" << format("{:08X}", debug_base_register) << RESET << "\n";
-
-    std::cout << "\n" << BOLDMAGENTA << "System Registers:" << RESET "\n";
-    std::cout << "Multiply-and-accumulate register high (MACH):                " << BOLDWHITE << "0x" << format("{:08X}", mach) << RESET << "\n";
-    std::cout << "Multiply-and-accumulate register low (MACL):                 " << BOLDWHITE << "0x" << format("{:08X}", macl) << RESET << "\n";
-    std::cout << "Procedure Register (PR):                                     " << BOLDWHITE << "0x" << format("{:08X}", procedure_register) << RESET << "\n";
-    std::cout << "Program Counter (PC):                                        " << BOLDWHITE << "0x" << format("{:08X}", pc) << RESET << "\n";
-    std::cout << "Floating-point Status/Control Register (FPSCR):              " << BOLDWHITE << "0x" << format("{:08X}", fpscr) << RESET << "\n";
-    std::cout << "Floating-point Communication Register (FPUL):                " << BOLDWHITE << "0x" << format("{:08X}", fpul) << RESET << "\n";
+    lucid_out() << "\n" << BOLDGREEN << "Control Registers:" << RESET << "\n";
+    lucid_out() << "Status Register (SR):                                        " << BOLDWHITE << "0x" << format("{:08X}", status_register) << RESET << "\n";
+    lucid_out() << "Saved Status Register (SSR):                                 " << BOLDWHITE << "0x" << format("{:08X}", saved_status_register) << RESET << "\n";
+    lucid_out() << "Saved Program Counter (SPC):                                 " << BOLDWHITE << "0x" << format("{:08X}", saved_pc) << RESET << "\n";
+    lucid_out() << "Global Base Register (GBR):                                  " << BOLDWHITE << "0x" << format("{:08X}", global_base_register) << RESET << "\n";
+    lucid_out() << "Vector Base Register (VBR):                                  " << BOLDWHITE << "0x" << format("{:08X}", vector_base_register) << RESET << "\n";
+    lucid_out() << "Saved General Register 15 (SGR):                             " << BOLDWHITE << "0x" << format("{:08X}", saved_general_register_15) << RESET << "\n";
+    lucid_out() << "Debug Base Register (DBR):                                   " << BOLDWHITE << "0x" << format("{:08X}", debug_base_register) << RESET << "\n";
+
+    lucid_out() << "\n" << BOLDMAGENTA << "System Registers:" << RESET "\n";
+    lucid_out() << "Multiply-and-accumulate register high (MACH):                " << BOLDWHITE << "0x" << format("{:08X}", mach) << RESET << "\n";
+    lucid_out() << "Multiply-and-accumulate register low (MACL):                 " << BOLDWHITE << "0x" << format("{:08X}", macl) << RESET << "\n";
+    lucid_out() << "Procedure Register (PR):                                     " << BOLDWHITE << "0x" << format("{:08X}", procedure_register) << RESET << "\n";
+    lucid_out() << "Program Counter (PC):                                        " << BOLDWHITE << "0x" << format("{:08X}", pc) << RESET << "\n";
+    lucid_out() << "Floating-point Status/Control Register (FPSCR):              " << BOLDWHITE << "0x" << format("{:08X}", fpscr) << RESET << "\n";
+    lucid_out() << "Floating-point Communication Register (FPUL):                " << BOLDWHITE << "0x" << format("{:08X}", fpul) << RESET << "\n";
+
+    lucid_out() << "\n" << BOLDCYAN << "Floating-point Registers:" << RESET "\n";
+
+    for (int i = 0; i < 16; i++)
+    {
+        lucid_out() << "FR" << i << ((i < 10) ? " : " : ": ") << BOLDWHITE << "0x" << format("{:08X}", fr[i])
+        << RESET << "        XF" << i << ((i < 10) ? " : " : ": ") << BOLDWHITE << "0x" << format("{:08X}", xf[i]) << RESET << "\n";
+    }
     
-    std::cout << "\n" << BOLDYELLOW << "Exception Registers:" << RESET "\n";
-    std::cout << "Exception event register (EXPEVT):                           " << BOLDWHITE << "0x" << format("{:08X}", expevt) << RESET << "\n";
+    lucid_out() << "\n" << BOLDYELLOW << "Exception Registers:" << RESET "\n";
+    lucid_out() << "Exception event register (EXPEVT):                           " << BOLDWHITE << "0x" << format("{:08X}", expevt) << RESET << "\n";
+    lucid_out() << "Interrupt event register (INTEVT):                           " << BOLDWHITE << "0x" << format("{:08X}", intevt) << RESET << "\n";
+    lucid_out() << "TRAPA exception register (TRA):                              " << BOLDWHITE << "0x" << format("{:08X}", tra) << RESET << "\n";
+}
+
+void Sh4_Cpu::copy_state(const Sh4_Cpu &other)
+{
+    *this = other;
+
+    for (std::uint8_t i = 0; i < 8; i++)
+    {
+        registers[i + 8] = &registers_[i + 8];
+    }
+
+    remap_banking_registers();
+    remap_fpu_registers();
+}
+
+std::vector<Sh4_Register_Diff> sh4_compare_state(const Sh4_Cpu_State &state, const Sh4_Cpu_State &other)
+{
+    std::vector<Sh4_Register_Diff> diffs;
+
+    // Names only get built for what differs
+    if (!memcmp(&state, &other, sizeof(Sh4_Cpu_State)))
+    {
+        return diffs;
+    }
+
+    auto check = [&diffs](auto name, std::uint32_t value, std::uint32_t other_value)
+    {
+        if (value != other_value)
+        {
+            diffs.push_back({name(), value, other_value});
+        }
+    };
+
+    for (int i = 0; i < 8; i++)
+    {
+        check([i]() { return format("R{}_BANK0", i); }, state.r_bank0[i], other.r_bank0[i]);
+        check([i]() { return format("R{}_BANK1", i); }, state.r_bank1[i], other.r_bank1[i]);
+        check([i]() { return format("R{}", i + 8); }, state.r[i], other.r[i]);
+    }
+
+    check([]() { return "SR"; }, state.sr, other.sr);
+    check([]() { return "SSR"; }, state.ssr, other.ssr);
+    check([]() { return "SPC"; }, state.spc, other.spc);
+    check([]() { return "GBR"; }, state.gbr, other.gbr);
+    check([]() { return "VBR"; }, state.vbr, other.vbr);
+    check([]() { return "SGR"; }, state.sgr, other.sgr);
+    check([]() { return "DBR"; }, state.dbr, other.dbr);
+    check([]() { return "MACH"; }, state.mach, other.mach);
+    check([]() { return "MACL"; }, state.macl, other.macl);
+    check([]() { return "PR"; }, state.pr, other.pr);
+    check([]() { return "PC"; }, state.pc, other.pc);
+    check([]() { return "Delay PC"; }, state.delay_pc, other.delay_pc);
+    check([]() { return "FPSCR"; }, state.fpscr, other.fpscr);
+    check([]() { return "FPUL"; }, state.fpul, other.fpul);
+
+    for (int bank = 0; bank < 2; bank++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            check([bank, i]() { return format("FPR{}_BANK{}", i, bank); }, state.fpr[bank][i], other.fpr[bank][i]);
+        }
+    }
+
+    check([]() { return "Sleeping"; }, state.sleeping, other.sleeping);
+    check([]() { return "EXPEVT"; }, state.expevt, other.expevt);
+    check([]() { return "INTEVT"; }, state.intevt, other.intevt);
+    check([]() { return "TRA"; }, state.tra, other.tra);
+    check([]() { return "MMUCR"; }, state.mmucr, other.mmucr);
+    check([]() { return "CCR"; }, state.ccr, other.ccr);
+
+    return diffs;
+}
+
+std::vector<Sh4_Register_Diff> Sh4_Cpu::compare(const Sh4_Cpu &other) const
+{
+    Sh4_Cpu_State state, other_state;
+
+    save_state(state);
+    other.save_state(other_state);
+
+    return sh4_compare_state(state, other_state);
+}
+
+void Sh4_Cpu::save_state(Sh4_Cpu_State &state) const
+{
+    memcpy(state.r_bank0, registers_, sizeof(state.r_bank0));
+    memcpy(state.r_bank1, bank1_registers, sizeof(state.r_bank1));
+    memcpy(state.r, registers_ + 8, sizeof(state.r));
+
+    state.sr = status_register;
+    state.ssr = saved_status_register;
+    state.spc = saved_pc;
+    state.gbr = global_base_register;
+    state.vbr = vector_base_register;
+    state.sgr = saved_general_register_15;
+    state.dbr = debug_base_register;
+    state.mach = mach;
+    state.macl = macl;
+    state.pr = procedure_register;
+    state.pc = pc;
+    state.delay_pc = delay_pc;
+    state.fpscr = fpscr;
+    state.fpul = fpul;
+
+    memcpy(state.fpr, fpu_registers_, sizeof(state.fpr));
+
+    state.sleeping = sleeping;
+    state.expevt = expevt;
+    state.intevt = intevt;
+    state.tra = tra;
+    state.mmucr = mmu.mmucr;
+    state.ccr = ccr;
+}
+
+void Sh4_Cpu::load_state(const Sh4_Cpu_State &state)
+{
+    memcpy(registers_, state.r_bank0, sizeof(state.r_bank0));
+    memcpy(bank1_registers, state.r_bank1, sizeof(state.r_bank1));
+    memcpy(registers_ + 8, state.r, sizeof(state.r));
+
+    status_register = state.sr;
+    saved_status_register = state.ssr;
+    saved_pc = state.spc;
+    global_base_register = state.gbr;
+    vector_base_register = state.vbr;
+    saved_general_register_15 = state.sgr;
+    debug_base_register = state.dbr;
+    mach = state.mach;
+    macl = state.macl;
+    procedure_register = state.pr;
+    pc = state.pc;
+    delay_pc = state.delay_pc;
+    fpscr = state.fpscr;
+    fpul = state.fpul;
+
+    memcpy(fpu_registers_, state.fpr, sizeof(state.fpr));
+
+    sleeping = state.sleeping;
+    expevt = state.expevt;
+    intevt = state.intevt;
+    tra = state.tra;
+
+    // Only when it changed, writing it drops the MMU's lookup caches
+    if (mmu.mmucr != state.mmucr)
+    {
+        mmu.write_mmucr(state.mmucr);
+    }
+
+    ccr = state.ccr;
+
+    remap_banking_registers();
+    remap_fpu_registers();
+    update_interrupts();
 }
 
 void Sh4_Cpu::remap_banking_registers()
@@ -171,6 +352,92 @@ void Sh4_Cpu::set_bank1_register(std::uint8_t index, std::uint32_t value)
     bank1_registers[index] = value;
 }
 
+void Sh4_Cpu::raise_exception(std::uint32_t expevt_, std::uint32_t vector)
+{
+    // Exceptions while SR.BL is set reset the CPU
+    if (status_register & SR_BL)
+    {
+        lucid_err() << BOLDRED << "raise_exception: Exception 0x" << format("{:03X}", expevt_) << " with SR.BL set at 0x"
+                  << format("{:08X}", pc) << ", manual reset" << RESET << "\n";
+        reset();
+        return;
+    }
+
+    expevt = expevt_;
+
+    // In a delay slot, the branch runs again after the handler returns
+    enter_exception((delay_pc != pc + 2) ? pc - 2 : pc, vector);
+}
+
+void Sh4_Cpu::enter_exception(std::uint32_t spc, std::uint32_t vector)
+{
+    saved_pc = spc;
+    saved_status_register = status_register;
+    saved_general_register_15 = registers_[15];
+
+    status_register |= SR_MD | SR_RB | SR_BL;
+    remap_banking_registers();
+    update_interrupts();
+
+    pc = vector_base_register + vector;
+    delay_pc = pc + 2;
+}
+
+/*
+    Same state as after power on, except for EXPEVT and what the manual
+    leaves untouched on a manual reset (General registers, SSR, SPC...)
+*/
+void Sh4_Cpu::reset()
+{
+    status_register = SR_INITIAL_VALUE;
+    vector_base_register = 0x00000000;
+    fpscr = FPSCR_INITIAL_VALUE;
+    expevt = EXPEVT_MANUAL_RESET;
+    sleeping = false;
+
+    mmu.write_mmucr(0);
+
+    pc = 0xA0000000;
+    delay_pc = pc + 2;
+
+    remap_banking_registers();
+    remap_fpu_registers();
+    update_interrupts();
+}
+
+/*
+    Interrupts are accepted when their level is above SR.IMASK and SR.BL is
+    clear, or at any SR.BL while sleeping
+*/
+void Sh4_Cpu::update_interrupts()
+{
+    std::uint8_t imask = (status_register & SR_IMASK_MASK) >> SR_IMASK_SHIFT;
+
+    interrupt_pending_ = interrupt_level > imask && (!(status_register & SR_BL) || sleeping);
+}
+
+void Sh4_Cpu::set_interrupt_request(std::uint8_t level, std::uint32_t intevt_)
+{
+    interrupt_level = level;
+    interrupt_code = intevt_;
+
+    update_interrupts();
+}
+
+bool Sh4_Cpu::accept_interrupt()
+{
+    if (delay_pc != pc + 2)
+    {
+        return false;
+    }
+
+    intevt = interrupt_code;
+    sleeping = false;
+
+    enter_exception(pc, VECTOR_INTERRUPT);
+    return true;
+}
+
 void Sh4_Cpu::set_pc(std::uint32_t pc_)
 {
     pc = pc_;
@@ -201,6 +468,51 @@ std::uint32_t Sh4_Cpu::get_expevt()
     return expevt;
 }
 
+void Sh4_Cpu::set_intevt(std::uint32_t intevt_)
+{
+    intevt = intevt_;
+}
+
+std::uint32_t Sh4_Cpu::get_intevt()
+{
+    return intevt;
+}
+
+void Sh4_Cpu::set_tra(std::uint32_t tra_)
+{
+    tra = tra_;
+}
+
+std::uint32_t Sh4_Cpu::get_tra()
+{
+    return tra;
+}
+
+void Sh4_Cpu::set_ssr(std::uint32_t ssr_)
+{
+    saved_status_register = ssr_;
+}
+
+std::uint32_t Sh4_Cpu::get_ssr()
+{
+    return saved_status_register;
+}
+
+void Sh4_Cpu::set_spc(std::uint32_t spc_)
+{
+    saved_pc = spc_;
+}
+
+std::uint32_t Sh4_Cpu::get_spc()
+{
+    return saved_pc;
+}
+
+std::uint32_t Sh4_Cpu::get_sgr()
+{
+    return saved_general_register_15;
+}
+
 void Sh4_Cpu::set_macl(std::uint32_t macl_)
 {
     macl = macl_;
@@ -231,6 +543,138 @@ std::uint8_t Sh4_Cpu::get_tbit()
     return (status_register & 0x01);
 }
 
+/*
+    Full SR write, switches the R0-R7 bank if RB changed and picks up the new
+    IMASK/BL for interrupts
+*/
+void Sh4_Cpu::set_sr(std::uint32_t sr_)
+{
+    bool bank_changed = ((status_register ^ sr_) & (1u << 29)) != 0;
+
+    status_register = sr_;
+
+    if (bank_changed)
+    {
+        remap_banking_registers();
+    }
+
+    update_interrupts();
+}
+
+std::uint32_t Sh4_Cpu::get_sr()
+{
+    return status_register;
+}
+
+void Sh4_Cpu::set_vbr(std::uint32_t vbr_)
+{
+    vector_base_register = vbr_;
+}
+
+std::uint32_t Sh4_Cpu::get_vbr()
+{
+    return vector_base_register;
+}
+
+void Sh4_Cpu::set_gbr(std::uint32_t gbr_)
+{
+    global_base_register = gbr_;
+}
+
+std::uint32_t Sh4_Cpu::get_gbr()
+{
+    return global_base_register;
+}
+
+void Sh4_Cpu::set_sleeping(bool sleeping_)
+{
+    sleeping = sleeping_;
+    update_interrupts();
+}
+
+bool Sh4_Cpu::is_sleeping()
+{
+    return sleeping;
+}
+
+void Sh4_Cpu::remap_fpu_registers()
+{
+    fr = fpu_registers_[(fpscr & FPSCR_FR_BIT) ? 1 : 0];
+    xf = fpu_registers_[(fpscr & FPSCR_FR_BIT) ? 0 : 1];
+}
+
+void Sh4_Cpu::set_fpscr(std::uint32_t fpscr_)
+{
+    // Only bits 0-21 are implemented, the rest read as 0
+    std::uint32_t old_fpscr = fpscr;
+    fpscr = fpscr_ & 0x003FFFFF;
+
+    if ((old_fpscr ^ fpscr) & FPSCR_FR_BIT)
+    {
+        remap_fpu_registers();
+    }
+}
+
+std::uint32_t Sh4_Cpu::get_fpscr()
+{
+    return fpscr;
+}
+
+void Sh4_Cpu::set_fpul(std::uint32_t fpul_)
+{
+    fpul = fpul_;
+}
+
+std::uint32_t Sh4_Cpu::get_fpul()
+{
+    return fpul;
+}
+
+void Sh4_Cpu::set_fr_bits(std::uint8_t index, std::uint32_t value)
+{
+    fr[index] = value;
+}
+
+std::uint32_t Sh4_Cpu::get_fr_bits(std::uint8_t index)
+{
+    return fr[index];
+}
+
+void Sh4_Cpu::set_xf_bits(std::uint8_t index, std::uint32_t value)
+{
+    xf[index] = value;
+}
+
+std::uint32_t Sh4_Cpu::get_xf_bits(std::uint8_t index)
+{
+    return xf[index];
+}
+
+void Sh4_Cpu::set_fr(std::uint8_t index, float value)
+{
+    fr[index] = std::bit_cast<std::uint32_t>(value);
+}
+
+float Sh4_Cpu::get_fr(std::uint8_t index)
+{
+    return std::bit_cast<float>(fr[index]);
+}
+
+void Sh4_Cpu::set_dr(std::uint8_t index, double value)
+{
+    std::uint64_t bits = std::bit_cast<std::uint64_t>(value);
+
+    // DRn = FR(n) (Upper 32 bits) : FR(n + 1) (Lower 32 bits)
+    fr[index & 0xE] = static_cast<std::uint32_t>(bits >> 32);
+    fr[(index & 0xE) + 1] = static_cast<std::uint32_t>(bits);
+}
+
+double Sh4_Cpu::get_dr(std::uint8_t index)
+{
+    std::uint64_t bits = (static_cast<std::uint64_t>(fr[index & 0xE]) << 32) | fr[(index & 0xE) + 1];
+    return std::bit_cast<double>(bits);
+}
+
 void Sh4_Cpu::set_dbr(std::uint32_t dbr_)
 {
     debug_base_register = dbr_;
@@ -243,12 +687,12 @@ std::uint32_t Sh4_Cpu::get_dbr()
 
 void Sh4_Cpu::set_mmucr(std::uint32_t mmucr_)
 {
-    mmucr = mmucr_;
+    mmu.write_mmucr(mmucr_);
 }
 
 std::uint32_t Sh4_Cpu::get_mmucr()
 {
-    return (mmucr);
+    return (mmu.mmucr);
 }
 
 void Sh4_Cpu::set_ccr(std::uint32_t ccr_)
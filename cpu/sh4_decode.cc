@@ -1,4 +1,6 @@
 #include <cpu/sh4_decode.hh>
+#include <algorithm>
+#include <cstring>
 
 #if __has_include(<format>)
     #include <format>
@@ -8,30 +10,1262 @@
     using fmt::format;
 #endif
 
-Sh4_Decode::Sh4_Decode(Sh4_Cpu *cpu_, Memory *memory_)
+Sh4_Decode::Sh4_Decode(Sh4_Cpu *cpu_, Memory *memory_, Scheduler *scheduler_) : blocks(cpu_, memory_), jit(this, cpu_)
 {
     cpu = cpu_;
     memory = memory_;
+    scheduler = scheduler_;
+
+    idle_loop_skip = true;
+    fuse_pairs = true;
+    bulk_loops = true;
+    profile_pairs = false;
+    profile_pc = UINT32_MAX;
+    profile_opcode = 0;
+    fused_hits = {};
+    engine = Sh4_Engine::Interpreter;
+    hle_bios = nullptr;
+
+    executed_instructions = 0;
+    executed_state_accesses = 0;
+    decoded_state_accesses = 0;
+
+    link_until = 0;
+    step_link_cycles = 0;
+
+    tier_cached_threshold = TIER_CACHED_THRESHOLD;
+    tier_jit_threshold = TIER_JIT_THRESHOLD;
+    tier_cached_promotions = 0;
+    tier_jit_promotions = 0;
+    tier_demotions = 0;
+    interpreted_instructions = 0;
+
+    next_block = nullptr;
+    branched = true;
+    started = false;
+    stop_on_unimplemented = false;
+    status = Lucid_Status::Running;
+
+    memory->code_write_handler = [this](std::uint32_t p_addr) { code_written(p_addr); };
+    blocks.jit = &jit;
+
+    update_fpu_mode();
+}
+
+/*
+    Has to run after every FPSCR write so that FPU opcodes don't need to
+    check the PR/SZ (Or RM/DN) bits themselves
+*/
+void Sh4_Decode::update_fpu_mode()
+{
+    fpu_handlers = sh4_fpu_table(cpu->get_fpscr());
+    host_fpu_env.update(cpu->get_fpscr());
+}
+
+/*
+    Per-engine setup, done once before the first step
+*/
+bool Sh4_Decode::start()
+{
+    // Every time, another decoder may have run on this thread in between
+    if (engine == Sh4_Engine::Jit || engine == Sh4_Engine::Tiered)
+    {
+        if (!jit.code_cache.mapped())
+        {
+            lucid_err() << BOLDRED << "[JIT] Couldn't allocate the code cache" << RESET << std::endl;
+            lucid_stop(Lucid_Status::Host_Error);
+            return false;
+        }
+
+        jit.make_current();
+    }
+
+    if (started)
+    {
+        return true;
+    }
+
+    // Successors that aren't blocks yet go back to the interpreter
+    blocks.lazy = engine == Sh4_Engine::Tiered;
+
+    started = true;
+
+    return true;
 }
 
 void Sh4_Decode::run()
 {
-    while (true)
+    if (!start())
+    {
+        return;
+    }
+
+    host_fpu_env.enter_guest();
+    link_until = UINT64_MAX;
+
+    switch (engine)
+    {
+        case Sh4_Engine::Cached:
+            while (true) step_cached();
+            break;
+
+        case Sh4_Engine::Jit:
+            while (true) step_jit();
+            break;
+
+        case Sh4_Engine::Tiered:
+            while (true) step_tiered();
+            break;
+
+        default:
+            while (true) step_interpreter();
+            break;
+    }
+
+    host_fpu_env.leave_guest();
+}
+
+std::uint64_t Sh4_Decode::run_cycles(std::uint64_t cycles)
+{
+    std::uint64_t first = scheduler->get_cycles();
+    std::uint64_t target = (cycles > UINT64_MAX - first) ? UINT64_MAX : first + cycles;
+
+    if (!start())
+    {
+        return 0;
+    }
+
+    host_fpu_env.enter_guest();
+    link_until = target;
+
+    switch (engine)
+    {
+        case Sh4_Engine::Cached:
+            while (scheduler->get_cycles() < target && status == Lucid_Status::Running) step_cached();
+            break;
+
+        case Sh4_Engine::Jit:
+            while (scheduler->get_cycles() < target && status == Lucid_Status::Running) step_jit();
+            break;
+
+        case Sh4_Engine::Tiered:
+            while (scheduler->get_cycles() < target && status == Lucid_Status::Running) step_tiered();
+            break;
+
+        default:
+            while (scheduler->get_cycles() < target && status == Lucid_Status::Running) step_interpreter();
+            break;
+    }
+
+    host_fpu_env.leave_guest();
+
+    return scheduler->get_cycles() - first;
+}
+
+bool Sh4_Decode::run_until(std::uint32_t pc, std::uint64_t max_cycles)
+{
+    std::uint64_t now = scheduler->get_cycles();
+    std::uint64_t target = (max_cycles > UINT64_MAX - now) ? UINT64_MAX : now + max_cycles;
+
+    if (!start())
+    {
+        return false;
+    }
+
+    host_fpu_env.enter_guest();
+    link_until = 0;
+
+    switch (engine)
+    {
+        case Sh4_Engine::Cached:
+            while (GET_PC() != pc && scheduler->get_cycles() < target && status == Lucid_Status::Running) step_cached();
+            break;
+
+        case Sh4_Engine::Jit:
+            while (GET_PC() != pc && scheduler->get_cycles() < target && status == Lucid_Status::Running) step_jit();
+            break;
+
+        case Sh4_Engine::Tiered:
+            while (GET_PC() != pc && scheduler->get_cycles() < target && status == Lucid_Status::Running) step_tiered();
+            break;
+
+        default:
+            while (GET_PC() != pc && scheduler->get_cycles() < target && status == Lucid_Status::Running) step_interpreter();
+            break;
+    }
+
+    host_fpu_env.leave_guest();
+
+    return GET_PC() == pc;
+}
+
+std::uint32_t Sh4_Decode::step()
+{
+    std::uint32_t count;
+
+    if (!start())
+    {
+        return 0;
+    }
+
+    host_fpu_env.enter_guest();
+
+    std::uint64_t cycles = scheduler->get_cycles();
+    link_until = (step_link_cycles > UINT64_MAX - cycles) ? UINT64_MAX : cycles + step_link_cycles;
+
+    switch (engine)
+    {
+        case Sh4_Engine::Cached:
+            count = step_cached();
+            break;
+
+        case Sh4_Engine::Jit:
+            count = step_jit();
+            break;
+
+        case Sh4_Engine::Tiered:
+            count = step_tiered();
+            break;
+
+        default:
+            count = step_interpreter();
+            break;
+    }
+
+    host_fpu_env.leave_guest();
+
+    return count;
+}
+
+void Sh4_Decode::resync()
+{
+    next_block = nullptr;
+    branched = true;
+
+    update_fpu_mode();
+}
+
+/*
+    Runs the instruction at PC (Or the fused pair starting there), returns how
+    many instructions that was.
+    Every instruction is charged one cycle, the same as in the block engines and
+    the idle loop skip, so that all of them put events at the same guest time.
+    It's an approximation, not the SH-4's real (Dual issue) pipeline timings.
+*/
+std::uint32_t Sh4_Decode::interpret()
+{
+    if (cpu->mmu.translating())
+    {
+        return interpret_translated();
+    }
+
+    uint16_t opcode = fetch_opcode();
+
+    if (profile_pairs)
+    {
+        profile_pair(GET_PC(), opcode);
+    }
+
+    if (fuse_pairs && sh4_fusion_candidate(opcode) && execute_fused(opcode))
+    {
+        scheduler->add_cycles(2);
+        return 2;
+    }
+
+    parse_opcode(opcode);
+    scheduler->add_cycles(1);
+    return 1;
+}
+
+/*
+    With address translation on any access can fault halfway through an
+    instruction, which then has to look like it never ran: the registers are
+    put back the way they were and the exception is taken with PC still
+    pointing to it. No pairs, nothing that could have run past the fault.
+*/
+std::uint32_t Sh4_Decode::interpret_translated()
+{
+    Sh4_Cpu_State before;
+    cpu->save_state(before);
+
+    std::uint16_t opcode = fetch_opcode();
+
+    if (!cpu->mmu.fault_pending())
+    {
+        parse_opcode(opcode);
+    }
+
+    if (cpu->mmu.fault_pending())
+    {
+        // The MMU keeps what the access did to it (URC, LRUI)
+        before.mmucr = cpu->get_mmucr();
+        cpu->load_state(before);
+
+        cpu->mmu.clear_fault();
+        raise_exception(cpu->mmu.fault_expevt, cpu->mmu.fault_vector);
+    }
+
+    scheduler->add_cycles(1);
+    return 1;
+}
+
+std::uint32_t Sh4_Decode::step_interpreter()
+{
+    cpu->mmu.sync();
+
+    // Between instructions here, between blocks for the other engines
+    if (cpu->interrupt_pending())
+    {
+        cpu->accept_interrupt();
+    }
+
+    if (cpu->is_sleeping())
+    {
+        // Nothing to execute, wait for whatever comes next
+        scheduler->skip_to_next_event(IDLE_LOOP_MAX_SKIP);
+        return 0;
+    }
+
+    std::uint32_t count = interpret();
+
+    if (scheduler->event_pending())
+    {
+        scheduler->run_events();
+    }
+
+    return count;
+}
+
+std::uint32_t Sh4_Decode::step_cached()
+{
+    // Blocks can't be rolled back halfway, see interpret_translated
+    if (cpu->mmu.sync())
+    {
+        next_block = nullptr;
+        return step_interpreter();
+    }
+
+    if (cpu->interrupt_pending() && cpu->accept_interrupt())
+    {
+        next_block = nullptr;
+    }
+
+    if (cpu->is_sleeping())
+    {
+        scheduler->skip_to_next_event(IDLE_LOOP_MAX_SKIP);
+        next_block = nullptr;
+        return 0;
+    }
+
+    // Only taken when there's no link to follow
+    if (!next_block)
+    {
+        next_block = blocks.lookup(GET_PC());
+    }
+
+    Sh4_Block *block = next_block;
+
+    execute_ir(block->ir);
+
+    std::uint32_t count = block->opcodes.size();
+
+    executed_instructions += count;
+    executed_state_accesses += block->ir_state_accesses;
+    decoded_state_accesses += block->decoded_state_accesses;
+
+    scheduler->add_cycles(count);
+
+    // Stopped halfway through, PC is on the instruction that did it
+    if (status != Lucid_Status::Running)
+    {
+        next_block = nullptr;
+        return count;
+    }
+
+    next_block = blocks.next(block, GET_PC());
+
+    // The block that just ran may have invalidated itself
+    blocks.collect_retired();
+
+    if (scheduler->event_pending())
+    {
+        scheduler->run_events();
+
+        if (next_block->start_pc != GET_PC())
+        {
+            next_block = nullptr;
+        }
+    }
+
+    return count;
+}
+
+std::uint32_t Sh4_Decode::step_jit()
+{
+    // Blocks can't be rolled back halfway, see interpret_translated
+    if (cpu->mmu.sync())
+    {
+        next_block = nullptr;
+        return step_interpreter();
+    }
+
+    if (cpu->interrupt_pending() && cpu->accept_interrupt())
+    {
+        next_block = nullptr;
+    }
+
+    if (cpu->is_sleeping())
+    {
+        scheduler->skip_to_next_event(IDLE_LOOP_MAX_SKIP);
+        next_block = nullptr;
+        return 0;
+    }
+
+    if (!next_block)
+    {
+        next_block = blocks.lookup(GET_PC());
+    }
+
+    Sh4_Block *block = next_block;
+
+    // Evicted from the code cache since
+    if (block->native && !jit.code_cache.live(block->native_generation))
+    {
+        block->native = nullptr;
+    }
+
+    if (!block->native && !translate(block))
+    {
+        next_block = nullptr;
+        return 0;
+    }
+
+    std::uint64_t instructions = executed_instructions;
+
+    block->native();
+
+    // Cycles and statistics are counted by the native code, for every block it went through
+    std::uint32_t count = static_cast<std::uint32_t>(executed_instructions - instructions);
+    block = jit.exit_block;
+
+    // Stopped halfway through, PC is on the instruction that did it
+    if (status != Lucid_Status::Running)
+    {
+        next_block = nullptr;
+        return count;
+    }
+
+    next_block = blocks.next(block, GET_PC());
+
+    if (next_block && block->valid)
+    {
+        jit.link(block, next_block, GET_PC());
+    }
+
+    blocks.collect_retired();
+
+    if (scheduler->event_pending())
+    {
+        scheduler->run_events();
+
+        if (next_block->start_pc != GET_PC())
+        {
+            next_block = nullptr;
+        }
+    }
+
+    return count;
+}
+
+/*
+    Host code for a block, false if the code buffer ran out (Everything got
+    flushed, including the block)
+*/
+bool Sh4_Decode::translate(Sh4_Block *block)
+{
+    block->native = jit.compile(*block);
+    block->native_generation = jit.code_cache.generation();
+
+    if (!block->native)
+    {
+        // Doesn't fit in the code cache at all, start over with an empty one (No links to reset then)
+        std::uint64_t invalidated = blocks.invalidated;
+
+        jit.flush();
+        blocks.flush();
+        blocks.collect_retired();
+
+        tier_demotions += blocks.invalidated - invalidated;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Tiered execution
+
+    Code starts in the interpreter, which counts how often each branch target is
+    reached. Past tier_cached_threshold a block gets built there and runs from the
+    block cache, past tier_jit_threshold runs of that block it gets translated to
+    host code. Successors that aren't blocks yet go back to the interpreter (The
+    block cache is lazy), so code that only runs a few times (Boot, init...) never
+    gets decoded or translated.
+
+    Invalidated blocks (Code writes, JIT flushes) start over from the interpreter.
+*/
+std::uint32_t Sh4_Decode::step_tiered()
+{
+    if (cpu->mmu.sync())
+    {
+        next_block = nullptr;
+        branched = true;
+        return step_interpreter();
+    }
+
+    // Refused in a delay slot, so never halfway through a block
+    if (cpu->interrupt_pending() && cpu->accept_interrupt())
+    {
+        next_block = nullptr;
+        branched = true;
+    }
+
+    if (cpu->is_sleeping())
+    {
+        scheduler->skip_to_next_event(IDLE_LOOP_MAX_SKIP);
+        next_block = nullptr;
+        branched = true;
+        return 0;
+    }
+
+    if (!next_block && branched)
+    {
+        next_block = blocks.find(GET_PC());
+
+        if (!next_block && ++heat[GET_PC()] >= tier_cached_threshold)
+        {
+            heat.erase(GET_PC());
+            next_block = blocks.lookup(GET_PC());
+            tier_cached_promotions++;
+
+            // It was hot enough for the JIT last time
+            if (next_block->tcache_flags & TCACHE_FLAG_NATIVE)
+            {
+                next_block->executions = tier_jit_threshold;
+            }
+        }
+    }
+
+    if (!next_block)
+    {
+        std::uint32_t pc = GET_PC();
+        std::uint32_t count = interpret();
+
+        interpreted_instructions += count;
+
+        // Not the next instruction, and not in the middle of a delayed branch either
+        branched = GET_PC() != pc + count * 2 && GET_DELAY_PC() == GET_PC() + 2;
+
+        if (scheduler->event_pending())
+        {
+            scheduler->run_events();
+            branched = true;
+        }
+
+        return count;
+    }
+
+    Sh4_Block *block = next_block;
+
+    // Evicted from the code cache, back to the cached tier until it's translated again
+    if (block->native && !jit.code_cache.live(block->native_generation))
+    {
+        block->native = nullptr;
+        tier_demotions++;
+    }
+
+    if (!block->native && ++block->executions >= tier_jit_threshold)
+    {
+        if (!translate(block))
+        {
+            next_block = nullptr;
+            branched = true;
+            return 0;
+        }
+
+        tier_jit_promotions++;
+
+        if (blocks.tcache)
+        {
+            blocks.tcache->set_flags(block->start_pc, TCACHE_FLAG_NATIVE);
+        }
+    }
+
+    std::uint32_t count;
+
+    if (block->native)
+    {
+        std::uint64_t instructions = executed_instructions;
+
+        block->native();
+
+        // See step_jit
+        count = static_cast<std::uint32_t>(executed_instructions - instructions);
+        block = jit.exit_block;
+    }
+    else
+    {
+        execute_ir(block->ir);
+
+        count = block->opcodes.size();
+
+        executed_instructions += count;
+        executed_state_accesses += block->ir_state_accesses;
+        decoded_state_accesses += block->decoded_state_accesses;
+
+        scheduler->add_cycles(count);
+    }
+
+    if (status != Lucid_Status::Running)
+    {
+        next_block = nullptr;
+        branched = true;
+        return count;
+    }
+
+    next_block = blocks.next(block, GET_PC());
+    branched = true;
+
+    if (next_block && block->valid)
+    {
+        jit.link(block, next_block, GET_PC());
+    }
+
+    blocks.collect_retired();
+
+    if (scheduler->event_pending())
+    {
+        scheduler->run_events();
+
+        if (next_block && next_block->start_pc != GET_PC())
+        {
+            next_block = nullptr;
+        }
+    }
+
+    return count;
+}
+
+void Sh4_Decode::print_stats()
+{
+    if (engine == Sh4_Engine::Interpreter)
+    {
+        print_pair_stats();
+        return;
+    }
+
+    lucid_out() << BOLDWHITE << "Blocks: " << blocks.compiled << " compiled, " << blocks.invalidated << " invalidated, "
+              << blocks.lookups << " lookups, " << blocks.chained << " chained" << RESET << std::endl;
+
+    lucid_out() << BOLDWHITE << "RAS: " << blocks.ras_hits << " hits, " << blocks.ras_misses << " misses" << RESET << std::endl;
+
+    lucid_out() << BOLDWHITE << "IR: " << blocks.ir_stats.forwarded_loads << " forwarded loads, "
+              << blocks.ir_stats.redundant_memory_loads << " redundant memory loads, " << blocks.ir_stats.folded_constants
+              << " folded constants, " << blocks.ir_stats.dead_stores << " dead stores, " << blocks.ir_stats.dead_flags
+              << " dead flags, " << blocks.ir_stats.dead_values << " dead values" << RESET << std::endl;
+
+    if (blocks.tcache)
+    {
+        lucid_out() << BOLDWHITE << "Translation cache: " << blocks.tcache->hits << " hits, " << blocks.tcache->misses << " misses, "
+                  << blocks.tcache->stale << " stale" << RESET << std::endl;
+    }
+
+    if (engine == Sh4_Engine::Tiered)
+    {
+        lucid_out() << BOLDWHITE << "Tiers: " << interpreted_instructions << " instructions interpreted, " << tier_cached_promotions
+                  << " blocks promoted to cached, " << tier_jit_promotions << " to JIT, " << tier_demotions << " demoted" << RESET << std::endl;
+    }
+
+    if (engine == Sh4_Engine::Jit || engine == Sh4_Engine::Tiered)
+    {
+        const Sh4_Code_Cache &code_cache = jit.code_cache;
+
+        lucid_out() << BOLDWHITE << "JIT: " << jit.compiled << " blocks translated, " << jit.fastmem_accesses << " fastmem accesses ("
+                  << jit.backpatched << " backpatched, " << jit.code_page_faults << " code page faults), " << jit.linked << " links"
+                  << RESET << std::endl;
+
+        lucid_out() << BOLDWHITE << "Code cache: " << code_cache.occupancy() / 1024 << "/" << code_cache.capacity() / 1024 << "KB used ("
+                  << (code_cache.dual_mapped() ? "dual mapped" : "single mapping") << "), " << code_cache.evictions
+                  << " generations evicted, " << code_cache.flushes << " flushes" << RESET << std::endl;
+    }
+
+    if (executed_instructions)
+    {
+        lucid_out() << BOLDWHITE << "Guest state loads/stores: " << executed_state_accesses << " over " << executed_instructions
+                  << " instructions (" << format("{:.3f}", static_cast<double>(executed_state_accesses) / executed_instructions)
+                  << " per instruction, " << format("{:.3f}", static_cast<double>(decoded_state_accesses) / executed_instructions)
+                  << " without optimizations)" << RESET << std::endl;
+    }
+}
+
+/*
+    How often each fused pair ran, and the most frequent pairs overall so the
+    set in sh4_fused.hh can be tuned
+*/
+void Sh4_Decode::print_pair_stats()
+{
+    lucid_out() << BOLDWHITE << "Fused pairs:" << RESET << std::endl;
+
+    for (std::size_t i = 1; i < fused_hits.size(); i++)
+    {
+        lucid_out() << "    " << sh4_fused_name(static_cast<Sh4_Fused>(i)) << ": " << fused_hits[i] << std::endl;
+    }
+
+    if (pair_profile.empty())
+    {
+        return;
+    }
+
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> pairs(pair_profile.begin(), pair_profile.end());
+    std::size_t count = std::min<std::size_t>(pairs.size(), 16);
+
+    std::partial_sort(pairs.begin(), pairs.begin() + count, pairs.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+
+    lucid_out() << BOLDWHITE << "Most frequent pairs:" << RESET << std::endl;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::uint16_t first = pairs[i].first >> 16;
+        std::uint16_t second = pairs[i].first & 0xFFFF;
+        Sh4_Fused fused = sh4_fuse(first, second);
+
+        lucid_out() << "    0x" << format("{:04X}", first) << ", 0x" << format("{:04X}", second) << ": " << pairs[i].second
+                  << ((fused != Sh4_Fused::None) ? " (fused)" : "") << std::endl;
+    }
+}
+
+void Sh4_Decode::execute_ir(const Sh4_Ir_Block &ir)
+{
+    if (ir_values.size() < ir.value_count)
+    {
+        ir_values.resize(ir.value_count);
+    }
+
+    std::uint32_t *v = ir_values.data();
+
+    for (const Sh4_Ir_Inst &inst : ir.insts)
+    {
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Nop:
+                break;
+
+            case Sh4_Ir_Op::Const:
+                v[inst.dst] = inst.imm;
+                break;
+
+            case Sh4_Ir_Op::Load_Reg:
+                v[inst.dst] = cpu->get_register(inst.imm);
+                break;
+
+            case Sh4_Ir_Op::Store_Reg:
+                cpu->set_register(inst.imm, v[inst.a]);
+                break;
+
+            case Sh4_Ir_Op::Load_T:
+                v[inst.dst] = cpu->get_tbit();
+                break;
+
+            case Sh4_Ir_Op::Store_T:
+                cpu->set_tbit(v[inst.a]);
+                break;
+
+            case Sh4_Ir_Op::Add:
+                v[inst.dst] = v[inst.a] + v[inst.b];
+                break;
+
+            case Sh4_Ir_Op::Sub:
+                v[inst.dst] = v[inst.a] - v[inst.b];
+                break;
+
+            case Sh4_Ir_Op::And:
+                v[inst.dst] = v[inst.a] & v[inst.b];
+                break;
+
+            case Sh4_Ir_Op::Or:
+                v[inst.dst] = v[inst.a] | v[inst.b];
+                break;
+
+            case Sh4_Ir_Op::Xor:
+                v[inst.dst] = v[inst.a] ^ v[inst.b];
+                break;
+
+            case Sh4_Ir_Op::Shl:
+                v[inst.dst] = v[inst.a] << (v[inst.b] & 31);
+                break;
+
+            case Sh4_Ir_Op::Shr:
+                v[inst.dst] = v[inst.a] >> (v[inst.b] & 31);
+                break;
+
+            case Sh4_Ir_Op::Sar:
+                v[inst.dst] = static_cast<std::uint32_t>(static_cast<std::int32_t>(v[inst.a]) >> (v[inst.b] & 31));
+                break;
+
+            case Sh4_Ir_Op::Swap_B:
+                v[inst.dst] = (v[inst.a] & 0xFFFF0000) | ((v[inst.a] & 0x0000FF00) >> 8) | ((v[inst.a] & 0x000000FF) << 8);
+                break;
+
+            case Sh4_Ir_Op::Swap_W:
+                v[inst.dst] = (v[inst.a] >> 16) | (v[inst.a] << 16);
+                break;
+
+            case Sh4_Ir_Op::Cmp_Eq:
+                v[inst.dst] = (v[inst.a] == v[inst.b]) ? 1 : 0;
+                break;
+
+            case Sh4_Ir_Op::Cmp_Hi:
+                v[inst.dst] = (v[inst.a] > v[inst.b]) ? 1 : 0;
+                break;
+
+            case Sh4_Ir_Op::Test:
+                v[inst.dst] = (v[inst.a] & v[inst.b]) ? 0 : 1;
+                break;
+
+            case Sh4_Ir_Op::Load_32:
+            case Sh4_Ir_Op::Store_8:
+            case Sh4_Ir_Op::Store_16:
+            case Sh4_Ir_Op::Store_32:
+                switch (inst.op)
+                {
+                    case Sh4_Ir_Op::Load_32: v[inst.dst] = memory->read<std::uint32_t>(v[inst.a], cpu); break;
+                    case Sh4_Ir_Op::Store_8: memory->write<std::uint8_t>(v[inst.a], static_cast<std::uint8_t>(v[inst.b]), cpu); break;
+                    case Sh4_Ir_Op::Store_16: memory->write<std::uint16_t>(v[inst.a], static_cast<std::uint16_t>(v[inst.b]), cpu); break;
+                    default: memory->write<std::uint32_t>(v[inst.a], v[inst.b], cpu); break;
+                }
+
+                // Unhandled access, stop on the instruction it belongs to (Never a delay slot)
+                if (status != Lucid_Status::Running)
+                {
+                    SET_PC(inst.pc);
+                    SET_DELAY_PC(inst.pc + 2);
+                    return;
+                }
+                break;
+
+            case Sh4_Ir_Op::Interpret:
+                if (inst.flags & IR_FLAG_SYNC_PC)
+                {
+                    SET_PC(inst.pc);
+                    SET_DELAY_PC(inst.pc + 2);
+                }
+
+                parse_opcode(static_cast<std::uint16_t>(inst.imm));
+
+                // Raised an exception or stopped the machine, the rest of the block doesn't run
+                if (((inst.flags & IR_FLAG_SYNC_PC) && GET_PC() != inst.pc + 2) || status != Lucid_Status::Running)
+                {
+                    return;
+                }
+                break;
+
+            case Sh4_Ir_Op::Exit:
+                SET_PC(inst.imm);
+                SET_DELAY_PC(inst.imm + 2);
+                break;
+        }
+    }
+}
+
+/*
+    Guest code wrote to a page something was built from
+*/
+void Sh4_Decode::code_written(std::uint32_t p_addr)
+{
+    std::uint64_t invalidated = blocks.invalidated;
+
+    blocks.invalidate_page(p_addr);
+    tier_demotions += blocks.invalidated - invalidated;
+
+    std::uint32_t page = (p_addr & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT;
+
+    std::erase_if(heat, [page](const auto &entry) {
+        return ((entry.first & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT) == page;
+    });
+
+    std::erase_if(idle_loops, [page](const auto &entry) {
+        std::uint32_t branch_pc = entry.first;
+        std::uint32_t target = branch_pc - ((entry.second.length - 1) << 1);
+
+        return ((branch_pc & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT) == page || ((target & 0x1FFFFFFF) >> BLOCK_PAGE_SHIFT) == page;
+    });
+}
+
+/*
+    Called on every taken backwards BT/BF, PC already points to the loop start
+*/
+void Sh4_Decode::idle_loop_branch(std::uint32_t branch_pc, std::uint32_t target)
+{
+    // The analysis and bulk copies work on untranslated addresses
+    if (cpu->mmu.translating())
+    {
+        return;
+    }
+
+    auto it = idle_loops.find(branch_pc);
+
+    if (it == idle_loops.end())
+    {
+        it = idle_loops.emplace(branch_pc, sh4_analyze_idle_loop(cpu, memory, target, branch_pc)).first;
+
+        memory->set_code_page(target);
+        memory->set_code_page(branch_pc);
+    }
+
+    Sh4_Idle_Loop &loop = it->second;
+
+    switch (loop.kind)
+    {
+        case Sh4_Idle_Loop::Kind::Countdown:
+        {
+            /*
+                The counter has already been decremented by this iteration's DT, consume all
+                but the last remaining iteration (Which runs normally and falls through)
+            */
+            std::uint32_t remaining = cpu->get_register(loop.counter);
+
+            if (remaining <= 1)
+            {
+                break;
+            }
+
+            std::uint64_t skip = remaining - 1;
+
+            if (scheduler->get_next_event() != UINT64_MAX)
+            {
+                std::uint64_t budget = (scheduler->get_next_event() > scheduler->get_cycles()) ?
+                    (scheduler->get_next_event() - scheduler->get_cycles()) / loop.length : 0;
+                skip = std::min(skip, budget);
+            }
+
+            cpu->set_register(loop.counter, remaining - static_cast<std::uint32_t>(skip));
+            scheduler->add_cycles(skip * loop.length);
+            break;
+        }
+
+        case Sh4_Idle_Loop::Kind::Poll:
+        {
+            std::array<std::uint32_t, 17> state;
+
+            for (std::uint8_t i = 0; i < 16; i++)
+            {
+                state[i] = cpu->get_register(i);
+            }
+
+            state[16] = cpu->get_tbit();
+
+            if (loop.has_snapshot && state == loop.snapshot)
+            {
+                // Nothing will change until a device does something
+                scheduler->skip_to_next_event(IDLE_LOOP_MAX_SKIP);
+            }
+
+            loop.snapshot = state;
+            loop.has_snapshot = true;
+            break;
+        }
+
+        case Sh4_Idle_Loop::Kind::Copy:
+        case Sh4_Idle_Loop::Kind::Fill:
+            if (bulk_loops)
+            {
+                bulk_loop(loop);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+    Same idea as Countdown loops, every iteration but the last one runs as a single
+    host copy/fill. Falls back to interpreting when either range isn't plain RAM
+    or they overlap.
+*/
+void Sh4_Decode::bulk_loop(const Sh4_Idle_Loop &loop)
+{
+    std::uint32_t remaining = cpu->get_register(loop.counter);
+
+    if (remaining <= 1)
     {
-        uint16_t opcode = fetch_opcode();
+        return;
+    }
 
-        parse_opcode(opcode);
+    std::uint64_t count = remaining - 1;
+
+    if (scheduler->get_next_event() != UINT64_MAX)
+    {
+        std::uint64_t budget = (scheduler->get_next_event() > scheduler->get_cycles()) ?
+            (scheduler->get_next_event() - scheduler->get_cycles()) / loop.length : 0;
+        count = std::min(count, budget);
+    }
+
+    if (count == 0 || count > 0x01000000)
+    {
+        return;
+    }
+
+    std::uint32_t destination = cpu->get_register(loop.destination);
+    std::uint32_t first = destination + loop.store_offset;
+    std::uint32_t last = first + static_cast<std::uint32_t>(loop.destination_step * static_cast<std::int64_t>(count - 1));
+    std::uint32_t low = std::min(first, last);
+    std::uint32_t size = static_cast<std::uint32_t>(count * 4);
+
+    if ((first & 3) || ((loop.destination_step > 0) ? (last < first) : (last > first)))
+    {
+        return;
+    }
+
+    std::uint8_t *to = memory->ram_pointer(low, size);
+
+    if (!to)
+    {
+        return;
+    }
+
+    std::uint32_t source = cpu->get_register(loop.source);
+    std::uint32_t value = cpu->get_register(loop.value);
+
+    if (loop.kind == Sh4_Idle_Loop::Kind::Copy)
+    {
+        std::uint8_t *from = memory->ram_pointer(source, size);
+
+        if (!from || (source & 3) || (from < to + size && to < from + size))
+        {
+            return;
+        }
+
+        if (loop.destination_step > 0)
+        {
+            std::memcpy(to, from, size);
+        }
+        else
+        {
+            // Longwords end up in reverse order
+            for (std::uint64_t i = 0; i < count; i++)
+            {
+                std::memcpy(to + size - 4 - (i * 4), from + (i * 4), 4);
+            }
+        }
+
+        std::memcpy(&value, from + size - 4, 4);
+
+        cpu->set_register(loop.source, source + size);
+        cpu->set_register(loop.value, value);
+    }
+    else
+    {
+        for (std::uint64_t i = 0; i < count; i++)
+        {
+            std::memcpy(to + (i * 4), &value, 4);
+        }
+    }
 
-        //cpu->print_registers();
+    cpu->set_register(loop.destination, destination + static_cast<std::uint32_t>(loop.destination_step * static_cast<std::int64_t>(count)));
+    cpu->set_register(loop.counter, remaining - static_cast<std::uint32_t>(count));
+    scheduler->add_cycles(count * loop.length);
+
+    // May drop this very loop (And the blocks running it), nothing can use it afterwards
+    memory->ram_written(low, size);
+}
+
+/*
+    Runs "first" and the instruction after it as a single step if they form one
+    of the pairs in sh4_fused.hh, returns false (Nothing executed) otherwise
+*/
+bool Sh4_Decode::execute_fused(std::uint16_t first)
+{
+    std::uint32_t pc = GET_PC();
+
+    // A delay slot can't start a pair, the branch already owns the next PC
+    if (GET_DELAY_PC() != pc + 2)
+    {
+        return false;
+    }
+
+    std::uint16_t second = memory->read<std::uint16_t>(pc + 2, cpu);
+    Sh4_Fused fused = sh4_fuse(first, second);
+
+    // Fetching the second one stopped the machine, neither of them runs
+    if (status != Lucid_Status::Running)
+    {
+        return true;
+    }
+
+    if (fused == Sh4_Fused::None)
+    {
+        return false;
+    }
+
+    if (profile_pairs)
+    {
+        profile_pair(pc + 2, second);
+    }
+
+    std::uint8_t nnnn = (first >> 8) & 0xF;
+    std::uint32_t branch_pc = pc + 2;
+    std::uint32_t target = branch_pc + 4 + (static_cast<std::int32_t>(static_cast<std::int8_t>(second & 0xFF)) << 1);
+    bool taken = false;
+
+#ifdef DEBUG_INSTRUCTIONS
+    lucid_out() << BOLDWHITE << "fused: " << sh4_fused_name(fused) << " (0x" << format("{:04X}", first) << ", 0x" << format("{:04X}", second) << ")\n";
+#endif
+
+    switch (fused)
+    {
+        case Sh4_Fused::Literal_Jmp:
+        case Sh4_Fused::Literal_Jsr:
+        {
+            std::uint32_t value = memory->read<std::uint32_t>((((first & 0xFF) << 2) + 4) + (pc & 0xFFFFFFFC), cpu);
+
+            // Stopped on the mov.l, nothing else of the pair happens
+            if (status != Lucid_Status::Running)
+            {
+                break;
+            }
+
+            SET_REG(nnnn, value);
+
+            if (fused == Sh4_Fused::Literal_Jsr)
+            {
+                cpu->set_pr(branch_pc + 4);
+            }
+
+            // Delay slot next
+            SET_PC(branch_pc + 2);
+            SET_DELAY_PC(GET_REG(nnnn));
+            break;
+        }
+
+        case Sh4_Fused::Mov_Shll8:
+            SET_REG(nnnn, static_cast<std::uint32_t>(static_cast<std::int32_t>(static_cast<std::int8_t>(first & 0xFF))) << 8);
+            SET_PC(pc + 4);
+            SET_DELAY_PC(pc + 6);
+            break;
+
+        case Sh4_Fused::Tst_Bt:
+            SET_TBIT((GET_REG(0) & (first & 0xFF)) ? 0 : 1);
+            taken = GET_TBIT();
+            break;
+
+        case Sh4_Fused::Dt_Bf:
+            SET_REG(nnnn, GET_REG(nnnn) - 1);
+            SET_TBIT(GET_REG(nnnn) == 0 ? 1 : 0);
+            taken = !GET_TBIT();
+            break;
+
+        default:
+            break;
+    }
+
+    if (fused == Sh4_Fused::Tst_Bt || fused == Sh4_Fused::Dt_Bf)
+    {
+        if (taken)
+        {
+            SET_PC(target);
+            SET_DELAY_PC(target + 2);
+
+            if (idle_loop_skip && target <= branch_pc)
+            {
+                idle_loop_branch(branch_pc, target);
+            }
+        }
+        else
+        {
+            SET_PC(pc + 4);
+            SET_DELAY_PC(pc + 6);
+        }
+    }
+
+    fused_hits[static_cast<std::size_t>(fused)]++;
+
+    return true;
+}
+
+/*
+    Only pairs that actually ran back to back (Not across a taken branch)
+*/
+void Sh4_Decode::profile_pair(std::uint32_t pc, std::uint16_t opcode)
+{
+    if (pc == profile_pc + 2)
+    {
+        pair_profile[(static_cast<std::uint32_t>(profile_opcode) << 16) | opcode]++;
     }
+
+    profile_pc = pc;
+    profile_opcode = opcode;
 }
 
 uint16_t Sh4_Decode::fetch_opcode()
 {
-    uint16_t opcode = memory->read<uint16_t>(GET_PC(), cpu);
+    uint16_t opcode = memory->fetch(GET_PC(), cpu);
     return opcode;
 }
 
+/*
+    Opcodes the interpreter doesn't know, whether they're undefined or just not
+    implemented yet, raise an illegal instruction exception like undefined ones
+    do on hardware (Unless stop_on_unimplemented is set). With SR.BL set that
+    exception would be a manual reset which just runs into the same opcode again,
+    so stop there too (This is also how test images end, with SR.BL still set
+    from boot)
+*/
+void Sh4_Decode::unimplemented_opcode(std::uint16_t opcode)
+{
+    lucid_err() << BOLDRED << "parse_opcode: Unimplemented opcode 0x" << format("{:04X}", opcode) << " at 0x" << format("{:08X}", GET_PC()) << RESET << "\n";
+
+    if (stop_on_unimplemented || (cpu->get_sr() & SR_BL))
+    {
+        cpu->print_registers();
+        lucid_stop(Lucid_Status::Unimplemented);
+        return;
+    }
+
+    illegal_instruction();
+}
+
+/*
+    Also what privileged instructions do in user mode. In a delay slot it's a
+    slot illegal instruction instead, SPC then points to the branch.
+*/
+void Sh4_Decode::illegal_instruction()
+{
+    bool delay_slot = GET_DELAY_PC() != GET_PC() + 2;
+
+    raise_exception(delay_slot ? EXPEVT_SLOT_ILLEGAL_INSTRUCTION : EXPEVT_ILLEGAL_INSTRUCTION, VECTOR_GENERAL);
+}
+
+void Sh4_Decode::raise_exception(std::uint32_t expevt, std::uint32_t vector)
+{
+    cpu->raise_exception(expevt, vector);
+
+    // With SR.BL set that was a manual reset, which also resets FPSCR
+    update_fpu_mode();
+}
+
+/*
+    Privileged instructions in user mode don't run, they raise an illegal
+    instruction exception (Only usable directly in a switch case)
+*/
+#define PRIVILEGED() \
+    if (!cpu->get_md_bit()) \
+    { \
+        illegal_instruction(); \
+        skip_pc_set = true; \
+        break; \
+    }
+
 void Sh4_Decode::parse_opcode(uint16_t opcode)
 {
     uint8_t function = (opcode >> 12) & 0xF;
@@ -52,11 +1286,46 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             0010nnnnxxxxxxxx
         */
         case 0b0000:
+            if (opcode == HLE_TRAP_OPCODE && hle_bios)
+            {
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "hle syscall 0x" << format("{:08X}", GET_PC()) << "\n";
+#endif
+                hle_bios->syscall(GET_PC());
+                skip_pc_set = true;
+                break;
+            }
+
             switch (opcode & 0x000F)
             {
                 case 0b0011:
                     switch ((opcode & 0x00F0) >> 4)
                     {
+                        case 0b0000:
+                        {
+                            std::uint32_t target = GET_PC() + 4 + Rn();
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << "bsrf r" << +(nnnn) << std::endl;
+#endif
+                            cpu->set_pr(GET_PC() + 4);
+                            SET_PC(GET_DELAY_PC());
+                            SET_DELAY_PC(target);
+                            skip_pc_set = true;
+                            break;
+                        }
+
+                        case 0b0010:
+                        {
+                            std::uint32_t target = GET_PC() + 4 + Rn();
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << "braf r" << +(nnnn) << std::endl;
+#endif
+                            SET_PC(GET_DELAY_PC());
+                            SET_DELAY_PC(target);
+                            skip_pc_set = true;
+                            break;
+                        }
+
                         case 0b1000:
                             /*
                                 TODO:
@@ -64,66 +1333,215 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                                 This deals with cached memory regions, maybe it's important later on?
                             */
 #ifdef DEBUG_INSTRUCTIONS
-                            std::cout << "pref @r" << +(nnnn) << std::endl;
+                            lucid_out() << "pref @r" << +(nnnn) << std::endl;
 #endif
-                            std::cout << BOLDYELLOW << "parse_opcode: pref instruction detected, cached address is 0x" << format("{:08X}", Rn()) << RESET << std::endl;
+                            lucid_out() << BOLDYELLOW << "parse_opcode: pref instruction detected, cached address is 0x" << format("{:08X}", Rn()) << RESET << std::endl;
                             break;
 
                         default:
-                            std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0000 opcode variation 0x" << format("{:02X}", (opcode & 0x000F))
-                                << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), subfamily 0b" << format("{:04b}", ((opcode & 0x00F0) >> 4))
-                                << RESET << "\n";
-                            cpu->print_registers();
-                            exit(1);
+                            unimplemented_opcode(opcode);
+                            skip_pc_set = true;
                             break;
                     }
                     break;
         
+                case 0b0010:
+                    switch ((opcode & 0x00F0) >> 4)
+                    {
+                        case 0b0000:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc sr, r" << +(nnnn) << "\n";
+#endif
+                            PRIVILEGED();
+                            Rn(cpu->get_sr());
+                            break;
+
+                        case 0b0001:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc gbr, r" << +(nnnn) << "\n";
+#endif
+                            Rn(cpu->get_gbr());
+                            break;
+
+                        case 0b0010:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc vbr, r" << +(nnnn) << "\n";
+#endif
+                            PRIVILEGED();
+                            Rn(cpu->get_vbr());
+                            break;
+
+                        case 0b0011:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc ssr, r" << +(nnnn) << "\n";
+#endif
+                            PRIVILEGED();
+                            Rn(cpu->get_ssr());
+                            break;
+
+                        case 0b0100:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc spc, r" << +(nnnn) << "\n";
+#endif
+                            PRIVILEGED();
+                            Rn(cpu->get_spc());
+                            break;
+
+                        case 0b1000: case 0b1001: case 0b1010: case 0b1011:
+                        case 0b1100: case 0b1101: case 0b1110: case 0b1111:
+                        {
+                            std::uint8_t bank_index = (opcode & 0x0070) >> 4;
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc r" << +(bank_index) << "_bank, r" << +(nnnn) << "\n";
+#endif
+                            PRIVILEGED();
+
+                            // The bank that isn't currently selected
+                            Rn((cpu->get_sr() & SR_RB) ? cpu->get_bank0_register(bank_index) : cpu->get_bank1_register(bank_index));
+                            break;
+                        }
+
+                        default:
+                            unimplemented_opcode(opcode);
+                            skip_pc_set = true;
+                            break;
+                    }
+                    break;
+
+                case 0b1000:
+                    if (opcode == 0x0038)
+                    {
+#ifdef DEBUG_INSTRUCTIONS
+                        lucid_out() << "ldtlb" << std::endl;
+#endif
+                        PRIVILEGED();
+                        cpu->mmu.ldtlb();
+                    }
+                    else
+                    {
+                        unimplemented_opcode(opcode);
+                        skip_pc_set = true;
+                    }
+                    break;
+
                 case 0b1001:
                     if (opcode == 0x0009)
                     {
 #ifdef DEBUG_INSTRUCTIONS
-                        std::cout << "nop" << std::endl;
+                        lucid_out() << "nop" << std::endl;
+#endif
+                    }
+                    else
+                    {
+                        unimplemented_opcode(opcode);
+                        skip_pc_set = true;
+                    }
+                    break;
+
+                case 0b1011:
+                    if (opcode == 0x000B)
+                    {
+#ifdef DEBUG_INSTRUCTIONS
+                        lucid_out() << "rts" << std::endl;
+#endif
+                        SET_PC(GET_DELAY_PC());
+                        SET_DELAY_PC(cpu->get_pr());
+                        skip_pc_set = true;
+                    }
+                    else if (opcode == 0x002B)
+                    {
+#ifdef DEBUG_INSTRUCTIONS
+                        lucid_out() << "rte" << std::endl;
+#endif
+                        PRIVILEGED();
+
+                        std::uint32_t target = cpu->get_spc();
+
+                        // The delay slot already runs with the restored SR (Register bank included)
+                        cpu->set_sr(cpu->get_ssr());
+                        SET_PC(GET_DELAY_PC());
+                        SET_DELAY_PC(target);
+                        skip_pc_set = true;
+                    }
+                    else if (opcode == 0x001B)
+                    {
+#ifdef DEBUG_INSTRUCTIONS
+                        lucid_out() << "sleep" << std::endl;
+#endif
+                        /*
+                            PC moves past SLEEP right away, that's the address an interrupt
+                            will save in SPC when it wakes the CPU up
+                        */
+                        cpu->set_sleeping(true);
+                    }
+                    else
+                    {
+                        unimplemented_opcode(opcode);
+                        skip_pc_set = true;
+                    }
+                    break;
+
+                case 0b1010:
+                    /*
+                        To find which STx family of instructions we're dealing with, check the bit pattern
+                        at the high nibble of the LSB(yte) of the opcode
+                    */
+                    switch ((opcode & 0x00F0) >> 4)
+                    {
+                        case 0b0001:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "sts macl, r" << +(nnnn) << "\n";
+#endif
+                            Rn(cpu->get_macl());
+                            break;
+
+                        case 0b0010:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "sts pr, r" << +(nnnn) << "\n";
+#endif
+                            Rn(cpu->get_pr());
+                            break;
+
+                        case 0b0101:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "sts fpul, r" << +(nnnn) << "\n";
+#endif
+                            Rn(cpu->get_fpul());
+                            break;
+
+                        case 0b0110:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "sts fpscr, r" << +(nnnn) << "\n";
+#endif
+                            Rn(cpu->get_fpscr());
+                            break;
+
+                        case 0b0011:
+#ifdef DEBUG_INSTRUCTIONS
+                            lucid_out() << BOLDWHITE << "stc sgr, r" << +(nnnn) << "\n";
 #endif
-                    }
-                    else
-                    {
-                        std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0000 opcode variation 0x" << format("{:02X}", (opcode & 0x000F))
-                                << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), subfamily 0b" << format("{:04b}", ((opcode & 0x00F0) >> 4))
-                                << RESET << "\n";
-                            cpu->print_registers();
-                            exit(1);
-                    }
-                    break;
+                            PRIVILEGED();
+                            Rn(cpu->get_sgr());
+                            break;
 
-                case 0b1010:
-                    /*
-                        To find which STx family of instructions we're dealing with, check the bit pattern
-                        at the high nibble of the LSB(yte) of the opcode
-                    */
-                    switch ((opcode & 0x00F0) >> 4)
-                    {
-                        case 0b0001:
+                        case 0b1111:
 #ifdef DEBUG_INSTRUCTIONS
-                            std::cout << BOLDWHITE << "sts macl, r" << +(nnnn) << "\n";
+                            lucid_out() << BOLDWHITE << "stc dbr, r" << +(nnnn) << "\n";
 #endif
-                            Rn(cpu->get_macl());
+                            PRIVILEGED();
+                            Rn(cpu->get_dbr());
                             break;
 
                         default:
-                            std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0000 opcode variation 0x" << format("{:02X}", (opcode & 0x000F))
-                                << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), subfamily 0b" << format("{:04b}", ((opcode & 0x00F0) >> 4))
-                                << RESET << "\n";
-                            cpu->print_registers();
-                            exit(1);
+                            unimplemented_opcode(opcode);
+                            skip_pc_set = true;
                             break;
                     }
                     break;
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0000 opcode variation 0x" << format("{:02X}", (opcode & 0x000F)) << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
@@ -135,7 +1553,7 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         */
         case 0b0001:
 #ifdef DEBUG_INSTRUCTIONS
-            std::cout << "mov.l r" << +(mmmm) << ",@(" << +(dddd << 2) << ",r" << +(nnnn) << ")" << std::endl;
+            lucid_out() << "mov.l r" << +(mmmm) << ",@(" << +(dddd << 2) << ",r" << +(nnnn) << ")" << std::endl;
 #endif
             memory->write<uint32_t>(((dddd << 2) + Rn()), Rm(), cpu);
             break;
@@ -150,21 +1568,21 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             {
                 case 0b0000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.b r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
+                    lucid_out() << BOLDWHITE << "mov.b r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
 #endif
                     memory->write(Rn(), (std::uint8_t) Rm(), cpu);
                     break;
                 
                 case 0b0001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.w r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
+                    lucid_out() << BOLDWHITE << "mov.w r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
 #endif
                     memory->write(Rn(), (std::uint16_t) Rm(), cpu);
                     break;
 
                 case 0b0010:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.l r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
+                    lucid_out() << BOLDWHITE << "mov.l r" << +(mmmm) << ",@r" << +(nnnn) << RESET << "\n";
 #endif
                     memory->write(Rn(), (std::uint32_t) Rm(), cpu);
                     break;
@@ -172,25 +1590,37 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                 case 0b0101:
                 {
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.w r" << +(mmmm) << ",@-r" << +(nnnn) << RESET << "\n";
+                    lucid_out() << BOLDWHITE << "mov.w r" << +(mmmm) << ",@-r" << +(nnnn) << RESET << "\n";
 #endif
-                    Rn(Rn() - 2);
-                    std::uint32_t dst = Rn();
+                    // Rm is read before the decrement (Matters for mov.w Rn,@-Rn)
                     std::uint16_t src = Rm();
-                    memory->write(dst, src, cpu);
+                    Rn(Rn() - 2);
+                    memory->write(Rn(), src, cpu);
+                    break;
+                }
+
+                case 0b0110:
+                {
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "mov.l r" << +(mmmm) << ",@-r" << +(nnnn) << RESET << "\n";
+#endif
+                    // Rm is read before the decrement (Matters for mov.l Rn,@-Rn)
+                    std::uint32_t src = Rm();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), src, cpu);
                     break;
                 }
 
                 case 0b1000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "tst r" << +(mmmm) << ", r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "tst r" << +(mmmm) << ", r" << +(nnnn) << "\n";
 #endif
                     SET_TBIT(Rm() & Rn() ? 0 : 1);
                     break;
 
                 case 0b1010:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "xor r" << +(mmmm) << ", r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "xor r" << +(mmmm) << ", r" << +(nnnn) << "\n";
 #endif
                     Rn(Rm() ^ Rn());
                     break;
@@ -198,7 +1628,7 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                 case 0b1110:
                 {
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mulu.w r" << +(mmmm) << ", r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "mulu.w r" << +(mmmm) << ", r" << +(nnnn) << "\n";
 #endif
                     std::uint32_t macl_ = (std::uint32_t) ((Rm() & 0xFFFF) * (Rn() & 0xFFFF));
                     cpu->set_macl(macl_);
@@ -206,9 +1636,8 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                 }
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0010 opcode variation 0x" << format("{:02X}", (opcode & 0x000F)) << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
 
@@ -224,15 +1653,14 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             {
                 case 0b0110:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "cmp/hi r" << +(mmmm) << ",r" << +(nnnn) << std::endl;
+                    lucid_out() << "cmp/hi r" << +(mmmm) << ",r" << +(nnnn) << std::endl;
 #endif
                     SET_TBIT(Rn() > Rm() ? 1 : 0);
                     break;
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0011 opcode variation 0x" << format("{:02X}", (opcode & 0x000F)) << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
@@ -247,81 +1675,340 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             {
                 case 0b00000001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "shlr r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "shlr r" << +(nnnn) << "\n";
 #endif
                     SET_TBIT(Rn() & 0x00000001);
                     Rn((Rn() >> 1));
                     break;
 
+                case 0b00000011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l sr, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_sr(), cpu);
+                    break;
+
                 case 0b00000101:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "rotr r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "rotr r" << +(nnnn) << "\n";
 #endif
                     SET_TBIT(Rn() & 0x00000001);
                     Rn((Rn() >> 1));
                     Rn(Rn() | (GET_TBIT() << 31));
                     break;
                 
+                case 0b00000111:
+                {
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, sr\n";
+#endif
+                    PRIVILEGED();
+
+                    std::uint32_t value = memory->read<std::uint32_t>(Rn(), cpu);
+
+                    // Rm is incremented before the bank can change
+                    Rn(Rn() + 4);
+                    cpu->set_sr(value & SR_WRITABLE_MASK);
+                    break;
+                }
+
                 case 0b00001001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "shlr2 r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "shlr2 r" << +(nnnn) << "\n";
 #endif
                     Rn(Rn() >> 2);
                     break;
                 
+                case 0b00001011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "jsr @r" << +(nnnn) << "\n";
+#endif
+                    cpu->set_pr(GET_PC() + 4);
+                    SET_PC(GET_DELAY_PC());
+                    SET_DELAY_PC(Rn());
+                    skip_pc_set = true;
+                    break;
+
+                case 0b00001110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", sr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_sr(Rn() & SR_WRITABLE_MASK);
+                    break;
+
                 case 0b00010000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "dt r" << +(nnnn) << std::endl;
+                    lucid_out() << BOLDWHITE << "dt r" << +(nnnn) << std::endl;
 #endif
                     Rn(Rn() - 1);
                     SET_TBIT(Rn() == 0 ? 1 : 0);
                     break;
 
+                case 0b00010011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l gbr, @-r" << +(nnnn) << "\n";
+#endif
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_gbr(), cpu);
+                    break;
+
+                case 0b00010111:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, gbr\n";
+#endif
+                    cpu->set_gbr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
                 case 0b00011000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "shll8 r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "shll8 r" << +(nnnn) << "\n";
 #endif
                     Rn(Rn() << 8);
                     break;
                     
+                case 0b00011110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", gbr\n";
+#endif
+                    cpu->set_gbr(Rn());
+                    break;
+
                 case 0b00100001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "shar r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "shar r" << +(nnnn) << "\n";
 #endif
                     SET_TBIT(Rn() & 0x00000001);
                     Rn((((std::int32_t) Rn()) >> 1));
                     break;
 
+                case 0b00100010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "sts.l pr, @-r" << +(nnnn) << "\n";
+#endif
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_pr(), cpu);
+                    break;
+
+                case 0b00100011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l vbr, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_vbr(), cpu);
+                    break;
+
+                case 0b00100110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds.l @r" << +(nnnn) << "+, pr\n";
+#endif
+                    cpu->set_pr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
+                case 0b00100111:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, vbr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_vbr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
                 case 0b00101000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "shll16 r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "shll16 r" << +(nnnn) << "\n";
 #endif
                     Rn(Rn() << 16);
                     break;
 
+                case 0b00101010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds r" << +(nnnn) << ", pr\n";
+#endif
+                    cpu->set_pr(Rn());
+                    break;
+
                 case 0b00101011:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "jmp @r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "jmp @r" << +(nnnn) << "\n";
 #endif
                     SET_PC(GET_DELAY_PC());
                     SET_DELAY_PC(Rn());
                     skip_pc_set = true;
                     break;
 
-                case 0b11111010:
+                case 0b00101110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", vbr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_vbr(Rn());
+                    break;
+
+                case 0b00110010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l sgr, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_sgr(), cpu);
+                    break;
+
+                case 0b00110011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l ssr, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_ssr(), cpu);
+                    break;
+
+                case 0b00110111:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, ssr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_ssr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
+                case 0b00111110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", ssr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_ssr(Rn());
+                    break;
+
+                case 0b01000011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l spc, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_spc(), cpu);
+                    break;
+
+                case 0b01000111:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, spc\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_spc(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
+                case 0b01001110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", spc\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_spc(Rn());
+                    break;
+
+                case 0b01010010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "sts.l fpul, @-r" << +(nnnn) << "\n";
+#endif
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_fpul(), cpu);
+                    break;
+
+                case 0b01010110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds.l @r" << +(nnnn) << "+, fpul\n";
+#endif
+                    cpu->set_fpul(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
+                case 0b01011010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds r" << +(nnnn) << ", fpul\n";
+#endif
+                    cpu->set_fpul(Rn());
+                    break;
+
+                case 0b01100010:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "ldc r" << +(nnnn) << ", DBR" << RESET << "\n";
+                    lucid_out() << BOLDWHITE << "sts.l fpscr, @-r" << +(nnnn) << "\n";
 #endif
-                    if (cpu->get_md_bit())
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_fpscr(), cpu);
+                    break;
+
+                case 0b01100110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds.l @r" << +(nnnn) << "+, fpscr\n";
+#endif
+                    cpu->set_fpscr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    update_fpu_mode();
+                    break;
+
+                case 0b01101010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "lds r" << +(nnnn) << ", fpscr\n";
+#endif
+                    cpu->set_fpscr(Rn());
+                    update_fpu_mode();
+                    break;
+
+                case 0b10001110: case 0b10011110: case 0b10101110: case 0b10111110:
+                case 0b11001110: case 0b11011110: case 0b11101110: case 0b11111110:
+                {
+                    std::uint8_t bank_index = (opcode & 0x0070) >> 4;
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", r" << +(bank_index) << "_bank\n";
+#endif
+                    PRIVILEGED();
+
+                    // The bank that isn't currently selected
+                    if (cpu->get_sr() & SR_RB)
+                    {
+                        cpu->set_bank0_register(bank_index, Rn());
+                    }
+                    else
                     {
-                        cpu->set_dbr(Rn());
+                        cpu->set_bank1_register(bank_index, Rn());
                     }
                     break;
+                }
+
+                case 0b11110010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "stc.l dbr, @-r" << +(nnnn) << "\n";
+#endif
+                    PRIVILEGED();
+                    Rn(Rn() - 4);
+                    memory->write(Rn(), cpu->get_dbr(), cpu);
+                    break;
+
+                case 0b11110110:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc.l @r" << +(nnnn) << "+, dbr\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_dbr(memory->read<std::uint32_t>(Rn(), cpu));
+                    Rn(Rn() + 4);
+                    break;
+
+                case 0b11111010:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ldc r" << +(nnnn) << ", DBR" << RESET << "\n";
+#endif
+                    PRIVILEGED();
+                    cpu->set_dbr(Rn());
+                    break;
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0100 opcode variation 0x" << format("{:04X}", (opcode & 0x00FF)) << " (0b" << format("{:08b}", (opcode & 0x00FF)) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
@@ -334,7 +2021,7 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         case 0b0101:
         {
 #ifdef DEBUG_INSTRUCTIONS
-            std::cout << "mov.l @(" << +(dddd << 2) << ",r" << +(mmmm) << "),r" << +(nnnn) << std::endl;
+            lucid_out() << "mov.l @(" << +(dddd << 2) << ",r" << +(mmmm) << "),r" << +(nnnn) << std::endl;
 #endif
 
             std::uint32_t addr =  (Rm() + (dddd << 2));
@@ -356,37 +2043,47 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             {
                 case 0b0010:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.l @r" << +(mmmm) << ",r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "mov.l @r" << +(mmmm) << ",r" << +(nnnn) << "\n";
 #endif
                     Rn(memory->read<uint32_t>(Rm(), cpu));
                     break;
 
                 case 0b0011:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov r" << +(mmmm) << ",r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "mov r" << +(mmmm) << ",r" << +(nnnn) << "\n";
 #endif
                     Rn(Rm());
                     break;
 
                 case 0b0101:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.w @r" << +(mmmm) << "+,r" << +(nnnn) << std::endl;
+                    lucid_out() << BOLDWHITE << "mov.w @r" << +(mmmm) << "+,r" << +(nnnn) << std::endl;
 #endif
                     Rn(memory->read<uint16_t>(Rm(), cpu));
-                    Rm(Rm() + 2);
+
+                    // With m == n the loaded value is kept, there's no increment
+                    if (mmmm != nnnn)
+                    {
+                        Rm(Rm() + 2);
+                    }
                     break;
 
                 case 0b0110:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "mov.l @+r" << +(mmmm) << ",r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "mov.l @+r" << +(mmmm) << ",r" << +(nnnn) << "\n";
 #endif
                     Rn(memory->read<std::uint32_t>(Rm(), cpu));
-                    Rm((Rm() + 4));
+
+                    // With m == n the loaded value is kept, there's no increment
+                    if (mmmm != nnnn)
+                    {
+                        Rm(Rm() + 4);
+                    }
                     break;
 
                 case 0b1000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "swap.b r" << +(mmmm) << ",r" << +(nnnn) << std::endl;
+                    lucid_out() << BOLDWHITE << "swap.b r" << +(mmmm) << ",r" << +(nnnn) << std::endl;
 #endif
                     Rn((Rm() & 0xFFFF0000) | ((Rm() & 0x0000FF00) >> 8)
                                     |((Rm() & 0x000000FF) << 8));
@@ -394,15 +2091,14 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
 
                 case 0b1001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "swap.w r" << +(mmmm) << ",r" << +(nnnn) << "\n";
+                    lucid_out() << BOLDWHITE << "swap.w r" << +(mmmm) << ",r" << +(nnnn) << "\n";
 #endif
                     Rn((Rm() >> 16) | (Rm() << 16));
                     break;
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b0110 opcode variation 0x" << format("{:02X}", (opcode & 0x000F)) << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
@@ -415,7 +2111,7 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         case 0b0111:
         {
 #ifdef DEBUG_INSTRUCTIONS
-            std::cout << "add #" << +((std::int32_t) imm) << ",r" << +(nnnn) << std::endl;
+            lucid_out() << "add #" << +((std::int32_t) imm) << ",r" << +(nnnn) << std::endl;
 #endif
 
             Rn(Rn() + ((std::int32_t) imm));
@@ -433,14 +2129,14 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
             {
                 case 0b0001:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "mov.w r0,@(" << +(dddd << 1) << ",r" << +(mmmm) << ")" << std::endl;
+                    lucid_out() << "mov.w r0,@(" << +(dddd << 1) << ",r" << +(mmmm) << ")" << std::endl;
 #endif
                     memory->write((Rm() + (dddd << 1)), (std::uint16_t) (GET_REG(0) & 0xFFFF), cpu);
                     break;
 
                 case 0b0101:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "mov.w @(" << +(dddd << 1) << ",r" << +(mmmm) << "),r0" << std::endl;
+                    lucid_out() << "mov.w @(" << +(dddd << 1) << ",r" << +(mmmm) << "),r0" << std::endl;
 #endif
                     SET_REG(0, ((dddd << 1) + Rm()));
                     break;
@@ -449,14 +2145,21 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                 {
                     std::uint32_t pc_ = ((((std::int32_t)((std::int8_t)(opcode & 0x00FF))) << 1) + 4);
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "bt 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
+                    lucid_out() << BOLDWHITE << "bt 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
 #endif
 
                     if (GET_TBIT())
                     {
+                        std::uint32_t branch_pc = GET_PC();
+
                         SET_PC(GET_PC() + pc_);
                         SET_DELAY_PC(GET_PC() + 2);
 
+                        if (idle_loop_skip && GET_PC() <= branch_pc)
+                        {
+                            idle_loop_branch(branch_pc, GET_PC());
+                        }
+
                         skip_pc_set = true;
                     }
                     break;
@@ -466,27 +2169,107 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
                 {
                     std::uint32_t pc_ = ((((std::int32_t)((std::int8_t)(opcode & 0x00FF))) << 1) + 4);
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << BOLDWHITE << "bf 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
+                    lucid_out() << BOLDWHITE << "bf 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
 #endif
 
                     if (!GET_TBIT())
                     {
+                        std::uint32_t branch_pc = GET_PC();
+
                         SET_PC(GET_PC() + pc_);
                         SET_DELAY_PC(GET_PC() + 2);
 
+                        if (idle_loop_skip && GET_PC() <= branch_pc)
+                        {
+                            idle_loop_branch(branch_pc, GET_PC());
+                        }
+
+                        skip_pc_set = true;
+                    }
+                    break;
+                }
+
+                case 0b1101:
+                {
+                    std::uint32_t pc_ = ((((std::int32_t)((std::int8_t)(opcode & 0x00FF))) << 1) + 4);
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "bt/s 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
+#endif
+
+                    // Delayed, the instruction in the delay slot runs first
+                    if (GET_TBIT())
+                    {
+                        std::uint32_t target = GET_PC() + pc_;
+
+                        SET_PC(GET_DELAY_PC());
+                        SET_DELAY_PC(target);
+
+                        skip_pc_set = true;
+                    }
+                    break;
+                }
+
+                case 0b1111:
+                {
+                    std::uint32_t pc_ = ((((std::int32_t)((std::int8_t)(opcode & 0x00FF))) << 1) + 4);
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "bf/s 0x" << format("{:08X}", GET_PC() + pc_) << "\n";
+#endif
+
+                    if (!GET_TBIT())
+                    {
+                        std::uint32_t target = GET_PC() + pc_;
+
+                        SET_PC(GET_DELAY_PC());
+                        SET_DELAY_PC(target);
+
                         skip_pc_set = true;
                     }
                     break;
                 }
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b1000 opcode variation 0x" << format("{:02X}", (opcode & 0x0F00) >> 8) << " (0b" << format("{:04b}", (opcode & 0x0F00) >> 8) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
 
+        /*
+            Opcode type:
+
+            0b1010dddddddddddd
+        */
+        case 0b1010:
+        {
+            std::uint32_t target = GET_PC() + ((((std::int32_t)((std::int16_t)(opcode << 4))) >> 4) << 1) + 4;
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "bra 0x" << format("{:08X}", target) << "\n";
+#endif
+            SET_PC(GET_DELAY_PC());
+            SET_DELAY_PC(target);
+            skip_pc_set = true;
+            break;
+        }
+
+        /*
+            Opcode type:
+
+            0b1011dddddddddddd
+        */
+        case 0b1011:
+        {
+            std::uint32_t target = GET_PC() + ((((std::int32_t)((std::int16_t)(opcode << 4))) >> 4) << 1) + 4;
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "bsr 0x" << format("{:08X}", target) << "\n";
+#endif
+            cpu->set_pr(GET_PC() + 4);
+            SET_PC(GET_DELAY_PC());
+            SET_DELAY_PC(target);
+            skip_pc_set = true;
+            break;
+        }
+
         /*
             Opcode type:
 
@@ -495,31 +2278,52 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         case 0b1100:
             switch ((opcode & 0x0F00) >> 8)
             {
+                case 0b0011:
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << "trapa #" << +(dddddddd) << std::endl;
+#endif
+                    // Not allowed in a delay slot
+                    if (GET_DELAY_PC() != GET_PC() + 2)
+                    {
+                        illegal_instruction();
+                        skip_pc_set = true;
+                        break;
+                    }
+
+                    cpu->set_tra(dddddddd << 2);
+
+                    // SPC is the instruction after TRAPA
+                    SET_PC(GET_PC() + 2);
+                    SET_DELAY_PC(GET_PC() + 2);
+
+                    raise_exception(EXPEVT_TRAPA, VECTOR_GENERAL);
+                    skip_pc_set = true;
+                    break;
+
                 case 0b0111:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "mova @(" << +(dddd) << ",pc),r0" << std::endl;
+                    lucid_out() << "mova @(" << +(dddd) << ",pc),r0" << std::endl;
 #endif
                     SET_REG(0, (GET_PC() & 0xFFFFFFFC) + (dddddddd << 2) + 4);
                     break;
 
                 case 0b1000:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "tst #" << +((std::uint8_t) imm) << ", r0" << std::endl;
+                    lucid_out() << "tst #" << +((std::uint8_t) imm) << ", r0" << std::endl;
 #endif
-                    SET_TBIT((GET_REG(0) & imm) ? 0 : 1);
+                    SET_TBIT((GET_REG(0) & ((std::uint8_t) imm)) ? 0 : 1);
                     break;
 
                 case 0b1011:
 #ifdef DEBUG_INSTRUCTIONS
-                    std::cout << "or #" << +((std::uint8_t) imm) << ", r0" << std::endl;
+                    lucid_out() << "or #" << +((std::uint8_t) imm) << ", r0" << std::endl;
 #endif
                     SET_REG(0, GET_REG(0) | ((std::uint8_t) imm));
                     break;
 
                 default:
-                    std::cerr << BOLDRED << "parse_opcode: Unimplemented 0b1100 opcode variation 0x" << format("{:02X}", (opcode & 0x0F00) >> 8) << " (0b" << format("{:04b}", (opcode & 0x0F00) >> 8) << "), complete opcode: 0x" << format("{:04X}", opcode) << RESET << "\n";
-                    cpu->print_registers();
-                    exit(1);
+                    unimplemented_opcode(opcode);
+                    skip_pc_set = true;
                     break;
             }
             break;
@@ -531,9 +2335,9 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         */
         case 0b1101:
 #ifdef DEBUG_INSTRUCTIONS
-            std::cout << "mov.l @(" << +(dddd) << ",pc),r" << +(nnnn) << std::endl;
+            lucid_out() << "mov.l @(" << +(dddddddd << 2) << ",pc),r" << +(nnnn) << std::endl;
 #endif
-            Rn(memory->read<std::uint32_t>(((dddd << 2) + 4) + (GET_PC() & 0xFFFFFFFC), cpu));
+            Rn(memory->read<std::uint32_t>(((dddddddd << 2) + 4) + (GET_PC() & 0xFFFFFFFC), cpu));
             break;
 
         /*
@@ -543,19 +2347,61 @@ void Sh4_Decode::parse_opcode(uint16_t opcode)
         */
         case 0b1110:
 #ifdef DEBUG_INSTRUCTIONS
-            std::cout << BOLDWHITE << "mov #" << +(imm) << ", r" << +(nnnn) << "\n";
+            lucid_out() << BOLDWHITE << "mov #" << +(imm) << ", r" << +(nnnn) << "\n";
 #endif
             Rn((std::int32_t) imm);
             break;
 
+        /*
+            Opcode type:
+
+            0b1111nnnnmmmmxxxx
+        */
+        case 0b1111:
+            if (opcode == 0xFBFD)
+            {
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "frchg" << "\n";
+#endif
+                cpu->set_fpscr(cpu->get_fpscr() ^ FPSCR_FR_BIT);
+                update_fpu_mode();
+            }
+            else if (opcode == 0xF3FD)
+            {
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fschg" << "\n";
+#endif
+                cpu->set_fpscr(cpu->get_fpscr() ^ FPSCR_SZ_BIT);
+                update_fpu_mode();
+            }
+            else
+            {
+                std::uint32_t pc = GET_PC();
+                fpu_handlers[opcode & 0x000F](cpu, memory, opcode);
+
+                // Encodings that don't exist in the current FPSCR mode raise an exception, which already set PC
+                if (GET_PC() != pc)
+                {
+                    if (stop_on_unimplemented)
+                    {
+                        cpu->print_registers();
+                        lucid_stop(Lucid_Status::Unimplemented);
+                    }
+
+                    update_fpu_mode();
+                    skip_pc_set = true;
+                }
+            }
+            break;
+
         default:
-            std::cerr << BOLDRED << "Unimplemented opcode: 0x" << format("{:04X}", opcode) << " (Function bits: 0b" << format("{:04b}", function) << ")" << RESET << "\n";
-            cpu->print_registers();
-            exit(1);
+            unimplemented_opcode(opcode);
+            skip_pc_set = true;
             break;
     }
     
-    if (!skip_pc_set)
+    // Stopped (Unhandled access...), PC stays on the instruction that did it
+    if (!skip_pc_set && status == Lucid_Status::Running)
     {
         SET_PC(GET_DELAY_PC());
         SET_DELAY_PC(GET_DELAY_PC() + 2);
@@ -0,0 +1,278 @@
+#include <cpu/sh4_diff.hh>
+#include <cpu/sh4_tcache.hh>
+#include <lucid.hh>
+#include <cstring>
+#include <iostream>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+#define DIFF_RAM_PAGES      ((16 * 1024 * 1024) >> 12)
+
+/*
+    Two 128-bit accumulators, each 64-bit lane gets (data ^ key).low * (data ^ key).high
+    plus the data itself with its halves swapped, the key changes every 32 bytes
+    so that the position of the data matters
+*/
+std::uint64_t sh4_page_hash(const std::uint8_t *data, std::size_t size)
+{
+#ifdef __SSE2__
+    __m128i acc0 = _mm_set_epi64x(0x9E3779B185EBCA87ll, 0xC2B2AE3D27D4EB4Fll);
+    __m128i acc1 = _mm_set_epi64x(0x165667B19E3779F9ll, 0x85EBCA77C2B2AE63ll);
+    __m128i key = _mm_set_epi64x(0x27D4EB2F165667C5ll, 0x94D049BB133111EBll);
+    const __m128i step = _mm_set_epi64x(0x9E3779B97F4A7C15ll, 0xBF58476D1CE4E5B9ll);
+
+    for (std::size_t i = 0; i < size; i += 32)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16));
+
+        __m128i keyed_a = _mm_xor_si128(a, key);
+        __m128i keyed_b = _mm_xor_si128(b, key);
+
+        acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(keyed_a, _mm_srli_epi64(keyed_a, 32)));
+        acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(keyed_b, _mm_srli_epi64(keyed_b, 32)));
+
+        acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        key = _mm_add_epi64(key, step);
+    }
+
+    std::uint64_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2), acc1);
+
+    return sh4_tcache_hash(lanes, sizeof(lanes));
+#else
+    return sh4_tcache_hash(data, size);
+#endif
+}
+
+Sh4_Diff::Sh4_Diff(Sh4_Decode *reference_, Sh4_Decode *test_)
+{
+    reference = reference_;
+    test = test_;
+
+    steps = 0;
+    instructions = 0;
+    pages_hashed = 0;
+    full_checks = 0;
+
+    // One instruction at a time, nothing skipped
+    reference->engine = Sh4_Engine::Interpreter;
+    reference->fuse_pairs = false;
+
+    // Before anything is translated, the JIT only marks pages in what it compiles after
+    for (Sh4_Decode *decoder : {reference, test})
+    {
+        decoder->idle_loop_skip = false;
+        decoder->bulk_loops = false;
+        decoder->memory->track_dirty_pages();
+    }
+
+    test->step_link_cycles = DIFF_LINK_CYCLES;
+
+    // Whatever the reset left undefined has to match too
+    test->cpu->copy_state(*reference->cpu);
+}
+
+bool Sh4_Diff::run(std::uint64_t max_steps)
+{
+    // A guest exit (Or error) ends the run instead of the process, so the last steps still get their full check
+    Lucid_Status status = Lucid_Status::Running;
+    Lucid_Status *previous = lucid_context.status;
+    lucid_context.status = &status;
+
+    bool matched = lock_step(max_steps, status);
+
+    lucid_context.status = previous;
+
+    if (matched && status != Lucid_Status::Running)
+    {
+        lucid_stop(status);
+    }
+
+    return matched;
+}
+
+bool Sh4_Diff::lock_step(std::uint64_t max_steps, const Lucid_Status &status)
+{
+    std::uint64_t reference_instructions = 0;
+    std::uint32_t pc = test->cpu->get_pc();
+    std::uint32_t count = 0;
+
+    if (!compare(true))
+    {
+        report(test->cpu->get_pc(), 0);
+        return false;
+    }
+
+    while ((!max_steps || steps < max_steps) && status == Lucid_Status::Running)
+    {
+        pc = test->cpu->get_pc();
+        bool sleeping = test->cpu->is_sleeping();
+
+        count = test->step();
+
+        instructions += count;
+        steps++;
+
+        // Waits for the next event on both sides
+        if (sleeping)
+        {
+            reference->step();
+        }
+
+        while (reference_instructions < instructions)
+        {
+            std::uint32_t reference_count = reference->step();
+
+            if (!reference_count)
+            {
+                break;
+            }
+
+            reference_instructions += reference_count;
+        }
+
+        if (!compare(steps % DIFF_FULL_CHECK_INTERVAL == 0) || reference_instructions != instructions)
+        {
+            if (reference_instructions != instructions)
+            {
+                lucid_out() << BOLDRED << "Differential test: The interpreter ran " << reference_instructions << " instructions instead of "
+                          << instructions << RESET << "\n";
+            }
+
+            report(pc, count);
+            return false;
+        }
+    }
+
+    // The last steps since a full check, in case something wrote without setting dirty_pages
+    if (!compare(true))
+    {
+        report(pc, count);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Registers, then the main memory pages that were written to on either side
+    (Or all of them)
+*/
+bool Sh4_Diff::compare(bool full)
+{
+    Memory *a = reference->memory;
+    Memory *b = test->memory;
+
+    bool registers_match = test->cpu->compare(*reference->cpu).empty();
+
+    differing_pages.clear();
+
+    if (full)
+    {
+        full_checks++;
+    }
+
+    // Dirty flags go 8 at a time
+    for (std::uint32_t word = 0; word < DIFF_RAM_PAGES; word += 8)
+    {
+        std::uint64_t dirty_a, dirty_b;
+
+        memcpy(&dirty_a, a->dirty_pages + word, sizeof(dirty_a));
+        memcpy(&dirty_b, b->dirty_pages + word, sizeof(dirty_b));
+
+        std::uint64_t dirty = dirty_a | dirty_b;
+
+        if (!full && !dirty)
+        {
+            continue;
+        }
+
+        memset(a->dirty_pages + word, 0, 8);
+        memset(b->dirty_pages + word, 0, 8);
+
+        for (std::uint32_t page = word; page < word + 8; page++)
+        {
+            if (!full && !((dirty >> ((page - word) * 8)) & 0xFF))
+            {
+                continue;
+            }
+
+            std::uint32_t offset = page << 12;
+            pages_hashed++;
+
+            if (sh4_page_hash(a->main_memory + offset, 4096) != sh4_page_hash(b->main_memory + offset, 4096))
+            {
+                differing_pages.push_back(page);
+            }
+        }
+    }
+
+    return registers_match && differing_pages.empty();
+}
+
+void Sh4_Diff::report(std::uint32_t pc, std::uint32_t count)
+{
+    lucid_out() << BOLDRED << "Differential test: Diverged from the interpreter after " << steps << " steps (" << instructions
+              << " instructions)" << RESET << "\n";
+
+    lucid_out() << BOLDWHITE << "Last step at 0x" << format("{:08X}", pc) << " (" << count << " instructions):";
+
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        lucid_out() << ((i % 8) ? " " : "\n    ") << "0x" << format("{:04X}", reference->memory->read<std::uint16_t>(pc + i * 2, reference->cpu));
+    }
+
+    lucid_out() << RESET << "\n";
+
+    for (const Sh4_Register_Diff &diff : test->cpu->compare(*reference->cpu))
+    {
+        lucid_out() << "    " << diff.name << ": interpreter " << BOLDWHITE << "0x" << format("{:08X}", diff.other) << RESET
+                  << ", engine " << BOLDRED << "0x" << format("{:08X}", diff.value) << RESET << "\n";
+    }
+
+    for (std::uint32_t page : differing_pages)
+    {
+        std::uint32_t offset = page << 12;
+        std::uint32_t i = 0;
+
+        while (i < 4096 && reference->memory->main_memory[offset + i] == test->memory->main_memory[offset + i])
+        {
+            i++;
+        }
+
+        lucid_out() << "    Main memory page 0x" << format("{:08X}", 0x0C000000 | offset) << ": first difference at 0x"
+                  << format("{:08X}", 0x0C000000 | (offset + i)) << ", interpreter " << BOLDWHITE << "0x"
+                  << format("{:02X}", reference->memory->main_memory[offset + i]) << RESET << ", engine " << BOLDRED << "0x"
+                  << format("{:02X}", test->memory->main_memory[offset + i]) << RESET << "\n";
+    }
+
+    if (test->engine != Sh4_Engine::Interpreter)
+    {
+        Sh4_Block *block = test->blocks.find(pc);
+
+        if (block)
+        {
+            lucid_out() << sh4_ir_dump(block->ir);
+        }
+    }
+}
+
+void Sh4_Diff::print_stats()
+{
+    lucid_out() << BOLDWHITE << "Differential test: " << steps << " steps, " << instructions << " instructions, "
+              << pages_hashed << " pages hashed, " << full_checks << " full memory checks" << RESET << std::endl;
+}
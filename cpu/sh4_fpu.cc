@@ -0,0 +1,771 @@
+#include <cpu/sh4_fpu.hh>
+#include <lucid.hh>
+#include <iostream>
+#include <cmath>
+#include <bit>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+namespace {
+
+/*
+    Raises an illegal instruction exception, the decoder notices PC moved (See
+    Sh4_Decode::parse_opcode). Stops instead with SR.BL set, like
+    Sh4_Decode::unimplemented_opcode
+*/
+void unimplemented_fpu_opcode(Sh4_Cpu *cpu, std::uint16_t opcode)
+{
+    lucid_err() << BOLDRED << "parse_opcode: Unimplemented 0b1111 opcode variation 0x" << format("{:02X}", (opcode & 0x000F))
+        << " (0b" << format("{:04b}", (opcode & 0x000F)) << "), complete opcode: 0x" << format("{:04X}", opcode)
+        << " (FPSCR: 0x" << format("{:08X}", cpu->get_fpscr()) << ")" << RESET << "\n";
+
+    if (cpu->get_sr() & SR_BL)
+    {
+        cpu->print_registers();
+        lucid_stop(Lucid_Status::Unimplemented);
+        return;
+    }
+
+    bool delay_slot = cpu->get_delay_pc() != cpu->get_pc() + 2;
+    cpu->raise_exception(delay_slot ? EXPEVT_SLOT_ILLEGAL_INSTRUCTION : EXPEVT_ILLEGAL_INSTRUCTION, VECTOR_GENERAL);
+}
+
+/*
+    PR = Precision (false: Single, true: Double)
+    SZ = Transfer size (false: 32 bits, true: 64 bits pairs)
+*/
+template <bool PR, bool SZ>
+struct Sh4_Fpu {
+
+    /*
+        With FPSCR.SZ = 1, FMOV moves register pairs; an odd register index
+        selects the XD pair from the other bank instead.
+    */
+    static std::uint64_t get_pair(Sh4_Cpu *cpu, std::uint8_t index)
+    {
+        if (index & 1)
+        {
+            return (static_cast<std::uint64_t>(cpu->get_xf_bits(index & 0xE)) << 32) | cpu->get_xf_bits((index & 0xE) + 1);
+        }
+
+        return (static_cast<std::uint64_t>(cpu->get_fr_bits(index)) << 32) | cpu->get_fr_bits(index + 1);
+    }
+
+    static void set_pair(Sh4_Cpu *cpu, std::uint8_t index, std::uint64_t value)
+    {
+        if (index & 1)
+        {
+            cpu->set_xf_bits(index & 0xE, static_cast<std::uint32_t>(value >> 32));
+            cpu->set_xf_bits((index & 0xE) + 1, static_cast<std::uint32_t>(value));
+        }
+        else
+        {
+            cpu->set_fr_bits(index, static_cast<std::uint32_t>(value >> 32));
+            cpu->set_fr_bits(index + 1, static_cast<std::uint32_t>(value));
+        }
+    }
+
+    static void load(Sh4_Cpu *cpu, Memory *memory, std::uint8_t nnnn, std::uint32_t address)
+    {
+        if constexpr (SZ)
+        {
+            std::uint64_t value = (static_cast<std::uint64_t>(memory->read<std::uint32_t>(address, cpu)) << 32)
+                                | memory->read<std::uint32_t>(address + 4, cpu);
+            set_pair(cpu, nnnn, value);
+        }
+        else
+        {
+            cpu->set_fr_bits(nnnn, memory->read<std::uint32_t>(address, cpu));
+        }
+    }
+
+    static void store(Sh4_Cpu *cpu, Memory *memory, std::uint8_t mmmm, std::uint32_t address)
+    {
+        if constexpr (SZ)
+        {
+            std::uint64_t value = get_pair(cpu, mmmm);
+            memory->write<std::uint32_t>(address, static_cast<std::uint32_t>(value >> 32), cpu);
+            memory->write<std::uint32_t>(address + 4, static_cast<std::uint32_t>(value), cpu);
+        }
+        else
+        {
+            memory->write<std::uint32_t>(address, cpu->get_fr_bits(mmmm), cpu);
+        }
+    }
+
+    static constexpr std::uint32_t transfer_size = SZ ? 8 : 4;
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0000
+    */
+    static void fadd(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+        if constexpr (PR)
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fadd dr" << +(mmmm) << ", dr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_dr(nnnn, cpu->get_dr(nnnn) + cpu->get_dr(mmmm));
+        }
+        else
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fadd fr" << +(mmmm) << ", fr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_fr(nnnn, cpu->get_fr(nnnn) + cpu->get_fr(mmmm));
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0001
+    */
+    static void fsub(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+        if constexpr (PR)
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fsub dr" << +(mmmm) << ", dr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_dr(nnnn, cpu->get_dr(nnnn) - cpu->get_dr(mmmm));
+        }
+        else
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fsub fr" << +(mmmm) << ", fr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_fr(nnnn, cpu->get_fr(nnnn) - cpu->get_fr(mmmm));
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0010
+    */
+    static void fmul(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+        if constexpr (PR)
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fmul dr" << +(mmmm) << ", dr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_dr(nnnn, cpu->get_dr(nnnn) * cpu->get_dr(mmmm));
+        }
+        else
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fmul fr" << +(mmmm) << ", fr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_fr(nnnn, cpu->get_fr(nnnn) * cpu->get_fr(mmmm));
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0011
+    */
+    static void fdiv(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+        if constexpr (PR)
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fdiv dr" << +(mmmm) << ", dr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_dr(nnnn, cpu->get_dr(nnnn) / cpu->get_dr(mmmm));
+        }
+        else
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fdiv fr" << +(mmmm) << ", fr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_fr(nnnn, cpu->get_fr(nnnn) / cpu->get_fr(mmmm));
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0100
+    */
+    static void fcmp_eq(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fcmp/eq " << (PR ? "dr" : "fr") << +(mmmm) << ", " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        if constexpr (PR)
+        {
+            cpu->set_tbit(cpu->get_dr(nnnn) == cpu->get_dr(mmmm) ? 1 : 0);
+        }
+        else
+        {
+            cpu->set_tbit(cpu->get_fr(nnnn) == cpu->get_fr(mmmm) ? 1 : 0);
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0101
+    */
+    static void fcmp_gt(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fcmp/gt " << (PR ? "dr" : "fr") << +(mmmm) << ", " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        if constexpr (PR)
+        {
+            cpu->set_tbit(cpu->get_dr(nnnn) > cpu->get_dr(mmmm) ? 1 : 0);
+        }
+        else
+        {
+            cpu->set_tbit(cpu->get_fr(nnnn) > cpu->get_fr(mmmm) ? 1 : 0);
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0110
+    */
+    static void fmov_load_r0_indexed(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " @(r0,r" << +(mmmm) << "), " << (SZ ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        load(cpu, memory, nnnn, cpu->get_register(0) + cpu->get_register(mmmm));
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm0111
+    */
+    static void fmov_store_r0_indexed(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " " << (SZ ? "dr" : "fr") << +(mmmm) << ", @(r0,r" << +(nnnn) << ")" << RESET << "\n";
+#endif
+        store(cpu, memory, mmmm, cpu->get_register(0) + cpu->get_register(nnnn));
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1000
+    */
+    static void fmov_load(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " @r" << +(mmmm) << ", " << (SZ ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        load(cpu, memory, nnnn, cpu->get_register(mmmm));
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1001
+    */
+    static void fmov_load_postinc(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " @r" << +(mmmm) << "+, " << (SZ ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        load(cpu, memory, nnnn, cpu->get_register(mmmm));
+        cpu->set_register(mmmm, cpu->get_register(mmmm) + transfer_size);
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1010
+    */
+    static void fmov_store(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " " << (SZ ? "dr" : "fr") << +(mmmm) << ", @r" << +(nnnn) << RESET << "\n";
+#endif
+        store(cpu, memory, mmmm, cpu->get_register(nnnn));
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1011
+    */
+    static void fmov_store_predec(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov" << (SZ ? "" : ".s") << " " << (SZ ? "dr" : "fr") << +(mmmm) << ", @-r" << +(nnnn) << RESET << "\n";
+#endif
+        std::uint32_t address = cpu->get_register(nnnn) - transfer_size;
+        store(cpu, memory, mmmm, address);
+        cpu->set_register(nnnn, address);
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1100
+    */
+    static void fmov(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+#ifdef DEBUG_INSTRUCTIONS
+        lucid_out() << BOLDWHITE << "fmov " << (SZ ? "dr" : "fr") << +(mmmm) << ", " << (SZ ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+        if constexpr (SZ)
+        {
+            set_pair(cpu, nnnn, get_pair(cpu, mmmm));
+        }
+        else
+        {
+            cpu->set_fr_bits(nnnn, cpu->get_fr_bits(mmmm));
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnxxxx1101
+    */
+    static void single_operand(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+
+        switch ((opcode & 0x00F0) >> 4)
+        {
+            case 0b0000:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fsts fpul, fr" << +(nnnn) << RESET << "\n";
+#endif
+                cpu->set_fr_bits(nnnn, cpu->get_fpul());
+                break;
+
+            case 0b0001:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "flds fr" << +(nnnn) << ", fpul" << RESET << "\n";
+#endif
+                cpu->set_fpul(cpu->get_fr_bits(nnnn));
+                break;
+
+            case 0b0010:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "float fpul, " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+                if constexpr (PR)
+                {
+                    cpu->set_dr(nnnn, static_cast<double>(static_cast<std::int32_t>(cpu->get_fpul())));
+                }
+                else
+                {
+                    cpu->set_fr(nnnn, static_cast<float>(static_cast<std::int32_t>(cpu->get_fpul())));
+                }
+                break;
+
+            case 0b0011:
+            {
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "ftrc " << (PR ? "dr" : "fr") << +(nnnn) << ", fpul" << RESET << "\n";
+#endif
+                // Out of range values (And NaNs) saturate, like on hardware
+                double value = PR ? cpu->get_dr(nnnn) : static_cast<double>(cpu->get_fr(nnnn));
+                std::int32_t result;
+
+                if (std::isnan(value))
+                {
+                    result = INT32_MIN;
+                }
+                else if (value >= 2147483647.0)
+                {
+                    result = INT32_MAX;
+                }
+                else if (value <= -2147483648.0)
+                {
+                    result = INT32_MIN;
+                }
+                else
+                {
+                    result = static_cast<std::int32_t>(value);
+                }
+
+                cpu->set_fpul(static_cast<std::uint32_t>(result));
+                break;
+            }
+
+            case 0b0100:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fneg " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+                // Sign bit only, for DRn it lives in the even (Upper) register
+                cpu->set_fr_bits(PR ? (nnnn & 0xE) : nnnn, cpu->get_fr_bits(PR ? (nnnn & 0xE) : nnnn) ^ 0x80000000);
+                break;
+
+            case 0b0101:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fabs " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+                cpu->set_fr_bits(PR ? (nnnn & 0xE) : nnnn, cpu->get_fr_bits(PR ? (nnnn & 0xE) : nnnn) & 0x7FFFFFFF);
+                break;
+
+            case 0b0110:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fsqrt " << (PR ? "dr" : "fr") << +(nnnn) << RESET << "\n";
+#endif
+                if constexpr (PR)
+                {
+                    cpu->set_dr(nnnn, std::sqrt(cpu->get_dr(nnnn)));
+                }
+                else
+                {
+                    cpu->set_fr(nnnn, std::sqrt(cpu->get_fr(nnnn)));
+                }
+                break;
+
+            case 0b0111:
+                // FSRRA only exists in single precision mode
+                if constexpr (PR)
+                {
+                    unimplemented_fpu_opcode(cpu, opcode);
+                }
+                else
+                {
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "fsrra fr" << +(nnnn) << RESET << "\n";
+#endif
+                    cpu->set_fr(nnnn, 1.0f / std::sqrt(cpu->get_fr(nnnn)));
+                }
+                break;
+
+            case 0b1000:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fldi0 fr" << +(nnnn) << RESET << "\n";
+#endif
+                cpu->set_fr_bits(nnnn, 0x00000000);
+                break;
+
+            case 0b1001:
+#ifdef DEBUG_INSTRUCTIONS
+                lucid_out() << BOLDWHITE << "fldi1 fr" << +(nnnn) << RESET << "\n";
+#endif
+                cpu->set_fr_bits(nnnn, 0x3F800000);
+                break;
+
+            case 0b1010:
+                // FCNVSD/FCNVDS only exist in double precision mode
+                if constexpr (PR)
+                {
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "fcnvsd fpul, dr" << +(nnnn) << RESET << "\n";
+#endif
+                    cpu->set_dr(nnnn, static_cast<double>(std::bit_cast<float>(cpu->get_fpul())));
+                }
+                else
+                {
+                    unimplemented_fpu_opcode(cpu, opcode);
+                }
+                break;
+
+            case 0b1011:
+                if constexpr (PR)
+                {
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "fcnvds dr" << +(nnnn) << ", fpul" << RESET << "\n";
+#endif
+                    cpu->set_fpul(std::bit_cast<std::uint32_t>(static_cast<float>(cpu->get_dr(nnnn))));
+                }
+                else
+                {
+                    unimplemented_fpu_opcode(cpu, opcode);
+                }
+                break;
+
+            case 0b1110:
+                if constexpr (PR)
+                {
+                    unimplemented_fpu_opcode(cpu, opcode);
+                }
+                else
+                {
+                    // FIPR FVm,FVn: 1111nnmm11101101
+                    std::uint8_t n = nnnn & 0xC;
+                    std::uint8_t m = (nnnn & 0x3) << 2;
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "fipr fv" << +(m) << ", fv" << +(n) << RESET << "\n";
+#endif
+                    float result = 0.0f;
+
+                    for (std::uint8_t i = 0; i < 4; i++)
+                    {
+                        result += cpu->get_fr(m + i) * cpu->get_fr(n + i);
+                    }
+
+                    cpu->set_fr(n + 3, result);
+                }
+                break;
+
+            case 0b1111:
+                if (!PR && (opcode & 0x0300) == 0x0100)
+                {
+                    // FTRV XMTRX,FVn: 1111nn0111111101
+                    std::uint8_t n = nnnn & 0xC;
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "ftrv xmtrx, fv" << +(n) << RESET << "\n";
+#endif
+                    float vector[4];
+
+                    for (std::uint8_t i = 0; i < 4; i++)
+                    {
+                        vector[i] = cpu->get_fr(n + i);
+                    }
+
+                    for (std::uint8_t i = 0; i < 4; i++)
+                    {
+                        float result = 0.0f;
+
+                        // XMTRX is stored column-major in XF0-XF15
+                        for (std::uint8_t j = 0; j < 4; j++)
+                        {
+                            result += std::bit_cast<float>(cpu->get_xf_bits(i + (j << 2))) * vector[j];
+                        }
+
+                        cpu->set_fr(n + i, result);
+                    }
+                }
+                else if (!PR && (opcode & 0x0100) == 0x0000)
+                {
+                    // FSCA FPUL,DRn: 1111nnn011111101
+                    std::uint8_t n = nnnn & 0xE;
+#ifdef DEBUG_INSTRUCTIONS
+                    lucid_out() << BOLDWHITE << "fsca fpul, dr" << +(n) << RESET << "\n";
+#endif
+                    // The low 16 bits of FPUL are a fraction of a full turn
+                    double angle = (static_cast<double>(cpu->get_fpul() & 0xFFFF) / 65536.0) * 2.0 * M_PI;
+                    cpu->set_fr(n, static_cast<float>(std::sin(angle)));
+                    cpu->set_fr(n + 1, static_cast<float>(std::cos(angle)));
+                }
+                else
+                {
+                    // FRCHG/FSCHG are handled by the decoder as they swap tables
+                    unimplemented_fpu_opcode(cpu, opcode);
+                }
+                break;
+
+            default:
+                unimplemented_fpu_opcode(cpu, opcode);
+                break;
+        }
+    }
+
+    /*
+        Opcode type:
+
+        1111nnnnmmmm1110
+    */
+    static void fmac(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+        std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+
+        // FMAC only exists in single precision mode
+        if constexpr (PR)
+        {
+            unimplemented_fpu_opcode(cpu, opcode);
+        }
+        else
+        {
+#ifdef DEBUG_INSTRUCTIONS
+            lucid_out() << BOLDWHITE << "fmac fr0, fr" << +(mmmm) << ", fr" << +(nnnn) << RESET << "\n";
+#endif
+            cpu->set_fr(nnnn, (cpu->get_fr(0) * cpu->get_fr(mmmm)) + cpu->get_fr(nnnn));
+        }
+    }
+
+    static void invalid(Sh4_Cpu *cpu, Memory *, std::uint16_t opcode)
+    {
+        unimplemented_fpu_opcode(cpu, opcode);
+    }
+
+    static constexpr Sh4_Fpu_Table table = {
+        fadd, fsub, fmul, fdiv,
+        fcmp_eq, fcmp_gt, fmov_load_r0_indexed, fmov_store_r0_indexed,
+        fmov_load, fmov_load_postinc, fmov_store, fmov_store_predec,
+        fmov, single_operand, fmac, invalid
+    };
+};
+
+/*
+    Indexed by (PR << 1) | SZ
+*/
+constexpr const Sh4_Fpu_Table *fpu_tables[4] = {
+    &Sh4_Fpu<false, false>::table,
+    &Sh4_Fpu<false, true>::table,
+    &Sh4_Fpu<true, false>::table,
+    &Sh4_Fpu<true, true>::table,
+};
+
+}
+
+const Sh4_Fpu_Handler *sh4_fpu_table(std::uint32_t fpscr)
+{
+    return fpu_tables[((fpscr & FPSCR_PR_BIT) ? 2 : 0) | ((fpscr & FPSCR_SZ_BIT) ? 1 : 0)]->data();
+}
+
+/*
+    Host side, MXCSR on x86-64 and the C fenv rounding mode elsewhere (Where
+    there's no portable way to flush denormals)
+*/
+#if defined(__x86_64__) || defined(_M_X64)
+#include <xmmintrin.h>
+
+#define MXCSR_DAZ_BIT           (1u << 6)
+#define MXCSR_FTZ_BIT           (1u << 15)
+#define MXCSR_RC_MASK           (0b11u << 13)
+#define MXCSR_RC_NEAREST        (0b00u << 13)
+#define MXCSR_RC_ZERO           (0b11u << 13)
+
+std::uint32_t Sh4_Host_Fpu_Env::read_control()
+{
+    return _mm_getcsr();
+}
+
+void Sh4_Host_Fpu_Env::write_control(std::uint32_t control)
+{
+    _mm_setcsr(control);
+}
+
+std::uint32_t Sh4_Host_Fpu_Env::guest_control_from_fpscr(std::uint32_t host_control, std::uint32_t fpscr)
+{
+    std::uint32_t control = host_control & ~(MXCSR_RC_MASK | MXCSR_DAZ_BIT | MXCSR_FTZ_BIT);
+
+    // RM = 01 is round to zero, 00 is round to nearest (10 and 11 are reserved)
+    control |= ((fpscr & FPSCR_RM_MASK) == 0b01) ? MXCSR_RC_ZERO : MXCSR_RC_NEAREST;
+
+    // DN = 1 treats denormalized inputs and outputs as zero
+    if (fpscr & FPSCR_DN_BIT)
+    {
+        control |= (MXCSR_DAZ_BIT | MXCSR_FTZ_BIT);
+    }
+
+    return control;
+}
+#else
+#include <cfenv>
+
+std::uint32_t Sh4_Host_Fpu_Env::read_control()
+{
+    return static_cast<std::uint32_t>(std::fegetround());
+}
+
+void Sh4_Host_Fpu_Env::write_control(std::uint32_t control)
+{
+    std::fesetround(static_cast<int>(control));
+}
+
+std::uint32_t Sh4_Host_Fpu_Env::guest_control_from_fpscr(std::uint32_t host_control, std::uint32_t fpscr)
+{
+    (void) host_control;
+    return static_cast<std::uint32_t>(((fpscr & FPSCR_RM_MASK) == 0b01) ? FE_TOWARDZERO : FE_TONEAREST);
+}
+#endif
+
+Sh4_Host_Fpu_Env::Sh4_Host_Fpu_Env()
+{
+    host_control = read_control();
+    guest_fpscr = FPSCR_INITIAL_VALUE;
+    guest_control = guest_control_from_fpscr(host_control, guest_fpscr);
+    in_guest = false;
+}
+
+void Sh4_Host_Fpu_Env::update(std::uint32_t fpscr)
+{
+    guest_fpscr = fpscr;
+
+    std::uint32_t control = guest_control_from_fpscr(host_control, fpscr);
+
+    if (control == guest_control)
+    {
+        return;
+    }
+
+    guest_control = control;
+
+    if (in_guest)
+    {
+        write_control(guest_control);
+    }
+}
+
+void Sh4_Host_Fpu_Env::enter_guest()
+{
+    if (in_guest)
+    {
+        return;
+    }
+
+    // The host may have changed its own control bits since the last time
+    host_control = read_control();
+    guest_control = guest_control_from_fpscr(host_control, guest_fpscr);
+    write_control(guest_control);
+    in_guest = true;
+}
+
+void Sh4_Host_Fpu_Env::leave_guest()
+{
+    if (!in_guest)
+    {
+        return;
+    }
+
+    write_control(host_control);
+    in_guest = false;
+}
@@ -0,0 +1,72 @@
+#include <cpu/sh4_fused.hh>
+
+Sh4_Fused sh4_fuse(std::uint16_t first, std::uint16_t second)
+{
+    std::uint16_t nnnn = first & 0x0F00;
+
+    switch (first >> 12)
+    {
+        case 0b1101:
+            // The jump has to use the register that was just loaded
+            if (second == (0x402B | nnnn))
+            {
+                return Sh4_Fused::Literal_Jmp;
+            }
+
+            if (second == (0x400B | nnnn))
+            {
+                return Sh4_Fused::Literal_Jsr;
+            }
+            break;
+
+        case 0b1110:
+            if (second == (0x4018 | nnnn))
+            {
+                return Sh4_Fused::Mov_Shll8;
+            }
+            break;
+
+        case 0b1100:
+            if ((first & 0xFF00) == 0xC800 && (second & 0xFF00) == 0x8900)
+            {
+                return Sh4_Fused::Tst_Bt;
+            }
+            break;
+
+        case 0b0100:
+            if ((first & 0xF0FF) == 0x4010 && (second & 0xFF00) == 0x8B00)
+            {
+                return Sh4_Fused::Dt_Bf;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return Sh4_Fused::None;
+}
+
+const char *sh4_fused_name(Sh4_Fused fused)
+{
+    switch (fused)
+    {
+        case Sh4_Fused::Literal_Jmp:
+            return "mov.l @(disp,pc),rn + jmp @rn";
+
+        case Sh4_Fused::Literal_Jsr:
+            return "mov.l @(disp,pc),rn + jsr @rn";
+
+        case Sh4_Fused::Mov_Shll8:
+            return "mov #imm,rn + shll8 rn";
+
+        case Sh4_Fused::Tst_Bt:
+            return "tst #imm,r0 + bt";
+
+        case Sh4_Fused::Dt_Bf:
+            return "dt rn + bf";
+
+        default:
+            return "none";
+    }
+}
@@ -0,0 +1,731 @@
+#include <cpu/sh4_fuzz.hh>
+#include <cpu/sh4_diff.hh>
+#include <cpu/sh4_tcache.hh>
+#include <lucid.hh>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+namespace
+{
+    constexpr std::uint32_t SR_M = 1u << 9, SR_Q = 1u << 8, SR_IMASK = 0xF0, SR_S = 1u << 1, SR_T = 1u;
+
+    std::vector<std::string> split_csv_line(const std::string &line)
+    {
+        std::vector<std::string> fields(1);
+        bool quoted = false;
+
+        for (std::size_t i = 0; i < line.size(); i++)
+        {
+            char c = line[i];
+
+            if (quoted && c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+            {
+                fields.back() += '"';
+                i++;
+            }
+            else if (c == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (c == ',' && !quoted)
+            {
+                fields.emplace_back();
+            }
+            else if (c != '\r')
+            {
+                fields.back() += c;
+            }
+        }
+
+        return fields;
+    }
+
+    // Bits of the opcode under the letter's positions in the encoding, packed
+    std::uint32_t field(const Sh4_Instr_Class &instr, std::uint16_t opcode, char letter)
+    {
+        std::uint32_t value = 0;
+
+        for (std::size_t i = 0; i < instr.code.size(); i++)
+        {
+            if (instr.code[i] == letter)
+            {
+                value = (value << 1) | ((opcode >> (15 - i)) & 1);
+            }
+        }
+
+        return value;
+    }
+
+    bool has(const std::string &text, const char *part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    // Bytes moved by each memory access of the instruction
+    std::uint32_t access_size(const Sh4_Instr_Class &instr)
+    {
+        const std::string &name = instr.instruction;
+
+        if (name.ends_with(".B")) return 1;
+        if (name.ends_with(".W")) return 2;
+        if (name == "FMOV" && (has(instr.format, "DR") || has(instr.format, "XD"))) return 8;
+
+        return 4;
+    }
+
+    void set_gpr(Sh4_Cpu_State &state, std::uint32_t index, std::uint32_t value)
+    {
+        if (index >= 8)
+        {
+            state.r[index - 8] = value;
+        }
+        else if (state.sr & SR_RB)
+        {
+            state.r_bank1[index] = value;
+        }
+        else
+        {
+            state.r_bank0[index] = value;
+        }
+    }
+
+    void fill(std::uint8_t *data, std::size_t size, std::mt19937_64 &rng)
+    {
+        for (std::size_t i = 0; i < size; i += 8)
+        {
+            std::uint64_t value = rng();
+            memcpy(data + i, &value, std::min<std::size_t>(8, size - i));
+        }
+    }
+
+    std::string strip_colors(const std::string &text)
+    {
+        std::string stripped;
+
+        for (std::size_t i = 0; i < text.size(); i++)
+        {
+            if (text[i] == '\033')
+            {
+                while (i < text.size() && text[i] != 'm') i++;
+                continue;
+            }
+
+            stripped += text[i];
+        }
+
+        return stripped;
+    }
+}
+
+std::string Sh4_Instr_Class::key() const
+{
+    return format.empty() ? instruction : instruction + " " + format;
+}
+
+std::vector<Sh4_Instr_Class> sh4_load_instr_table(const std::string &path)
+{
+    std::vector<Sh4_Instr_Class> classes;
+    std::ifstream file(path);
+    std::string line;
+
+    // Header
+    std::getline(file, line);
+
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields = split_csv_line(line);
+
+        if (fields.size() < 4 || fields[3].size() != 16)
+        {
+            continue;
+        }
+
+        Sh4_Instr_Class instr = {fields[0], fields[1], fields[3], fields.size() > 4 && !fields[4].empty(), 0, 0};
+
+        for (std::size_t i = 0; i < 16; i++)
+        {
+            if (instr.code[i] == '0' || instr.code[i] == '1')
+            {
+                instr.fixed_mask |= 1 << (15 - i);
+                instr.fixed_bits |= (instr.code[i] == '1') << (15 - i);
+            }
+        }
+
+        classes.push_back(instr);
+    }
+
+    return classes;
+}
+
+Sh4_Fuzz::Sh4_Fuzz(Sh4_Decode *decoder_)
+{
+    decoder = decoder_;
+
+    cases = FUZZ_DEFAULT_CASES;
+    seed = 0x5EED;
+    slow_threshold = FUZZ_SLOW_THRESHOLD;
+
+    // One instruction per step, nothing fast-forwarded
+    decoder->fuse_pairs = false;
+    decoder->idle_loop_skip = false;
+    decoder->bulk_loops = false;
+
+    // Unimplemented opcodes stop the decoder (See run_case) instead of raising an exception
+    decoder->stop_on_unimplemented = true;
+}
+
+bool Sh4_Fuzz::load(const std::string &csv_path)
+{
+    classes = sh4_load_instr_table(csv_path);
+
+    if (classes.empty())
+    {
+        lucid_err() << BOLDRED << "Instruction test: No instructions in " << csv_path << " (Exported from resources/sh4_instr.xlsx at build time)"
+                  << RESET << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Random registers (Privileged mode, interrupts masked), with the ones the
+    instruction dereferences pointing to the data area and branch targets in
+    main memory around the code
+*/
+Sh4_Fuzz_Case Sh4_Fuzz::generate(const Sh4_Instr_Class &instr, std::uint64_t case_seed)
+{
+    std::mt19937_64 rng(case_seed);
+    Sh4_Fuzz_Case test = {};
+
+    test.seed = case_seed;
+
+    const std::string &name = instr.instruction;
+    const std::string &operands = instr.format;
+
+    bool indexed = has(operands, "(R0,R");
+    bool n_pointer = has(operands, "@Rn") || has(operands, "@-Rn") || has(operands, "(disp,Rn)") || has(operands, "(R0,Rn)");
+    bool m_pointer = has(operands, "@Rm") || has(operands, "(disp,Rm)") || has(operands, "(R0,Rm)");
+    bool gbr_pointer = has(operands, ",GBR)");
+
+    // R0 as an index can't be the base register too
+    for (int tries = 0; tries < 64; tries++)
+    {
+        test.opcode = instr.fixed_bits | (static_cast<std::uint16_t>(rng()) & ~instr.fixed_mask);
+
+        if (!indexed || ((!has(operands, "(R0,Rn)") || field(instr, test.opcode, 'n')) && (!has(operands, "(R0,Rm)") || field(instr, test.opcode, 'm'))))
+        {
+            break;
+        }
+    }
+
+    /*
+        Jump targets, not memory operands. Going by the encoding rather than the
+        name, the table has a few rows with the wrong one
+    */
+    bool absolute_target = (test.opcode & 0xF0DF) == 0x400B;         // JMP/JSR @Rn
+    bool relative_target = (test.opcode & 0xF0DF) == 0x0003;         // BRAF/BSRF Rn
+
+    if (absolute_target || relative_target)
+    {
+        n_pointer = false;
+    }
+
+    Sh4_Cpu_State &state = test.state;
+
+    for (int i = 0; i < 8; i++)
+    {
+        state.r_bank0[i] = rng();
+        state.r_bank1[i] = rng();
+        state.r[i] = rng();
+    }
+
+    auto code_target = [&rng]() { return static_cast<std::uint32_t>(FUZZ_CODE_ADDRESS - 2048 + (rng() % 4096)) & ~1u; };
+
+    // SR.BL clear, exceptions (TRAPA, illegal instructions) would reset the CPU otherwise
+    state.sr = (rng() & (SR_RB | SR_M | SR_Q | SR_S | SR_T)) | SR_MD | SR_IMASK;
+    state.ssr = (rng() & (SR_RB | SR_M | SR_Q | SR_S | SR_T)) | SR_MD | SR_BL | SR_IMASK;
+    state.spc = code_target();
+    state.gbr = rng();
+    // The general exception handler (VBR + 0x100) in mapped memory, the block engines decode it right after TRAPA
+    state.vbr = code_target() - 0x100;
+    state.sgr = rng();
+    state.dbr = rng();
+    state.mach = rng();
+    state.macl = rng();
+    state.pr = code_target();
+    state.pc = FUZZ_CODE_ADDRESS;
+    state.delay_pc = FUZZ_CODE_ADDRESS + 2;
+
+    // Double precision/pair moves only where the format asks for them
+    state.fpscr = (rng() & (1 | FPSCR_DN_BIT | FPSCR_FR_BIT));
+
+    if (name[0] == 'F' && (has(operands, "DR") || has(operands, "XD")))
+    {
+        state.fpscr |= (name == "FMOV") ? FPSCR_SZ_BIT : FPSCR_PR_BIT;
+    }
+
+    state.fpul = rng();
+
+    // Half of them plain numbers, the rest any bit pattern (NaNs, denormals...)
+    for (int bank = 0; bank < 2; bank++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            float number = static_cast<float>(static_cast<std::int64_t>(rng() % 2048) - 1024) / 8.0f;
+            state.fpr[bank][i] = (rng() & 1) ? std::bit_cast<std::uint32_t>(number) : static_cast<std::uint32_t>(rng());
+        }
+    }
+
+    std::uint32_t size = access_size(instr);
+    auto pointer = [&rng, size]() { return (FUZZ_DATA_ADDRESS + 1024 + static_cast<std::uint32_t>(rng() % 1024)) & ~(size - 1); };
+
+    if (m_pointer) set_gpr(state, field(instr, test.opcode, 'm'), pointer());
+    if (n_pointer) set_gpr(state, field(instr, test.opcode, 'n'), pointer());
+    if (absolute_target) set_gpr(state, (test.opcode >> 8) & 0xF, code_target());
+    if (relative_target) set_gpr(state, (test.opcode >> 8) & 0xF, code_target() - (FUZZ_CODE_ADDRESS + 4));
+
+    if (gbr_pointer)
+    {
+        state.gbr = FUZZ_DATA_ADDRESS;
+    }
+
+    if (indexed || has(operands, "(R0,GBR)"))
+    {
+        set_gpr(state, 0, static_cast<std::uint32_t>(rng() % 256) & ~(size - 1));
+    }
+
+    return test;
+}
+
+/*
+    Sets up memory and the CPU for the case, runs it and hashes the result.
+    False if the decoder stopped (Unimplemented opcode, unhandled access)
+*/
+bool Sh4_Fuzz::run_case(const Sh4_Fuzz_Case &test, std::uint64_t &state_hash, std::uint64_t &memory_hash, std::uint64_t &ns)
+{
+    Memory *memory = decoder->memory;
+    std::mt19937_64 rng(test.seed ^ 0xDA7ADA7ADA7ADA7Aull);
+
+    std::uint8_t *data = memory->ram_pointer(FUZZ_DATA_ADDRESS, FUZZ_DATA_SIZE);
+    std::uint8_t *code = memory->ram_pointer(FUZZ_CODE_ADDRESS, 4 + FUZZ_POOL_SIZE);
+
+    fill(data, FUZZ_DATA_SIZE, rng);
+    fill(code + 4, FUZZ_POOL_SIZE, rng);
+
+    code[0] = test.opcode & 0xFF;
+    code[1] = test.opcode >> 8;
+
+    // NOP, in case it's a delayed branch
+    code[2] = 0x09;
+    code[3] = 0x00;
+
+    memory->ram_written(FUZZ_DATA_ADDRESS, FUZZ_DATA_SIZE);
+    memory->ram_written(FUZZ_CODE_ADDRESS, 4 + FUZZ_POOL_SIZE);
+
+    decoder->cpu->load_state(test.state);
+    decoder->resync();
+
+    Sh4_Branch branch = sh4_branch_type(test.opcode);
+    std::uint32_t length = (branch == Sh4_Branch::Conditional_Delayed || branch == Sh4_Branch::Static_Delayed ||
+                            branch == Sh4_Branch::Indirect_Delayed) ? 2 : 1;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // A step can come back empty when the JIT had to flush its code cache
+    for (std::uint32_t executed = 0, tries = 0; executed < length && tries < 4 && decoder->status == Lucid_Status::Running; tries++)
+    {
+        executed += decoder->step();
+    }
+
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / length;
+
+    Sh4_Cpu_State result;
+    decoder->cpu->save_state(result);
+
+    state_hash = sh4_tcache_hash(&result, sizeof(result));
+    memory_hash = sh4_page_hash(data, FUZZ_DATA_SIZE);
+
+    return decoder->status == Lucid_Status::Running;
+}
+
+/*
+    Runs body in a child process with its output captured, the lines it writes to
+    the FILE it gets end up in results. False (And the reason in failure) if the
+    child didn't make it to the end
+*/
+bool Sh4_Fuzz::isolated(const std::function<void(std::FILE *)> &body, std::vector<std::string> &results, std::string &failure)
+{
+    int fds[2];
+    std::FILE *log = std::tmpfile();
+
+    if (!log || pipe(fds))
+    {
+        failure = "couldn't create a pipe";
+        return false;
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    pid_t child = fork();
+
+    if (child == 0)
+    {
+        close(fds[0]);
+        dup2(fileno(log), STDOUT_FILENO);
+        dup2(fileno(log), STDERR_FILENO);
+
+        // Stops are recorded in the decoder's status rather than ending the process
+        lucid_context.status = &decoder->status;
+
+        std::FILE *out = fdopen(fds[1], "w");
+        body(out);
+        std::fflush(out);
+        std::fflush(stdout);
+        std::cout.flush();
+
+        _exit(decoder->status == Lucid_Status::Running ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    std::FILE *in = fdopen(fds[0], "r");
+    char *line = nullptr;
+    std::size_t capacity = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &capacity, in)) > 0)
+    {
+        results.emplace_back(line, line[length - 1] == '\n' ? length - 1 : length);
+    }
+
+    free(line);
+    std::fclose(in);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    bool finished = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    if (!finished)
+    {
+        // First error the emulator printed
+        std::string output, text;
+        std::rewind(log);
+
+        char buffer[4096];
+        std::size_t read;
+
+        while ((read = std::fread(buffer, 1, sizeof(buffer), log)) > 0)
+        {
+            output.append(buffer, read);
+        }
+
+        std::istringstream lines(strip_colors(output));
+        failure.clear();
+
+        while (std::getline(lines, text))
+        {
+            if (has(text, "Unimplemented") || has(text, "Unhandled") || has(text, "rror"))
+            {
+                failure = text;
+                break;
+            }
+        }
+
+        if (failure.empty())
+        {
+            failure = WIFSIGNALED(status) ? format("killed by signal {}", WTERMSIG(status)) : format("exited with status {}", WEXITSTATUS(status));
+        }
+    }
+
+    std::fclose(log);
+    return finished;
+}
+
+bool Sh4_Fuzz::run()
+{
+    decoder->engine = Sh4_Engine::Interpreter;
+
+    std::ofstream trace;
+
+    if (!trace_path.empty())
+    {
+        trace.open(trace_path, std::ios::trunc);
+
+        if (!trace.is_open())
+        {
+            lucid_err() << BOLDRED << "Instruction test: Couldn't write " << trace_path << RESET << "\n";
+            return false;
+        }
+
+        trace << "# Lucid instruction trace: class, seed, opcode, state hash, memory hash\n";
+    }
+
+    std::uint32_t ran = 0, unimplemented = 0, failed = 0, slow = 0;
+
+    lucid_out() << BOLDBLUE << "Instruction test: " << classes.size() << " instruction classes, " << cases << " cases each (Seed 0x"
+              << format("{:X}", seed) << ")" << RESET << std::endl;
+
+    for (std::size_t k = 0; k < classes.size(); k++)
+    {
+        const Sh4_Instr_Class &instr = classes[k];
+        std::vector<std::string> results;
+        std::string failure;
+
+        bool finished = isolated([&](std::FILE *out)
+        {
+            std::vector<std::uint64_t> times;
+
+            for (std::uint32_t i = 0; i < cases; i++)
+            {
+                Sh4_Fuzz_Case test = generate(instr, sh4_tcache_hash(&i, sizeof(i), seed ^ (k * 0x9E3779B97F4A7C15ull)));
+                std::uint64_t state_hash, memory_hash, ns;
+
+                if (!run_case(test, state_hash, memory_hash, ns))
+                {
+                    return;
+                }
+
+                times.push_back(ns);
+
+                std::fprintf(out, "case %016llX %04X %016llX %016llX\n", static_cast<unsigned long long>(test.seed), test.opcode,
+                             static_cast<unsigned long long>(state_hash), static_cast<unsigned long long>(memory_hash));
+            }
+
+            std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+            std::fprintf(out, "time %llu\n", static_cast<unsigned long long>(times.empty() ? 0 : times[times.size() / 2]));
+        }, results, failure);
+
+        std::uint64_t median = 0;
+
+        for (const std::string &result : results)
+        {
+            if (result.starts_with("case "))
+            {
+                if (trace.is_open())
+                {
+                    std::istringstream fields(result.substr(5));
+                    std::string case_seed, opcode, state_hash, memory_hash;
+
+                    fields >> case_seed >> opcode >> state_hash >> memory_hash;
+                    trace << instr.key() << "\t" << case_seed << "\t" << opcode << "\t" << state_hash << "\t" << memory_hash << "\n";
+                }
+            }
+            else if (result.starts_with("time "))
+            {
+                median = std::stoull(result.substr(5));
+            }
+        }
+
+        std::string line = format("    {:<28} {}  ", instr.key(), instr.code);
+
+        if (!finished)
+        {
+            bool missing = has(failure, "Unimplemented");
+
+            (missing ? unimplemented : failed)++;
+            lucid_out() << line << (missing ? BOLDYELLOW "unimplemented" : BOLDRED "failed") << RESET << " (" << failure << ")\n";
+            continue;
+        }
+
+        ran++;
+
+        if (median > slow_threshold)
+        {
+            slow++;
+            lucid_out() << line << BOLDMAGENTA << format("{:>6}ns slow", median) << RESET << "\n";
+        }
+        else
+        {
+            lucid_out() << line << format("{:>6}ns", median) << "\n";
+        }
+    }
+
+    lucid_out() << BOLDWHITE << "Instruction test: " << ran << "/" << classes.size() << " classes ran, " << unimplemented << " unimplemented, "
+              << failed << " failed, " << slow << " slower than " << slow_threshold << "ns" << RESET << std::endl;
+
+    return !unimplemented && !failed;
+}
+
+/*
+    Replays a golden trace with the current engine. Mismatches are compared
+    against this build's interpreter to show which registers are off
+*/
+bool Sh4_Fuzz::check(const std::string &golden_path)
+{
+    std::ifstream golden(golden_path);
+
+    if (!golden.is_open())
+    {
+        lucid_err() << BOLDRED << "Instruction test: Couldn't open " << golden_path << RESET << "\n";
+        return false;
+    }
+
+    struct Golden_Case {
+        std::uint64_t seed;
+        std::uint16_t opcode;
+        std::uint64_t state_hash;
+        std::uint64_t memory_hash;
+    };
+
+    std::vector<std::string> order;
+    std::map<std::string, std::vector<Golden_Case>> traced;
+    std::string line;
+
+    while (std::getline(golden, line))
+    {
+        std::size_t tab = line.find('\t');
+
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string key = line.substr(0, tab);
+        std::istringstream fields(line.substr(tab + 1));
+        Golden_Case test = {};
+        unsigned int opcode = 0;
+
+        fields >> std::hex >> test.seed >> opcode >> test.state_hash >> test.memory_hash;
+        test.opcode = opcode;
+
+        if (!traced.count(key))
+        {
+            order.push_back(key);
+        }
+
+        traced[key].push_back(test);
+    }
+
+    Sh4_Engine engine = decoder->engine;
+    std::uint64_t total = 0, mismatches = 0, failed = 0;
+
+    for (const std::string &key : order)
+    {
+        // The table has rows that only differ in the encoding
+        std::vector<const Sh4_Instr_Class *> candidates;
+
+        for (const Sh4_Instr_Class &instr : classes)
+        {
+            if (instr.key() == key)
+            {
+                candidates.push_back(&instr);
+            }
+        }
+
+        if (candidates.empty())
+        {
+            lucid_out() << BOLDMAGENTA << "    " << key << ": not in the instruction table anymore, skipped" << RESET << "\n";
+            continue;
+        }
+
+        const std::vector<Golden_Case> &tests = traced[key];
+        std::vector<std::string> results;
+        std::string failure;
+
+        bool finished = isolated([&](std::FILE *out)
+        {
+            for (const Golden_Case &expected : tests)
+            {
+                const Sh4_Instr_Class *instr = candidates.front();
+
+                for (const Sh4_Instr_Class *candidate : candidates)
+                {
+                    if ((expected.opcode & candidate->fixed_mask) == candidate->fixed_bits)
+                    {
+                        instr = candidate;
+                    }
+                }
+
+                Sh4_Fuzz_Case test = generate(*instr, expected.seed);
+                std::uint64_t state_hash, memory_hash, ns;
+
+                if (test.opcode != expected.opcode)
+                {
+                    std::fprintf(out, "mismatch %04X generated as %04X (Table changed?)\n", expected.opcode, test.opcode);
+                    continue;
+                }
+
+                if (!run_case(test, state_hash, memory_hash, ns))
+                {
+                    return;
+                }
+
+                if (state_hash == expected.state_hash && memory_hash == expected.memory_hash)
+                {
+                    std::fprintf(out, "ok\n");
+                    continue;
+                }
+
+                Sh4_Cpu_State result, reference;
+                decoder->cpu->save_state(result);
+
+                // Same case in the interpreter (The child is thrown away afterwards)
+                decoder->engine = Sh4_Engine::Interpreter;
+                run_case(test, state_hash, memory_hash, ns);
+                decoder->cpu->save_state(reference);
+                decoder->engine = engine;
+
+                std::string details;
+
+                for (const Sh4_Register_Diff &diff : sh4_compare_state(result, reference))
+                {
+                    details += format(" {}: 0x{:08X} (Interpreter: 0x{:08X})", diff.name, diff.value, diff.other);
+                }
+
+                if (details.empty())
+                {
+                    details = (state_hash == expected.state_hash) ? " data area differs from the trace" : " same as this build's interpreter";
+                }
+
+                std::fprintf(out, "mismatch %04X seed %016llX:%s\n", test.opcode, static_cast<unsigned long long>(test.seed), details.c_str());
+            }
+        }, results, failure);
+
+        std::uint32_t shown = 0;
+
+        for (const std::string &result : results)
+        {
+            total++;
+
+            if (result.starts_with("mismatch "))
+            {
+                mismatches++;
+
+                if (shown++ < 4)
+                {
+                    lucid_out() << BOLDRED << "    " << key << ": " << RESET << result.substr(9) << "\n";
+                }
+            }
+        }
+
+        if (!finished)
+        {
+            failed++;
+            lucid_out() << BOLDRED << "    " << key << ": failed after " << results.size() << " cases" << RESET << " (" << failure << ")\n";
+        }
+    }
+
+    lucid_out() << BOLDWHITE << "Instruction test: " << total << " cases replayed, " << mismatches << " mismatches, " << failed
+              << " classes failed" << RESET << std::endl;
+
+    return !mismatches && !failed;
+}
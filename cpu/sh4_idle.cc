@@ -0,0 +1,257 @@
+#include <cpu/sh4_idle.hh>
+
+namespace {
+
+/*
+    Instructions that only read memory and/or write general registers and the
+    T bit (No stores, no control/system register writes, no branches)
+*/
+bool is_side_effect_free(std::uint16_t opcode)
+{
+    switch ((opcode >> 12) & 0xF)
+    {
+        case 0b0000:
+            // nop
+            return opcode == 0x0009;
+
+        case 0b0010:
+            // tst, and, xor, or
+            return (opcode & 0x000F) >= 0b1000 && (opcode & 0x000F) <= 0b1011;
+
+        case 0b0011:
+            // cmp/eq, cmp/hs, cmp/ge, cmp/hi, cmp/gt, sub, add
+            switch (opcode & 0x000F)
+            {
+                case 0b0000: case 0b0010: case 0b0011: case 0b0110:
+                case 0b0111: case 0b1000: case 0b1100:
+                    return true;
+                default:
+                    return false;
+            }
+
+        case 0b0100:
+            // shll, shlr, shll2, shlr2, shll8, shlr8, shll16, shlr16, dt, cmp/pz, cmp/pl
+            switch (opcode & 0x00FF)
+            {
+                case 0b00000000: case 0b00000001: case 0b00001000: case 0b00001001:
+                case 0b00011000: case 0b00011001: case 0b00101000: case 0b00101001:
+                case 0b00010000: case 0b00010001: case 0b00010101:
+                    return true;
+                default:
+                    return false;
+            }
+
+        case 0b0101:
+            // mov.l @(disp,Rm),Rn
+            return true;
+
+        case 0b0110:
+            // mov.x @Rm,Rn, mov, not, swap.x, extu.x, exts.x (No post-increment)
+            switch (opcode & 0x000F)
+            {
+                case 0b0000: case 0b0001: case 0b0010: case 0b0011:
+                case 0b0111: case 0b1000: case 0b1001: case 0b1100:
+                case 0b1101: case 0b1110: case 0b1111:
+                    return true;
+                default:
+                    return false;
+            }
+
+        case 0b0111:
+            // add #imm,Rn
+            return true;
+
+        case 0b1000:
+            // mov.b/mov.w @(disp,Rm),R0, cmp/eq #imm,R0
+            switch ((opcode & 0x0F00) >> 8)
+            {
+                case 0b0100: case 0b0101: case 0b1000:
+                    return true;
+                default:
+                    return false;
+            }
+
+        case 0b1001:
+        case 0b1101:
+        case 0b1110:
+            // mov.w/mov.l @(disp,PC),Rn, mov #imm,Rn
+            return true;
+
+        case 0b1100:
+            // mov.x @(disp,GBR),R0, mova, tst/and/xor/or #imm,R0
+            switch ((opcode & 0x0F00) >> 8)
+            {
+                case 0b0100: case 0b0101: case 0b0110: case 0b0111:
+                case 0b1000: case 0b1001: case 0b1010: case 0b1011:
+                    return true;
+                default:
+                    return false;
+            }
+
+        default:
+            return false;
+    }
+}
+
+/*
+    Copy/Fill loops, the body (Branch excluded) may only contain:
+
+    * One "dt Rc"
+    * One "mov.l Rv,@Rd" or "mov.l Rv,@-Rd"
+    * For copies, one "mov.l @Rs+,Rv" before the store
+    * "add #imm,Rd" and nops
+
+    The registers have to be distinct so that each one plays a single role, and
+    Rd has to move by exactly one longword per iteration.
+*/
+bool analyze_bulk_loop(Sh4_Cpu *cpu, Memory *memory, std::uint32_t target, std::uint32_t branch_pc, Sh4_Idle_Loop &loop)
+{
+    if ((memory->read<std::uint16_t>(branch_pc, cpu) & 0xFF00) != 0x8B00)
+    {
+        return false;
+    }
+
+    int counter = -1, source = -1, loaded = -1, destination = -1, value = -1;
+
+    // First pass: find the store, its register decides what "add #imm" may touch
+    for (std::uint32_t address = target; address < branch_pc; address += 2)
+    {
+        std::uint16_t opcode = memory->read<std::uint16_t>(address, cpu);
+
+        if ((opcode & 0xF00F) == 0x2002 || (opcode & 0xF00F) == 0x2006)
+        {
+            if (destination != -1)
+            {
+                return false;
+            }
+
+            destination = (opcode >> 8) & 0xF;
+            value = (opcode >> 4) & 0xF;
+        }
+    }
+
+    if (destination == -1)
+    {
+        return false;
+    }
+
+    std::int32_t offset = 0, store_offset = 0;
+    bool stored = false;
+
+    for (std::uint32_t address = target; address < branch_pc; address += 2)
+    {
+        std::uint16_t opcode = memory->read<std::uint16_t>(address, cpu);
+        int n = (opcode >> 8) & 0xF, m = (opcode >> 4) & 0xF;
+
+        if ((opcode & 0xF0FF) == 0x4010 && counter == -1)
+        {
+            counter = n;
+        }
+        else if ((opcode & 0xF00F) == 0x6006 && source == -1 && !stored)
+        {
+            source = m;
+            loaded = n;
+        }
+        else if ((opcode & 0xF00F) == 0x2002)
+        {
+            store_offset = offset;
+            stored = true;
+        }
+        else if ((opcode & 0xF00F) == 0x2006)
+        {
+            offset -= 4;
+            store_offset = offset;
+            stored = true;
+        }
+        else if ((opcode & 0xF000) == 0x7000 && n == destination)
+        {
+            offset += static_cast<std::int8_t>(opcode & 0xFF);
+        }
+        else if (opcode != 0x0009)
+        {
+            return false;
+        }
+    }
+
+    if (counter == -1 || (offset != 4 && offset != -4) || counter == destination || counter == value)
+    {
+        return false;
+    }
+
+    if (source != -1)
+    {
+        // Copy: the stored value has to be the one just loaded
+        if (loaded != value || source == destination || source == counter || source == loaded)
+        {
+            return false;
+        }
+
+        loop.kind = Sh4_Idle_Loop::Kind::Copy;
+        loop.source = source;
+    }
+    else
+    {
+        if (value == destination)
+        {
+            return false;
+        }
+
+        loop.kind = Sh4_Idle_Loop::Kind::Fill;
+    }
+
+    loop.counter = counter;
+    loop.destination = destination;
+    loop.value = value;
+    loop.destination_step = offset;
+    loop.store_offset = store_offset;
+
+    return true;
+}
+
+}
+
+/*
+    Classifies the loop [target, branch_pc] closed by a (taken) backwards BT/BF
+*/
+Sh4_Idle_Loop sh4_analyze_idle_loop(Sh4_Cpu *cpu, Memory *memory, std::uint32_t target, std::uint32_t branch_pc)
+{
+    Sh4_Idle_Loop loop = {};
+    loop.kind = Sh4_Idle_Loop::Kind::None;
+    loop.length = ((branch_pc - target) >> 1) + 1;
+
+    if (target > branch_pc || loop.length > IDLE_LOOP_MAX_LENGTH)
+    {
+        return loop;
+    }
+
+    std::uint16_t branch = memory->read<std::uint16_t>(branch_pc, cpu);
+
+    // dt rN; bf <dt>
+    if (loop.length == 2 && (branch & 0xFF00) == 0x8B00)
+    {
+        std::uint16_t opcode = memory->read<std::uint16_t>(target, cpu);
+
+        if ((opcode & 0xF0FF) == 0x4010)
+        {
+            loop.kind = Sh4_Idle_Loop::Kind::Countdown;
+            loop.counter = (opcode >> 8) & 0xF;
+            return loop;
+        }
+    }
+
+    if (analyze_bulk_loop(cpu, memory, target, branch_pc, loop))
+    {
+        return loop;
+    }
+
+    for (std::uint32_t address = target; address < branch_pc; address += 2)
+    {
+        if (!is_side_effect_free(memory->read<std::uint16_t>(address, cpu)))
+        {
+            return loop;
+        }
+    }
+
+    loop.kind = Sh4_Idle_Loop::Kind::Poll;
+    return loop;
+}
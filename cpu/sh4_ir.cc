@@ -0,0 +1,751 @@
+#include <cpu/sh4_ir.hh>
+#include <cpu/sh4_block.hh>
+#include <algorithm>
+#include <array>
+#include <sstream>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+namespace {
+
+class Ir_Builder {
+
+public:
+
+    Sh4_Ir_Block &block;
+    std::uint32_t pc;
+
+    Ir_Builder(Sh4_Ir_Block &block_) : block(block_)
+    {
+        pc = 0;
+    }
+
+    std::uint32_t emit(Sh4_Ir_Op op, std::uint32_t a = IR_NO_VALUE, std::uint32_t b = IR_NO_VALUE, std::uint32_t imm = 0, bool has_dst = true)
+    {
+        std::uint32_t dst = has_dst ? block.value_count++ : IR_NO_VALUE;
+        block.insts.push_back({op, 0, dst, a, b, imm, pc});
+        return dst;
+    }
+
+    std::uint32_t constant(std::uint32_t value)
+    {
+        return emit(Sh4_Ir_Op::Const, IR_NO_VALUE, IR_NO_VALUE, value);
+    }
+
+    std::uint32_t reg(std::uint8_t index)
+    {
+        return emit(Sh4_Ir_Op::Load_Reg, IR_NO_VALUE, IR_NO_VALUE, index);
+    }
+
+    void set_reg(std::uint8_t index, std::uint32_t value)
+    {
+        emit(Sh4_Ir_Op::Store_Reg, value, IR_NO_VALUE, index, false);
+    }
+
+    void set_t(std::uint32_t value)
+    {
+        emit(Sh4_Ir_Op::Store_T, value, IR_NO_VALUE, 0, false);
+    }
+
+    std::uint32_t op(Sh4_Ir_Op op_, std::uint32_t a, std::uint32_t b = IR_NO_VALUE)
+    {
+        return emit(op_, a, b);
+    }
+
+    void store(Sh4_Ir_Op op_, std::uint32_t address, std::uint32_t value)
+    {
+        emit(op_, address, value, 0, false);
+    }
+
+    void interpret(std::uint16_t opcode, bool delay_slot)
+    {
+        emit(Sh4_Ir_Op::Interpret, IR_NO_VALUE, IR_NO_VALUE, opcode, false);
+        block.insts.back().flags = delay_slot ? 0 : IR_FLAG_SYNC_PC;
+    }
+};
+
+/*
+    Mirrors Sh4_Decode::parse_opcode for the instructions it can express,
+    returns false for anything that has to be interpreted
+*/
+bool lower(Ir_Builder &ir, std::uint16_t opcode, std::uint32_t pc, Sh4_Cpu *cpu, Memory *memory)
+{
+    std::int8_t imm = ((std::int8_t) (opcode & 0xFF));
+    std::uint8_t nnnn = ((opcode & 0x0F00) >> 8);
+    std::uint8_t mmmm = ((opcode & 0x00F0) >> 4);
+    std::uint8_t dddd = (std::uint8_t) ((opcode & 0x000F) >> 0);
+    std::uint16_t dddddddd = (std::uint16_t) ((opcode & 0x00FF) >> 0);
+
+    switch ((opcode >> 12) & 0xF)
+    {
+        case 0b0000:
+            // nop
+            return opcode == 0x0009;
+
+        case 0b0001:
+            // mov.l Rm,@(disp,Rn)
+            ir.store(Sh4_Ir_Op::Store_32, ir.op(Sh4_Ir_Op::Add, ir.constant(dddd << 2), ir.reg(nnnn)), ir.reg(mmmm));
+            return true;
+
+        case 0b0010:
+            switch (opcode & 0x000F)
+            {
+                case 0b0000:
+                    ir.store(Sh4_Ir_Op::Store_8, ir.reg(nnnn), ir.reg(mmmm));
+                    return true;
+
+                case 0b0001:
+                    ir.store(Sh4_Ir_Op::Store_16, ir.reg(nnnn), ir.reg(mmmm));
+                    return true;
+
+                case 0b0010:
+                    ir.store(Sh4_Ir_Op::Store_32, ir.reg(nnnn), ir.reg(mmmm));
+                    return true;
+
+                case 0b0101:
+                {
+                    // mov.w Rm,@-Rn
+                    std::uint32_t src = ir.reg(mmmm);
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Sub, ir.reg(nnnn), ir.constant(2)));
+                    ir.store(Sh4_Ir_Op::Store_16, ir.reg(nnnn), src);
+                    return true;
+                }
+
+                case 0b0110:
+                {
+                    // mov.l Rm,@-Rn
+                    std::uint32_t src = ir.reg(mmmm);
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Sub, ir.reg(nnnn), ir.constant(4)));
+                    ir.store(Sh4_Ir_Op::Store_32, ir.reg(nnnn), src);
+                    return true;
+                }
+
+                case 0b1000:
+                    ir.set_t(ir.op(Sh4_Ir_Op::Test, ir.reg(mmmm), ir.reg(nnnn)));
+                    return true;
+
+                case 0b1010:
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Xor, ir.reg(mmmm), ir.reg(nnnn)));
+                    return true;
+            }
+            return false;
+
+        case 0b0011:
+            if ((opcode & 0x000F) == 0b0110)
+            {
+                // cmp/hi Rm,Rn
+                ir.set_t(ir.op(Sh4_Ir_Op::Cmp_Hi, ir.reg(nnnn), ir.reg(mmmm)));
+                return true;
+            }
+            return false;
+
+        case 0b0100:
+            switch (opcode & 0x00FF)
+            {
+                case 0b00000001:
+                    // shlr
+                    ir.set_t(ir.op(Sh4_Ir_Op::And, ir.reg(nnnn), ir.constant(1)));
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Shr, ir.reg(nnnn), ir.constant(1)));
+                    return true;
+
+                case 0b00000101:
+                {
+                    // rotr
+                    ir.set_t(ir.op(Sh4_Ir_Op::And, ir.reg(nnnn), ir.constant(1)));
+                    std::uint32_t value = ir.reg(nnnn);
+                    std::uint32_t low = ir.op(Sh4_Ir_Op::Shr, value, ir.constant(1));
+                    std::uint32_t high = ir.op(Sh4_Ir_Op::Shl, value, ir.constant(31));
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Or, low, high));
+                    return true;
+                }
+
+                case 0b00001001:
+                    // shlr2
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Shr, ir.reg(nnnn), ir.constant(2)));
+                    return true;
+
+                case 0b00010000:
+                {
+                    // dt
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Sub, ir.reg(nnnn), ir.constant(1)));
+                    ir.set_t(ir.op(Sh4_Ir_Op::Cmp_Eq, ir.reg(nnnn), ir.constant(0)));
+                    return true;
+                }
+
+                case 0b00011000:
+                    // shll8
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Shl, ir.reg(nnnn), ir.constant(8)));
+                    return true;
+
+                case 0b00100001:
+                    // shar
+                    ir.set_t(ir.op(Sh4_Ir_Op::And, ir.reg(nnnn), ir.constant(1)));
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Sar, ir.reg(nnnn), ir.constant(1)));
+                    return true;
+
+                case 0b00101000:
+                    // shll16
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Shl, ir.reg(nnnn), ir.constant(16)));
+                    return true;
+            }
+            return false;
+
+        case 0b0101:
+            // mov.l @(disp,Rm),Rn
+            ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Load_32, ir.op(Sh4_Ir_Op::Add, ir.reg(mmmm), ir.constant(dddd << 2))));
+            return true;
+
+        case 0b0110:
+            switch (opcode & 0x000F)
+            {
+                case 0b0010:
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Load_32, ir.reg(mmmm)));
+                    return true;
+
+                case 0b0011:
+                    ir.set_reg(nnnn, ir.reg(mmmm));
+                    return true;
+
+                case 0b0110:
+                    // mov.l @Rm+,Rn
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Load_32, ir.reg(mmmm)));
+
+                    // No increment with m == n, the loaded value is kept
+                    if (mmmm != nnnn)
+                    {
+                        ir.set_reg(mmmm, ir.op(Sh4_Ir_Op::Add, ir.reg(mmmm), ir.constant(4)));
+                    }
+                    return true;
+
+                case 0b1000:
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Swap_B, ir.reg(mmmm)));
+                    return true;
+
+                case 0b1001:
+                    ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Swap_W, ir.reg(mmmm)));
+                    return true;
+            }
+            return false;
+
+        case 0b0111:
+            // add #imm,Rn
+            ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Add, ir.reg(nnnn), ir.constant(static_cast<std::uint32_t>(static_cast<std::int32_t>(imm)))));
+            return true;
+
+        case 0b1000:
+            if (((opcode & 0x0F00) >> 8) == 0b0001)
+            {
+                // mov.w R0,@(disp,Rm)
+                std::uint32_t address = ir.op(Sh4_Ir_Op::Add, ir.reg(mmmm), ir.constant(dddd << 1));
+                ir.store(Sh4_Ir_Op::Store_16, address, ir.op(Sh4_Ir_Op::And, ir.reg(0), ir.constant(0xFFFF)));
+                return true;
+            }
+            return false;
+
+        case 0b1100:
+            switch ((opcode & 0x0F00) >> 8)
+            {
+                case 0b0111:
+                    // mova @(disp,PC),R0
+                    ir.set_reg(0, ir.constant((pc & 0xFFFFFFFC) + (dddddddd << 2) + 4));
+                    return true;
+
+                case 0b1011:
+                    // or #imm,R0
+                    ir.set_reg(0, ir.op(Sh4_Ir_Op::Or, ir.reg(0), ir.constant(static_cast<std::uint8_t>(imm))));
+                    return true;
+            }
+            return false;
+
+        case 0b1101:
+        {
+            // mov.l @(disp,PC),Rn
+            std::uint32_t address = ((dddddddd << 2) + 4) + (pc & 0xFFFFFFFC);
+
+            // Literal pools in the Boot ROM can't change, fold them
+            if ((address & 0x1FFFFFFF) <= 0x001FFFFC)
+            {
+                ir.set_reg(nnnn, ir.constant(memory->read<std::uint32_t>(address, cpu)));
+            }
+            else
+            {
+                ir.set_reg(nnnn, ir.op(Sh4_Ir_Op::Load_32, ir.constant(address)));
+            }
+            return true;
+        }
+
+        case 0b1110:
+            // mov #imm,Rn
+            ir.set_reg(nnnn, ir.constant(static_cast<std::uint32_t>(static_cast<std::int32_t>(imm))));
+            return true;
+    }
+
+    return false;
+}
+
+bool is_delayed(std::uint16_t opcode)
+{
+    Sh4_Branch branch = sh4_branch_type(opcode);
+
+    return branch == Sh4_Branch::Conditional_Delayed || branch == Sh4_Branch::Static_Delayed ||
+           branch == Sh4_Branch::Indirect_Delayed;
+}
+
+bool is_pure(Sh4_Ir_Op op)
+{
+    switch (op)
+    {
+        case Sh4_Ir_Op::Const: case Sh4_Ir_Op::Load_Reg: case Sh4_Ir_Op::Load_T:
+        case Sh4_Ir_Op::Add: case Sh4_Ir_Op::Sub: case Sh4_Ir_Op::And: case Sh4_Ir_Op::Or:
+        case Sh4_Ir_Op::Xor: case Sh4_Ir_Op::Shl: case Sh4_Ir_Op::Shr: case Sh4_Ir_Op::Sar:
+        case Sh4_Ir_Op::Swap_B: case Sh4_Ir_Op::Swap_W: case Sh4_Ir_Op::Cmp_Eq:
+        case Sh4_Ir_Op::Cmp_Hi: case Sh4_Ir_Op::Test:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+    Operations after which guest state has to be exact (They may read it, or
+    fault and report it)
+*/
+bool is_barrier(Sh4_Ir_Op op)
+{
+    switch (op)
+    {
+        case Sh4_Ir_Op::Load_32: case Sh4_Ir_Op::Store_8: case Sh4_Ir_Op::Store_16:
+        case Sh4_Ir_Op::Store_32: case Sh4_Ir_Op::Interpret: case Sh4_Ir_Op::Exit:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool fold(Sh4_Ir_Op op, std::uint32_t a, std::uint32_t b, std::uint32_t &result)
+{
+    switch (op)
+    {
+        case Sh4_Ir_Op::Add: result = a + b; return true;
+        case Sh4_Ir_Op::Sub: result = a - b; return true;
+        case Sh4_Ir_Op::And: result = a & b; return true;
+        case Sh4_Ir_Op::Or: result = a | b; return true;
+        case Sh4_Ir_Op::Xor: result = a ^ b; return true;
+        case Sh4_Ir_Op::Shl: result = a << (b & 31); return true;
+        case Sh4_Ir_Op::Shr: result = a >> (b & 31); return true;
+        case Sh4_Ir_Op::Sar: result = static_cast<std::uint32_t>(static_cast<std::int32_t>(a) >> (b & 31)); return true;
+        case Sh4_Ir_Op::Swap_B: result = (a & 0xFFFF0000) | ((a & 0x0000FF00) >> 8) | ((a & 0x000000FF) << 8); return true;
+        case Sh4_Ir_Op::Swap_W: result = (a >> 16) | (a << 16); return true;
+        case Sh4_Ir_Op::Cmp_Eq: result = (a == b) ? 1 : 0; return true;
+        case Sh4_Ir_Op::Cmp_Hi: result = (a > b) ? 1 : 0; return true;
+        case Sh4_Ir_Op::Test: result = (a & b) ? 0 : 1; return true;
+        default: return false;
+    }
+}
+
+const char *op_name(Sh4_Ir_Op op)
+{
+    switch (op)
+    {
+        case Sh4_Ir_Op::Nop: return "nop";
+        case Sh4_Ir_Op::Const: return "const";
+        case Sh4_Ir_Op::Load_Reg: return "load_reg";
+        case Sh4_Ir_Op::Store_Reg: return "store_reg";
+        case Sh4_Ir_Op::Load_T: return "load_t";
+        case Sh4_Ir_Op::Store_T: return "store_t";
+        case Sh4_Ir_Op::Add: return "add";
+        case Sh4_Ir_Op::Sub: return "sub";
+        case Sh4_Ir_Op::And: return "and";
+        case Sh4_Ir_Op::Or: return "or";
+        case Sh4_Ir_Op::Xor: return "xor";
+        case Sh4_Ir_Op::Shl: return "shl";
+        case Sh4_Ir_Op::Shr: return "shr";
+        case Sh4_Ir_Op::Sar: return "sar";
+        case Sh4_Ir_Op::Swap_B: return "swap.b";
+        case Sh4_Ir_Op::Swap_W: return "swap.w";
+        case Sh4_Ir_Op::Cmp_Eq: return "cmp_eq";
+        case Sh4_Ir_Op::Cmp_Hi: return "cmp_hi";
+        case Sh4_Ir_Op::Test: return "test";
+        case Sh4_Ir_Op::Load_32: return "load32";
+        case Sh4_Ir_Op::Store_8: return "store8";
+        case Sh4_Ir_Op::Store_16: return "store16";
+        case Sh4_Ir_Op::Store_32: return "store32";
+        case Sh4_Ir_Op::Interpret: return "interpret";
+        case Sh4_Ir_Op::Exit: return "exit";
+    }
+
+    return "?";
+}
+
+}
+
+Sh4_Ir_Block sh4_ir_build(std::uint32_t start_pc, const std::vector<std::uint16_t> &opcodes, Sh4_Cpu *cpu, Memory *memory)
+{
+    Sh4_Ir_Block block;
+    block.start_pc = start_pc;
+    block.end_pc = start_pc + (opcodes.size() << 1);
+    block.value_count = 0;
+
+    Ir_Builder ir(block);
+
+    bool delay_slot = false;
+    bool lowered = false;
+
+    for (std::size_t i = 0; i < opcodes.size(); i++)
+    {
+        std::uint16_t opcode = opcodes[i];
+        ir.pc = start_pc + (i << 1);
+
+        // Branches and their delay slots always go through the interpreter, it owns PC/delay PC
+        lowered = !delay_slot && sh4_branch_type(opcode) == Sh4_Branch::None && lower(ir, opcode, ir.pc, cpu, memory);
+
+        if (!lowered)
+        {
+            ir.interpret(opcode, delay_slot);
+        }
+
+        delay_slot = is_delayed(opcode);
+    }
+
+    // The interpreter already moved PC if the block ended with an interpreted instruction
+    if (lowered)
+    {
+        ir.pc = block.end_pc;
+        ir.emit(Sh4_Ir_Op::Exit, IR_NO_VALUE, IR_NO_VALUE, block.end_pc, false);
+    }
+
+    return block;
+}
+
+void sh4_ir_optimize(Sh4_Ir_Block &block, Sh4_Ir_Stats &stats)
+{
+    auto &insts = block.insts;
+
+    // Value id -> defining instruction
+    std::vector<std::uint32_t> definition(block.value_count, IR_NO_VALUE);
+
+    // Value id -> value that replaces it
+    std::vector<std::uint32_t> alias(block.value_count);
+
+    for (std::uint32_t i = 0; i < block.value_count; i++)
+    {
+        alias[i] = i;
+    }
+
+    auto resolve = [&alias](std::uint32_t value) {
+        return (value == IR_NO_VALUE) ? value : alias[value];
+    };
+
+    /*
+        Forward pass: register forwarding, memory load elimination and constant
+        folding
+    */
+    std::array<std::uint32_t, 16> known_reg;
+    std::uint32_t known_t = IR_NO_VALUE;
+    known_reg.fill(IR_NO_VALUE);
+
+    // Memory loads since the last store/Interpret, by address (Base value + displacement)
+    struct Known_Load {
+        std::uint32_t base;
+        std::uint32_t displacement;
+        std::uint32_t value;
+    };
+
+    std::vector<Known_Load> known_loads;
+
+    // Constant addresses have no base, anything that isn't base + constant is its own base
+    auto split_address = [&insts, &definition](std::uint32_t address, std::uint32_t &base, std::uint32_t &displacement) {
+        const Sh4_Ir_Inst &def = insts[definition[address]];
+
+        base = address;
+        displacement = 0;
+
+        if (def.op == Sh4_Ir_Op::Const)
+        {
+            base = IR_NO_VALUE;
+            displacement = def.imm;
+        }
+        else if (def.op == Sh4_Ir_Op::Add && insts[definition[def.a]].op == Sh4_Ir_Op::Const)
+        {
+            base = def.b;
+            displacement = insts[definition[def.a]].imm;
+        }
+        else if (def.op == Sh4_Ir_Op::Add && insts[definition[def.b]].op == Sh4_Ir_Op::Const)
+        {
+            base = def.a;
+            displacement = insts[definition[def.b]].imm;
+        }
+    };
+
+    for (std::uint32_t i = 0; i < insts.size(); i++)
+    {
+        Sh4_Ir_Inst &inst = insts[i];
+
+        inst.a = resolve(inst.a);
+        inst.b = resolve(inst.b);
+
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Load_Reg:
+                if (known_reg[inst.imm] != IR_NO_VALUE)
+                {
+                    alias[inst.dst] = known_reg[inst.imm];
+                    inst.op = Sh4_Ir_Op::Nop;
+                    stats.forwarded_loads++;
+                    continue;
+                }
+                known_reg[inst.imm] = inst.dst;
+                break;
+
+            case Sh4_Ir_Op::Store_Reg:
+                known_reg[inst.imm] = inst.a;
+                break;
+
+            case Sh4_Ir_Op::Load_T:
+                if (known_t != IR_NO_VALUE)
+                {
+                    alias[inst.dst] = known_t;
+                    inst.op = Sh4_Ir_Op::Nop;
+                    stats.forwarded_loads++;
+                    continue;
+                }
+                known_t = inst.dst;
+                break;
+
+            case Sh4_Ir_Op::Store_T:
+                known_t = inst.a;
+                break;
+
+            case Sh4_Ir_Op::Load_32:
+            {
+                std::uint32_t base, displacement;
+                split_address(inst.a, base, displacement);
+
+                auto known = std::find_if(known_loads.begin(), known_loads.end(), [&](const Known_Load &load) {
+                    return load.base == base && load.displacement == displacement;
+                });
+
+                if (known != known_loads.end())
+                {
+                    alias[inst.dst] = known->value;
+                    inst.op = Sh4_Ir_Op::Nop;
+                    stats.redundant_memory_loads++;
+                    continue;
+                }
+
+                known_loads.push_back({base, displacement, inst.dst});
+                break;
+            }
+
+            case Sh4_Ir_Op::Store_8:
+            case Sh4_Ir_Op::Store_16:
+            case Sh4_Ir_Op::Store_32:
+                // May overlap any of them under a different base
+                known_loads.clear();
+                break;
+
+            case Sh4_Ir_Op::Interpret:
+                // Anything could have changed
+                known_reg.fill(IR_NO_VALUE);
+                known_t = IR_NO_VALUE;
+                known_loads.clear();
+                break;
+
+            default:
+            {
+                std::uint32_t result;
+                bool a_const = inst.a != IR_NO_VALUE && insts[definition[inst.a]].op == Sh4_Ir_Op::Const;
+                bool b_const = inst.b == IR_NO_VALUE || insts[definition[inst.b]].op == Sh4_Ir_Op::Const;
+
+                if (is_pure(inst.op) && a_const && b_const &&
+                    fold(inst.op, insts[definition[inst.a]].imm, (inst.b == IR_NO_VALUE) ? 0 : insts[definition[inst.b]].imm, result))
+                {
+                    inst.op = Sh4_Ir_Op::Const;
+                    inst.imm = result;
+                    inst.a = IR_NO_VALUE;
+                    inst.b = IR_NO_VALUE;
+                    stats.folded_constants++;
+                }
+                break;
+            }
+        }
+
+        if (inst.dst != IR_NO_VALUE)
+        {
+            definition[inst.dst] = i;
+        }
+    }
+
+    /*
+        Backward pass: dead register/T stores (Overwritten before anything can
+        observe them) and unused values
+    */
+    std::array<bool, 16> reg_live;
+    bool t_live = true;
+    reg_live.fill(true);
+
+    std::vector<bool> used(block.value_count, false);
+
+    for (std::size_t i = insts.size(); i-- > 0;)
+    {
+        Sh4_Ir_Inst &inst = insts[i];
+
+        if (is_barrier(inst.op))
+        {
+            reg_live.fill(true);
+            t_live = true;
+        }
+
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Store_Reg:
+                if (!reg_live[inst.imm])
+                {
+                    inst.op = Sh4_Ir_Op::Nop;
+                    stats.dead_stores++;
+                    continue;
+                }
+                reg_live[inst.imm] = false;
+                break;
+
+            case Sh4_Ir_Op::Store_T:
+                if (!t_live)
+                {
+                    inst.op = Sh4_Ir_Op::Nop;
+                    stats.dead_flags++;
+                    continue;
+                }
+                t_live = false;
+                break;
+
+            case Sh4_Ir_Op::Load_Reg:
+                reg_live[inst.imm] = true;
+                break;
+
+            case Sh4_Ir_Op::Load_T:
+                t_live = true;
+                break;
+
+            default:
+                break;
+        }
+
+        if (is_pure(inst.op) && !used[inst.dst])
+        {
+            inst.op = Sh4_Ir_Op::Nop;
+            stats.dead_values++;
+            continue;
+        }
+
+        if (inst.a != IR_NO_VALUE)
+        {
+            used[inst.a] = true;
+        }
+
+        if (inst.b != IR_NO_VALUE)
+        {
+            used[inst.b] = true;
+        }
+    }
+
+    std::erase_if(insts, [](const Sh4_Ir_Inst &inst) { return inst.op == Sh4_Ir_Op::Nop; });
+}
+
+/*
+    One instruction per line:
+
+    block 0xA0000000-0xA0000010
+      [A0000000] %0 = const 0x00000064
+      [A0000000] store_reg r1, %0
+      [A0000008] interpret 0x8BFC (sync pc)
+*/
+std::string sh4_ir_dump(const Sh4_Ir_Block &block)
+{
+    std::ostringstream out;
+
+    out << "block 0x" << format("{:08X}", block.start_pc) << "-0x" << format("{:08X}", block.end_pc) << "\n";
+
+    for (const Sh4_Ir_Inst &inst : block.insts)
+    {
+        out << "  [" << format("{:08X}", inst.pc) << "] ";
+
+        if (inst.dst != IR_NO_VALUE)
+        {
+            out << "%" << inst.dst << " = ";
+        }
+
+        out << op_name(inst.op);
+
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Const:
+            case Sh4_Ir_Op::Exit:
+                out << " 0x" << format("{:08X}", inst.imm);
+                break;
+
+            case Sh4_Ir_Op::Load_Reg:
+                out << " r" << inst.imm;
+                break;
+
+            case Sh4_Ir_Op::Store_Reg:
+                out << " r" << inst.imm << ", %" << inst.a;
+                break;
+
+            case Sh4_Ir_Op::Interpret:
+                out << " 0x" << format("{:04X}", inst.imm) << ((inst.flags & IR_FLAG_SYNC_PC) ? " (sync pc)" : " (delay slot)");
+                break;
+
+            default:
+                if (inst.a != IR_NO_VALUE)
+                {
+                    out << " %" << inst.a;
+                }
+
+                if (inst.b != IR_NO_VALUE)
+                {
+                    out << ", %" << inst.b;
+                }
+                break;
+        }
+
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+/*
+    Guest register/T bit accesses one run of the block makes (Not counting the
+    ones done by Interpret operations), SR.T updates are read-modify-write
+*/
+std::uint32_t sh4_ir_state_accesses(const Sh4_Ir_Block &block)
+{
+    std::uint32_t accesses = 0;
+
+    for (const Sh4_Ir_Inst &inst : block.insts)
+    {
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Load_Reg:
+            case Sh4_Ir_Op::Store_Reg:
+            case Sh4_Ir_Op::Load_T:
+                accesses++;
+                break;
+
+            case Sh4_Ir_Op::Store_T:
+                accesses += 2;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return accesses;
+}
@@ -0,0 +1,982 @@
+#include <cpu/sh4_jit.hh>
+#include <cpu/sh4_decode.hh>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <ucontext.h>
+
+using namespace X64;
+
+/*
+    Host registers guest GPRs get allocated to, all callee-saved so they survive
+    the helper calls
+*/
+static constexpr std::array<Reg, JIT_ALLOCATABLE_REGS> allocatable_regs = { RBP, R12, R13, R14, R15 };
+
+/*
+    Slow path helpers, called from the generated code
+*/
+static std::uint32_t sh4_jit_read_32(Sh4_Decode *decoder, std::uint32_t address)
+{
+    return decoder->memory->read<std::uint32_t>(address, decoder->cpu);
+}
+
+static void sh4_jit_write_8(Sh4_Decode *decoder, std::uint32_t address, std::uint32_t value)
+{
+    decoder->memory->write<std::uint8_t>(address, static_cast<std::uint8_t>(value), decoder->cpu);
+}
+
+static void sh4_jit_write_16(Sh4_Decode *decoder, std::uint32_t address, std::uint32_t value)
+{
+    decoder->memory->write<std::uint16_t>(address, static_cast<std::uint16_t>(value), decoder->cpu);
+}
+
+static void sh4_jit_write_32(Sh4_Decode *decoder, std::uint32_t address, std::uint32_t value)
+{
+    decoder->memory->write<std::uint32_t>(address, value, decoder->cpu);
+}
+
+/*
+    Non-zero if the instruction raised an exception (PC isn't the next
+    instruction) or stopped the machine, the rest of the block is skipped then
+*/
+static std::uint32_t sh4_jit_interpret(Sh4_Decode *decoder, std::uint32_t opcode, std::uint32_t pc, std::uint32_t flags)
+{
+    if (flags & IR_FLAG_SYNC_PC)
+    {
+        decoder->cpu->set_pc(pc);
+        decoder->cpu->set_delay_pc(pc + 2);
+    }
+
+    decoder->parse_opcode(static_cast<std::uint16_t>(opcode));
+
+    return ((flags & IR_FLAG_SYNC_PC) && decoder->cpu->get_pc() != pc + 2) || decoder->status != Lucid_Status::Running;
+}
+
+/*
+    JIT instance whose code runs on this thread, for the fault handler
+*/
+static thread_local Sh4_Jit *current_jit = nullptr;
+
+static struct sigaction previous_handler;
+
+Sh4_Jit::Sh4_Jit(Sh4_Decode *decoder_, Sh4_Cpu *cpu_)
+{
+    decoder = decoder_;
+    cpu = cpu_;
+
+    compiled = 0;
+    fastmem_accesses = 0;
+    backpatched = 0;
+    code_page_faults = 0;
+    linked = 0;
+    state_accesses = 0;
+    exit_block = nullptr;
+
+    fastmem = true;
+    fastmem_base = nullptr;
+    fastmem_checked = false;
+
+    auto base = reinterpret_cast<std::uint8_t *>(cpu);
+    registers_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->registers) - base);
+    status_register_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->status_register) - base);
+    pc_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->pc) - base);
+    delay_pc_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->delay_pc) - base);
+    interrupt_pending_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->interrupt_pending_) - base);
+    mmucr_offset = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&cpu->mmu.mmucr) - base);
+}
+
+Sh4_Jit::~Sh4_Jit()
+{
+    if (current_jit == this)
+    {
+        current_jit = nullptr;
+    }
+}
+
+void Sh4_Jit::flush()
+{
+    code_cache.flush();
+    fastmem_sites.clear();
+
+    for (auto &links : native_links)
+    {
+        links.clear();
+    }
+}
+
+void Sh4_Jit::make_current()
+{
+    current_jit = this;
+}
+
+void Sh4_Jit::fault_handler(int signal, siginfo_t *info, void *context)
+{
+    ucontext_t *ucontext = static_cast<ucontext_t *>(context);
+    std::uintptr_t rip = ucontext->uc_mcontext.gregs[REG_RIP];
+    std::uintptr_t resume;
+
+    if (current_jit && current_jit->handle_fault(rip, reinterpret_cast<std::uintptr_t>(info->si_addr), resume))
+    {
+        ucontext->uc_mcontext.gregs[REG_RIP] = resume;
+        return;
+    }
+
+    // Not ours, let it crash the way it would have without the handler
+    sigaction(signal, &previous_handler, nullptr);
+}
+
+/*
+    A fastmem access faulted, either on a page code was built from (Invalidate
+    it and retry) or outside what the arena maps (Send the site to its slow path
+    stub from now on, starting with this access)
+*/
+bool Sh4_Jit::handle_fault(std::uintptr_t rip, std::uintptr_t fault_address, std::uintptr_t &resume)
+{
+    auto it = fastmem_sites.find(rip);
+
+    if (!code_cache.contains(rip) || it == fastmem_sites.end())
+    {
+        return false;
+    }
+
+    const Fastmem_Site &site = it->second;
+    std::uintptr_t arena = reinterpret_cast<std::uintptr_t>(fastmem_base);
+    std::uint32_t p_addr = static_cast<std::uint32_t>(fault_address - arena);
+
+    bool store = site.op != Sh4_Ir_Op::Load_32;
+
+    if (store && fault_address >= arena && p_addr >= 0x0C000000 && p_addr <= 0x0FFFFFFF
+        && decoder->memory->code_pages[(p_addr & 0x00FFFFFF) >> 12])
+    {
+        decoder->memory->code_written(p_addr);
+        code_page_faults++;
+        resume = rip;
+        return true;
+    }
+
+    // Overwrites the address masking, the access after it is never reached again
+    X64::Emitter jump;
+    jump.jump_to(site.stub - site.start);
+
+    code_cache.patch(reinterpret_cast<const std::uint8_t *>(site.start), jump.data(), jump.size());
+    backpatched++;
+
+    resume = site.start;
+    fastmem_sites.erase(it);
+    return true;
+}
+
+/*
+    Address in ESI, value (Stores) in EDX, result (Loads) in EAX, the same as
+    for the helpers
+*/
+void Sh4_Jit::fastmem_access(Sh4_Ir_Op op, std::uint32_t pc)
+{
+    std::int32_t base = static_cast<std::int32_t>(reinterpret_cast<std::uintptr_t>(fastmem_base));
+    std::size_t start = emitter.size();
+
+    emitter.mov(RAX, RSI);
+    emitter.alu(Alu::And, RAX, 0x1FFFFFFFu);
+
+    std::size_t access = emitter.size();
+
+    switch (op)
+    {
+        case Sh4_Ir_Op::Load_32: emitter.load(RAX, RAX, base); break;
+        case Sh4_Ir_Op::Store_8: emitter.store8(RAX, base, RDX); break;
+        case Sh4_Ir_Op::Store_16: emitter.store16(RAX, base, RDX); break;
+        default: emitter.store(RAX, base, RDX); break;
+    }
+
+    if (op != Sh4_Ir_Op::Load_32 && decoder->memory->dirty_pages)
+    {
+        mark_dirty();
+    }
+
+    std::uint16_t dirty = 0;
+
+    for (std::uint8_t i = 0; i < 16; i++)
+    {
+        if (guest_regs[i].dirty)
+        {
+            dirty |= 1 << i;
+        }
+    }
+
+    pending_sites.push_back({start, access, emitter.size(), op, pc, dirty});
+    fastmem_accesses++;
+}
+
+/*
+    Sets Memory::dirty_pages for a fastmem store (Address masked in EAX) when
+    something tracks them (Sh4_Diff). The arena also has VRAM, only main
+    memory has flags.
+*/
+void Sh4_Jit::mark_dirty()
+{
+    emitter.mov(RCX, RAX);
+    emitter.alu(Alu::And, RCX, 0x1C000000u);
+    emitter.alu(Alu::Cmp, RCX, 0x0C000000u);
+
+    std::size_t skip = emitter.jump(Cond::Not_Equal);
+
+    emitter.shift(Shift::Shr, RAX, 12);
+    emitter.alu(Alu::And, RAX, 0xFFFu);
+    emitter.mov64(RCX, reinterpret_cast<std::uint64_t>(decoder->memory->dirty_pages));
+    emitter.alu64(Alu::Add, RCX, RAX);
+    emitter.mov(RAX, 1u);
+    emitter.store8(RCX, 0, RAX);
+
+    emitter.bind(skip);
+}
+
+/*
+    Slow path of a fastmem site, only reached once the site has been patched.
+    The registers are written back without being marked clean, the block still
+    has them dirty when it gets back. Returns where the stub starts.
+*/
+std::size_t Sh4_Jit::slow_stub(const Pending_Site &site)
+{
+    std::size_t start = emitter.size();
+
+    auto helper = (site.op == Sh4_Ir_Op::Load_32) ? reinterpret_cast<const void *>(&sh4_jit_read_32) :
+                  (site.op == Sh4_Ir_Op::Store_8) ? reinterpret_cast<const void *>(&sh4_jit_write_8) :
+                  (site.op == Sh4_Ir_Op::Store_16) ? reinterpret_cast<const void *>(&sh4_jit_write_16) :
+                  reinterpret_cast<const void *>(&sh4_jit_write_32);
+
+    for (std::uint8_t i = 0; i < 16; i++)
+    {
+        if (site.dirty & (1 << i))
+        {
+            emitter.load64(RAX, RBX, registers_offset + (i * 8));
+            emitter.store(RAX, 0, guest_regs[i].host);
+        }
+    }
+
+    emitter.mov64(RDI, reinterpret_cast<std::uint64_t>(decoder));
+    emitter.call(helper);
+    check_status(site.pc);
+    emitter.jump_to(site.end);
+
+    return start;
+}
+
+/*
+    Picks the guest registers accessed the most in the block, the ones only
+    touched once aren't worth a host register
+*/
+void Sh4_Jit::allocate(const Sh4_Ir_Block &ir)
+{
+    std::array<std::uint32_t, 16> uses = {};
+
+    for (const Sh4_Ir_Inst &inst : ir.insts)
+    {
+        if (inst.op == Sh4_Ir_Op::Load_Reg || inst.op == Sh4_Ir_Op::Store_Reg)
+        {
+            uses[inst.imm & 0xF]++;
+        }
+    }
+
+    std::array<std::uint8_t, 16> order;
+
+    for (std::uint8_t i = 0; i < 16; i++)
+    {
+        order[i] = i;
+        guest_regs[i] = { false, RAX, false, false };
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&uses](std::uint8_t a, std::uint8_t b) { return uses[a] > uses[b]; });
+
+    for (std::size_t i = 0; i < JIT_ALLOCATABLE_REGS; i++)
+    {
+        if (uses[order[i]] < 2)
+        {
+            break;
+        }
+
+        guest_regs[order[i]].allocated = true;
+        guest_regs[order[i]].host = allocatable_regs[i];
+    }
+}
+
+/*
+    Registers are reached through Sh4_Cpu::registers, R0-R7 may point to
+    either bank
+*/
+void Sh4_Jit::load_guest(std::uint8_t index, Reg dst)
+{
+    emitter.load64(RAX, RBX, registers_offset + (index * 8));
+    emitter.load(dst, RAX, 0);
+    state_accesses++;
+}
+
+void Sh4_Jit::store_guest(std::uint8_t index, Reg src)
+{
+    emitter.load64(RAX, RBX, registers_offset + (index * 8));
+    emitter.store(RAX, 0, src);
+    state_accesses++;
+}
+
+/*
+    Flush modified registers back to Sh4_Cpu
+*/
+void Sh4_Jit::writeback()
+{
+    for (std::uint8_t i = 0; i < 16; i++)
+    {
+        if (guest_regs[i].dirty)
+        {
+            store_guest(i, guest_regs[i].host);
+            guest_regs[i].dirty = false;
+        }
+    }
+}
+
+/*
+    The guest state may have changed under us, reload on the next use
+*/
+void Sh4_Jit::forget()
+{
+    for (auto &reg : guest_regs)
+    {
+        reg.loaded = false;
+    }
+}
+
+/*
+    Adds what the block ran to the scheduler and the statistics, leaves the
+    address of Scheduler::cycles in RCX and of Sh4_Decode::executed_instructions
+    in RDX for the link checks
+*/
+void Sh4_Jit::count(std::uint32_t instructions, std::uint32_t decoded_state_accesses)
+{
+    auto offset = [](const void *field, const void *base)
+    {
+        return static_cast<std::int32_t>(reinterpret_cast<const std::uint8_t *>(field) - reinterpret_cast<const std::uint8_t *>(base));
+    };
+
+    emitter.mov64(RCX, reinterpret_cast<std::uint64_t>(&decoder->scheduler->cycles));
+    emitter.alu64(Alu::Add, RCX, 0, instructions);
+
+    emitter.mov64(RDX, reinterpret_cast<std::uint64_t>(&decoder->executed_instructions));
+    emitter.alu64(Alu::Add, RDX, 0, instructions);
+    emitter.alu64(Alu::Add, RDX, offset(&decoder->executed_state_accesses, &decoder->executed_instructions), state_accesses);
+    emitter.alu64(Alu::Add, RDX, offset(&decoder->decoded_state_accesses, &decoder->executed_instructions), decoded_state_accesses);
+}
+
+void Sh4_Jit::patch_jump(std::uintptr_t site, std::uintptr_t target)
+{
+    std::int32_t displacement = static_cast<std::int32_t>(target - (site + 4));
+
+    code_cache.patch(reinterpret_cast<const std::uint8_t *>(site), reinterpret_cast<const std::uint8_t *>(&displacement), 4);
+}
+
+std::uintptr_t Sh4_Jit::jump_target(std::uintptr_t site) const
+{
+    std::int32_t displacement;
+    std::memcpy(&displacement, reinterpret_cast<const void *>(site), 4);
+
+    return site + 4 + displacement;
+}
+
+void Sh4_Jit::link(Sh4_Block *from, Sh4_Block *to, std::uint32_t pc)
+{
+    if (!from->native || !to->native || !code_cache.live(from->native_generation) || !code_cache.live(to->native_generation))
+    {
+        return;
+    }
+
+    Sh4_Jit_Exits &exits = from->native_exits;
+    std::uintptr_t target = reinterpret_cast<std::uintptr_t>(to->native);
+    std::uintptr_t site = 0;
+
+    // Same order as the compares in the host code
+    if (pc == from->taken_pc)
+    {
+        site = exits.taken;
+    }
+    else if (pc == from->fallthrough_pc)
+    {
+        site = exits.fallthrough;
+    }
+    else if (exits.indirect[0])
+    {
+        // Already cached, it may have been sent back to the dispatcher since
+        for (std::size_t i = 0; i < JIT_INDIRECT_LINKS && !site; i++)
+        {
+            std::uint32_t cached;
+            std::memcpy(&cached, reinterpret_cast<const void *>(exits.indirect_pc[i]), 4);
+
+            if (cached == pc)
+            {
+                site = exits.indirect[i];
+            }
+        }
+
+        if (!site)
+        {
+            std::size_t victim = exits.indirect_victim;
+            exits.indirect_victim = (exits.indirect_victim + 1) % JIT_INDIRECT_LINKS;
+
+            // The jump first, so the entry never matches the new PC while it still goes to the old target
+            patch_jump(exits.indirect[victim], exits.dispatcher);
+            code_cache.patch(reinterpret_cast<const std::uint8_t *>(exits.indirect_pc[victim]), reinterpret_cast<const std::uint8_t *>(&pc), 4);
+
+            site = exits.indirect[victim];
+        }
+    }
+
+    if (!site || jump_target(site) == target)
+    {
+        return;
+    }
+
+    patch_jump(site, target);
+    native_links[to->native_generation % CODE_CACHE_GENERATIONS].push_back({site, exits.dispatcher, from->native_generation, target});
+    linked++;
+}
+
+void Sh4_Jit::unlink(const Sh4_Block *block)
+{
+    if (!block->native || !code_cache.live(block->native_generation))
+    {
+        return;
+    }
+
+    std::uintptr_t target = reinterpret_cast<std::uintptr_t>(block->native);
+
+    std::erase_if(native_links[block->native_generation % CODE_CACHE_GENERATIONS], [this, target](const Native_Link &link)
+    {
+        if (link.target != target)
+        {
+            return false;
+        }
+
+        if (code_cache.live(link.generation))
+        {
+            patch_jump(link.site, link.dispatcher);
+        }
+
+        return true;
+    });
+}
+
+/*
+    The code of `generation` is gone, jumps from the code that's still live
+    can't go there anymore
+*/
+void Sh4_Jit::evict_links(std::uint64_t generation)
+{
+    auto &links = native_links[generation % CODE_CACHE_GENERATIONS];
+
+    for (const Native_Link &link : links)
+    {
+        if (code_cache.live(link.generation))
+        {
+            patch_jump(link.site, link.dispatcher);
+        }
+    }
+
+    links.clear();
+}
+
+/*
+    After a memory helper, guest registers have to be written back already
+*/
+void Sh4_Jit::check_status(std::uint32_t pc)
+{
+    emitter.mov64(RCX, reinterpret_cast<std::uint64_t>(&decoder->status));
+    emitter.load(RCX, RCX, 0);
+    emitter.test(RCX, RCX);
+    stop_exits.push_back({emitter.jump(Cond::Not_Equal), pc});
+}
+
+void Sh4_Jit::load_value(Reg dst, std::uint32_t value)
+{
+    if (value_is_const[value])
+    {
+        emitter.mov(dst, value_const[value]);
+    }
+    else
+    {
+        emitter.load(dst, RSP, value * 4);
+    }
+}
+
+void Sh4_Jit::store_value(std::uint32_t value, Reg src)
+{
+    emitter.store(RSP, value * 4, src);
+}
+
+Sh4_Jit_Entry Sh4_Jit::compile(Sh4_Block &block)
+{
+    static constexpr std::array<Reg, 6> saved_regs = { RBX, RBP, R12, R13, R14, R15 };
+
+    const Sh4_Ir_Block &ir = block.ir;
+
+    emitter.clear();
+    pending_sites.clear();
+    state_accesses = 0;
+
+    if (!fastmem_checked)
+    {
+        fastmem_checked = true;
+
+        if (fastmem && decoder->memory->map_fastmem())
+        {
+            fastmem_base = decoder->memory->fastmem;
+
+            // Once per process, a second install would save the handler itself as the previous one
+            static std::once_flag handler_installed;
+
+            std::call_once(handler_installed, []()
+            {
+                struct sigaction action = {};
+                action.sa_sigaction = &Sh4_Jit::fault_handler;
+                action.sa_flags = SA_SIGINFO | SA_NODEFER;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGSEGV, &action, &previous_handler);
+            });
+        }
+    }
+
+    exception_exits.clear();
+    dispatcher_exits.clear();
+    stop_exits.clear();
+    value_is_const.assign(ir.value_count, false);
+    value_const.assign(ir.value_count, 0);
+
+    allocate(ir);
+
+    // Keeps the stack 16 byte aligned for the helper calls (6 pushes + return address)
+    std::uint32_t frame = ((ir.value_count * 4 + 15) & ~15u) + 8;
+
+    for (Reg reg : saved_regs)
+    {
+        emitter.push(reg);
+    }
+
+    emitter.alu64(Alu::Sub, RSP, frame);
+    emitter.mov64(RBX, reinterpret_cast<std::uint64_t>(cpu));
+
+    for (const Sh4_Ir_Inst &inst : ir.insts)
+    {
+        switch (inst.op)
+        {
+            case Sh4_Ir_Op::Nop:
+                break;
+
+            case Sh4_Ir_Op::Const:
+                value_is_const[inst.dst] = true;
+                value_const[inst.dst] = inst.imm;
+                break;
+
+            case Sh4_Ir_Op::Load_Reg:
+            {
+                Guest_Reg &reg = guest_regs[inst.imm & 0xF];
+
+                if (reg.allocated)
+                {
+                    if (!reg.loaded)
+                    {
+                        load_guest(inst.imm & 0xF, reg.host);
+                        reg.loaded = true;
+                    }
+
+                    store_value(inst.dst, reg.host);
+                }
+                else
+                {
+                    load_guest(inst.imm & 0xF, RCX);
+                    store_value(inst.dst, RCX);
+                }
+                break;
+            }
+
+            case Sh4_Ir_Op::Store_Reg:
+            {
+                Guest_Reg &reg = guest_regs[inst.imm & 0xF];
+
+                if (reg.allocated)
+                {
+                    load_value(reg.host, inst.a);
+                    reg.loaded = true;
+                    reg.dirty = true;
+                }
+                else
+                {
+                    load_value(RCX, inst.a);
+                    store_guest(inst.imm & 0xF, RCX);
+                }
+                break;
+            }
+
+            case Sh4_Ir_Op::Load_T:
+                emitter.load(RCX, RBX, status_register_offset);
+                emitter.alu(Alu::And, RCX, 1u);
+                store_value(inst.dst, RCX);
+                state_accesses++;
+                break;
+
+            case Sh4_Ir_Op::Store_T:
+                load_value(RCX, inst.a);
+                emitter.alu(Alu::And, RCX, 1u);
+                emitter.load(RAX, RBX, status_register_offset);
+                emitter.alu(Alu::And, RAX, 0xFFFFFFFEu);
+                emitter.alu(Alu::Or, RAX, RCX);
+                emitter.store(RBX, status_register_offset, RAX);
+                state_accesses += 2;
+                break;
+
+            case Sh4_Ir_Op::Add:
+            case Sh4_Ir_Op::Sub:
+            case Sh4_Ir_Op::And:
+            case Sh4_Ir_Op::Or:
+            case Sh4_Ir_Op::Xor:
+            {
+                Alu alu = Alu::Add;
+
+                switch (inst.op)
+                {
+                    case Sh4_Ir_Op::Sub: alu = Alu::Sub; break;
+                    case Sh4_Ir_Op::And: alu = Alu::And; break;
+                    case Sh4_Ir_Op::Or: alu = Alu::Or; break;
+                    case Sh4_Ir_Op::Xor: alu = Alu::Xor; break;
+                    default: break;
+                }
+
+                load_value(RAX, inst.a);
+
+                if (value_is_const[inst.b])
+                {
+                    emitter.alu(alu, RAX, value_const[inst.b]);
+                }
+                else
+                {
+                    load_value(RCX, inst.b);
+                    emitter.alu(alu, RAX, RCX);
+                }
+
+                store_value(inst.dst, RAX);
+                break;
+            }
+
+            case Sh4_Ir_Op::Shl:
+            case Sh4_Ir_Op::Shr:
+            case Sh4_Ir_Op::Sar:
+            {
+                Shift shift = (inst.op == Sh4_Ir_Op::Shl) ? Shift::Shl : (inst.op == Sh4_Ir_Op::Shr) ? Shift::Shr : Shift::Sar;
+
+                load_value(RAX, inst.a);
+
+                // x86 masks the count to 5 bits too
+                if (value_is_const[inst.b])
+                {
+                    if (value_const[inst.b] & 31)
+                    {
+                        emitter.shift(shift, RAX, value_const[inst.b] & 31);
+                    }
+                }
+                else
+                {
+                    load_value(RCX, inst.b);
+                    emitter.shift(shift, RAX);
+                }
+
+                store_value(inst.dst, RAX);
+                break;
+            }
+
+            case Sh4_Ir_Op::Swap_B:
+                load_value(RAX, inst.a);
+                emitter.rotate16(Shift::Rol, RAX, 8);
+                store_value(inst.dst, RAX);
+                break;
+
+            case Sh4_Ir_Op::Swap_W:
+                load_value(RAX, inst.a);
+                emitter.shift(Shift::Rol, RAX, 16);
+                store_value(inst.dst, RAX);
+                break;
+
+            case Sh4_Ir_Op::Cmp_Eq:
+            case Sh4_Ir_Op::Cmp_Hi:
+            case Sh4_Ir_Op::Test:
+                load_value(RAX, inst.a);
+                load_value(RCX, inst.b);
+
+                if (inst.op == Sh4_Ir_Op::Test)
+                {
+                    emitter.test(RAX, RCX);
+                }
+                else
+                {
+                    emitter.alu(Alu::Cmp, RAX, RCX);
+                }
+
+                emitter.set((inst.op == Sh4_Ir_Op::Cmp_Hi) ? Cond::Above : Cond::Equal, RAX);
+                store_value(inst.dst, RAX);
+                break;
+
+            case Sh4_Ir_Op::Load_32:
+                if (fastmem_base)
+                {
+                    load_value(RSI, inst.a);
+                    fastmem_access(inst.op, inst.pc);
+                    store_value(inst.dst, RAX);
+                    break;
+                }
+
+                writeback();
+                load_value(RSI, inst.a);
+                emitter.mov64(RDI, reinterpret_cast<std::uint64_t>(decoder));
+                emitter.call(reinterpret_cast<const void *>(&sh4_jit_read_32));
+                store_value(inst.dst, RAX);
+                check_status(inst.pc);
+                break;
+
+            case Sh4_Ir_Op::Store_8:
+            case Sh4_Ir_Op::Store_16:
+            case Sh4_Ir_Op::Store_32:
+            {
+                auto helper = (inst.op == Sh4_Ir_Op::Store_8) ? &sh4_jit_write_8 : (inst.op == Sh4_Ir_Op::Store_16) ? &sh4_jit_write_16 : &sh4_jit_write_32;
+
+                if (fastmem_base)
+                {
+                    load_value(RSI, inst.a);
+                    load_value(RDX, inst.b);
+                    fastmem_access(inst.op, inst.pc);
+                    break;
+                }
+
+                writeback();
+                load_value(RSI, inst.a);
+                load_value(RDX, inst.b);
+                emitter.mov64(RDI, reinterpret_cast<std::uint64_t>(decoder));
+                emitter.call(reinterpret_cast<const void *>(helper));
+                check_status(inst.pc);
+                break;
+            }
+
+            case Sh4_Ir_Op::Interpret:
+                writeback();
+                emitter.mov64(RDI, reinterpret_cast<std::uint64_t>(decoder));
+                emitter.mov(RSI, inst.imm);
+                emitter.mov(RDX, inst.pc);
+                emitter.mov(RCX, static_cast<std::uint32_t>(inst.flags));
+                emitter.call(reinterpret_cast<const void *>(&sh4_jit_interpret));
+                forget();
+
+                // Guest registers are all written back at this point, straight to the epilogue (Not linked)
+                if (&inst != &ir.insts.back())
+                {
+                    emitter.test(RAX, RAX);
+                    exception_exits.push_back(emitter.jump(Cond::Not_Equal));
+                }
+                else
+                {
+                    // The block's branch, PC is checked against the links below
+                    check_status(inst.pc);
+                }
+                break;
+
+            case Sh4_Ir_Op::Exit:
+                emitter.store(RBX, pc_offset, inst.imm);
+                emitter.store(RBX, delay_pc_offset, inst.imm + 2);
+                break;
+        }
+    }
+
+    writeback();
+
+    auto teardown = [this, frame]()
+    {
+        emitter.alu64(Alu::Add, RSP, frame);
+
+        for (auto reg = saved_regs.rbegin(); reg != saved_regs.rend(); reg++)
+        {
+            emitter.pop(*reg);
+        }
+    };
+
+    // Only runs once the frame is gone, RCX/RAX are free
+    auto leave = [this, &block]()
+    {
+        emitter.mov64(RCX, reinterpret_cast<std::uint64_t>(&exit_block));
+        emitter.mov64(RAX, reinterpret_cast<std::uint64_t>(&block));
+        emitter.store64(RCX, 0, RAX);
+        emitter.ret();
+    };
+
+    // SLEEP, SR writes... always go back to the dispatcher
+    bool linkable = block.branch != Sh4_Branch::Stop;
+    std::uint32_t instructions = static_cast<std::uint32_t>(block.opcodes.size());
+
+    count(instructions, block.decoded_state_accesses);
+
+    if (linkable)
+    {
+        std::int32_t next_event = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&decoder->scheduler->next_event) -
+            reinterpret_cast<std::uint8_t *>(&decoder->scheduler->cycles));
+        std::int32_t link_until = static_cast<std::int32_t>(reinterpret_cast<std::uint8_t *>(&decoder->link_until) -
+            reinterpret_cast<std::uint8_t *>(&decoder->executed_instructions));
+
+        emitter.load64(RAX, RCX, 0);
+        emitter.alu64(Alu::Cmp, RAX, RCX, next_event);
+        dispatcher_exits.push_back(emitter.jump(Cond::Above_Equal));
+        emitter.alu64(Alu::Cmp, RAX, RDX, link_until);
+        dispatcher_exits.push_back(emitter.jump(Cond::Above_Equal));
+
+        emitter.test8(RBX, interrupt_pending_offset, 1);
+        dispatcher_exits.push_back(emitter.jump(Cond::Not_Equal));
+        emitter.test(RBX, mmucr_offset, MMUCR_AT_BIT);
+        dispatcher_exits.push_back(emitter.jump(Cond::Not_Equal));
+
+        emitter.load(RAX, RBX, pc_offset);
+    }
+
+    teardown();
+
+    std::size_t taken = 0, fallthrough = 0;
+    std::array<std::size_t, JIT_INDIRECT_LINKS> indirect_pc = {}, indirect = {};
+
+    // Tail jumps, to the dispatcher (Right below) until they're linked
+    auto link_exit = [this](std::uint32_t pc, std::size_t &compare)
+    {
+        emitter.alu(Alu::Cmp, RAX, pc);
+        compare = emitter.size() - 4;
+
+        std::size_t skip = emitter.jump(Cond::Not_Equal);
+        std::size_t site = emitter.jump();
+        emitter.bind(skip);
+
+        return site;
+    };
+
+    std::size_t compare;
+
+    if (linkable && block.taken_pc != UINT32_MAX)
+    {
+        taken = link_exit(block.taken_pc, compare);
+    }
+
+    if (linkable && block.fallthrough_pc != UINT32_MAX)
+    {
+        fallthrough = link_exit(block.fallthrough_pc, compare);
+    }
+
+    // Never matches (PCs are even) until an entry gets a target
+    if (linkable && block.branch == Sh4_Branch::Indirect_Delayed)
+    {
+        for (std::size_t i = 0; i < JIT_INDIRECT_LINKS; i++)
+        {
+            indirect[i] = link_exit(UINT32_MAX, indirect_pc[i]);
+        }
+    }
+
+    std::size_t dispatcher = emitter.size();
+
+    for (std::size_t site : {taken, fallthrough})
+    {
+        if (site)
+        {
+            emitter.bind(site);
+        }
+    }
+
+    for (std::size_t site : indirect)
+    {
+        if (site)
+        {
+            emitter.bind(site);
+        }
+    }
+
+    leave();
+
+    // Exceptions and stops, not linked either
+    std::size_t unlinked = emitter.size();
+
+    for (std::size_t site : exception_exits)
+    {
+        emitter.bind(site);
+    }
+
+    count(instructions, block.decoded_state_accesses);
+
+    for (std::size_t site : dispatcher_exits)
+    {
+        emitter.bind(site);
+    }
+
+    teardown();
+    leave();
+
+    // Out of line, they hardly ever run
+    std::vector<std::size_t> stubs;
+
+    for (const Pending_Site &site : pending_sites)
+    {
+        stubs.push_back(slow_stub(site));
+    }
+
+    for (const Stop_Exit &exit : stop_exits)
+    {
+        emitter.bind(exit.site);
+        emitter.store(RBX, pc_offset, exit.pc);
+        emitter.store(RBX, delay_pc_offset, exit.pc + 2);
+        emitter.jump_to(unlinked);
+    }
+
+    std::uint64_t generation = code_cache.generation();
+    const std::uint8_t *entry = code_cache.install(emitter.data(), emitter.size());
+
+    if (!entry)
+    {
+        return nullptr;
+    }
+
+    // Filling the new code evicted a generation (Or more)
+    for (std::uint64_t next = generation + 1; next <= code_cache.generation(); next++)
+    {
+        if (next >= CODE_CACHE_GENERATIONS)
+        {
+            evict_links(next - CODE_CACHE_GENERATIONS);
+        }
+    }
+
+    // Forget whatever used to be at that address
+    std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(entry);
+    fastmem_sites.erase(fastmem_sites.lower_bound(begin), fastmem_sites.lower_bound(begin + emitter.size()));
+
+    for (std::size_t i = 0; i < pending_sites.size(); i++)
+    {
+        const Pending_Site &site = pending_sites[i];
+        fastmem_sites[begin + site.access] = {begin + site.start, begin + stubs[i], site.op};
+    }
+
+    if (perf_map.enabled())
+    {
+        perf_map.record(ir.start_pc, entry, emitter.size());
+    }
+
+    auto address = [begin](std::size_t offset) -> std::uintptr_t { return offset ? begin + offset : 0; };
+
+    block.native_exits = {};
+    block.native_exits.taken = address(taken);
+    block.native_exits.fallthrough = address(fallthrough);
+
+    for (std::size_t i = 0; i < JIT_INDIRECT_LINKS; i++)
+    {
+        block.native_exits.indirect_pc[i] = address(indirect_pc[i]);
+        block.native_exits.indirect[i] = address(indirect[i]);
+    }
+
+    block.native_exits.dispatcher = begin + dispatcher;
+
+    compiled++;
+    block.native_state_accesses = state_accesses;
+
+    return reinterpret_cast<Sh4_Jit_Entry>(entry);
+}
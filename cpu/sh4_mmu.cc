@@ -0,0 +1,474 @@
+#include <cpu/sh4_mmu.hh>
+#include <cpu/sh4_cpu.hh>
+#include <cstring>
+
+Sh4_Mmu::Sh4_Mmu()
+{
+    utlb = {};
+    itlb = {};
+
+    for (Sh4_Tlb_Entry &entry : utlb)
+    {
+        entry.mask = page_mask(0);
+    }
+
+    for (Sh4_Tlb_Entry &entry : itlb)
+    {
+        entry.mask = page_mask(0);
+    }
+
+    pteh = 0;
+    ptel = 0;
+    ptea = 0;
+    ttb = 0;
+    tea = 0;
+    mmucr = 0;
+
+    fault_expevt = 0;
+    fault_vector = 0;
+
+    translating_ = false;
+    fault = false;
+
+    flush_lookup();
+}
+
+/*
+    1KB, 4KB, 64KB or 1MB
+*/
+std::uint32_t Sh4_Mmu::page_mask(std::uint32_t ptel_)
+{
+    static constexpr std::uint32_t masks[4] = {0x000003FF, 0x00000FFF, 0x0000FFFF, 0x000FFFFF};
+
+    return masks[((ptel_ & PTEL_SZ1_BIT) ? 2 : 0) | ((ptel_ & PTEL_SZ0_BIT) ? 1 : 0)];
+}
+
+void Sh4_Mmu::flush_lookup()
+{
+    for (auto &cache : lookup)
+    {
+        memset(cache.data(), 0, sizeof(Lookup_Entry) * cache.size());
+    }
+}
+
+namespace
+{
+    // Shared pages and single virtual mode (Privileged) ignore the ASID
+    bool tlb_match(const Sh4_Tlb_Entry &entry, std::uint32_t address, std::uint32_t asid, bool check_asid)
+    {
+        return (entry.ptel & PTEL_V_BIT) && !((entry.pteh ^ address) & PTEH_VPN_MASK & ~entry.mask) &&
+               (!check_asid || (entry.ptel & PTEL_SH_BIT) || (entry.pteh & PTEH_ASID_MASK) == asid);
+    }
+}
+
+/*
+    A multiple hit resets the CPU on hardware, the first matching entry wins here
+*/
+Sh4_Tlb_Entry *Sh4_Mmu::search_utlb(std::uint32_t address, bool privileged)
+{
+    std::uint32_t urc = (mmucr >> MMUCR_URC_SHIFT) & 0x3F;
+    std::uint32_t urb = (mmucr >> MMUCR_URB_SHIFT) & 0x3F;
+
+    // Every UTLB access moves the replace counter, wrapping at URB (If set)
+    urc = (urc + 1) & 0x3F;
+
+    if (urb && urc == urb)
+    {
+        urc = 0;
+    }
+
+    mmucr = (mmucr & ~(0x3Fu << MMUCR_URC_SHIFT)) | (urc << MMUCR_URC_SHIFT);
+
+    bool check_asid = !(privileged && (mmucr & MMUCR_SV_BIT));
+
+    for (Sh4_Tlb_Entry &entry : utlb)
+    {
+        if (tlb_match(entry, address, pteh & PTEH_ASID_MASK, check_asid))
+        {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+    ITLB misses look in the UTLB and copy the entry over the least recently
+    used ITLB entry (MMUCR.LRUI)
+*/
+Sh4_Tlb_Entry *Sh4_Mmu::search_itlb(std::uint32_t address, bool privileged)
+{
+    bool check_asid = !(privileged && (mmucr & MMUCR_SV_BIT));
+
+    for (std::uint32_t i = 0; i < MMU_ITLB_ENTRIES; i++)
+    {
+        if (tlb_match(itlb[i], address, pteh & PTEH_ASID_MASK, check_asid))
+        {
+            use_itlb(i);
+            return &itlb[i];
+        }
+    }
+
+    Sh4_Tlb_Entry *entry = search_utlb(address, privileged);
+
+    if (!entry)
+    {
+        return nullptr;
+    }
+
+    std::uint32_t lrui = mmucr >> MMUCR_LRUI_SHIFT;
+    std::uint32_t victim = 0;
+
+    if ((lrui & 0b111000) == 0b111000)
+    {
+        victim = 0;
+    }
+    else if ((lrui & 0b100110) == 0b000110)
+    {
+        victim = 1;
+    }
+    else if ((lrui & 0b010101) == 0b000001)
+    {
+        victim = 2;
+    }
+    else if ((lrui & 0b001011) == 0b000000)
+    {
+        victim = 3;
+    }
+
+    // The ITLB only has PR bit 1 (User access), no D/WT
+    itlb[victim] = *entry;
+    itlb[victim].ptel &= ~((1u << PTEL_PR_SHIFT) | PTEL_D_BIT | PTEL_WT_BIT);
+
+    use_itlb(victim);
+
+    return &itlb[victim];
+}
+
+void Sh4_Mmu::use_itlb(std::uint32_t index)
+{
+    std::uint32_t lrui = mmucr >> MMUCR_LRUI_SHIFT;
+
+    switch (index)
+    {
+        case 0: lrui &= ~0b111000u; break;
+        case 1: lrui = (lrui | 0b100000) & ~0b000110u; break;
+        case 2: lrui = (lrui | 0b010100) & ~0b000001u; break;
+        case 3: lrui |= 0b001011; break;
+    }
+
+    mmucr = (mmucr & ~(0x3Fu << MMUCR_LRUI_SHIFT)) | (lrui << MMUCR_LRUI_SHIFT);
+}
+
+void Sh4_Mmu::raise(std::uint32_t address, std::uint32_t expevt, std::uint32_t vector)
+{
+    tea = address;
+    pteh = (address & PTEH_VPN_MASK) | (pteh & PTEH_ASID_MASK);
+
+    fault_expevt = expevt;
+    fault_vector = vector;
+    fault = true;
+}
+
+bool Sh4_Mmu::translate_slow(std::uint32_t address, Sh4_Access access, bool privileged, std::uint32_t &p_addr)
+{
+    if (fault)
+    {
+        return false;
+    }
+
+    Sh4_Tlb_Entry *entry;
+
+    if (access == Sh4_Access::Fetch)
+    {
+        entry = search_itlb(address, privileged);
+
+        if (!entry)
+        {
+            raise(address, EXPEVT_TLB_MISS_READ, VECTOR_TLB_MISS);
+            return false;
+        }
+
+        if (!privileged && !(entry->ptel & (2u << PTEL_PR_SHIFT)))
+        {
+            raise(address, EXPEVT_TLB_PROTECTION_READ, VECTOR_GENERAL);
+            return false;
+        }
+    }
+    else
+    {
+        bool write = access == Sh4_Access::Write;
+
+        entry = search_utlb(address, privileged);
+
+        if (!entry)
+        {
+            raise(address, write ? EXPEVT_TLB_MISS_WRITE : EXPEVT_TLB_MISS_READ, VECTOR_TLB_MISS);
+            return false;
+        }
+
+        // PR: Privileged read only, privileged read/write, read only, read/write
+        std::uint32_t pr = (entry->ptel >> PTEL_PR_SHIFT) & 3;
+        bool allowed = write ? (privileged ? (pr & 1) : pr == 3) : (privileged || (pr & 2));
+
+        if (!allowed)
+        {
+            raise(address, write ? EXPEVT_TLB_PROTECTION_WRITE : EXPEVT_TLB_PROTECTION_READ, VECTOR_GENERAL);
+            return false;
+        }
+
+        if (write && !(entry->ptel & PTEL_D_BIT))
+        {
+            raise(address, EXPEVT_INITIAL_PAGE_WRITE, VECTOR_GENERAL);
+            return false;
+        }
+    }
+
+    p_addr = ((entry->ptel & PTEL_PPN_MASK & ~entry->mask) | (address & entry->mask)) & 0x1FFFFFFF;
+
+    Lookup_Entry &cached = lookup[static_cast<std::size_t>(access)][(address >> 10) & (MMU_LOOKUP_ENTRIES - 1)];
+
+    cached.tag = (address & 0xFFFFFC00) | LOOKUP_VALID | privileged;
+    cached.page = p_addr & 0xFFFFFC00;
+
+    return true;
+}
+
+bool Sh4_Mmu::probe(std::uint32_t address, bool write, bool privileged, std::uint32_t &p_addr) const
+{
+    p_addr = address & 0x1FFFFFFF;
+
+    if (!translating_ || (address >= 0x80000000 && (address >> 29) != 6))
+    {
+        return true;
+    }
+
+    bool check_asid = !(privileged && (mmucr & MMUCR_SV_BIT));
+
+    for (const Sh4_Tlb_Entry &entry : utlb)
+    {
+        if (!tlb_match(entry, address, pteh & PTEH_ASID_MASK, check_asid))
+        {
+            continue;
+        }
+
+        std::uint32_t pr = (entry.ptel >> PTEL_PR_SHIFT) & 3;
+        bool allowed = write ? (privileged ? (pr & 1) : pr == 3) && (entry.ptel & PTEL_D_BIT) : (privileged || (pr & 2));
+
+        p_addr = ((entry.ptel & PTEL_PPN_MASK & ~entry.mask) | (address & entry.mask)) & 0x1FFFFFFF;
+        return allowed;
+    }
+
+    return false;
+}
+
+/*
+    PTEH/PTEL/PTEA go to the UTLB entry MMUCR.URC points to
+*/
+void Sh4_Mmu::ldtlb()
+{
+    Sh4_Tlb_Entry &entry = utlb[(mmucr >> MMUCR_URC_SHIFT) & 0x3F];
+
+    entry.pteh = pteh & (PTEH_VPN_MASK | PTEH_ASID_MASK);
+    entry.ptel = ptel & PTEL_WRITABLE_MASK;
+    entry.ptea = ptea & 0xF;
+    entry.mask = page_mask(entry.ptel);
+
+    flush_lookup();
+}
+
+void Sh4_Mmu::write_mmucr(std::uint32_t value)
+{
+    if (value & MMUCR_TI_BIT)
+    {
+        for (Sh4_Tlb_Entry &entry : utlb)
+        {
+            entry.ptel &= ~PTEL_V_BIT;
+        }
+
+        for (Sh4_Tlb_Entry &entry : itlb)
+        {
+            entry.ptel &= ~PTEL_V_BIT;
+        }
+    }
+
+    mmucr = value & MMUCR_WRITABLE_MASK & ~MMUCR_TI_BIT;
+
+    flush_lookup();
+}
+
+bool Sh4_Mmu::is_register(std::uint32_t p_addr)
+{
+    switch (p_addr)
+    {
+        case 0x1F000000:
+        case 0x1F000004:
+        case 0x1F000008:
+        case 0x1F00000C:
+        case 0x1F000010:
+        case 0x1F000034:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+std::uint32_t Sh4_Mmu::read_register(std::uint32_t p_addr)
+{
+    switch (p_addr)
+    {
+        case 0x1F000000: return pteh;
+        case 0x1F000004: return ptel;
+        case 0x1F000008: return ttb;
+        case 0x1F00000C: return tea;
+        case 0x1F000010: return mmucr;
+        case 0x1F000034: return ptea;
+        default: return 0;
+    }
+}
+
+void Sh4_Mmu::write_register(std::uint32_t p_addr, std::uint32_t value)
+{
+    switch (p_addr)
+    {
+        case 0x1F000000:
+            // Cached translations don't know about ASIDs
+            if ((value & PTEH_ASID_MASK) != (pteh & PTEH_ASID_MASK))
+            {
+                flush_lookup();
+            }
+
+            pteh = value & (PTEH_VPN_MASK | PTEH_ASID_MASK);
+            break;
+
+        case 0x1F000004: ptel = value & PTEL_WRITABLE_MASK; break;
+        case 0x1F000008: ttb = value; break;
+        case 0x1F00000C: tea = value; break;
+        case 0x1F000010: write_mmucr(value); break;
+        case 0x1F000034: ptea = value & 0xF; break;
+        default: break;
+    }
+}
+
+/*
+    Address arrays hold VPN, (D,) V and ASID, data arrays 1 the PTEL fields and
+    data arrays 2 (Bit 23 set) the PTEA ones
+*/
+std::uint32_t Sh4_Mmu::read_array(std::uint32_t address)
+{
+    bool data_2 = address & (1u << 23);
+
+    switch (address >> 24)
+    {
+        case 0xF2:
+        {
+            const Sh4_Tlb_Entry &entry = itlb[(address >> 8) & 3];
+            return entry.pteh | (entry.ptel & PTEL_V_BIT);
+        }
+
+        case 0xF3:
+        {
+            const Sh4_Tlb_Entry &entry = itlb[(address >> 8) & 3];
+            return data_2 ? entry.ptea : entry.ptel;
+        }
+
+        case 0xF6:
+        {
+            const Sh4_Tlb_Entry &entry = utlb[(address >> 8) & 0x3F];
+            return entry.pteh | (entry.ptel & PTEL_V_BIT) | ((entry.ptel & PTEL_D_BIT) << 7);
+        }
+
+        default:
+        {
+            const Sh4_Tlb_Entry &entry = utlb[(address >> 8) & 0x3F];
+            return data_2 ? entry.ptea : entry.ptel;
+        }
+    }
+}
+
+void Sh4_Mmu::write_array(std::uint32_t address, std::uint32_t value, bool privileged)
+{
+    bool data_2 = address & (1u << 23);
+    std::uint32_t v = value & PTEL_V_BIT;
+    std::uint32_t d = (value >> 7) & PTEL_D_BIT;
+
+    switch (address >> 24)
+    {
+        case 0xF2:
+        {
+            Sh4_Tlb_Entry &entry = itlb[(address >> 8) & 3];
+
+            entry.pteh = value & (PTEH_VPN_MASK | PTEH_ASID_MASK);
+            entry.ptel = (entry.ptel & ~PTEL_V_BIT) | v;
+            break;
+        }
+
+        case 0xF3:
+        {
+            Sh4_Tlb_Entry &entry = itlb[(address >> 8) & 3];
+
+            if (data_2)
+            {
+                entry.ptea = value & 0xF;
+            }
+            else
+            {
+                entry.ptel = value & PTEL_WRITABLE_MASK & ~((1u << PTEL_PR_SHIFT) | PTEL_D_BIT | PTEL_WT_BIT);
+                entry.mask = page_mask(entry.ptel);
+            }
+            break;
+        }
+
+        case 0xF6:
+        {
+            // Associative: updates D/V of whatever entries the VPN (And ASID) hits
+            if (address & (1u << 7))
+            {
+                bool check_asid = !(privileged && (mmucr & MMUCR_SV_BIT));
+
+                for (Sh4_Tlb_Entry &entry : utlb)
+                {
+                    if (tlb_match(entry, value, value & PTEH_ASID_MASK, check_asid))
+                    {
+                        entry.ptel = (entry.ptel & ~(PTEL_V_BIT | PTEL_D_BIT)) | v | d;
+                    }
+                }
+
+                for (Sh4_Tlb_Entry &entry : itlb)
+                {
+                    if (tlb_match(entry, value, value & PTEH_ASID_MASK, check_asid))
+                    {
+                        entry.ptel = (entry.ptel & ~PTEL_V_BIT) | v;
+                    }
+                }
+            }
+            else
+            {
+                Sh4_Tlb_Entry &entry = utlb[(address >> 8) & 0x3F];
+
+                entry.pteh = value & (PTEH_VPN_MASK | PTEH_ASID_MASK);
+                entry.ptel = (entry.ptel & ~(PTEL_V_BIT | PTEL_D_BIT)) | v | d;
+            }
+            break;
+        }
+
+        default:
+        {
+            Sh4_Tlb_Entry &entry = utlb[(address >> 8) & 0x3F];
+
+            if (data_2)
+            {
+                entry.ptea = value & 0xF;
+            }
+            else
+            {
+                entry.ptel = value & PTEL_WRITABLE_MASK;
+                entry.mask = page_mask(entry.ptel);
+            }
+            break;
+        }
+    }
+
+    flush_lookup();
+}
@@ -0,0 +1,174 @@
+#include <cpu/sh4_perf_map.hh>
+#include <lucid.hh>
+#include <ctime>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+/*
+    jitdump format (See tools/perf/Documentation/jitdump-specification.txt)
+*/
+namespace
+{
+    constexpr std::uint32_t JITDUMP_MAGIC = 0x4A695444;     // "JiTD"
+    constexpr std::uint32_t JITDUMP_VERSION = 1;
+    constexpr std::uint32_t JITDUMP_ELF_X86_64 = 62;
+    constexpr std::uint32_t JITDUMP_CODE_LOAD = 0;
+
+    struct Jitdump_Header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t total_size;
+        std::uint32_t elf_mach;
+        std::uint32_t pad1;
+        std::uint32_t pid;
+        std::uint64_t timestamp;
+        std::uint64_t flags;
+    };
+
+    struct Jitdump_Code_Load {
+        std::uint32_t id;
+        std::uint32_t total_size;
+        std::uint64_t timestamp;
+        std::uint32_t pid;
+        std::uint32_t tid;
+        std::uint64_t vma;
+        std::uint64_t code_addr;
+        std::uint64_t code_size;
+        std::uint64_t code_index;
+    };
+}
+
+std::string sh4_perf_name(std::uint32_t guest_pc)
+{
+    std::uint32_t p_addr = guest_pc & 0x1FFFFFFF;
+    const char *region = "other";
+
+    if (p_addr <= 0x001FFFFF)
+    {
+        region = "bios";
+    }
+    else if (p_addr >= 0x00200000 && p_addr <= 0x0023FFFF)
+    {
+        region = "flash";
+    }
+    else if (p_addr >= 0x0C000000 && p_addr <= 0x0FFFFFFF)
+    {
+        region = "ram";
+    }
+
+    return format("sh4_{:08X}_{}", guest_pc, region);
+}
+
+Sh4_Perf_Map::Sh4_Perf_Map()
+{
+    map_file = nullptr;
+    dump_file = nullptr;
+    dump_marker = nullptr;
+    code_index = 0;
+}
+
+Sh4_Perf_Map::~Sh4_Perf_Map()
+{
+    if (map_file)
+    {
+        std::fclose(map_file);
+    }
+
+    if (dump_marker)
+    {
+        munmap(dump_marker, sysconf(_SC_PAGESIZE));
+    }
+
+    if (dump_file)
+    {
+        std::fclose(dump_file);
+    }
+}
+
+std::uint64_t Sh4_Perf_Map::timestamp()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return static_cast<std::uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+bool Sh4_Perf_Map::open_map()
+{
+    std::string path = format("/tmp/perf-{}.map", getpid());
+    map_file = std::fopen(path.c_str(), "w");
+
+    if (!map_file)
+    {
+        lucid_err() << BOLDRED << "Couldn't create " << path << RESET << "\n";
+        return false;
+    }
+
+    lucid_out() << BOLDBLUE << "Writing JIT symbols to " << path << RESET << "\n";
+    return true;
+}
+
+bool Sh4_Perf_Map::open_dump()
+{
+    std::string path = format("/tmp/jit-{}.dump", getpid());
+    dump_file = std::fopen(path.c_str(), "w+");
+
+    if (!dump_file)
+    {
+        lucid_err() << BOLDRED << "Couldn't create " << path << RESET << "\n";
+        return false;
+    }
+
+    void *marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(dump_file), 0);
+    dump_marker = (marker != MAP_FAILED) ? marker : nullptr;
+
+    Jitdump_Header header = {JITDUMP_MAGIC, JITDUMP_VERSION, sizeof(Jitdump_Header), JITDUMP_ELF_X86_64, 0,
+                             static_cast<std::uint32_t>(getpid()), timestamp(), 0};
+
+    std::fwrite(&header, sizeof(header), 1, dump_file);
+    std::fflush(dump_file);
+
+    lucid_out() << BOLDBLUE << "Writing jitdump to " << path << RESET << "\n";
+    return true;
+}
+
+void Sh4_Perf_Map::record(std::uint32_t guest_pc, const void *code, std::size_t size)
+{
+    std::string name = sh4_perf_name(guest_pc);
+
+    if (map_file)
+    {
+        std::fprintf(map_file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(code), size, name.c_str());
+        std::fflush(map_file);
+    }
+
+    if (dump_file)
+    {
+        Jitdump_Code_Load load = {};
+
+        load.id = JITDUMP_CODE_LOAD;
+        load.total_size = sizeof(load) + name.size() + 1 + size;
+        load.timestamp = timestamp();
+        load.pid = getpid();
+        load.tid = static_cast<std::uint32_t>(syscall(SYS_gettid));
+        load.vma = reinterpret_cast<std::uint64_t>(code);
+        load.code_addr = load.vma;
+        load.code_size = size;
+        load.code_index = code_index++;
+
+        std::fwrite(&load, sizeof(load), 1, dump_file);
+        std::fwrite(name.c_str(), name.size() + 1, 1, dump_file);
+        std::fwrite(code, size, 1, dump_file);
+        std::fflush(dump_file);
+    }
+}
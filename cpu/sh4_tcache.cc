@@ -0,0 +1,336 @@
+#include <cpu/sh4_tcache.hh>
+#include <lucid.hh>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable_v<Sh4_Ir_Inst>, "IR instructions are stored as-is");
+
+namespace
+{
+    struct Tcache_Header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t build_id;
+        std::uint64_t rom_hash;
+        std::uint32_t entry_count;
+        std::uint32_t inst_size;
+    };
+
+    // Opcodes are padded so that the IR after them stays aligned
+    std::uint32_t opcodes_size(std::uint32_t count)
+    {
+        return (count * sizeof(std::uint16_t) + 7) & ~7u;
+    }
+
+    std::uint32_t entry_size(std::uint32_t opcode_count, std::uint32_t inst_count)
+    {
+        return sizeof(Sh4_Tcache_Entry) + opcodes_size(opcode_count) + inst_count * sizeof(Sh4_Ir_Inst);
+    }
+
+    /*
+        Anything that changes with a rebuild, a new build means the IR may be
+        lowered differently. The file is whichever one has this code in it:
+        liblucid.so when the emulator is linked as a shared library (The
+        executable then belongs to whatever embeds it), the executable otherwise.
+    */
+    std::uint64_t current_build_id()
+    {
+        // The main program has no name here (dladdr gives argv[0], not necessarily a path)
+        std::string path = "/proc/self/exe";
+
+        dl_iterate_phdr([](dl_phdr_info *object, std::size_t, void *data)
+        {
+            std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&current_build_id);
+
+            for (int i = 0; i < object->dlpi_phnum; i++)
+            {
+                const ElfW(Phdr) &segment = object->dlpi_phdr[i];
+                std::uintptr_t start = object->dlpi_addr + segment.p_vaddr;
+
+                if (segment.p_type == PT_LOAD && address >= start && address < start + segment.p_memsz)
+                {
+                    if (object->dlpi_name && object->dlpi_name[0])
+                    {
+                        *static_cast<std::string *>(data) = object->dlpi_name;
+                    }
+
+                    return 1;
+                }
+            }
+
+            return 0;
+        }, &path);
+
+        struct stat info = {};
+        stat(path.c_str(), &info);
+
+        std::uint64_t id[] = {
+            TCACHE_VERSION,
+            sizeof(Sh4_Ir_Inst),
+            static_cast<std::uint64_t>(info.st_size),
+            static_cast<std::uint64_t>(info.st_mtime)
+        };
+
+        return sh4_tcache_hash(id, sizeof(id));
+    }
+}
+
+/*
+    FNV-1a
+*/
+std::uint64_t sh4_tcache_hash(const void *data, std::size_t size, std::uint64_t hash)
+{
+    const std::uint8_t *bytes = static_cast<const std::uint8_t *>(data);
+
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+Sh4_Translation_Cache::Sh4_Translation_Cache()
+{
+    mapping = nullptr;
+    mapping_size = 0;
+    build_id = 0;
+    rom_hash = 0;
+
+    hits = 0;
+    misses = 0;
+    stale = 0;
+}
+
+Sh4_Translation_Cache::~Sh4_Translation_Cache()
+{
+    unmap();
+}
+
+void Sh4_Translation_Cache::unmap()
+{
+    if (mapping)
+    {
+        munmap(const_cast<std::uint8_t *>(mapping), mapping_size);
+    }
+
+    mapping = nullptr;
+    mapping_size = 0;
+    loaded.clear();
+}
+
+/*
+    Maps the cache file (If there's one) and indexes its entries. A missing file is
+    fine, it gets created by save()
+*/
+void Sh4_Translation_Cache::open(const std::string &path_, Memory *memory)
+{
+    unmap();
+
+    path = path_;
+    build_id = current_build_id();
+    rom_hash = sh4_tcache_hash(memory->bios, 2 * 1024 * 1024);
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat info = {};
+    fstat(fd, &info);
+
+    if (info.st_size < static_cast<off_t>(sizeof(Tcache_Header)))
+    {
+        close(fd);
+        return;
+    }
+
+    void *file = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (file == MAP_FAILED)
+    {
+        lucid_err() << BOLDMAGENTA << "Translation cache: Couldn't map " << path << ", starting from scratch" << RESET << "\n";
+        return;
+    }
+
+    mapping = static_cast<const std::uint8_t *>(file);
+    mapping_size = info.st_size;
+
+    const Tcache_Header *header = reinterpret_cast<const Tcache_Header *>(mapping);
+
+    if (header->magic != TCACHE_MAGIC || header->version != TCACHE_VERSION || header->inst_size != sizeof(Sh4_Ir_Inst)
+        || header->build_id != build_id || header->rom_hash != rom_hash)
+    {
+        lucid_out() << BOLDMAGENTA << "Translation cache: " << path << " is from another build or Boot ROM, ignoring it" << RESET << "\n";
+        unmap();
+        return;
+    }
+
+    std::size_t offset = sizeof(Tcache_Header);
+
+    for (std::uint32_t i = 0; i < header->entry_count; i++)
+    {
+        if (offset + sizeof(Sh4_Tcache_Entry) > mapping_size)
+        {
+            break;
+        }
+
+        const Sh4_Tcache_Entry *entry = reinterpret_cast<const Sh4_Tcache_Entry *>(mapping + offset);
+
+        // Truncated or corrupted, keep what was read so far
+        if (entry->size != entry_size(entry->opcode_count, entry->inst_count) || offset + entry->size > mapping_size)
+        {
+            break;
+        }
+
+        loaded[entry->start_pc] = entry;
+        offset += entry->size;
+    }
+
+    lucid_out() << BOLDBLUE << "Translation cache: " << loaded.size() << " blocks loaded from " << path << RESET << "\n";
+}
+
+bool Sh4_Translation_Cache::find(std::uint32_t start_pc, const std::vector<std::uint16_t> &opcodes, Sh4_Ir_Block &ir,
+                                 std::uint32_t &decoded_state_accesses, std::uint32_t &flags)
+{
+    auto it = loaded.find(start_pc);
+
+    if (it == loaded.end())
+    {
+        misses++;
+        return false;
+    }
+
+    const Sh4_Tcache_Entry *entry = it->second;
+    const std::uint8_t *data = reinterpret_cast<const std::uint8_t *>(entry + 1);
+
+    std::size_t size = opcodes.size() * sizeof(std::uint16_t);
+
+    if (entry->opcode_count != opcodes.size() || entry->code_hash != sh4_tcache_hash(opcodes.data(), size)
+        || memcmp(data, opcodes.data(), size))
+    {
+        // The code at that address isn't the one that was cached
+        stale++;
+        return false;
+    }
+
+    const Sh4_Ir_Inst *insts = reinterpret_cast<const Sh4_Ir_Inst *>(data + opcodes_size(entry->opcode_count));
+
+    ir.start_pc = entry->start_pc;
+    ir.end_pc = entry->end_pc;
+    ir.value_count = entry->value_count;
+    ir.insts.assign(insts, insts + entry->inst_count);
+
+    decoded_state_accesses = entry->decoded_state_accesses;
+    flags = entry->flags;
+
+    hits++;
+    return true;
+}
+
+void Sh4_Translation_Cache::record(const Sh4_Ir_Block &ir, const std::vector<std::uint16_t> &opcodes,
+                                   std::uint32_t decoded_state_accesses, std::uint32_t flags)
+{
+    Sh4_Tcache_Entry entry = {};
+
+    entry.start_pc = ir.start_pc;
+    entry.end_pc = ir.end_pc;
+    entry.code_hash = sh4_tcache_hash(opcodes.data(), opcodes.size() * sizeof(std::uint16_t));
+    entry.opcode_count = opcodes.size();
+    entry.inst_count = ir.insts.size();
+    entry.value_count = ir.value_count;
+    entry.decoded_state_accesses = decoded_state_accesses;
+    entry.flags = flags;
+    entry.size = entry_size(entry.opcode_count, entry.inst_count);
+
+    std::vector<std::uint8_t> &bytes = recorded[ir.start_pc];
+    bytes.assign(entry.size, 0);
+
+    memcpy(bytes.data(), &entry, sizeof(entry));
+    memcpy(bytes.data() + sizeof(entry), opcodes.data(), opcodes.size() * sizeof(std::uint16_t));
+    memcpy(bytes.data() + sizeof(entry) + opcodes_size(entry.opcode_count), ir.insts.data(), ir.insts.size() * sizeof(Sh4_Ir_Inst));
+}
+
+void Sh4_Translation_Cache::set_flags(std::uint32_t start_pc, std::uint32_t flags)
+{
+    auto it = recorded.find(start_pc);
+
+    if (it == recorded.end())
+    {
+        auto entry = loaded.find(start_pc);
+
+        if (entry == loaded.end() || (entry->second->flags & flags) == flags)
+        {
+            return;
+        }
+
+        // Copy it out of the (Read-only) mapping
+        const std::uint8_t *bytes = reinterpret_cast<const std::uint8_t *>(entry->second);
+        it = recorded.emplace(start_pc, std::vector<std::uint8_t>(bytes, bytes + entry->second->size)).first;
+    }
+
+    reinterpret_cast<Sh4_Tcache_Entry *>(it->second.data())->flags |= flags;
+}
+
+/*
+    Writes every entry (Loaded ones that weren't rebuilt, plus the new ones) to a
+    temporary file and moves it over the old one, the current mapping stays valid
+*/
+bool Sh4_Translation_Cache::save()
+{
+    if (path.empty() || recorded.empty())
+    {
+        return true;
+    }
+
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        lucid_err() << BOLDRED << "Translation cache: Couldn't write " << temporary << RESET << "\n";
+        return false;
+    }
+
+    Tcache_Header header = {TCACHE_MAGIC, TCACHE_VERSION, build_id, rom_hash, 0, sizeof(Sh4_Ir_Inst)};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (auto &[pc, entry] : loaded)
+    {
+        if (!recorded.count(pc))
+        {
+            file.write(reinterpret_cast<const char *>(entry), entry->size);
+            header.entry_count++;
+        }
+    }
+
+    for (auto &[pc, bytes] : recorded)
+    {
+        file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+        header.entry_count++;
+    }
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.close();
+
+    if (!file || std::rename(temporary.c_str(), path.c_str()))
+    {
+        lucid_err() << BOLDRED << "Translation cache: Couldn't write " << path << RESET << "\n";
+        return false;
+    }
+
+    return true;
+}
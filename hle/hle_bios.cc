@@ -0,0 +1,300 @@
+#include <hle/hle_bios.hh>
+#include <lucid.hh>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+/*
+    Flash partitions (Offset, size), indexed by the FLASHROM_INFO partition number
+*/
+static constexpr std::array<std::array<std::uint32_t, 2>, 5> flash_partitions = {{
+    { 0x1A000, 0x2000 },    // System (Factory settings, console ID...)
+    { 0x18000, 0x2000 },    // Reserved
+    { 0x1C000, 0x4000 },    // Block 1 (User settings)
+    { 0x10000, 0x8000 },    // Settings
+    { 0x00000, 0x10000 }    // Block 2
+}};
+
+// Console ID inside the system partition
+#define FLASH_CONSOLE_ID        0x1A056
+
+#define GDROM_STATUS_NO_DISC    7
+
+Hle_Bios::Hle_Bios(Sh4_Cpu *cpu_, Memory *memory_)
+{
+    cpu = cpu_;
+    memory = memory_;
+}
+
+/*
+    Machine state the BIOS hands over to a program
+*/
+void Hle_Bios::boot(std::uint32_t entry)
+{
+    lucid_out() << BOLDBLUE << "HLE BIOS: Booting 0x" << format("{:08X}", entry) << RESET << std::endl;
+
+    for (std::uint8_t i = 0; i < static_cast<std::uint8_t>(Stub::Count); i++)
+    {
+        memory->write<std::uint16_t>(stub_address(static_cast<Stub>(i)), HLE_TRAP_OPCODE, cpu);
+        memory->write<std::uint16_t>(stub_address(static_cast<Stub>(i)) + 2, 0x0009, cpu);
+    }
+
+    memory->write<std::uint32_t>(HLE_VECTOR_SYSINFO, stub_address(Stub::Sysinfo), cpu);
+    memory->write<std::uint32_t>(HLE_VECTOR_ROMFONT, stub_address(Stub::Romfont), cpu);
+    memory->write<std::uint32_t>(HLE_VECTOR_FLASHROM, stub_address(Stub::Flashrom), cpu);
+    memory->write<std::uint32_t>(HLE_VECTOR_GDROM, stub_address(Stub::Gdrom), cpu);
+    memory->write<std::uint32_t>(HLE_VECTOR_SYSTEM, stub_address(Stub::System), cpu);
+
+    copy_to_guest(HLE_SYSINFO_ADDRESS, &memory->flash[FLASH_CONSOLE_ID], 8);
+
+    // Privileged, register bank 0, exceptions enabled but every interrupt masked
+    cpu->set_sr(0x400000F0);
+    cpu->set_vbr(0x8C00F400);
+    cpu->set_gbr(0x8C000000);
+    cpu->set_fpscr(0x00040001);
+
+    for (std::uint8_t i = 0; i < 15; i++)
+    {
+        cpu->set_register(i, 0);
+    }
+
+    cpu->set_register(15, 0x8D000000);
+
+    // Returning from the program ends up in the BIOS menu
+    cpu->set_pr(stub_address(Stub::Exit));
+
+    cpu->set_pc(entry);
+    cpu->set_delay_pc(entry + 2);
+}
+
+bool Hle_Bios::copy_to_guest(std::uint32_t address, const std::uint8_t *data, std::uint32_t size)
+{
+    std::uint8_t *to = memory->ram_pointer(address, size);
+
+    if (!to)
+    {
+        return false;
+    }
+
+    std::memcpy(to, data, size);
+    memory->ram_written(address, size);
+
+    return true;
+}
+
+void Hle_Bios::syscall(std::uint32_t pc)
+{
+    std::uint32_t result;
+
+    if (pc == stub_address(Stub::Sysinfo))
+    {
+        result = sysinfo();
+    }
+    else if (pc == stub_address(Stub::Romfont))
+    {
+        result = romfont();
+    }
+    else if (pc == stub_address(Stub::Flashrom))
+    {
+        result = flashrom();
+    }
+    else if (pc == stub_address(Stub::Gdrom))
+    {
+        result = gdrom();
+    }
+    else if (pc == stub_address(Stub::System) || pc == stub_address(Stub::Exit))
+    {
+        result = system(pc == stub_address(Stub::Exit));
+    }
+    else
+    {
+        lucid_err() << BOLDRED << "HLE BIOS: Trap outside of a syscall stub at 0x" << format("{:08X}", pc) << RESET << "\n";
+        cpu->print_registers();
+        lucid_stop(Lucid_Status::Unimplemented);
+        return;
+    }
+
+    cpu->set_register(0, result);
+
+    // Same as the RTS at the end of the real handlers, minus the delay slot
+    cpu->set_pc(cpu->get_pr());
+    cpu->set_delay_pc(cpu->get_pr() + 2);
+}
+
+/*
+    R7: 0 = Init, 2 = Icon, 3 = ID
+*/
+std::uint32_t Hle_Bios::sysinfo()
+{
+    switch (cpu->get_register(7))
+    {
+        case 0:
+            copy_to_guest(HLE_SYSINFO_ADDRESS, &memory->flash[FLASH_CONSOLE_ID], 8);
+            return 0;
+
+        case 2:
+        {
+            // No icons without the real ROM, hand out a blank one
+            std::array<std::uint8_t, 704> icon = {};
+            copy_to_guest(cpu->get_register(5), icon.data(), icon.size());
+            return icon.size();
+        }
+
+        case 3:
+            return HLE_SYSINFO_ADDRESS;
+
+        default:
+            lucid_out() << BOLDMAGENTA << "HLE BIOS: Unhandled SYSINFO function " << cpu->get_register(7) << RESET << std::endl;
+            return 0xFFFFFFFF;
+    }
+}
+
+/*
+    R1: 0 = Font address, 1 = Lock, 2 = Unlock
+*/
+std::uint32_t Hle_Bios::romfont()
+{
+    switch (cpu->get_register(1))
+    {
+        case 0:
+            return 0xA0100020;
+
+        case 1:
+        case 2:
+            return 0;
+
+        default:
+            lucid_out() << BOLDMAGENTA << "HLE BIOS: Unhandled ROMFONT function " << cpu->get_register(1) << RESET << std::endl;
+            return 0xFFFFFFFF;
+    }
+}
+
+/*
+    R7: 0 = Info, 1 = Read, 2 = Write, 3 = Delete
+*/
+std::uint32_t Hle_Bios::flashrom()
+{
+    std::uint32_t r4 = cpu->get_register(4), r5 = cpu->get_register(5), r6 = cpu->get_register(6);
+
+    switch (cpu->get_register(7))
+    {
+        case 0:
+            // R4 = partition, R5 = where to store its offset and size
+            if (r4 >= flash_partitions.size())
+            {
+                return 0xFFFFFFFF;
+            }
+
+            memory->write<std::uint32_t>(r5, flash_partitions[r4][0], cpu);
+            memory->write<std::uint32_t>(r5 + 4, flash_partitions[r4][1], cpu);
+            return 0;
+
+        case 1:
+            // R4 = offset, R5 = destination, R6 = size
+            if (r4 >= 0x20000 || r6 > 0x20000 - r4 || !copy_to_guest(r5, &memory->flash[r4], r6))
+            {
+                return 0xFFFFFFFF;
+            }
+
+            return r6;
+
+        case 2:
+        {
+            // R4 = offset, R5 = source, R6 = size. Flash writes can only clear bits
+            std::uint8_t *from = memory->ram_pointer(r5, r6);
+
+            if (r4 >= 0x20000 || r6 > 0x20000 - r4 || !from)
+            {
+                return 0xFFFFFFFF;
+            }
+
+            for (std::uint32_t i = 0; i < r6; i++)
+            {
+                memory->flash[r4 + i] &= from[i];
+            }
+
+            return r6;
+        }
+
+        case 3:
+            // R4 = partition offset, erased back to all ones
+            for (const auto &partition : flash_partitions)
+            {
+                if (partition[0] == r4)
+                {
+                    std::memset(&memory->flash[partition[0]], 0xFF, partition[1]);
+                    return 0;
+                }
+            }
+
+            return 0xFFFFFFFF;
+
+        default:
+            lucid_out() << BOLDMAGENTA << "HLE BIOS: Unhandled FLASHROM function " << cpu->get_register(7) << RESET << std::endl;
+            return 0xFFFFFFFF;
+    }
+}
+
+/*
+    R6 = -1 (GD-ROM superfunction), R7: 0 = Send command, 1 = Check command,
+    2 = Main loop, 3 = Init, 4 = Check drive, 8 = Abort, 9 = Reset, 10 = Sector mode
+
+    There's no drive behind this, it always reports an empty tray
+*/
+std::uint32_t Hle_Bios::gdrom()
+{
+    switch (cpu->get_register(7))
+    {
+        case 0:
+            // No request ID, the command couldn't be queued
+            return 0;
+
+        case 1:
+            // R5 = status, the request failed
+            memory->write<std::uint32_t>(cpu->get_register(5), GDROM_STATUS_NO_DISC, cpu);
+            return 0xFFFFFFFF;
+
+        case 2:
+        case 3:
+        case 8:
+        case 9:
+        case 10:
+            return 0;
+
+        case 4:
+            // R4 = drive status, disc type
+            memory->write<std::uint32_t>(cpu->get_register(4), GDROM_STATUS_NO_DISC, cpu);
+            memory->write<std::uint32_t>(cpu->get_register(4) + 4, 0, cpu);
+            return 0;
+
+        default:
+            lucid_out() << BOLDMAGENTA << "HLE BIOS: Unhandled GDROM function " << cpu->get_register(7) << RESET << std::endl;
+            return 0xFFFFFFFF;
+    }
+}
+
+/*
+    R4: 0 = Init, -1 = Go back to the BIOS menu (Also where programs return to)
+*/
+std::uint32_t Hle_Bios::system(bool returned)
+{
+    if (!returned && cpu->get_register(4) == 0)
+    {
+        return 0;
+    }
+
+    lucid_out() << BOLDBLUE << "HLE BIOS: Program exited to the BIOS menu" << RESET << std::endl;
+    cpu->print_registers();
+    lucid_stop(Lucid_Status::Exited);
+
+    return 0;
+}
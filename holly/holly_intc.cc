@@ -0,0 +1,184 @@
+#include <holly/holly_intc.hh>
+#include <lucid.hh>
+#include <iostream>
+#include <bit>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+namespace {
+
+/*
+    IRL levels Holly asserts, in the order of the IML register sets
+*/
+constexpr std::uint8_t holly_levels[3] = { 2, 4, 6 };
+
+}
+
+Holly_Intc::Holly_Intc()
+{
+    istnrm = 0;
+    istext = 0;
+    isterr = 0;
+
+    for (std::uint8_t i = 0; i < 3; i++)
+    {
+        iml_nrm[i] = 0;
+        iml_ext[i] = 0;
+        iml_err[i] = 0;
+    }
+
+    pending_levels = 0;
+}
+
+void Holly_Intc::update(Sh4_Cpu *cpu)
+{
+    std::uint32_t levels = 0;
+
+    for (std::uint8_t i = 0; i < 3; i++)
+    {
+        if ((istnrm & iml_nrm[i]) || (istext & iml_ext[i]) || (isterr & iml_err[i]))
+        {
+            levels |= 1u << holly_levels[i];
+        }
+    }
+
+    if (levels == pending_levels)
+    {
+        return;
+    }
+
+    pending_levels = levels;
+
+    if (levels == 0)
+    {
+        cpu->set_interrupt_request(0, 0);
+        return;
+    }
+
+    // Highest level wins, IRL level N is INTEVT 0x200 + (15 - N) * 0x20
+    std::uint8_t level = std::bit_width(levels) - 1;
+    cpu->set_interrupt_request(level, 0x200 + (15 - level) * 0x20);
+}
+
+std::uint32_t Holly_Intc::read_register(std::uint32_t p_addr)
+{
+    std::uint32_t offset = p_addr - SB_ISTNRM;
+
+    switch (offset)
+    {
+        case 0x00:
+            return istnrm | (istext ? ISTNRM_EXT_BIT : 0) | (isterr ? ISTNRM_ERR_BIT : 0);
+
+        case 0x04:
+            return istext;
+
+        case 0x08:
+            return isterr;
+    }
+
+    std::uint8_t i = (offset >> 4) - 1;
+
+    switch (offset & 0xF)
+    {
+        case 0x0:
+            return iml_nrm[i];
+
+        case 0x4:
+            return iml_ext[i];
+
+        default:
+            return iml_err[i];
+    }
+}
+
+void Holly_Intc::write_register(std::uint32_t p_addr, std::uint32_t value, Sh4_Cpu *cpu)
+{
+    std::uint32_t offset = p_addr - SB_ISTNRM;
+
+    switch (offset)
+    {
+        case 0x00:
+            istnrm &= ~value;
+            break;
+
+        case 0x04:
+            // Read only
+            return;
+
+        case 0x08:
+            isterr &= ~value;
+            break;
+
+        default:
+        {
+            std::uint8_t i = (offset >> 4) - 1;
+
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the SB_IML" << +(holly_levels[i]) << ((offset & 0xF) == 0x0 ? "NRM" : (offset & 0xF) == 0x4 ? "EXT" : "ERR")
+                << " register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+
+            switch (offset & 0xF)
+            {
+                case 0x0:
+                    iml_nrm[i] = value & ISTNRM_STATUS_MASK;
+                    break;
+
+                case 0x4:
+                    iml_ext[i] = value & ISTEXT_STATUS_MASK;
+                    break;
+
+                default:
+                    iml_err[i] = value;
+                    break;
+            }
+            break;
+        }
+    }
+
+    update(cpu);
+}
+
+void Holly_Intc::raise(Holly_Irq_Kind kind, std::uint32_t bits, Sh4_Cpu *cpu)
+{
+    switch (kind)
+    {
+        case Holly_Irq_Kind::Normal:
+            istnrm |= bits & ISTNRM_STATUS_MASK;
+            break;
+
+        case Holly_Irq_Kind::External:
+            istext |= bits & ISTEXT_STATUS_MASK;
+            break;
+
+        case Holly_Irq_Kind::Error:
+            isterr |= bits;
+            break;
+    }
+
+    update(cpu);
+}
+
+void Holly_Intc::clear(Holly_Irq_Kind kind, std::uint32_t bits, Sh4_Cpu *cpu)
+{
+    switch (kind)
+    {
+        case Holly_Irq_Kind::Normal:
+            istnrm &= ~bits;
+            break;
+
+        case Holly_Irq_Kind::External:
+            istext &= ~bits;
+            break;
+
+        case Holly_Irq_Kind::Error:
+            isterr &= ~bits;
+            break;
+    }
+
+    update(cpu);
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <cpu/sh4_ir.hh>
+#include <cpu/sh4_jit.hh>
+#include <cpu/sh4_tcache.hh>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Longest block, in instructions (A delayed branch always keeps its delay slot)
+*/
+#define BLOCK_MAX_LENGTH            64
+
+/*
+    Blocks never span more than one page past their start, invalidation works
+    at page granularity
+*/
+#define BLOCK_PAGE_SHIFT            12
+
+/*
+    Entries in the per-block inline cache used for indirect branches (JMP @Rn...)
+*/
+#define BLOCK_INDIRECT_CACHE_SIZE   4
+
+/*
+    How a block ends
+*/
+enum class Sh4_Branch {
+    None,                   // Not a branch (Block was cut because of its length/page)
+    Conditional,            // BT/BF
+    Conditional_Delayed,    // BT/S, BF/S
+    Static_Delayed,         // BRA, BSR
+    Indirect_Delayed,       // JMP, JSR, RTS, BRAF, BSRF...
+    Stop                    // SLEEP, needs to go back to the dispatcher
+};
+
+/*
+    Subroutine calls/returns, tracked by the return-address stack
+*/
+enum class Sh4_Call {
+    None,
+    Call,                   // BSR, BSRF, JSR
+    Return                  // RTS
+};
+
+/*
+    Entries in the return-address stack (Wraps around on overflow)
+*/
+#define BLOCK_RAS_SIZE              16
+
+Sh4_Branch sh4_branch_type(std::uint16_t opcode);
+Sh4_Call sh4_call_type(std::uint16_t opcode);
+std::uint32_t sh4_branch_target(std::uint16_t opcode, std::uint32_t pc);
+
+/*
+    A run of guest instructions, decoded once and then executed from the cache.
+
+    Static successors (The target of a BT/BF/BRA/BSR and the fall-through path)
+    are linked directly once they exist, so steady-state loops go from block to
+    block without a lookup. Indirect branches go through a small inline cache.
+    Every link to a block is tracked in its "incoming" list, so that all of them
+    can be cut when the block is invalidated.
+*/
+struct Sh4_Block {
+    std::uint32_t start_pc;
+
+    // Address right after the last instruction (Delay slot included)
+    std::uint32_t end_pc;
+
+    std::vector<std::uint16_t> opcodes;
+
+    // What actually runs
+    Sh4_Ir_Block ir;
+
+    // Host code for the IR, built on the first run by the JIT engine
+    Sh4_Jit_Entry native;
+
+    // Code cache generation native was installed in, it's gone once that one is evicted
+    std::uint64_t native_generation;
+
+    // Jumps in native that can be linked to other blocks
+    Sh4_Jit_Exits native_exits;
+
+    // Guest register/T bit loads and stores per execution (As decoded, optimized IR and host code)
+    std::uint32_t decoded_state_accesses;
+    std::uint32_t ir_state_accesses;
+    std::uint32_t native_state_accesses;
+
+    Sh4_Branch branch;
+    Sh4_Call call;
+
+    // UINT32_MAX when the block can't leave through that path
+    std::uint32_t taken_pc;
+    std::uint32_t fallthrough_pc;
+
+    Sh4_Block *taken_link;
+    Sh4_Block *fallthrough_link;
+
+    // Runs so far, for the tiered engine (See Sh4_Decode::step_tiered)
+    std::uint32_t executions;
+
+    // TCACHE_FLAG_* of the translation cache entry it came from
+    std::uint32_t tcache_flags;
+
+    struct Indirect_Entry {
+        std::uint32_t pc;
+        Sh4_Block *block;
+    };
+
+    std::array<Indirect_Entry, BLOCK_INDIRECT_CACHE_SIZE> indirect_cache;
+    std::uint8_t indirect_victim;
+
+    // Call blocks only, the block at the return address (end_pc)
+    Sh4_Block *return_link;
+
+    // Link slots (In other blocks) currently pointing to this block
+    std::vector<Sh4_Block **> incoming;
+
+    // Physical pages the block was built from
+    std::uint32_t first_page;
+    std::uint32_t last_page;
+
+    bool valid;
+};
+
+class Sh4_Block_Cache {
+
+private:
+
+    Sh4_Cpu *cpu;
+    Memory *memory;
+
+    // Keyed by (virtual) start PC
+    std::unordered_map<std::uint32_t, std::unique_ptr<Sh4_Block>> blocks;
+
+    // Physical page -> blocks built from it
+    std::unordered_map<std::uint32_t, std::vector<Sh4_Block *>> pages;
+
+    /*
+        Invalidated blocks may still be running (i.e. a block overwriting its own
+        code), they are only freed by collect_retired() from the dispatcher
+    */
+    std::vector<std::unique_ptr<Sh4_Block>> retired;
+
+    /*
+        Return-address stack
+
+        Calls push the guest return address along with the calling block, whose
+        return_link caches the block at that address. RTS pops the top entry and,
+        if the address matches, goes straight there without any lookup.
+
+        "generation" changes on every invalidation, entries pushed before that
+        are treated as misses since their caller may be gone.
+    */
+    struct Ras_Entry {
+        std::uint32_t return_pc;
+        Sh4_Block *caller;
+        std::uint64_t generation;
+    };
+
+    std::array<Ras_Entry, BLOCK_RAS_SIZE> ras;
+    std::uint32_t ras_top;
+    std::uint64_t generation;
+
+    Sh4_Block *next_return(std::uint32_t pc);
+
+    Sh4_Block *compile(std::uint32_t pc);
+    Sh4_Block *successor(std::uint32_t pc);
+    void link(Sh4_Block **slot, Sh4_Block *target);
+    void unlink(Sh4_Block **slot);
+    void invalidate_block(Sh4_Block *block);
+
+public:
+
+    /*
+        Statistics
+    */
+    std::uint64_t compiled;
+    std::uint64_t invalidated;
+    std::uint64_t lookups;
+    std::uint64_t chained;
+    std::uint64_t ras_hits;
+    std::uint64_t ras_misses;
+
+    Sh4_Ir_Stats ir_stats;
+
+    // Print the IR of every new block
+    bool dump_ir;
+
+    // IR from previous runs (nullptr if disabled)
+    Sh4_Translation_Cache *tcache;
+
+    // Native links to reset when a block is invalidated (nullptr without a JIT)
+    Sh4_Jit *jit;
+
+    /*
+        Don't build successors that don't exist yet, next() returns nullptr instead
+        and the caller decides (Tiered engine, cold code stays in the interpreter)
+    */
+    bool lazy;
+
+    Sh4_Block_Cache(Sh4_Cpu *cpu_, Memory *memory_);
+    ~Sh4_Block_Cache();
+
+    Sh4_Block *lookup(std::uint32_t pc);
+    Sh4_Block *find(std::uint32_t pc);
+    Sh4_Block *next(Sh4_Block *block, std::uint32_t pc);
+
+    void invalidate_page(std::uint32_t p_addr);
+    void flush();
+
+    void collect_retired()
+    {
+        if (!retired.empty())
+        {
+            retired.clear();
+        }
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Default size of the JIT code cache, and how many generations it's split in
+*/
+#define CODE_CACHE_DEFAULT_SIZE     (16 * 1024 * 1024)
+#define CODE_CACHE_MIN_SIZE         (1 * 1024 * 1024)
+#define CODE_CACHE_GENERATIONS      4
+
+/*
+    Executable memory for the JIT
+
+    The buffer is split in CODE_CACHE_GENERATIONS equal regions that are filled
+    one after the other. When the current one is full, the next region is reused,
+    which evicts all the code of the oldest generation at once (The rest of the
+    cache stays), so the memory used never goes over the configured size.
+
+    Generations are numbered from 0 and never reused, code installed during
+    generation g is valid as long as live(g): callers keep the generation next to
+    the code pointer and check it before running it, nothing has to walk the
+    blocks on an eviction. flush() drops every generation.
+
+    W^X: the memory is mapped twice (memfd), once writable for the emitter and
+    once executable, and no page is ever both. Without memfd there's a single
+    mapping whose pages are only made writable while code is being copied in.
+    If neither can be had the cache stays empty (mapped() is false, install()
+    never succeeds), the JIT engines refuse to start then.
+*/
+class Sh4_Code_Cache {
+
+private:
+
+    int fd;
+
+    // Writable and executable views of the same memory (The same pointer without memfd)
+    std::uint8_t *write_view;
+    std::uint8_t *exec_view;
+
+    std::size_t size;
+    std::size_t generation_size;
+
+    std::uint64_t current;
+
+    // Bytes used in each region
+    std::array<std::size_t, CODE_CACHE_GENERATIONS> used;
+
+    void map(std::size_t size_);
+    void write(std::size_t offset, const std::uint8_t *data, std::size_t length);
+    void unmap();
+    void next_generation();
+
+public:
+
+    /*
+        Statistics
+    */
+    std::uint64_t installed;
+    std::uint64_t evictions;
+    std::uint64_t flushes;
+
+    Sh4_Code_Cache();
+    ~Sh4_Code_Cache();
+
+    // Remaps the cache with a new size (Everything in it is dropped)
+    void resize(std::size_t size_);
+
+    /*
+        Copies host code in, returns where it can be run from (nullptr if it
+        doesn't fit in a generation)
+    */
+    const std::uint8_t *install(const std::uint8_t *data, std::size_t length);
+
+    // Overwrites code that was already installed (Backpatching)
+    void patch(const std::uint8_t *address, const std::uint8_t *data, std::size_t length);
+
+    bool contains(std::uintptr_t address) const
+    {
+        return address >= reinterpret_cast<std::uintptr_t>(exec_view) && address < reinterpret_cast<std::uintptr_t>(exec_view) + size;
+    }
+
+    void flush();
+
+    // Generation new code goes to
+    std::uint64_t generation() const
+    {
+        return current;
+    }
+
+    bool live(std::uint64_t generation_) const
+    {
+        return generation_ + CODE_CACHE_GENERATIONS > current;
+    }
+
+    std::size_t capacity() const
+    {
+        return size;
+    }
+
+    // Bytes of code that are still live
+    std::size_t occupancy() const;
+
+    bool mapped() const
+    {
+        return exec_view != nullptr;
+    }
+
+    bool dual_mapped() const
+    {
+        return write_view != exec_view;
+    }
+};
@@ -1,15 +1,101 @@
 #pragma once
 
+#include <cpu/sh4_mmu.hh>
 #include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
 
 #define	SR_INITIAL_VALUE		0b01110000000000000000000011110000
 #define SR						status_register
 #define SR_RB_BIT				((SR) & (1u << 29))
+#define SR_MD					(1u << 30)
+#define SR_RB					(1u << 29)
+#define SR_BL					(1u << 28)
+#define SR_FD					(1u << 15)
+#define SR_IMASK_SHIFT			4
+#define SR_IMASK_MASK			(0xFu << SR_IMASK_SHIFT)
+#define SR_WRITABLE_MASK		0x700083F3
 #define	FPSCR_INITIAL_VALUE		0b00000000000001000000000000000001
-#define UNDEFINED_REG_VAL		(static_cast<uint32_t>(rand()) | (static_cast<uint32_t>(rand()) << 16))
+#define FPSCR_FR_BIT			(1u << 21)
+#define FPSCR_SZ_BIT			(1u << 20)
+#define FPSCR_PR_BIT			(1u << 19)
+#define FPSCR_DN_BIT			(1u << 18)
+#define FPSCR_RM_MASK			0b11
+
+/*
+	Exception codes (EXPEVT) and where their handlers are (Offset from VBR)
+*/
+#define EXPEVT_TLB_MISS_READ			0x040	// Instruction fetches too
+#define EXPEVT_TLB_MISS_WRITE			0x060
+#define EXPEVT_INITIAL_PAGE_WRITE		0x080
+#define EXPEVT_TLB_PROTECTION_READ		0x0A0	// Instruction fetches too
+#define EXPEVT_TLB_PROTECTION_WRITE		0x0C0
+#define EXPEVT_TRAPA					0x160
+#define EXPEVT_ILLEGAL_INSTRUCTION		0x180
+#define EXPEVT_SLOT_ILLEGAL_INSTRUCTION	0x1A0
+#define EXPEVT_MANUAL_RESET				0x020
+
+#define VECTOR_GENERAL					0x100
+#define VECTOR_TLB_MISS					0x400
+#define VECTOR_INTERRUPT				0x600
+
+#define UNDEFINED_REG_VAL		(static_cast<uint32_t>(undefined_values()))
+
+/*
+	Default seed for what registers hold at power on (See Sh4_Cpu::undefined_values)
+*/
+#define SH4_DEFAULT_SEED		0x5EED
+
+/*
+	Guest visible CPU state as plain values (See Sh4_Cpu::save_state), the
+	instruction tests build it from scratch and hash it
+*/
+struct Sh4_Cpu_State {
+	std::uint32_t r_bank0[8];
+	std::uint32_t r_bank1[8];
+	std::uint32_t r[8];			// R8-R15
+
+	std::uint32_t sr;
+	std::uint32_t ssr;
+	std::uint32_t spc;
+	std::uint32_t gbr;
+	std::uint32_t vbr;
+	std::uint32_t sgr;
+	std::uint32_t dbr;
+	std::uint32_t mach;
+	std::uint32_t macl;
+	std::uint32_t pr;
+	std::uint32_t pc;
+	std::uint32_t delay_pc;
+	std::uint32_t fpscr;
+	std::uint32_t fpul;
+	std::uint32_t fpr[2][16];	// By bank, not by FPSCR.FR
+	std::uint32_t sleeping;
+	std::uint32_t expevt;
+	std::uint32_t intevt;
+	std::uint32_t tra;
+	std::uint32_t mmucr;
+	std::uint32_t ccr;
+};
+
+/*
+	A register that doesn't match between two CPUs (See Sh4_Cpu::compare)
+*/
+struct Sh4_Register_Diff {
+	std::string name;
+	std::uint32_t value;
+	std::uint32_t other;
+};
+
+// Every register that differs between two states
+std::vector<Sh4_Register_Diff> sh4_compare_state(const Sh4_Cpu_State &state, const Sh4_Cpu_State &other);
 
 class Sh4_Cpu {
 
+	// Generated code accesses the guest state directly
+	friend class Sh4_Jit;
+
 private:
 	/*
 		The SEGA Dreamcast's CPU is a Hitachi SH7750 (SH-4), a 32 bit RISC CPU:
@@ -163,6 +249,33 @@ private:
 	*/
 	std::uint32_t fpul;
 
+	/*
+		Floating-point Registers
+
+		The FPU has two banks of 16 single-precision registers, the FPSCR.FR bit
+		selects which one is visible as FR0-FR15; the other one is accessible as
+		XF0-XF15 (Used by FMOV when FPSCR.SZ = 1, FRCHG, FTRV...).
+
+		Pairs of registers form the double-precision DR0-DR14 (FPSCR.PR = 1),
+		with the even register holding the upper 32 bits.
+	*/
+	std::uint32_t fpu_registers_[2][16];
+
+	/*
+		Same idea as the "registers" array, "fr" points to the bank selected by
+		FPSCR.FR and "xf" to the other one.
+
+		NOTE: If an operation modifies the FR bit, run "remap_fpu_registers".
+	*/
+	std::uint32_t *fr;
+	std::uint32_t *xf;
+
+	/*
+		Set by the SLEEP instruction, instruction execution stops until an
+		interrupt (Or reset) takes the CPU out of sleep mode.
+	*/
+	bool sleeping;
+
 	/*
 		Exception Registers
 	*/
@@ -179,13 +292,32 @@ private:
 	std::uint32_t expevt;
 
 	/*
-		MMU Registers
+		Interrupt event register (INTEVT), code of the last interrupt taken
 	*/
+	std::uint32_t intevt;
 
 	/*
-		MMU control register
+		TRAPA exception register (TRA), immediate of the last TRAPA times 4
 	*/
-	std::uint32_t mmucr;
+	std::uint32_t tra;
+
+	/*
+		Highest priority interrupt request currently asserted: its level (1-15,
+		0 if there's none) and INTEVT code
+	*/
+	std::uint8_t interrupt_level;
+	std::uint32_t interrupt_code;
+
+	/*
+		Whether that request gets accepted at the next instruction boundary,
+		recomputed whenever the request, SR or the sleep state change so that
+		the engines only test a flag between blocks
+	*/
+	bool interrupt_pending_;
+
+	void update_interrupts();
+	void enter_exception(std::uint32_t spc, std::uint32_t vector);
+	void reset();
 
 	/*
 		Cache Control Registers
@@ -263,9 +395,21 @@ private:
 	*/
 	std::uint32_t holly_status;
 
+	/*
+		Where the registers the manual leaves undefined get their values from,
+		one generator per CPU so that instances don't depend on each other (Or
+		on the order they're created in)
+	*/
+	std::mt19937 undefined_values;
+
 public:
 
-	Sh4_Cpu();
+	/*
+		MMU (TLBs and the MMU registers: PTEH, PTEL, PTEA, TTB, TEA, MMUCR)
+	*/
+	Sh4_Mmu mmu;
+
+	Sh4_Cpu(std::uint32_t seed = SH4_DEFAULT_SEED);
 	~Sh4_Cpu();
 
 	void remap_banking_registers();
@@ -282,6 +426,45 @@ public:
 
 	void print_registers();
 
+	/*
+		Takes the whole guest state of "other" (The register pointers keep
+		pointing to this CPU's own registers)
+	*/
+	void copy_state(const Sh4_Cpu &other);
+
+	// Every register whose value differs from the one in "other"
+	std::vector<Sh4_Register_Diff> compare(const Sh4_Cpu &other) const;
+
+	void save_state(Sh4_Cpu_State &state) const;
+	void load_state(const Sh4_Cpu_State &state);
+
+	/*
+		Takes an exception: saves SR, PC (The delayed branch's if PC is in a
+		delay slot) and R15, switches to privileged mode and register bank 1 with
+		exceptions blocked, then jumps to VBR + vector. With SR.BL already set
+		that's a manual reset instead.
+	*/
+	void raise_exception(std::uint32_t expevt_, std::uint32_t vector);
+
+	/*
+		Asserts the interrupt request with the given priority level and INTEVT
+		code (Level 0 drops it). Only the highest priority source matters,
+		combining them is up to the caller.
+	*/
+	void set_interrupt_request(std::uint8_t level, std::uint32_t intevt_);
+
+	bool interrupt_pending() const
+	{
+		return interrupt_pending_;
+	}
+
+	/*
+		Takes the pending interrupt (Same as an exception, SPC is the next
+		instruction and the handler is at VBR + 0x600). False if PC is in a
+		delay slot, where interrupts aren't accepted.
+	*/
+	bool accept_interrupt();
+
 	void set_pc(std::uint32_t pc_);
 	std::uint32_t get_pc();
 
@@ -290,6 +473,20 @@ public:
 	
 	void set_expevt(std::uint32_t expevt_);
 	std::uint32_t get_expevt();
+
+	void set_intevt(std::uint32_t intevt_);
+	std::uint32_t get_intevt();
+
+	void set_tra(std::uint32_t tra_);
+	std::uint32_t get_tra();
+
+	void set_ssr(std::uint32_t ssr_);
+	std::uint32_t get_ssr();
+
+	void set_spc(std::uint32_t spc_);
+	std::uint32_t get_spc();
+
+	std::uint32_t get_sgr();
 	
 	void set_macl(std::uint32_t macl_);
 	std::uint32_t get_macl();
@@ -300,6 +497,38 @@ public:
 	void set_tbit(std::uint8_t tbit_);
 	std::uint8_t get_tbit();
 
+	void set_sr(std::uint32_t sr_);
+	std::uint32_t get_sr();
+
+	void set_vbr(std::uint32_t vbr_);
+	std::uint32_t get_vbr();
+
+	void set_gbr(std::uint32_t gbr_);
+	std::uint32_t get_gbr();
+
+	void set_sleeping(bool sleeping_);
+	bool is_sleeping();
+
+	void remap_fpu_registers();
+
+	void set_fpscr(std::uint32_t fpscr_);
+	std::uint32_t get_fpscr();
+
+	void set_fpul(std::uint32_t fpul_);
+	std::uint32_t get_fpul();
+
+	void set_fr_bits(std::uint8_t index, std::uint32_t value);
+	std::uint32_t get_fr_bits(std::uint8_t index);
+
+	void set_xf_bits(std::uint8_t index, std::uint32_t value);
+	std::uint32_t get_xf_bits(std::uint8_t index);
+
+	void set_fr(std::uint8_t index, float value);
+	float get_fr(std::uint8_t index);
+
+	void set_dr(std::uint8_t index, double value);
+	double get_dr(std::uint8_t index);
+
     void set_dbr(std::uint32_t dbr_);
 	std::uint32_t get_dbr();
 
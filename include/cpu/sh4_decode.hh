@@ -2,8 +2,17 @@
 
 #include <memory/memory.hh>
 #include <cpu/sh4_cpu.hh>
+#include <cpu/sh4_fpu.hh>
+#include <cpu/sh4_idle.hh>
+#include <cpu/sh4_fused.hh>
+#include <cpu/sh4_block.hh>
+#include <cpu/sh4_jit.hh>
+#include <hle/hle_bios.hh>
+#include <scheduler/scheduler.hh>
 #include <lucid.hh>
+#include <array>
 #include <iostream>
+#include <unordered_map>
 
 #define GET_REG(idx)        (cpu->get_register(idx))
 #define SET_REG(idx, val)   (cpu->set_register(idx, val))
@@ -27,18 +36,210 @@
 #define Rn(...) GET_MACRO(_0 __VA_OPT__(,) __VA_ARGS__,  Rn2, Rn1)(__VA_ARGS__)
 #define Rm(...) GET_MACRO(_0 __VA_OPT__(,) __VA_ARGS__,  Rm2, Rm1)(__VA_ARGS__)
 
+/*
+    Interpreter: fetch, decode and execute one instruction at a time
+    Cached: pre-decoded blocks, chained to each other (See sh4_block.hh)
+    Jit: same blocks, translated to host code (See sh4_jit.hh)
+    Tiered: each of the above depending on how hot the code is (See step_tiered)
+*/
+enum class Sh4_Engine {
+    Interpreter,
+    Cached,
+    Jit,
+    Tiered
+};
+
+/*
+    Default promotion thresholds for the tiered engine: times a branch target is
+    reached in the interpreter before it becomes a block, and times a block runs
+    before it's translated to host code
+*/
+#define TIER_CACHED_THRESHOLD       8
+#define TIER_JIT_THRESHOLD          256
+
 class Sh4_Decode {
 
 private:
 
+    /*
+        FPU handler table for the current FPSCR.PR/FPSCR.SZ combination,
+        see sh4_fpu.hh
+    */
+    const Sh4_Fpu_Handler *fpu_handlers;
+
+    /*
+        Host rounding/denormal mode matching the guest FPSCR
+    */
+    Sh4_Host_Fpu_Env host_fpu_env;
+
+    /*
+        Backwards branches already classified by sh4_analyze_idle_loop, keyed
+        by the address of the branch
+    */
+    std::unordered_map<std::uint32_t, Sh4_Idle_Loop> idle_loops;
+
+    void update_fpu_mode();
+    void idle_loop_branch(std::uint32_t branch_pc, std::uint32_t target);
+    void bulk_loop(const Sh4_Idle_Loop &loop);
+    bool execute_fused(std::uint16_t first);
+    void profile_pair(std::uint32_t pc, std::uint16_t opcode);
+
+    // Previous instruction, for the pair profile
+    std::uint32_t profile_pc;
+    std::uint16_t profile_opcode;
+    void code_written(std::uint32_t p_addr);
+
+    /*
+        Times each branch target was reached in the interpreter (Tiered engine),
+        dropped once it's a block
+    */
+    std::unordered_map<std::uint32_t, std::uint32_t> heat;
+
+    std::uint32_t interpret();
+    std::uint32_t interpret_translated();
+    bool translate(Sh4_Block *block);
+
+    void unimplemented_opcode(std::uint16_t opcode);
+    void illegal_instruction();
+    void raise_exception(std::uint32_t expevt, std::uint32_t vector);
+
+    /*
+        Where the block engines are between steps: the block to run next (From
+        chaining, nullptr to look it up) and, for the tiered engine, whether PC
+        is a branch target
+    */
+    Sh4_Block *next_block;
+    bool branched;
+    bool started;
+
+    // false if the engine can't run on this host, the machine is stopped then
+    bool start();
+
+    std::uint32_t step_interpreter();
+    std::uint32_t step_cached();
+    std::uint32_t step_jit();
+    std::uint32_t step_tiered();
+
+    /*
+        Scratch space for IR values
+    */
+    std::vector<std::uint32_t> ir_values;
+
+    void execute_ir(const Sh4_Ir_Block &ir);
+
 public:
 
     Memory *memory;
     Sh4_Cpu *cpu;
+    Scheduler *scheduler;
+
+    /*
+        Fast-forward detected idle loops (Enabled by default)
+    */
+    bool idle_loop_skip;
+
+    /*
+        Run detected memcpy/memset loops as host copies/fills (Enabled by default,
+        needs idle_loop_skip)
+    */
+    bool bulk_loops;
 
-    Sh4_Decode(Sh4_Cpu *cpu_, Memory *memory_);
+    /*
+        Run common instruction pairs as one handler in the interpreter (Enabled by
+        default), see sh4_fused.hh
+    */
+    bool fuse_pairs;
+
+    /*
+        Count every pair of consecutive instructions the interpreter runs (Slow,
+        only meant to pick which pairs are worth fusing)
+    */
+    bool profile_pairs;
+
+    /*
+        Stop on opcodes the interpreter doesn't implement instead of raising an
+        illegal instruction exception in the guest (Disabled by default)
+    */
+    bool stop_on_unimplemented;
+
+    /*
+        Why run_cycles()/run_until() have to stop, set through lucid_stop() when
+        a Machine points lucid_context to it (Running otherwise)
+    */
+    Lucid_Status status;
+
+    std::array<std::uint64_t, static_cast<std::size_t>(Sh4_Fused::Count)> fused_hits;
+    std::unordered_map<std::uint32_t, std::uint64_t> pair_profile;
+
+    Sh4_Engine engine;
+
+    // Tiered engine promotion thresholds
+    std::uint32_t tier_cached_threshold;
+    std::uint32_t tier_jit_threshold;
+
+    // Services syscalls when booting without a BIOS (nullptr otherwise)
+    Hle_Bios *hle_bios;
+    Sh4_Block_Cache blocks;
+    Sh4_Jit jit;
+
+    /*
+        Statistics (Block engines only), native code adds to them itself
+    */
+    std::uint64_t executed_instructions;
+    std::uint64_t executed_state_accesses;
+    std::uint64_t decoded_state_accesses;
+
+    /*
+        Linked native blocks only jump to each other while the scheduler is below
+        this cycle, set by run()/run_cycles() (run_until() has to see every block,
+        it's 0 there)
+    */
+    std::uint64_t link_until;
+
+    // How far step() lets native blocks go through their links, 0 for a single block
+    std::uint64_t step_link_cycles;
+
+    std::uint64_t tier_cached_promotions;
+    std::uint64_t tier_jit_promotions;
+    std::uint64_t tier_demotions;
+    std::uint64_t interpreted_instructions;
+
+    void print_stats();
+    void print_pair_stats();
+
+    Sh4_Decode(Sh4_Cpu *cpu_, Memory *memory_, Scheduler *scheduler_);
 
     void run();
+
+    /*
+        Runs a single block (A single instruction or fused pair for the
+        interpreter) of the current engine and returns how many instructions
+        that was, 0 if nothing ran (Sleeping, code cache flush). run() is the
+        same thing in a loop. With step_link_cycles the JIT may run more than
+        one block, through their links.
+    */
+    std::uint32_t step();
+
+    /*
+        run() with an end: whole steps until at least `cycles` more cycles went
+        by (Or status isn't Running anymore), returns how many did (A step can
+        go past the end, see Machine::run_cycles)
+    */
+    std::uint64_t run_cycles(std::uint64_t cycles);
+
+    /*
+        Steps until PC is `pc` or max_cycles went by, true if PC got there. The
+        block engines only stop between blocks, so `pc` has to be where one
+        starts (A branch target) for them.
+    */
+    bool run_until(std::uint32_t pc, std::uint64_t max_cycles);
+
+    /*
+        For when the CPU state was changed from outside (Not by guest code): drops
+        the block the engines were about to run and picks up the new FPSCR
+    */
+    void resync();
+
     uint16_t fetch_opcode();
     void parse_opcode(uint16_t opcode);
 };
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cpu/sh4_decode.hh>
+#include <cstddef>
+#include <cstdint>
+
+// Steps between comparisons of the whole main memory (Not just the dirty pages)
+#define DIFF_FULL_CHECK_INTERVAL    65536
+
+// How far a step of the JIT goes through native block links (See Sh4_Decode::step_link_cycles)
+#define DIFF_LINK_CYCLES            256
+
+/*
+    Differential testing
+
+    Runs an engine in lock-step with the reference interpreter, on two separate
+    machines that start from the same state. After every step of the engine
+    (A block, see Sh4_Decode::step) the interpreter runs the same number of
+    instructions and both CPUs are compared register by register, along with a
+    hash of every main memory page either side wrote to since the last check.
+
+    The tested machine runs the way it does outside of -diff, JIT fastmem and
+    backpatched sites included (Fastmem stores mark dirty pages while they're
+    tracked), and so do native block links: a JIT step may go through several
+    linked blocks, the code listed after a divergence is only where it started.
+    The whole memory is compared every DIFF_FULL_CHECK_INTERVAL steps and when
+    run() ends, to catch anything else that bypasses the dirty flags.
+
+    Not covered:
+    - Idle loop skipping and bulk loops, turned off on both machines. They
+      change registers and time without running the instructions, which the
+      reference can't be matched against instruction by instruction.
+    - Instruction pair fusion on the reference side (It's tested when the
+      interpreter is the engine under test).
+*/
+class Sh4_Diff {
+
+private:
+
+    Sh4_Decode *reference;
+    Sh4_Decode *test;
+
+    std::vector<std::uint32_t> differing_pages;
+
+    bool lock_step(std::uint64_t max_steps, const Lucid_Status &status);
+    bool compare(bool full);
+    void report(std::uint32_t pc, std::uint32_t count);
+
+public:
+
+    /*
+        Statistics
+    */
+    std::uint64_t steps;
+    std::uint64_t instructions;
+    std::uint64_t pages_hashed;
+    std::uint64_t full_checks;
+
+    Sh4_Diff(Sh4_Decode *reference_, Sh4_Decode *test_);
+
+    /*
+        Runs until both sides diverge (Returns false), the guest stops (See
+        lucid_stop, passed on once the final check is done) or after max_steps
+        (0 for no limit)
+    */
+    bool run(std::uint64_t max_steps = 0);
+
+    void print_stats();
+};
+
+/*
+    Hash of a block of memory (size a multiple of 32 bytes), only meant to
+    tell two copies apart
+*/
+std::uint64_t sh4_page_hash(const std::uint8_t *data, std::size_t size);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <array>
+#include <cstdint>
+
+/*
+    The behaviour of most FPU instructions (Opcode type 0b1111xxxxxxxxxxxx) depends
+    on the FPSCR.PR (Precision) and FPSCR.SZ (Transfer size) bits.
+
+    Instead of checking them on every instruction, there's a handler table per
+    PR/SZ combination, all of them generated at compile time.
+    The decoder keeps a pointer to the table matching the current FPSCR and only
+    swaps it whenever FPSCR gets written (LDS/LDS.L to FPSCR, FRCHG, FSCHG).
+
+    The tables are indexed with the low nibble of the opcode.
+*/
+using Sh4_Fpu_Handler = void (*)(Sh4_Cpu *cpu, Memory *memory, std::uint16_t opcode);
+using Sh4_Fpu_Table = std::array<Sh4_Fpu_Handler, 16>;
+
+const Sh4_Fpu_Handler *sh4_fpu_table(std::uint32_t fpscr);
+
+/*
+    Host floating-point environment
+
+    FPSCR_INITIAL_VALUE selects round to zero and flushes denormals (DN = 1),
+    which isn't what the host uses by default. Rather than saving/restoring the
+    host control register (MXCSR on x86-64) around every FPU instruction, the
+    guest value is only recomputed when FPSCR.RM/FPSCR.DN actually change, and
+    only written to the host while guest code is running (enter_guest/leave_guest
+    bracket the execution loop).
+*/
+class Sh4_Host_Fpu_Env {
+
+private:
+
+    std::uint32_t host_control;
+    std::uint32_t guest_control;
+    std::uint32_t guest_fpscr;
+    bool in_guest;
+
+    static std::uint32_t read_control();
+    static void write_control(std::uint32_t control);
+    static std::uint32_t guest_control_from_fpscr(std::uint32_t host_control, std::uint32_t fpscr);
+
+public:
+
+    Sh4_Host_Fpu_Env();
+
+    void update(std::uint32_t fpscr);
+    void enter_guest();
+    void leave_guest();
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Instruction pairs the interpreter runs as a single handler (Superinstructions)
+
+    The set comes from profiling the Boot ROM, run with -stats to see how often
+    each one fires along with the most frequent pairs that aren't fused yet.
+*/
+enum class Sh4_Fused : std::uint8_t {
+    None,
+    Literal_Jmp,        // mov.l @(disp,PC),Rn; jmp @Rn
+    Literal_Jsr,        // mov.l @(disp,PC),Rn; jsr @Rn
+    Mov_Shll8,          // mov #imm,Rn; shll8 Rn
+    Tst_Bt,             // tst #imm,R0; bt label
+    Dt_Bf,              // dt Rn; bf label
+    Count
+};
+
+/*
+    Cheap filter on the first opcode, so that the second one is only fetched
+    when a pair is possible
+*/
+inline bool sh4_fusion_candidate(std::uint16_t opcode)
+{
+    switch (opcode >> 12)
+    {
+        case 0b1101:
+        case 0b1110:
+            return true;
+
+        case 0b1100:
+            return (opcode & 0xFF00) == 0xC800;
+
+        case 0b0100:
+            return (opcode & 0xF0FF) == 0x4010;
+
+        default:
+            return false;
+    }
+}
+
+Sh4_Fused sh4_fuse(std::uint16_t first, std::uint16_t second);
+const char *sh4_fused_name(Sh4_Fused fused);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cpu/sh4_decode.hh>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// resources/sh4_instr.xlsx as CSV, exported at build time (See CMakeLists.txt)
+#ifndef SH4_INSTR_CSV
+    #define SH4_INSTR_CSV "sh4_instr.csv"
+#endif
+
+#define FUZZ_DEFAULT_CASES          256
+#define FUZZ_SLOW_THRESHOLD         500         // Median ns per instruction
+
+/*
+    The instruction under test is the last one of a page so that the block
+    engines see it as a block of its own (Plus the delay slot for delayed
+    branches, a NOP). PC-relative loads read from the random pool after it.
+*/
+#define FUZZ_CODE_ADDRESS           0x8C7FFFFE
+#define FUZZ_POOL_SIZE              1024
+
+/*
+    Every memory operand points in here, filled with random data for each case
+*/
+#define FUZZ_DATA_ADDRESS           0x8C900000
+#define FUZZ_DATA_SIZE              4096
+
+/*
+    One row of the instruction table: an instruction with one of its operand
+    formats, and which bits of the encoding are fixed
+*/
+struct Sh4_Instr_Class {
+    std::string instruction;
+    std::string format;
+    std::string code;
+    bool privileged;
+
+    std::uint16_t fixed_mask;
+    std::uint16_t fixed_bits;
+
+    // "MOV.L @(disp,PC),Rn", how the traces refer to it
+    std::string key() const;
+};
+
+std::vector<Sh4_Instr_Class> sh4_load_instr_table(const std::string &path);
+
+/*
+    A single instruction with the state it runs on, everything is derived from
+    the seed (Registers, operands and the contents of the data/pool areas)
+*/
+struct Sh4_Fuzz_Case {
+    std::uint64_t seed;
+    std::uint16_t opcode;
+    Sh4_Cpu_State state;
+};
+
+/*
+    Randomized instruction tests
+
+    run() generates cases for every class of the instruction table, runs them in
+    the interpreter and reports which ones are unimplemented and how long each
+    class takes (Median per instruction). The results (A hash of the registers
+    and of the data area after each case) can be saved as a golden trace, which
+    check() replays with any engine.
+
+    Each class runs in a child process of its own, so that a crash in one class
+    doesn't take the others down. Unimplemented opcodes stop the decoder
+    (stop_on_unimplemented, see Sh4_Decode::status), the child then reports
+    the class as failed.
+*/
+class Sh4_Fuzz {
+
+private:
+
+    Sh4_Decode *decoder;
+
+    std::vector<Sh4_Instr_Class> classes;
+
+    Sh4_Fuzz_Case generate(const Sh4_Instr_Class &instr, std::uint64_t case_seed);
+    bool run_case(const Sh4_Fuzz_Case &test, std::uint64_t &state_hash, std::uint64_t &memory_hash, std::uint64_t &ns);
+
+    bool isolated(const std::function<void(std::FILE *)> &body, std::vector<std::string> &results, std::string &failure);
+
+public:
+
+    // Cases per class, base seed and when a class counts as slow (ns)
+    std::uint32_t cases;
+    std::uint64_t seed;
+    std::uint64_t slow_threshold;
+
+    // Where run() writes the golden trace (Nowhere if empty)
+    std::string trace_path;
+
+    Sh4_Fuzz(Sh4_Decode *decoder_);
+
+    bool load(const std::string &csv_path);
+
+    // Both return false if anything failed or didn't match
+    bool run();
+    bool check(const std::string &golden_path);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <scheduler/scheduler.hh>
+#include <array>
+#include <cstdint>
+
+/*
+    Longest loop body (In instructions, branch included) considered for idle
+    loop detection
+*/
+#define IDLE_LOOP_MAX_LENGTH    16
+
+/*
+    Upper bound of a single idle fast-forward when nothing is scheduled (1ms)
+*/
+#define IDLE_LOOP_MAX_SKIP      (SH4_CLOCK_HZ / 1000)
+
+/*
+    Backwards BT/BF loops that can be skipped instead of being interpreted:
+
+    * Countdown: "dt rN; bf -2", the iteration count is known so it can be
+      consumed in one go (Bounded by the next scheduled event).
+    * Poll: the body only reads memory and updates registers/T (i.e. polling
+      a status register). Once an iteration leaves the registers untouched,
+      nothing can change until a device event writes memory, so execution can
+      jump straight to it.
+    * Copy/Fill: "mov.l @Rs+,Rt; mov.l Rt,@Rd (Or @-Rd); add #4,Rd; dt Rc;
+      bf" style memcpy/memset loops, run as a single host copy/fill when both
+      ranges are plain RAM.
+*/
+struct Sh4_Idle_Loop {
+    enum class Kind { None, Countdown, Poll, Copy, Fill };
+
+    Kind kind;
+
+    // Instructions per iteration, branch included
+    std::uint32_t length;
+
+    // Countdown register (Also used by Copy/Fill)
+    std::uint8_t counter;
+
+    // Copy/Fill: mov.l @Rs+ source (Copy only), destination and stored register
+    std::uint8_t source;
+    std::uint8_t destination;
+    std::uint8_t value;
+
+    // Copy/Fill: destination change per iteration, store address relative to
+    // the destination register at the start of an iteration
+    std::int32_t destination_step;
+    std::int32_t store_offset;
+
+    // R0-R15 + T at the end of the previous Poll iteration
+    bool has_snapshot;
+    std::array<std::uint32_t, 17> snapshot;
+};
+
+Sh4_Idle_Loop sh4_analyze_idle_loop(Sh4_Cpu *cpu, Memory *memory, std::uint32_t target, std::uint32_t branch_pc);
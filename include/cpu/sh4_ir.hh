@@ -0,0 +1,110 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    SH-4 block intermediate representation
+
+    Sits between decoding and execution/code generation. Every instruction
+    defines at most one value (SSA style, values are never reassigned), guest
+    state is only touched through explicit Load/Store operations so that the
+    passes can see (and drop) redundant accesses:
+
+    * Register forwarding: loads of a register that's already known in the
+      block reuse that value.
+    * Redundant memory load elimination: a Load_32 from the same base value
+      and displacement as an earlier one reuses its result, as long as no
+      store or Interpret operation came in between. Stores are never
+      forwarded to loads or dropped, the address may be an MMIO register
+      that doesn't read back what was written (ISTNRM...).
+    * Constant propagation/folding (mov #imm + shll8/or sequences, literal
+      pools in the Boot ROM...).
+    * Dead store elimination for registers and the T bit (i.e. a TST whose
+      result is overwritten by a CMP before anything reads it).
+    * Dead code elimination.
+
+    Instructions that aren't expressed in the IR become an Interpret operation,
+    which runs the regular interpreter on a single opcode and acts as a barrier
+    (It may read or write any guest state). If it raises an exception the rest
+    of the block is skipped.
+*/
+enum class Sh4_Ir_Op : std::uint8_t {
+    Nop,
+
+    Const,          // dst = imm
+    Load_Reg,       // dst = R[imm]
+    Store_Reg,      // R[imm] = a
+    Load_T,         // dst = SR.T
+    Store_T,        // SR.T = a
+
+    Add,            // dst = a + b
+    Sub,            // dst = a - b
+    And,            // dst = a & b
+    Or,             // dst = a | b
+    Xor,            // dst = a ^ b
+    Shl,            // dst = a << b
+    Shr,            // dst = a >> b (Logical)
+    Sar,            // dst = a >> b (Arithmetic)
+    Swap_B,         // dst = a with the two low bytes swapped
+    Swap_W,         // dst = a with both words swapped
+
+    Cmp_Eq,         // dst = (a == b)
+    Cmp_Hi,         // dst = (a > b) (Unsigned)
+    Test,           // dst = ((a & b) == 0)
+
+    Load_32,        // dst = [a]
+    Store_8,        // [a] = b
+    Store_16,       // [a] = b
+    Store_32,       // [a] = b
+
+    Interpret,      // Run opcode imm (Guest address pc) through the interpreter
+    Exit            // PC = imm
+};
+
+#define IR_NO_VALUE             UINT32_MAX
+
+/*
+    Interpret flag: PC has to be set to the instruction address first (Not the
+    case for delay slots, where the branch already set up PC/delay PC)
+*/
+#define IR_FLAG_SYNC_PC         (1u << 0)
+
+struct Sh4_Ir_Inst {
+    Sh4_Ir_Op op;
+    std::uint8_t flags;
+    std::uint32_t dst;
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t imm;
+
+    // Guest address of the instruction this came from
+    std::uint32_t pc;
+};
+
+struct Sh4_Ir_Block {
+    std::uint32_t start_pc;
+    std::uint32_t end_pc;
+    std::uint32_t value_count;
+    std::vector<Sh4_Ir_Inst> insts;
+};
+
+/*
+    Per-pass counters, mostly to see what the passes are worth
+*/
+struct Sh4_Ir_Stats {
+    std::uint64_t forwarded_loads;
+    std::uint64_t redundant_memory_loads;
+    std::uint64_t folded_constants;
+    std::uint64_t dead_stores;
+    std::uint64_t dead_flags;
+    std::uint64_t dead_values;
+};
+
+Sh4_Ir_Block sh4_ir_build(std::uint32_t start_pc, const std::vector<std::uint16_t> &opcodes, Sh4_Cpu *cpu, Memory *memory);
+void sh4_ir_optimize(Sh4_Ir_Block &block, Sh4_Ir_Stats &stats);
+std::string sh4_ir_dump(const Sh4_Ir_Block &block);
+std::uint32_t sh4_ir_state_accesses(const Sh4_Ir_Block &block);
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <cpu/sh4_ir.hh>
+#include <cpu/sh4_code_cache.hh>
+#include <cpu/sh4_perf_map.hh>
+#include <cpu/x64_emitter.hh>
+#include <array>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+class Sh4_Decode;
+struct Sh4_Block;
+
+/*
+    Guest registers kept in host registers across a block
+*/
+#define JIT_ALLOCATABLE_REGS        5
+
+/*
+    Targets cached in the host code of a block that ends in an indirect branch
+    (JMP, JSR, RTS...)
+*/
+#define JIT_INDIRECT_LINKS          4
+
+using Sh4_Jit_Entry = void(*)();
+
+/*
+    Patchable exits of a block's host code: where the rel32 of each jump is
+    (0 if the block can't leave that way) and, for the indirect ones, the imm32
+    of the compare in front of it. They all go to `dispatcher` until linked.
+*/
+struct Sh4_Jit_Exits {
+    std::uintptr_t taken;
+    std::uintptr_t fallthrough;
+    std::array<std::uintptr_t, JIT_INDIRECT_LINKS> indirect_pc;
+    std::array<std::uintptr_t, JIT_INDIRECT_LINKS> indirect;
+    std::uintptr_t dispatcher;
+    std::uint8_t indirect_victim;
+};
+
+/*
+    x86-64 backend, turns the IR of a block into host code.
+
+    Guest registers:
+    The most used GPRs of the block live in callee-saved host registers. A
+    register is loaded from Sh4_Cpu on its first read and only written back
+    (If it was modified) before anything that may look at the guest state:
+    memory accesses going through the slow path, Interpret operations (Which
+    may also raise exceptions or switch banks, so allocated registers are
+    reloaded after them) and the block exit.
+    The block is left right after a helper that stopped the machine (See
+    lucid_stop), with PC on the instruction that did it.
+
+    IR values that don't fold into immediates go to a stack frame, the block
+    is straight-line code so the allocation is decided entirely at compile time.
+
+    Block linking:
+    Blocks add their own cycles and statistics on the way out. Unless an event
+    is due, link_until is reached, an interrupt is pending, MMUCR.AT got set or
+    the block ends in a Stop branch, the new PC is then compared with the static
+    exits and the indirect cache of the block, whose jumps start out going back
+    to the dispatcher. The dispatcher calls link() after a block returned with a
+    successor that has host code, which patches the matching jump (And the
+    compared PC for indirect exits) to go straight to the successor's entry,
+    the frame is already torn down so it's a tail call.
+    Links are reset to the dispatcher when the target is invalidated (unlink())
+    and when the code cache evicts the generation it's in, so no jump can reach
+    code that isn't there anymore.
+
+    Fastmem:
+    Loads and stores go straight to the Memory::fastmem arena (Address masked to
+    29 bits, plus the arena base as a displacement), without writing guest
+    registers back first. Every site gets a slow path stub after the block's
+    epilogue: it writes back the registers that are dirty at that point, calls
+    the Memory helper, checks the status and jumps back past the access.
+    Anything that isn't main memory faults, the SIGSEGV handler finds the access
+    in fastmem_sites and rewrites its start into a jump to the stub, then
+    resumes there. Sites that only ever hit RAM stay a single host instruction.
+    Writes to pages code was built from also fault (Those pages are read-only
+    in the arena), they're handled in place by invalidating the page and
+    retrying the write, the site isn't patched. While Memory::dirty_pages is
+    tracked (Sh4_Diff) stores set it the same way the Memory helpers do.
+*/
+class Sh4_Jit {
+
+private:
+
+    Sh4_Decode *decoder;
+    Sh4_Cpu *cpu;
+
+    X64::Emitter emitter;
+
+    // Offsets from the Sh4_Cpu pointer (Kept in RBX)
+    std::int32_t registers_offset;
+    std::int32_t status_register_offset;
+    std::int32_t pc_offset;
+    std::int32_t delay_pc_offset;
+    std::int32_t interrupt_pending_offset;
+    std::int32_t mmucr_offset;
+
+    struct Guest_Reg {
+        bool allocated;
+        X64::Reg host;
+        bool loaded;
+        bool dirty;
+    };
+
+    std::array<Guest_Reg, 16> guest_regs;
+
+    std::uint32_t state_accesses;
+
+    void allocate(const Sh4_Ir_Block &ir);
+    void load_guest(std::uint8_t index, X64::Reg dst);
+    void store_guest(std::uint8_t index, X64::Reg src);
+    void writeback();
+    void forget();
+
+    // Values defined by a Const operation are used as immediates
+    std::vector<bool> value_is_const;
+    std::vector<std::uint32_t> value_const;
+
+    void load_value(X64::Reg dst, std::uint32_t value);
+    void store_value(std::uint32_t value, X64::Reg src);
+
+    // Jumps to the epilogue taken when an interpreted instruction raises an exception
+    std::vector<std::size_t> exception_exits;
+
+    // Link checks that failed, straight back to the dispatcher
+    std::vector<std::size_t> dispatcher_exits;
+
+    /*
+        Jumps taken when a memory helper stopped the machine (Unhandled access),
+        they set PC to the instruction it belongs to before leaving
+    */
+    struct Stop_Exit {
+        std::size_t site;
+        std::uint32_t pc;
+    };
+
+    std::vector<Stop_Exit> stop_exits;
+
+    void check_status(std::uint32_t pc);
+
+    // Arena base (nullptr if fastmem is off or couldn't be set up)
+    std::uint8_t *fastmem_base;
+    bool fastmem_checked;
+
+    /*
+        Fastmem accesses of the block being compiled (Offsets in the emitter,
+        with what their stub needs), then of all the installed code by host
+        address of the access
+    */
+    struct Pending_Site {
+        std::size_t start;
+        std::size_t access;
+        std::size_t end;
+        Sh4_Ir_Op op;
+        std::uint32_t pc;
+        std::uint16_t dirty;
+    };
+
+    struct Fastmem_Site {
+        std::uintptr_t start;
+        std::uintptr_t stub;
+        Sh4_Ir_Op op;
+    };
+
+    std::vector<Pending_Site> pending_sites;
+    std::map<std::uintptr_t, Fastmem_Site> fastmem_sites;
+
+    /*
+        Jumps patched to other blocks, by the generation of the code they go to
+        (Reset when it's evicted). generation is the one the jump itself is in,
+        it's only patched back while that's live.
+    */
+    struct Native_Link {
+        std::uintptr_t site;
+        std::uintptr_t dispatcher;
+        std::uint64_t generation;
+        std::uintptr_t target;
+    };
+
+    std::array<std::vector<Native_Link>, CODE_CACHE_GENERATIONS> native_links;
+
+    void count(std::uint32_t instructions, std::uint32_t decoded_state_accesses);
+    void patch_jump(std::uintptr_t site, std::uintptr_t target);
+    std::uintptr_t jump_target(std::uintptr_t site) const;
+    void evict_links(std::uint64_t generation);
+
+    void fastmem_access(Sh4_Ir_Op op, std::uint32_t pc);
+    void mark_dirty();
+    std::size_t slow_stub(const Pending_Site &site);
+    bool handle_fault(std::uintptr_t rip, std::uintptr_t fault_address, std::uintptr_t &resume);
+
+    static void fault_handler(int signal, siginfo_t *info, void *context);
+
+public:
+
+    /*
+        Statistics
+    */
+    std::uint64_t compiled;
+    std::uint64_t fastmem_accesses;
+    std::uint64_t backpatched;
+    std::uint64_t code_page_faults;
+    std::uint64_t linked;
+
+    // Use fastmem (Enabled by default, needs Memory::map_fastmem() to work)
+    bool fastmem;
+
+    // Where the generated code goes (See sh4_code_cache.hh)
+    Sh4_Code_Cache code_cache;
+
+    // Symbols for perf, every compiled block is recorded when it's enabled
+    Sh4_Perf_Map perf_map;
+
+    Sh4_Jit(Sh4_Decode *decoder_, Sh4_Cpu *cpu_);
+    ~Sh4_Jit();
+
+    // Block the last native run went back to the dispatcher from
+    Sh4_Block *exit_block;
+
+    /*
+        Returns nullptr when the code doesn't fit in the code cache (Call flush()
+        and retry), fills in native_state_accesses (Guest state loads/stores in
+        the generated code) and native_exits. The code stays valid while
+        code_cache.live() is true for the generation it was compiled in.
+    */
+    Sh4_Jit_Entry compile(Sh4_Block &block);
+
+    /*
+        Points the exit of `from` that leads to pc (The start of `to`, which has
+        to be native too) straight to it
+    */
+    void link(Sh4_Block *from, Sh4_Block *to, std::uint32_t pc);
+
+    // Sends every jump to the block back to the dispatcher (It's being invalidated)
+    void unlink(const Sh4_Block *block);
+
+    void flush();
+
+    // Routes faults from this thread's JIT code to this instance
+    void make_current();
+};
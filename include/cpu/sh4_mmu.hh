@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+    MMU control register (MMUCR)
+*/
+#define MMUCR_AT_BIT            (1u << 0)       // Address translation
+#define MMUCR_TI_BIT            (1u << 2)       // Invalidates every TLB entry (Always reads as 0)
+#define MMUCR_SV_BIT            (1u << 8)       // Single virtual memory mode
+#define MMUCR_URC_SHIFT         10              // UTLB replace counter (LDTLB destination)
+#define MMUCR_URB_SHIFT         18              // UTLB replace boundary
+#define MMUCR_LRUI_SHIFT        26              // ITLB least recently used entry
+#define MMUCR_WRITABLE_MASK     0xFCFCFF05
+
+/*
+    PTEH/PTEL fields, TLB entries keep them in the same layout
+*/
+#define PTEH_VPN_MASK           0xFFFFFC00
+#define PTEH_ASID_MASK          0x000000FF
+
+#define PTEL_PPN_MASK           0x1FFFFC00
+#define PTEL_V_BIT              (1u << 8)
+#define PTEL_SZ1_BIT            (1u << 7)
+#define PTEL_PR_SHIFT           5
+#define PTEL_SZ0_BIT            (1u << 4)
+#define PTEL_C_BIT              (1u << 3)
+#define PTEL_D_BIT              (1u << 2)
+#define PTEL_SH_BIT             (1u << 1)
+#define PTEL_WT_BIT             (1u << 0)
+#define PTEL_WRITABLE_MASK      0x1FFFFDFF
+
+#define MMU_UTLB_ENTRIES        64
+#define MMU_ITLB_ENTRIES        4
+
+/*
+    Entries in each of the host lookup caches (Direct-mapped by 1KB virtual
+    page, the smallest page size)
+*/
+#define MMU_LOOKUP_ENTRIES      1024
+
+enum class Sh4_Access : std::uint8_t {
+    Read,
+    Write,
+    Fetch
+};
+
+struct Sh4_Tlb_Entry {
+    std::uint32_t pteh;         // VPN, ASID
+    std::uint32_t ptel;         // PPN, V, SZ, PR, C, D, SH, WT
+    std::uint32_t ptea;         // SA, TC (PCMCIA, stored but unused)
+
+    // Page size - 1, from the SZ bits
+    std::uint32_t mask;
+};
+
+/*
+    SH-4 MMU
+
+    A 64 entry unified TLB (Loaded by LDTLB or through the memory-mapped
+    arrays) and a 4 entry instruction TLB that refills itself from the UTLB.
+    U0/P0 and P3 addresses go through them while MMUCR.AT is set, P1/P2/P4 are
+    never translated.
+
+    Every successful translation is remembered in a host-side cache, one per
+    access kind, keyed by virtual page and processor mode. A hit costs a single
+    compare. The caches only hold translations that are allowed as they are
+    (Writes to clean pages always go through the TLB, for the initial page
+    write exception), and get dropped as a whole whenever a TLB entry, the
+    ASID or MMUCR changes.
+
+    Faults are recorded (TEA, PTEH.VPN, the exception code) and translate()
+    fails, the access then does nothing. It's up to the caller to roll the
+    instruction back and take the exception (See Sh4_Decode::interpret). Until
+    then every other access fails too.
+
+    URC and LRUI are only updated by lookups that miss the host cache.
+*/
+class Sh4_Mmu {
+
+private:
+
+    struct Lookup_Entry {
+        std::uint32_t tag;      // Virtual page | LOOKUP_VALID | privileged
+        std::uint32_t page;     // Physical 1KB page
+    };
+
+    static constexpr std::uint32_t LOOKUP_VALID = 2;
+
+    std::array<std::array<Lookup_Entry, MMU_LOOKUP_ENTRIES>, 3> lookup;
+
+    // MMUCR.AT, as of the last sync()
+    bool translating_;
+
+    bool fault;
+
+    Sh4_Tlb_Entry *search_utlb(std::uint32_t address, bool privileged);
+    Sh4_Tlb_Entry *search_itlb(std::uint32_t address, bool privileged);
+    void use_itlb(std::uint32_t index);
+
+    bool translate_slow(std::uint32_t address, Sh4_Access access, bool privileged, std::uint32_t &p_addr);
+    void raise(std::uint32_t address, std::uint32_t expevt, std::uint32_t vector);
+
+    static std::uint32_t page_mask(std::uint32_t ptel);
+
+public:
+
+    std::array<Sh4_Tlb_Entry, MMU_UTLB_ENTRIES> utlb;
+    std::array<Sh4_Tlb_Entry, MMU_ITLB_ENTRIES> itlb;
+
+    /*
+        MMU registers
+    */
+    std::uint32_t pteh;
+    std::uint32_t ptel;
+    std::uint32_t ptea;
+    std::uint32_t ttb;
+    std::uint32_t tea;
+    std::uint32_t mmucr;
+
+    // Exception to take for the pending fault
+    std::uint32_t fault_expevt;
+    std::uint32_t fault_vector;
+
+    Sh4_Mmu();
+
+    /*
+        Picks up MMUCR.AT. Only called between steps, so that a block that turns
+        translation on finishes the way it started
+    */
+    bool sync()
+    {
+        translating_ = mmucr & MMUCR_AT_BIT;
+        return translating_;
+    }
+
+    bool translating() const
+    {
+        return translating_;
+    }
+
+    /*
+        p_addr has to hold the untranslated physical address already (What's
+        used with translation off), false on a TLB miss/protection fault
+    */
+    template <Sh4_Access access>
+    bool translate(std::uint32_t address, bool privileged, std::uint32_t &p_addr)
+    {
+        // P1, P2 and P4
+        if (address >= 0x80000000 && (address >> 29) != 6)
+        {
+            return true;
+        }
+
+        const Lookup_Entry &entry = lookup[static_cast<std::size_t>(access)][(address >> 10) & (MMU_LOOKUP_ENTRIES - 1)];
+
+        if (entry.tag == ((address & 0xFFFFFC00) | LOOKUP_VALID | privileged))
+        {
+            p_addr = entry.page | (address & 0x3FF);
+            return true;
+        }
+
+        return translate_slow(address, access, privileged, p_addr);
+    }
+
+    /*
+        The same UTLB lookup and protection checks as a data access, minus
+        everything a guest access leaves behind (Fault, TEA/PTEH, URC, the host
+        cache). For accesses made on the host's behalf (Debuggers, Machine::read),
+        which mustn't raise guest exceptions. Untranslated areas pass through.
+    */
+    bool probe(std::uint32_t address, bool write, bool privileged, std::uint32_t &p_addr) const;
+
+    bool fault_pending() const
+    {
+        return fault;
+    }
+
+    void clear_fault()
+    {
+        fault = false;
+    }
+
+    void flush_lookup();
+
+    void ldtlb();
+
+    void write_mmucr(std::uint32_t value);
+
+    /*
+        PTEH, PTEL, PTEA, TTB, TEA and MMUCR (By physical address, P4 or area 7)
+    */
+    static bool is_register(std::uint32_t p_addr);
+    std::uint32_t read_register(std::uint32_t p_addr);
+    void write_register(std::uint32_t p_addr, std::uint32_t value);
+
+    /*
+        Memory-mapped ITLB/UTLB address and data arrays (0xF2000000-0xF3FFFFFF,
+        0xF6000000-0xF7FFFFFF, by virtual address)
+    */
+    static bool is_array(std::uint32_t address)
+    {
+        return ((address >> 24) & 0xFA) == 0xF2;
+    }
+
+    std::uint32_t read_array(std::uint32_t address);
+    void write_array(std::uint32_t address, std::uint32_t value, bool privileged);
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/*
+    Symbols for the host code the JIT generates, so that Linux perf can tell the
+    guest code apart instead of showing anonymous addresses.
+
+    * /tmp/perf-<pid>.map: one "<address> <size> <name>" line per block, picked
+      up by perf report/perf top as is.
+    * /tmp/jit-<pid>.dump (jitdump): also carries the code bytes, for perf
+      annotate. Needs `perf record -k mono` and `perf inject --jit` afterwards.
+
+    Blocks are named after their guest start address and the memory region it's
+    in, i.e. sh4_8C010000_ram.
+*/
+class Sh4_Perf_Map {
+
+private:
+
+    std::FILE *map_file;
+    std::FILE *dump_file;
+
+    // The dump has to stay mapped executable, that's how perf finds it
+    void *dump_marker;
+
+    std::uint64_t code_index;
+
+    std::uint64_t timestamp();
+
+public:
+
+    Sh4_Perf_Map();
+    ~Sh4_Perf_Map();
+
+    bool open_map();
+    bool open_dump();
+
+    bool enabled() const
+    {
+        return map_file || dump_file;
+    }
+
+    void record(std::uint32_t guest_pc, const void *code, std::size_t size);
+};
+
+std::string sh4_perf_name(std::uint32_t guest_pc);
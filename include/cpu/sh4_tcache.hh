@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_ir.hh>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Persistent translation cache
+
+    Keeps the optimized IR of every block across runs, so that the same BIOS/program
+    doesn't go through decoding, lowering and the IR passes again. The file is mapped
+    with mmap when it's opened and written back (Old entries plus the new ones) by
+    save().
+
+    The file is tied to the emulator build (Size/mtime of liblucid.so, or of the
+    executable when it's linked in statically) and to the Boot ROM contents (Literal
+    pools there get folded into the IR), if either differs the whole file is ignored. Every entry also carries the opcodes of its block, and is only
+    used if they match what's in memory right now.
+
+    Host code isn't stored, it depends on where the helpers and the code buffer end up
+    on each run. Blocks are just translated again from the cached IR.
+*/
+#define TCACHE_MAGIC                0x48435354    // "TSCH"
+#define TCACHE_VERSION              1
+
+/*
+    The block had been translated to host code when the cache was saved (i.e. it was
+    hot enough for the JIT)
+*/
+#define TCACHE_FLAG_NATIVE          (1u << 0)
+
+struct Sh4_Tcache_Entry {
+    std::uint32_t start_pc;
+    std::uint32_t end_pc;
+    std::uint64_t code_hash;
+    std::uint32_t opcode_count;
+    std::uint32_t inst_count;
+    std::uint32_t value_count;
+    std::uint32_t decoded_state_accesses;
+    std::uint32_t flags;
+
+    // Whole entry, including the opcodes and IR that follow it
+    std::uint32_t size;
+};
+
+std::uint64_t sh4_tcache_hash(const void *data, std::size_t size, std::uint64_t hash = 0xCBF29CE484222325ull);
+
+class Sh4_Translation_Cache {
+
+private:
+
+    std::string path;
+
+    // Mapped file (nullptr if there was none or it didn't match)
+    const std::uint8_t *mapping;
+    std::size_t mapping_size;
+
+    std::uint64_t build_id;
+    std::uint64_t rom_hash;
+
+    // Start PC -> entry in the mapping
+    std::unordered_map<std::uint32_t, const Sh4_Tcache_Entry *> loaded;
+
+    // Start PC -> serialized entry, built this run
+    std::unordered_map<std::uint32_t, std::vector<std::uint8_t>> recorded;
+
+    void unmap();
+
+public:
+
+    /*
+        Statistics
+    */
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t stale;
+
+    Sh4_Translation_Cache();
+    ~Sh4_Translation_Cache();
+
+    void open(const std::string &path_, Memory *memory);
+    bool save();
+
+    /*
+        Cached IR for the block at start_pc made of these opcodes, false if there's
+        none (Or the code changed since)
+    */
+    bool find(std::uint32_t start_pc, const std::vector<std::uint16_t> &opcodes, Sh4_Ir_Block &ir,
+              std::uint32_t &decoded_state_accesses, std::uint32_t &flags);
+
+    void record(const Sh4_Ir_Block &ir, const std::vector<std::uint16_t> &opcodes, std::uint32_t decoded_state_accesses,
+                std::uint32_t flags);
+
+    // Adds TCACHE_FLAG_* to the entry of an existing block
+    void set_flags(std::uint32_t start_pc, std::uint32_t flags);
+};
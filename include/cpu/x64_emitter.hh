@@ -0,0 +1,385 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+    Minimal x86-64 machine code emitter, only covers what the SH-4 translator needs.
+
+    All 32 bit forms zero the upper half of the destination like the hardware does.
+*/
+namespace X64 {
+
+enum Reg : std::uint8_t {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+/*
+    Group 1 ALU operations (Register/register opcode, /digit for the immediate form)
+*/
+enum class Alu : std::uint8_t {
+    Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7
+};
+
+/*
+    Group 2 shift/rotate operations (/digit)
+*/
+enum class Shift : std::uint8_t {
+    Rol = 0, Ror = 1, Shl = 4, Shr = 5, Sar = 7
+};
+
+enum class Cond : std::uint8_t {
+    Below = 0x2, Above_Equal = 0x3, Equal = 0x4, Not_Equal = 0x5, Above = 0x7
+};
+
+class Emitter {
+
+private:
+
+    std::vector<std::uint8_t> code;
+
+    void byte(std::uint8_t value)
+    {
+        code.push_back(value);
+    }
+
+    void dword(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            byte(static_cast<std::uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    void qword(std::uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            byte(static_cast<std::uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    void rex(bool w, std::uint8_t reg, std::uint8_t rm, bool force = false)
+    {
+        std::uint8_t value = 0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+
+        if (value != 0x40 || force)
+        {
+            byte(value);
+        }
+    }
+
+    void modrm_reg(std::uint8_t reg, std::uint8_t rm)
+    {
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // [base + disp32]
+    void modrm_mem(std::uint8_t reg, std::uint8_t base, std::int32_t disp)
+    {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+
+        if ((base & 7) == RSP)
+        {
+            byte(0x24);
+        }
+
+        dword(static_cast<std::uint32_t>(disp));
+    }
+
+public:
+
+    std::size_t size() const
+    {
+        return code.size();
+    }
+
+    const std::uint8_t *data() const
+    {
+        return code.data();
+    }
+
+    void clear()
+    {
+        code.clear();
+    }
+
+    void mov(Reg dst, std::uint32_t imm)
+    {
+        rex(false, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+
+    void mov64(Reg dst, std::uint64_t imm)
+    {
+        rex(true, 0, dst);
+        byte(0xB8 + (dst & 7));
+        qword(imm);
+    }
+
+    void mov(Reg dst, Reg src)
+    {
+        rex(false, src, dst);
+        byte(0x89);
+        modrm_reg(src, dst);
+    }
+
+    // dst = dword [base + disp]
+    void load(Reg dst, Reg base, std::int32_t disp)
+    {
+        rex(false, dst, base);
+        byte(0x8B);
+        modrm_mem(dst, base, disp);
+    }
+
+    // dst = qword [base + disp]
+    void load64(Reg dst, Reg base, std::int32_t disp)
+    {
+        rex(true, dst, base);
+        byte(0x8B);
+        modrm_mem(dst, base, disp);
+    }
+
+    // dword [base + disp] = src
+    void store(Reg base, std::int32_t disp, Reg src)
+    {
+        rex(false, src, base);
+        byte(0x89);
+        modrm_mem(src, base, disp);
+    }
+
+    // qword [base + disp] = src
+    void store64(Reg base, std::int32_t disp, Reg src)
+    {
+        rex(true, src, base);
+        byte(0x89);
+        modrm_mem(src, base, disp);
+    }
+
+    // word [base + disp] = src
+    void store16(Reg base, std::int32_t disp, Reg src)
+    {
+        byte(0x66);
+        rex(false, src, base);
+        byte(0x89);
+        modrm_mem(src, base, disp);
+    }
+
+    // byte [base + disp] = src
+    void store8(Reg base, std::int32_t disp, Reg src)
+    {
+        rex(false, src, base, src >= RSP);
+        byte(0x88);
+        modrm_mem(src, base, disp);
+    }
+
+    // dword [base + disp] = imm
+    void store(Reg base, std::int32_t disp, std::uint32_t imm)
+    {
+        rex(false, 0, base);
+        byte(0xC7);
+        modrm_mem(0, base, disp);
+        dword(imm);
+    }
+
+    void alu(Alu op, Reg dst, Reg src)
+    {
+        rex(false, src, dst);
+        byte((static_cast<std::uint8_t>(op) << 3) | 0x01);
+        modrm_reg(src, dst);
+    }
+
+    void alu(Alu op, Reg dst, std::uint32_t imm)
+    {
+        rex(false, 0, dst);
+        byte(0x81);
+        modrm_reg(static_cast<std::uint8_t>(op), dst);
+        dword(imm);
+    }
+
+    void alu64(Alu op, Reg dst, std::uint32_t imm)
+    {
+        rex(true, 0, dst);
+        byte(0x81);
+        modrm_reg(static_cast<std::uint8_t>(op), dst);
+        dword(imm);
+    }
+
+    void alu64(Alu op, Reg dst, Reg src)
+    {
+        rex(true, src, dst);
+        byte((static_cast<std::uint8_t>(op) << 3) | 0x01);
+        modrm_reg(src, dst);
+    }
+
+    // dst op= qword [base + disp]
+    void alu64(Alu op, Reg dst, Reg base, std::int32_t disp)
+    {
+        rex(true, dst, base);
+        byte((static_cast<std::uint8_t>(op) << 3) | 0x03);
+        modrm_mem(dst, base, disp);
+    }
+
+    // qword [base + disp] op= imm
+    void alu64(Alu op, Reg base, std::int32_t disp, std::uint32_t imm)
+    {
+        rex(true, 0, base);
+        byte(0x81);
+        modrm_mem(static_cast<std::uint8_t>(op), base, disp);
+        dword(imm);
+    }
+
+    void test(Reg a, Reg b)
+    {
+        rex(false, b, a);
+        byte(0x85);
+        modrm_reg(b, a);
+    }
+
+    // dword [base + disp] & imm
+    void test(Reg base, std::int32_t disp, std::uint32_t imm)
+    {
+        rex(false, 0, base);
+        byte(0xF7);
+        modrm_mem(0, base, disp);
+        dword(imm);
+    }
+
+    // byte [base + disp] & imm
+    void test8(Reg base, std::int32_t disp, std::uint8_t imm)
+    {
+        rex(false, 0, base);
+        byte(0xF6);
+        modrm_mem(0, base, disp);
+        byte(imm);
+    }
+
+    void shift(Shift op, Reg dst, std::uint8_t imm)
+    {
+        rex(false, 0, dst);
+        byte(0xC1);
+        modrm_reg(static_cast<std::uint8_t>(op), dst);
+        byte(imm);
+    }
+
+    // Shift by CL
+    void shift(Shift op, Reg dst)
+    {
+        rex(false, 0, dst);
+        byte(0xD3);
+        modrm_reg(static_cast<std::uint8_t>(op), dst);
+    }
+
+    // Rotates the low 16 bits of dst (rol r16, imm8)
+    void rotate16(Shift op, Reg dst, std::uint8_t imm)
+    {
+        byte(0x66);
+        rex(false, 0, dst);
+        byte(0xC1);
+        modrm_reg(static_cast<std::uint8_t>(op), dst);
+        byte(imm);
+    }
+
+    // dst = cond ? 1 : 0
+    void set(Cond cond, Reg dst)
+    {
+        rex(false, 0, dst, dst >= RSP);
+        byte(0x0F);
+        byte(0x90 | static_cast<std::uint8_t>(cond));
+        modrm_reg(0, dst);
+
+        // movzx dst, dst8
+        rex(false, dst, dst, dst >= RSP);
+        byte(0x0F);
+        byte(0xB6);
+        modrm_reg(dst, dst);
+    }
+
+    void push(Reg reg)
+    {
+        rex(false, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(Reg reg)
+    {
+        rex(false, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    /*
+        Forward conditional jump, returns where its displacement is so that
+        bind() can point it to wherever the code is at by then
+    */
+    std::size_t jump(Cond cond)
+    {
+        byte(0x0F);
+        byte(0x80 | static_cast<std::uint8_t>(cond));
+        dword(0);
+        return code.size() - 4;
+    }
+
+    // Same for an unconditional jump
+    std::size_t jump()
+    {
+        byte(0xE9);
+        dword(0);
+        return code.size() - 4;
+    }
+
+    /*
+        Jump to an offset from the start of the buffer, already emitted or (For
+        code that gets patched in somewhere else) past its end
+    */
+    void jump_to(std::size_t target)
+    {
+        byte(0xE9);
+        dword(static_cast<std::uint32_t>(target - (code.size() + 4)));
+    }
+
+    void bind(std::size_t site)
+    {
+        std::uint32_t disp = static_cast<std::uint32_t>(code.size() - (site + 4));
+        std::memcpy(&code[site], &disp, 4);
+    }
+
+    void call(const void *function)
+    {
+        mov64(RAX, reinterpret_cast<std::uint64_t>(function));
+        byte(0xFF);
+        modrm_reg(2, RAX);
+    }
+
+    void ret()
+    {
+        byte(0xC3);
+    }
+
+    // Padding, with the recommended multi-byte NOPs
+    void nop(std::size_t length)
+    {
+        static const std::uint8_t nops[][9] = {
+            {0x90},
+            {0x66, 0x90},
+            {0x0F, 0x1F, 0x00},
+            {0x0F, 0x1F, 0x40, 0x00},
+            {0x0F, 0x1F, 0x44, 0x00, 0x00},
+            {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+            {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+            {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+            {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+        };
+
+        while (length)
+        {
+            std::size_t chunk = length < 9 ? length : 9;
+            code.insert(code.end(), nops[chunk - 1], nops[chunk - 1] + chunk);
+            length -= chunk;
+        }
+    }
+};
+
+}
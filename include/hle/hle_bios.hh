@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory/memory.hh>
+#include <cpu/sh4_cpu.hh>
+#include <cstdint>
+
+/*
+    Undefined on the SH-4, marks the syscall stubs below (See Sh4_Decode::parse_opcode)
+*/
+#define HLE_TRAP_OPCODE         0x0010
+
+/*
+    Syscall vectors, the BIOS leaves the address of each handler there
+*/
+#define HLE_VECTOR_SYSINFO      0x8C0000B0
+#define HLE_VECTOR_ROMFONT      0x8C0000B4
+#define HLE_VECTOR_FLASHROM     0x8C0000B8
+#define HLE_VECTOR_GDROM        0x8C0000BC
+#define HLE_VECTOR_SYSTEM       0x8C0000E0
+
+/*
+    Where the trap stubs live (Inside the area the BIOS keeps for itself), one
+    longword each
+*/
+#define HLE_STUB_BASE           0x8C000800
+
+/*
+    Console ID, filled by SYSINFO_INIT
+*/
+#define HLE_SYSINFO_ADDRESS     0x8C000068
+
+/*
+    High-level emulation of the boot ROM
+
+    boot() sets up what the BIOS leaves behind before jumping to a program
+    (Registers, syscall vectors...) and every syscall vector points to a stub
+    made of HLE_TRAP_OPCODE. When the CPU runs into one, syscall() does the
+    work natively and returns to PR like the real handler's RTS would.
+
+    Only the calls homebrew relies on are covered: system info, ROM font,
+    flash partitions and GD-ROM (Reported as an empty drive, there's no drive
+    emulation yet). The ROM font points to the (Blank) Boot ROM area, nothing
+    copyrighted is needed.
+*/
+class Hle_Bios {
+
+private:
+
+    Sh4_Cpu *cpu;
+    Memory *memory;
+
+    enum class Stub : std::uint8_t {
+        Sysinfo,
+        Romfont,
+        Flashrom,
+        Gdrom,
+        System,
+        Exit,           // Return address of the program itself
+        Count
+    };
+
+    static std::uint32_t stub_address(Stub stub)
+    {
+        return HLE_STUB_BASE + (static_cast<std::uint32_t>(stub) * 4);
+    }
+
+    bool copy_to_guest(std::uint32_t address, const std::uint8_t *data, std::uint32_t size);
+
+    std::uint32_t sysinfo();
+    std::uint32_t romfont();
+    std::uint32_t flashrom();
+    std::uint32_t gdrom();
+    std::uint32_t system(bool returned);
+
+public:
+
+    Hle_Bios(Sh4_Cpu *cpu_, Memory *memory_);
+
+    void boot(std::uint32_t entry);
+
+    /*
+        Called on HLE_TRAP_OPCODE, pc is the address of the stub
+    */
+    void syscall(std::uint32_t pc);
+};
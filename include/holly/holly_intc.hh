@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cpu/sh4_cpu.hh>
+#include <cstdint>
+
+/*
+    System bus interrupt registers (Physical addresses)
+*/
+#define SB_ISTNRM               0x005F6900      // Normal interrupt status (Write 1 to clear)
+#define SB_ISTEXT               0x005F6904      // External interrupt status (Read only, cleared at the source)
+#define SB_ISTERR               0x005F6908      // Error interrupt status (Write 1 to clear)
+#define SB_IML2NRM              0x005F6910
+#define SB_IML2EXT              0x005F6914
+#define SB_IML2ERR              0x005F6918
+#define SB_IML4NRM              0x005F6920
+#define SB_IML4EXT              0x005F6924
+#define SB_IML4ERR              0x005F6928
+#define SB_IML6NRM              0x005F6930
+#define SB_IML6EXT              0x005F6934
+#define SB_IML6ERR              0x005F6938
+
+/*
+    ISTNRM bits 30 and 31 mirror whether anything is set in ISTEXT/ISTERR
+*/
+#define ISTNRM_EXT_BIT          (1u << 30)
+#define ISTNRM_ERR_BIT          (1u << 31)
+#define ISTNRM_STATUS_MASK      0x003FFFFF
+#define ISTEXT_STATUS_MASK      0x0000000F
+
+enum class Holly_Irq_Kind : std::uint8_t {
+    Normal,
+    External,
+    Error
+};
+
+/*
+    Holly's interrupt controller (The system bus side of it)
+
+    Devices set bits in ISTNRM/ISTEXT/ISTERR and each of the three priority
+    levels Holly drives the SH-4's IRL pins with (2, 4 and 6) has its own mask
+    for every status register.
+
+    The status and mask registers only change on writes (From the guest or a
+    device), so that's when pending_levels gets recomputed, one bit per level
+    with anything unmasked. The highest one goes straight to
+    Sh4_Cpu::set_interrupt_request(), which folds it into the single flag the
+    engines test between blocks.
+*/
+class Holly_Intc {
+
+private:
+
+    std::uint32_t istnrm;
+    std::uint32_t istext;
+    std::uint32_t isterr;
+
+    // [0] = level 2, [1] = level 4, [2] = level 6
+    std::uint32_t iml_nrm[3];
+    std::uint32_t iml_ext[3];
+    std::uint32_t iml_err[3];
+
+    /*
+        Bit N set if anything is pending at level N (Only 2, 4 and 6 exist)
+    */
+    std::uint32_t pending_levels;
+
+    void update(Sh4_Cpu *cpu);
+
+public:
+
+    Holly_Intc();
+
+    static bool is_register(std::uint32_t p_addr)
+    {
+        // 0x5F690C/0x5F691C/0x5F692C aren't registers
+        return p_addr >= SB_ISTNRM && p_addr <= SB_IML6ERR && !(p_addr & 3) && (p_addr & 0xF) != 0xC;
+    }
+
+    std::uint32_t read_register(std::uint32_t p_addr);
+    void write_register(std::uint32_t p_addr, std::uint32_t value, Sh4_Cpu *cpu);
+
+    /*
+        Interrupt sources: raise() sets status bits, clear() drops ISTEXT bits
+        (The guest can't, those stay up until the device is serviced)
+    */
+    void raise(Holly_Irq_Kind kind, std::uint32_t bits, Sh4_Cpu *cpu);
+    void clear(Holly_Irq_Kind kind, std::uint32_t bits, Sh4_Cpu *cpu);
+
+    std::uint32_t get_pending_levels() const
+    {
+        return pending_levels;
+    }
+};
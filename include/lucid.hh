@@ -17,3 +17,76 @@
 #define BOLDMAGENTA "\033[1m\033[35m"      /* Bold Magenta */
 #define BOLDCYAN    "\033[1m\033[36m"      /* Bold Cyan */
 #define BOLDWHITE   "\033[1m\033[37m"      /* Bold White */
+
+#include <cstdlib>
+#include <iostream>
+
+/*
+    Why a machine stopped (See Machine::run_cycles). Anything but Exited is an
+    exit status of 1 for the command line front end.
+*/
+enum class Lucid_Status : int {
+    Running = 0,
+    Exited,                 // The program went back to the BIOS (HLE)
+    Unhandled_Access,       // Memory/register the emulator doesn't have, or the wrong size for it
+    Unimplemented,          // Opcode it can't run (With SR.BL set or -stopunimplemented), stray HLE trap
+    Load_Failed,            // Binary that couldn't be loaded
+    Host_Error              // Something the host couldn't provide (Memory for the JIT code cache)
+};
+
+inline const char *lucid_status_name(Lucid_Status status)
+{
+    switch (status)
+    {
+        case Lucid_Status::Running:             return "running";
+        case Lucid_Status::Exited:              return "exited";
+        case Lucid_Status::Unhandled_Access:    return "unhandled access";
+        case Lucid_Status::Unimplemented:       return "unimplemented";
+        case Lucid_Status::Load_Failed:         return "load failed";
+        case Lucid_Status::Host_Error:          return "host error";
+    }
+
+    return "unknown";
+}
+
+/*
+    Where the emulator reports to, one per thread: the process streams by
+    default, with fatal errors ending the process. While a Machine runs a
+    slice it points this to its own log and status instead (See Machine), so
+    that machines on different threads share none of it.
+*/
+struct Lucid_Context {
+    std::ostream *out = &std::cout;
+    std::ostream *err = &std::cerr;
+    Lucid_Status *status = nullptr;
+};
+
+inline thread_local Lucid_Context lucid_context;
+
+inline std::ostream &lucid_out()
+{
+    return *lucid_context.out;
+}
+
+inline std::ostream &lucid_err()
+{
+    return *lucid_context.err;
+}
+
+/*
+    Ends the process outside of a Machine. Under one it records why the
+    machine stopped (The first reason wins) and returns: the caller has to
+    back out of what it was doing, the run loops stop after the current step.
+*/
+inline void lucid_stop(Lucid_Status status)
+{
+    if (!lucid_context.status)
+    {
+        std::exit(status == Lucid_Status::Exited ? 0 : 1);
+    }
+
+    if (*lucid_context.status == Lucid_Status::Running)
+    {
+        *lucid_context.status = status;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <machine/machine.hh>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+    Default budget per job for lucid -batch (10 emulated seconds)
+*/
+#define BATCH_DEFAULT_CYCLES        (SH4_CLOCK_HZ * 10)
+
+struct Batch_Job {
+    std::string name;
+
+    /*
+        Gets the machine ready (Loads what it runs, picks the engine...), on the
+        worker thread that then runs it
+    */
+    std::function<void(Machine &)> setup;
+
+    // Budget, the job also ends when the machine stops (See Machine::status)
+    std::uint64_t cycles;
+
+    std::uint32_t seed = SH4_DEFAULT_SEED;
+};
+
+struct Batch_Result {
+    std::string name;
+    Lucid_Status status;
+    std::uint64_t cycles;
+    Sh4_Cpu_State state;
+
+    // Everything the machine printed
+    std::string log;
+};
+
+/*
+    Runs a list of independent jobs, one Machine each, on a pool of worker
+    threads. Workers pick the next job as soon as they're done with one, so
+    long jobs don't hold up the rest.
+
+    Jobs can share whatever is read-only between them (A Bios_Image), nothing
+    else is. Results come back in the order of the jobs.
+*/
+class Batch_Runner {
+
+public:
+
+    // Worker threads, 0 for one per host core
+    unsigned threads;
+
+    Batch_Runner();
+
+    std::vector<Batch_Result> run(const std::vector<Batch_Job> &jobs);
+};
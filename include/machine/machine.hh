@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cpu/sh4_cpu.hh>
+#include <cpu/sh4_decode.hh>
+#include <memory/memory.hh>
+#include <scheduler/scheduler.hh>
+#include <hle/hle_bios.hh>
+#include <cstdint>
+#include <string>
+
+// Scheduler event that ends a run_cycles()/run_until() slice
+#define MACHINE_SLICE_EVENT     "Slice end"
+
+/*
+    A whole Dreamcast: the CPU, memory, scheduler, HLE BIOS and the decoder
+    that runs them, wired together. The lucid executable is a command line
+    front end for one (Two with -diff), anything else embedding the emulator
+    (Test drivers, tools) goes through this too.
+
+    Nothing here ever blocks forever: run_cycles() and run_until() hand
+    control back after a bounded slice of emulated time, so the same machine
+    can be driven in as many slices as needed. The members stay public for
+    whatever the API doesn't cover (Decoder settings, engine choice...), set
+    those before the first slice.
+
+    Machines share no state, any number of them can run at once as long as
+    each one stays on one thread at a time (See Batch_Runner). While one of
+    its calls runs, lucid_context points to the machine's log and status:
+    errors that would end the lucid executable stop the machine instead, and
+    status() tells why.
+*/
+class Machine {
+
+private:
+
+    /*
+        lucid_context for the duration of a call, put back the way it was
+        afterwards (Machines can be nested, -diff runs one inside the other)
+    */
+    class Context {
+
+    private:
+
+        Lucid_Context previous;
+
+    public:
+
+        Context(Machine *machine);
+        ~Context();
+    };
+
+public:
+
+    Sh4_Cpu cpu;
+    Memory memory;
+    Scheduler scheduler;
+    Hle_Bios hle_bios;
+    Sh4_Decode decoder;
+
+    /*
+        Where everything the machine prints goes, both messages and errors
+        (nullptr: the thread's current streams, std::cout/std::cerr unless
+        something else set them)
+    */
+    std::ostream *log;
+
+    /*
+        seed picks the values of the registers the manual leaves undefined,
+        the same seed always gives the same machine
+    */
+    Machine(std::uint32_t seed = SH4_DEFAULT_SEED);
+
+    Machine(const Machine &) = delete;
+    Machine &operator=(const Machine &) = delete;
+
+    void load_bios(const std::string &bios_path);
+    void load_flash(const std::string &flash_path);
+
+    // A BIOS shared with other machines, see Bios_Image
+    void use_bios(std::shared_ptr<const Bios_Image> image);
+
+    /*
+        Loads a raw binary or an ELF and points the CPU to it, through the HLE
+        BIOS if hle is set (Which also gets its syscalls serviced from then on)
+        or straight to the entry point otherwise. Returns the entry point (0
+        and status() Load_Failed if it couldn't).
+    */
+    std::uint32_t load_binary(const std::string &binary_path, bool hle);
+
+    /*
+        Runs for at least `cycles` SH-4 cycles and returns how many went by.
+        Steps are whole blocks for the block engines, so the slice can end a
+        block past the limit, idle loops and SLEEP never skip past it though.
+    */
+    std::uint64_t run_cycles(std::uint64_t cycles);
+
+    /*
+        Running until something stops the machine for good (The program
+        exited, an error), no slice runs anything after that
+    */
+    Lucid_Status status() const
+    {
+        return decoder.status;
+    }
+
+    /*
+        Runs until PC is `pc` (true) or max_cycles went by (false), see
+        Sh4_Decode::run_until for what the block engines can stop at
+    */
+    bool run_until(std::uint32_t pc, std::uint64_t max_cycles);
+
+    // One step of the current engine, see Sh4_Decode::step
+    std::uint32_t step();
+
+    std::uint64_t get_cycles();
+
+    /*
+        CPU state. Loading it goes through Sh4_Decode::resync, so it's fine
+        between any two slices.
+    */
+    void save_state(Sh4_Cpu_State &state) const;
+    void load_state(const Sh4_Cpu_State &state);
+
+    std::uint32_t get_pc();
+    std::uint32_t get_register(std::uint8_t index);
+    void set_register(std::uint8_t index, std::uint32_t value);
+
+    /*
+        Where a guest data access to address would go, without any of its side
+        effects (See Sh4_Mmu::probe), false if the guest would take a TLB
+        exception there. host_address isn't translated again: P2 if address
+        went through the TLB, address itself otherwise.
+    */
+    bool translate(std::uint32_t address, bool write, std::uint32_t &host_address);
+
+    /*
+        Guest memory accesses, made the way the CPU would make them (MMIO
+        included, through the TLB for U0/P3 with MMUCR.AT set) but without
+        ever raising an exception: where the guest would fault, read() returns
+        0 and write() does nothing and returns false.
+    */
+    template <typename T>
+    T read(std::uint32_t address)
+    {
+        Context context(this);
+        std::uint32_t host_address;
+
+        return translate(address, false, host_address) ? memory.read<T>(host_address, &cpu) : 0;
+    }
+
+    template <typename T>
+    bool write(std::uint32_t address, T value)
+    {
+        Context context(this);
+        std::uint32_t host_address;
+
+        if (!translate(address, true, host_address))
+        {
+            return false;
+        }
+
+        memory.write<T>(host_address, value, &cpu);
+        return true;
+    }
+
+    /*
+        Bulk copies, in one go when the range is plain main memory or the 64-bit
+        VRAM area and a byte at a time otherwise. Code built from what gets
+        overwritten is dropped. False if the guest would fault somewhere in the
+        range, the bytes before that are copied.
+    */
+    bool read_block(std::uint32_t address, void *data, std::uint32_t size);
+    bool write_block(std::uint32_t address, const void *data, std::uint32_t size);
+};
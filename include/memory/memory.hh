@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cpu/sh4_cpu.hh>
+#include <holly/holly_intc.hh>
 #include <lucid.hh>
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <iostream>
 
 #if __has_include(<format>)
@@ -15,6 +18,44 @@
     using fmt::format;
 #endif
 
+// Where a raw (Non-ELF) binary goes, same as 1ST_READ.BIN off a disc
+#define BINARY_LOAD_ADDRESS 0x8C010000
+
+// Size of the fastmem arena (The whole 29-bit physical address space)
+#define FASTMEM_SIZE        0x20000000
+
+// 8MB of VRAM, two 4MB banks
+#define VRAM_SIZE           0x00800000
+
+/*
+    A BIOS read once and mapped read-only, for any number of Memory instances
+    to share (See Memory::use_bios). A stray write faults instead of changing
+    it under everyone else.
+*/
+class Bios_Image {
+
+private:
+
+    std::uint8_t *pages;
+
+    Bios_Image();
+
+public:
+
+    ~Bios_Image();
+
+    Bios_Image(const Bios_Image &) = delete;
+    Bios_Image &operator=(const Bios_Image &) = delete;
+
+    // nullptr if the file can't be read
+    static std::shared_ptr<const Bios_Image> load(const std::string &bios_path);
+
+    const std::uint8_t *data() const
+    {
+        return pages;
+    }
+};
+
 class Memory {
 
 public:
@@ -22,64 +63,187 @@ public:
     Memory();
     ~Memory();
 
-    std::uint8_t* bios;  // Pointer for BIOS (2MB)
+    std::uint8_t* bios;  // Pointer for BIOS (2MB), bios_storage or a shared Bios_Image (Read only)
     std::uint8_t* flash; // Pointer for Flash (256KB)
     std::uint8_t* main_memory; // Pointer for main memory (16MB)
-    std::uint8_t* vram;  // Pointer for VRAM (8MB)
+    std::uint8_t* vram;  // Pointer for VRAM (8MB, in the layout of the 64-bit area)
+
+    Holly_Intc holly_intc;
+
+    /*
+        One flag per 4KB page of main memory, set when something derived data from
+        the code in it (Block cache, idle loop detection...).
+        Writing to a flagged page calls code_write_handler and clears the flag, it's
+        up to the handler to drop whatever it built from that page.
+    */
+    std::uint8_t* code_pages;
+    std::function<void(std::uint32_t)> code_write_handler;
+
+    void set_code_page(std::uint32_t p_addr);
+    void code_written(std::uint32_t p_addr);
+
+    /*
+        One flag per 4KB page of main memory, set by every write that goes through
+        write() or ram_written() (JIT fastmem stores don't). nullptr until
+        track_dirty_pages() is called, whoever reads the flags clears them.
+    */
+    std::uint8_t* dirty_pages;
+
+    void track_dirty_pages();
+
+    /*
+        Host pointer to [address, address + size) if the whole range is plain main
+        memory (No MMIO, no mirrors), nullptr otherwise.
+        Bulk writes through it have to call ram_written() afterwards.
+    */
+    std::uint8_t *ram_pointer(std::uint32_t address, std::uint32_t size);
+    void ram_written(std::uint32_t address, std::uint32_t size);
+
+    /*
+        VRAM shows up twice in area 1 (And again at +0x02000000):
+          0x04000000-0x04FFFFFF  64-bit area, the two banks interleaved every 32 bits
+          0x05000000-0x05FFFFFF  32-bit area, bank 0 then bank 1
+        Each one mirrored every 8MB. vram is kept in the 64-bit layout (What the
+        PVR's texture engine reads), so that area is a plain offset and the 32-bit
+        one moves the bank select from bit 22 down to bit 2.
+    */
+    static bool is_vram(std::uint32_t p_addr)
+    {
+        return p_addr >= 0x04000000 && p_addr <= 0x07FFFFFF;
+    }
+
+    static std::uint32_t vram_offset(std::uint32_t p_addr)
+    {
+        std::uint32_t offset = p_addr & (VRAM_SIZE - 1);
+
+        if (p_addr & 0x01000000)
+        {
+            offset = ((offset & 0x003FFFFC) << 1) | ((offset >> 20) & 0x4) | (offset & 0x3);
+        }
+
+        return offset;
+    }
+
+    /*
+        Same as ram_pointer() for VRAM: only ranges in the 64-bit area map to
+        contiguous host memory, nullptr for anything else
+    */
+    std::uint8_t *vram_pointer(std::uint32_t address, std::uint32_t size);
+
+    /*
+        Fastmem arena: the physical address space, reserved as a whole with main
+        memory (And its mirrors) mapped at 0x0C000000-0x0FFFFFFF, the 64-bit VRAM
+        area (And its mirrors) at 0x04000000/0x06000000 and everything else
+        inaccessible. The JIT accesses it directly and relies on faults for
+        the rest (See Sh4_Jit).
+        Pages with their code_pages flag set are read-only here, so that writes
+        to them fault too and go through code_written().
+
+        Always below 2GB so that its base fits in a 32-bit displacement,
+        nullptr until map_fastmem() succeeds.
+    */
+    std::uint8_t *fastmem;
+
+    bool map_fastmem();
 
     void load_bios(const std::string& bios_path);
+
+    /*
+        Maps a BIOS already loaded somewhere else instead of a copy of its own,
+        load_bios() goes back to the private copy
+    */
+    void use_bios(std::shared_ptr<const Bios_Image> image);
     void load_flash(const std::string& flash_path);
-    void load_binary(const std::string& binary_path);
+    std::uint32_t load_binary(const std::string& binary_path);
 
     void dump_ram();
+
+private:
+
+    // memfd backing main_memory, so it can be mapped more than once (-1 if it's on the heap)
+    int ram_fd;
+
+    // Same for vram
+    int vram_fd;
+
+    std::uint8_t *bios_storage;
+    std::shared_ptr<const Bios_Image> shared_bios;
+
+    void protect_code_page(std::uint32_t p_addr, bool code);
+
+public:
     
+    /*
+        Instruction fetch, through the ITLB with MMUCR.AT set
+    */
+    std::uint16_t fetch(std::uint32_t address, Sh4_Cpu *cpu)
+    {
+        if (cpu->mmu.translating())
+        {
+            std::uint32_t p_addr = address & 0x1FFFFFFF;
+
+            if (!cpu->mmu.translate<Sh4_Access::Fetch>(address, cpu->get_md_bit(), p_addr))
+            {
+                return 0;
+            }
+
+            // P2, so that it isn't translated again
+            address = p_addr | 0xA0000000;
+        }
+
+        return read<std::uint16_t>(address, cpu);
+    }
+
     template <typename T>
     T read(uint32_t address, Sh4_Cpu *cpu) {
-        
-        // Get MD Bit (Bit #30) from the Status Register
-        bool md_bit = cpu->get_md_bit();
 
+        T *from;
+
+#ifdef MEMORY_DEBUG
         bool p = (address >> 31) & 1;
         bool alt = (address >> 30) & 1;
         bool nc = (address >> 29) & 1;
 
-        T *from;
-
-#ifdef MEMORY_DEBUG
-        std::cout << "memory_read: Reading from 0x" << format("{:08X}", address) << ", P: " << +(p) << " , ALT: " 
+        lucid_out() << "memory_read: Reading from 0x" << format("{:08X}", address) << ", P: " << +(p) << " , ALT: " 
         << +(alt) << " , NC: " << +(nc) << std::endl;
 
         if (address >= 0 && address <= 0x7FFFFFFF)
         {
-            std::cout << "             U0/P0 read (";
+            lucid_out() << "             U0/P0 read (";
         }
         else
         if (address >= 0x80000000 && address <= 0x9FFFFFFF)
         {
-            std::cout << "             P1 read (";
+            lucid_out() << "             P1 read (";
         }
         else
         if (address >= 0xA0000000 && address <= 0xBFFFFFFF)
         {
-            std::cout << "             P2 read (";
+            lucid_out() << "             P2 read (";
         }
         else
         if (address >= 0xC0000000 && address <= 0xDFFFFFFF)
         {
-            std::cout << "             P3 read (";
+            lucid_out() << "             P3 read (";
         }
         else
         if (address >= 0xE0000000 && address <= 0xFFFFFFFF)
         {
-            std::cout << "             P4 read (";
+            lucid_out() << "             P4 read (";
         }
 #endif
 
         // Calculate the physical address
         std::uint32_t p_addr = (address & 0x1FFFFFFF);
 
+        // U0/P3 go through the TLB with MMUCR.AT set, the instruction gets rolled back on a fault
+        if (cpu->mmu.translating() && !cpu->mmu.translate<Sh4_Access::Read>(address, cpu->get_md_bit(), p_addr))
+        {
+            return 0;
+        }
+
 #ifdef MEMORY_DEBUG
-        std::cout << "Physical: 0x" << format("{:08X}", p_addr) << ")" << std::endl;
+        lucid_out() << "Physical: 0x" << format("{:08X}", p_addr) << ")" << std::endl;
 #endif
 
         // $00000000 - $001FFFFF | Boot ROM (2MB)
@@ -93,30 +257,82 @@ public:
         }
         else if (p_addr == 0x005F7480)
         {
-            std::cout << BOLDRED << "memory_read: Illegal read from the SB_G1RRC register (Write only register)!" << RESET << std::endl;
+            lucid_out() << BOLDRED << "memory_read: Illegal read from the SB_G1RRC register (Write only register)!" << RESET << std::endl;
             return 0;
         }
         else if (p_addr >= 0x0C000000 && p_addr <= 0x0FFFFFFF)
         {
-            from = reinterpret_cast<T*>(&main_memory[p_addr - 0x0C000000]);
+            from = reinterpret_cast<T*>(&main_memory[p_addr & 0x00FFFFFF]);
+        }
+        else if (is_vram(p_addr))
+        {
+            from = reinterpret_cast<T*>(&vram[vram_offset(p_addr)]);
+        }
+        else if (Holly_Intc::is_register(p_addr))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_read: Tried to read from a Holly interrupt register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return 0;
+            }
+
+            // No message, interrupt handlers poll the status registers
+            return static_cast<uint32_t>(holly_intc.read_register(p_addr));
+        }
+        else if (Sh4_Mmu::is_register(p_addr))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_read: Tried to read from an MMU register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return 0;
+            }
+
+            return static_cast<uint32_t>(cpu->mmu.read_register(p_addr));
+        }
+        else if (Sh4_Mmu::is_array(address))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_read: Tried to read from a TLB array with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return 0;
+            }
+
+            return static_cast<uint32_t>(cpu->mmu.read_array(address));
+        }
+        else if (p_addr == 0x1F000020 || p_addr == 0x1F000028)
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_read: Tried to read from TRA/INTEVT register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return 0;
+            }
+
+            // No message, handlers read them on every TRAPA/interrupt
+            return static_cast<uint32_t>((p_addr == 0x1F000020) ? cpu->get_tra() : cpu->get_intevt());
         }
         else if (p_addr == 0x1F000024)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_read: Tried to read from EXPEVT register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_read: Tried to read from EXPEVT register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return 0;
             }
 
-            std::cout << BOLDMAGENTA << "memory_read: Read from the EXPEVT register" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_read: Read from the EXPEVT register" << RESET << std::endl;
 
             return static_cast<uint32_t>(cpu->get_expevt());
         }
         else
         {
-            std::cout << BOLDRED "memory_read: Unhandled read at address 0x" << format("{:08X}", p_addr) << " (Virtual: 0x" << format("{:08X}", address) << ")" << RESET << "\n";
+            lucid_out() << BOLDRED "memory_read: Unhandled read at address 0x" << format("{:08X}", p_addr) << " (Virtual: 0x" << format("{:08X}", address) << ")" << RESET << "\n";
             cpu->print_registers();
-            exit(1);
+            lucid_stop(Lucid_Status::Unhandled_Access);
+            return 0;
         }
 
         if (std::is_same<T, uint8_t>::value)
@@ -136,215 +352,273 @@ public:
     template <typename T>
     void write(uint32_t address, T value, Sh4_Cpu *cpu) {
 
-        // Get MD Bit (Bit #30) from the Status Register
-        bool md_bit = cpu->get_md_bit();
-
+#ifdef MEMORY_DEBUG
         bool p = (address >> 31) & 1;
         bool alt = (address >> 30) & 1;
         bool nc = (address >> 29) & 1;
 
-#ifdef MEMORY_DEBUG
-        std::cout << "memory_write: Writing to 0x" << format("{:08X}", address) << ", P: " << +(p) << " , ALT: " 
+        lucid_out() << "memory_write: Writing to 0x" << format("{:08X}", address) << ", P: " << +(p) << " , ALT: " 
         << +(alt) << " , NC: " << +(nc) << std::endl;
 
         if (address >= 0 && address <= 0x7FFFFFFF)
         {
-            std::cout << "             U0/P0 read (";
+            lucid_out() << "             U0/P0 read (";
         }
         else
         if (address >= 0x80000000 && address <= 0x9FFFFFFF)
         {
-            std::cout << "             P1 read (";
+            lucid_out() << "             P1 read (";
         }
         else
         if (address >= 0xA0000000 && address <= 0xBFFFFFFF)
         {
-            std::cout << "             P2 read (";
+            lucid_out() << "             P2 read (";
         }
         else
         if (address >= 0xC0000000 && address <= 0xDFFFFFFF)
         {
-            std::cout << "             P3 read (";
+            lucid_out() << "             P3 read (";
         }
         else
         if (address >= 0xE0000000 && address <= 0xFFFFFFFF)
         {
-            std::cout << "             P4 read (";
+            lucid_out() << "             P4 read (";
         }
 #endif
 
         // Calculate the physical address
         std::uint32_t p_addr = (address & 0x1FFFFFFF);
 
+        if (cpu->mmu.translating() && !cpu->mmu.translate<Sh4_Access::Write>(address, cpu->get_md_bit(), p_addr))
+        {
+            return;
+        }
+
 #ifdef MEMORY_DEBUG
-        std::cout << "Physical: 0x" << format("{:08X}", p_addr) << ")" << std::endl;
+        lucid_out() << "Physical: 0x" << format("{:08X}", p_addr) << ")" << std::endl;
 #endif
 
         if (p_addr == 0x005F74E4)
         {
-            std::cout << BOLDMAGENTA << "memory_write: Write to undocumented Holly register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to undocumented Holly register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_holly_status(value);
         }
         else
         if (p_addr >= 0x0C000000 && p_addr <= 0x0FFFFFFF)
         {
+            if (code_pages[(p_addr & 0x00FFFFFF) >> 12])
+            {
+                code_written(p_addr);
+            }
+
+            // 16MB, mirrored 4 times
+            std::uint32_t offset = p_addr & 0x00FFFFFF;
+
+            if (dirty_pages)
+            {
+                dirty_pages[offset >> 12] = 1;
+            }
+
             if ((std::is_same<T, std::uint16_t>::value))
             {
-                main_memory[p_addr - 0x0C000000] = value & 0x00FF;
-                main_memory[(p_addr + 1) - 0x0C000000] = ((((std::uint16_t) (value)) >> 8) & 0xFF);
+                main_memory[offset] = value & 0x00FF;
+                main_memory[offset + 1] = ((((std::uint16_t) (value)) >> 8) & 0xFF);
             }
             else if ((std::is_same<T, std::uint32_t>::value))
             {
-                main_memory[p_addr - 0x0C000000] = value & 0xFF;
-                main_memory[(p_addr + 1) - 0x0C000000] = ((((std::uint32_t) (value)) >> 8) & 0xFF);
-                main_memory[(p_addr + 2) - 0x0C000000] = ((((std::uint32_t) (value)) >> 16) & 0xFF);
-                main_memory[(p_addr + 3) - 0x0C000000] = ((((std::uint32_t) (value)) >> 24) & 0xFF);
+                main_memory[offset] = value & 0xFF;
+                main_memory[offset + 1] = ((((std::uint32_t) (value)) >> 8) & 0xFF);
+                main_memory[offset + 2] = ((((std::uint32_t) (value)) >> 16) & 0xFF);
+                main_memory[offset + 3] = ((((std::uint32_t) (value)) >> 24) & 0xFF);
             }
             else
             {
-                std::cout << BOLDRED << "memory_write: Write to SDRAM (16MB) region with unimplemented ";
-
-                if ((std::is_same<T, std::uint8_t>::value)) std::cout << "byte";
+                main_memory[offset] = value & 0xFF;
+            }
+        }
+        else if (is_vram(p_addr))
+        {
+            // Aligned accesses never straddle a 32-bit word, so one swizzle covers them
+            *reinterpret_cast<T*>(&vram[vram_offset(p_addr)]) = value;
+        }
+        else if (Holly_Intc::is_register(p_addr))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_write: Tried to write to a Holly interrupt register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
+            }
 
-                std::cout << " size! Exiting..." << std::endl;
-                
-                exit(1);
-            }           
+            holly_intc.write_register(p_addr, value, cpu);
         }
         else if (p_addr == 0x005F7480)
         {
-            std::cout << BOLDMAGENTA << "memory_write: Write to the SB_G1RRC register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the SB_G1RRC register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_sb_g1rrc(value);
         }
         else if (p_addr == 0x1F000010)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to MMUCR register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to MMUCR register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the MMUCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the MMUCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_mmucr(value);
         }
+        else if (Sh4_Mmu::is_register(p_addr))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_write: Tried to write to an MMU register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
+            }
+
+            // PTEH/PTEL/PTEA/TTB/TEA, no message since TLB refills write them all the time
+            cpu->mmu.write_register(p_addr, value);
+        }
+        else if (Sh4_Mmu::is_array(address))
+        {
+            if (!(std::is_same<T, uint32_t>::value))
+            {
+                lucid_out() << BOLDRED "memory_write: Tried to write to a TLB array with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
+            }
+
+            cpu->mmu.write_array(address, value, cpu->get_md_bit());
+        }
         else if (p_addr == 0x1F00001C)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to CCR register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to CCR register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the CCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the CCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_ccr(value);
         }
         else if (p_addr == 0x1F800000)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to BCR1 register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to BCR1 register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the BCR1 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the BCR1 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_bcr1(value);
         }
         else if (p_addr == 0x1F800004)
         {
             if (!(std::is_same<T, uint16_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to BCR2 register with a size != WORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to BCR2 register with a size != WORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the BCR2 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the BCR2 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_bcr2(value);
         }
         else if (p_addr == 0x1F800008)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to WCR1 register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to WCR1 register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the WCR1 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the WCR1 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_wcr1(value);
         }
         else if (p_addr == 0x1F80000C)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to WCR2 register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to WCR2 register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the WCR2 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the WCR2 register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_wcr2(value);
         }
         else if (p_addr == 0x1F800014)
         {
             if (!(std::is_same<T, uint32_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to MCR register with a size != LONGWORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to MCR register with a size != LONGWORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the MCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the MCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_mcr(value);
         }
         else if (p_addr == 0x1F80001C)
         {
             if (!(std::is_same<T, uint16_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to RTCSR register with a size != WORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to RTCSR register with a size != WORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the RTCSR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the RTCSR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_rtcsr(value);
         }
         else if (p_addr == 0x1F800024)
         {
             if (!(std::is_same<T, uint16_t>::value))
             {
-                std::cout << BOLDRED "memory_write: Tried to write to RTCOR register with a size != WORD ...!" << RESET << "\n";
-                exit(1);
+                lucid_out() << BOLDRED "memory_write: Tried to write to RTCOR register with a size != WORD ...!" << RESET << "\n";
+                lucid_stop(Lucid_Status::Unhandled_Access);
+                return;
             }
 
-            std::cout << BOLDMAGENTA << "memory_write: Write to the RTCOR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the RTCOR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_rtcor(value);
         }
         else if (p_addr == 0x1F800028)
         {
-            std::cout << BOLDMAGENTA << "memory_write: Write to the SDMR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the SDMR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_sdmr(value);
         }
         else if (p_addr == 0x1F940190)
         {
-            std::cout << BOLDMAGENTA << "memory_write: Write to the RFCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
+            lucid_out() << BOLDMAGENTA << "memory_write: Write to the RFCR register (Value: 0x" << format("{:08X}", value) << ")" << RESET << std::endl;
             cpu->set_rfcr(value);
         }
         else
         {
-            std::cout << BOLDRED << "memory_write: Unhandled write at address 0x" << format("{:08X}", p_addr) << " (Virtual: 0x" << format("{:08X}", address) << ") with value 0x";
+            lucid_out() << BOLDRED << "memory_write: Unhandled write at address 0x" << format("{:08X}", p_addr) << " (Virtual: 0x" << format("{:08X}", address) << ") with value 0x";
             
             if (std::is_same<T, uint8_t>::value)
             {
-                std::cout << format("{:02X}", value);
+                lucid_out() << format("{:02X}", value);
             }
             else if (std::is_same<T, uint16_t>::value)
             {
-                std::cout << format("{:04X}", value);
+                lucid_out() << format("{:04X}", value);
             }
             else if (std::is_same<T, uint32_t>::value)
             {
-                std::cout << format("{:08X}", value);
+                lucid_out() << format("{:08X}", value);
             }
 
-            std::cout << RESET << std::endl;
+            lucid_out() << RESET << std::endl;
 
-            exit(1);
+            lucid_stop(Lucid_Status::Unhandled_Access);
+            return;
         }
     }
 
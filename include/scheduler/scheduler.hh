@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+    SH-4 core clock, one cycle is the base unit of emulated time
+*/
+#define SH4_CLOCK_HZ            200000000ull
+
+class Scheduler {
+
+    // Blocks add their cycles and look for due events themselves (See sh4_jit.hh)
+    friend class Sh4_Jit;
+
+private:
+
+    struct Event {
+        std::uint64_t cycle;
+        std::string name;
+        std::function<void()> callback;
+    };
+
+    /*
+        Emulated cycles since power on
+    */
+    std::uint64_t cycles;
+
+    /*
+        Cycle of the earliest pending event (UINT64_MAX if there's none), cached
+        so that the execution loop only needs a compare per instruction
+    */
+    std::uint64_t next_event;
+
+    /*
+        Min-heap on Event::cycle
+    */
+    std::vector<Event> events;
+
+    /*
+        Real-time mode: emulated time is tied to the host clock whenever the guest
+        waits (SLEEP, idle loops), so instead of skipping ahead the host thread
+        blocks until the wall-clock time of the next event. Unthrottled mode just
+        jumps the cycle counter.
+
+        sync_time/sync_cycles anchor emulated cycles to the host clock.
+    */
+    bool real_time;
+    std::chrono::steady_clock::time_point sync_time;
+    std::uint64_t sync_cycles;
+
+    std::chrono::steady_clock::time_point cycles_to_host_time(std::uint64_t cycle);
+    std::uint64_t host_time_to_cycles(std::chrono::steady_clock::time_point time);
+
+public:
+
+    Scheduler();
+
+    void add_cycles(std::uint64_t cycles_)
+    {
+        cycles += cycles_;
+    }
+
+    std::uint64_t get_cycles()
+    {
+        return cycles;
+    }
+
+    bool event_pending()
+    {
+        return cycles >= next_event;
+    }
+
+    std::uint64_t get_next_event()
+    {
+        return next_event;
+    }
+
+    bool is_real_time()
+    {
+        return real_time;
+    }
+
+    void set_real_time(bool real_time_);
+
+    void schedule(std::uint64_t delay, const std::string &name, std::function<void()> callback);
+
+    // Drops every pending event called name
+    void cancel(const std::string &name);
+    void run_events();
+    void skip_to_next_event(std::uint64_t max_cycles);
+};
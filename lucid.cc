@@ -1,16 +1,53 @@
-#include <memory/memory.hh>
-#include <cpu/sh4_cpu.hh>
-#include <cpu/sh4_decode.hh>
+#include <machine/machine.hh>
+#include <machine/batch.hh>
+#include <cpu/sh4_diff.hh>
+#include <cpu/sh4_fuzz.hh>
+#include <cpu/sh4_tcache.hh>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cctype>
+
+#if __has_include(<format>)
+    #include <format>
+    using std::format;
+#else
+    #include <fmt/format.h>
+    using fmt::format;
+#endif
+
+// For the -stats exit handler, the emulator leaves through exit() most of the time
+static Sh4_Decode *stats_decoder = nullptr;
+
+// Saved by an exit handler too
+static Sh4_Translation_Cache tcache;
+
+// For the -diff exit handler (nullptr once the harness is gone)
+static Sh4_Diff *diff_harness = nullptr;
 
 int main(int argc, char **argv)
 {
     const std::string bios_arg = "-bios", flash_arg = "-flash", binary_arg = "-bin";
-    std::string bios_file, flash_file, binary_file;
+    const std::string no_idle_skip_arg = "-noidleskip", real_time_arg = "-realtime", engine_arg = "-engine";
+    const std::string dump_ir_arg = "-dumpir", stats_arg = "-stats", no_fuse_arg = "-nofuse", no_bulk_arg = "-nobulk", hle_arg = "-hle";
+    const std::string no_fastmem_arg = "-nofastmem", perf_map_arg = "-perfmap", jitdump_arg = "-jitdump", diff_arg = "-diff";
+    const std::string tcache_arg = "-tcache", jit_cache_arg = "-jitcache", tier_cached_arg = "-tiercached", tier_jit_arg = "-tierjit";
+    const std::string fuzz_arg = "-fuzz", fuzz_trace_arg = "-fuzztrace", fuzz_check_arg = "-fuzzcheck", fuzz_csv_arg = "-fuzzcsv";
+    const std::string fuzz_seed_arg = "-fuzzseed", fuzz_slow_arg = "-fuzzslow", stop_unimplemented_arg = "-stopunimplemented";
+    const std::string batch_arg = "-batch", threads_arg = "-threads", cycles_arg = "-cycles";
+    std::string bios_file, flash_file, binary_file, tcache_file, batch_file, engine_name = "interpreter";
+    std::uint64_t batch_cycles = BATCH_DEFAULT_CYCLES;
+    unsigned batch_threads = 0;
+    std::string fuzz_trace, fuzz_golden, fuzz_csv = SH4_INSTR_CSV;
+    std::uint32_t fuzz_cases = 0;
+    std::uint64_t fuzz_seed = 0x5EED, fuzz_slow = FUZZ_SLOW_THRESHOLD;
     bool load_bios = false, load_flash = false, load_binary = false;
+    std::size_t jit_cache_size = CODE_CACHE_DEFAULT_SIZE;
+    std::uint32_t tier_cached_threshold = TIER_CACHED_THRESHOLD, tier_jit_threshold = TIER_JIT_THRESHOLD;
+    bool idle_skip = true, real_time = false, dump_ir = false, stats = false, fuse = true, bulk = true, hle = false, fastmem = true;
+    bool perf_map = false, jitdump = false, diff = false, stop_unimplemented = false;
 
     if (argc < 2)
     {
@@ -63,37 +100,381 @@ int main(int argc, char **argv)
                     return 1;
                 }
             }
+            else if (no_idle_skip_arg.compare(argv[i]) == 0)
+            {
+                idle_skip = false;
+            }
+            else if (real_time_arg.compare(argv[i]) == 0)
+            {
+                real_time = true;
+            }
+            else if (dump_ir_arg.compare(argv[i]) == 0)
+            {
+                dump_ir = true;
+            }
+            else if (stats_arg.compare(argv[i]) == 0)
+            {
+                stats = true;
+            }
+            else if (no_fuse_arg.compare(argv[i]) == 0)
+            {
+                fuse = false;
+            }
+            else if (no_bulk_arg.compare(argv[i]) == 0)
+            {
+                bulk = false;
+            }
+            else if (no_fastmem_arg.compare(argv[i]) == 0)
+            {
+                fastmem = false;
+            }
+            else if (perf_map_arg.compare(argv[i]) == 0)
+            {
+                perf_map = true;
+            }
+            else if (jitdump_arg.compare(argv[i]) == 0)
+            {
+                jitdump = true;
+            }
+            else if (diff_arg.compare(argv[i]) == 0)
+            {
+                diff = true;
+            }
+            else if (stop_unimplemented_arg.compare(argv[i]) == 0)
+            {
+                stop_unimplemented = true;
+            }
+            else if (fuzz_arg.compare(argv[i]) == 0)
+            {
+                // Cases per instruction class
+                fuzz_cases = FUZZ_DEFAULT_CASES;
+
+                if (argv[i + 1] != NULL && std::isdigit(argv[i + 1][0]))
+                {
+                    fuzz_cases = std::strtoul(argv[i + 1], nullptr, 0);
+                    i++;
+                }
+            }
+            else if (fuzz_trace_arg.compare(argv[i]) == 0 || fuzz_check_arg.compare(argv[i]) == 0 || fuzz_csv_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    (fuzz_trace_arg.compare(argv[i]) == 0 ? fuzz_trace : fuzz_check_arg.compare(argv[i]) == 0 ? fuzz_golden : fuzz_csv) = argv[i + 1];
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No file provided for " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (fuzz_seed_arg.compare(argv[i]) == 0 || fuzz_slow_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    (fuzz_seed_arg.compare(argv[i]) == 0 ? fuzz_seed : fuzz_slow) = std::strtoull(argv[i + 1], nullptr, 0);
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No value provided for " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (batch_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    batch_file = argv[i + 1];
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No batch list provided\n";
+                    return 1;
+                }
+            }
+            else if (threads_arg.compare(argv[i]) == 0 || cycles_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    if (threads_arg.compare(argv[i]) == 0)
+                    {
+                        batch_threads = std::strtoul(argv[i + 1], nullptr, 0);
+                    }
+                    else
+                    {
+                        batch_cycles = std::strtoull(argv[i + 1], nullptr, 0);
+                    }
+
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No value provided for " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (hle_arg.compare(argv[i]) == 0)
+            {
+                hle = true;
+            }
+            else if (tcache_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    tcache_file = argv[i + 1];
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No translation cache file provided\n";
+                    return 1;
+                }
+            }
+            else if (tier_cached_arg.compare(argv[i]) == 0 || tier_jit_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    std::uint32_t threshold = std::strtoul(argv[i + 1], nullptr, 0);
+                    (tier_cached_arg.compare(argv[i]) == 0 ? tier_cached_threshold : tier_jit_threshold) = threshold;
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No promotion threshold provided\n";
+                    return 1;
+                }
+            }
+            else if (jit_cache_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    // In MB
+                    jit_cache_size = std::strtoul(argv[i + 1], nullptr, 0) * 1024 * 1024;
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No JIT code cache size provided\n";
+                    return 1;
+                }
+            }
+            else if (engine_arg.compare(argv[i]) == 0)
+            {
+                if (argv[i + 1] != NULL)
+                {
+                    engine_name = argv[i + 1];
+                    i++;
+                }
+                else
+                {
+                    std::cerr << "No engine provided (interpreter, cached, jit, tiered)\n";
+                    return 1;
+                }
+            }
         }
     }
 
-    // Initialize CPU
-    Sh4_Cpu cpu;
-    std::cout << "CPU Initialized" << std::endl;
+    Sh4_Engine engine = Sh4_Engine::Interpreter;
+
+    if (engine_name == "cached")
+    {
+        engine = Sh4_Engine::Cached;
+    }
+    else if (engine_name == "jit")
+    {
+        engine = Sh4_Engine::Jit;
+    }
+    else if (engine_name == "tiered")
+    {
+        engine = Sh4_Engine::Tiered;
+    }
+    else if (engine_name != "interpreter")
+    {
+        std::cerr << "Unknown engine: " << engine_name << " (interpreter, cached, jit, tiered)\n";
+        return 1;
+    }
 
-    Memory memory;
+    // The instruction tests run on a bare machine
+    bool fuzzing = fuzz_cases || !fuzz_golden.empty();
 
-    if (load_bios)
+    if (!load_bios && !hle && !fuzzing)
     {
-        memory.load_bios(bios_file);
+        std::cout << "In order for Lucid to work we need a BIOS file (Or -hle and a binary)...!" << std::endl;
+        return 1;
     }
-    else
+    else if (hle && !load_binary && batch_file.empty())
     {
-        std::cout << "In order for Lucid to work we need a BIOS file...!" << std::endl;
+        std::cout << "The HLE BIOS can only boot a binary (-bin)...!" << std::endl;
         return 1;
     }
 
-    if (load_flash) memory.load_flash(flash_file);
+    // Everything that goes in a machine before it starts (-diff sets up two)
+    auto load = [&](Machine &machine_)
+    {
+        if (load_bios && !hle) machine_.load_bios(bios_file);
+        if (load_flash) machine_.load_flash(flash_file);
+        if (load_binary) machine_.load_binary(binary_file, hle);
+
+        machine_.scheduler.set_real_time(real_time);
+        machine_.decoder.stop_on_unimplemented = stop_unimplemented;
+    };
+
+    // Engine settings, the -diff reference stays a plain interpreter
+    auto configure = [&](Machine &machine_)
+    {
+        Sh4_Decode &decoder_ = machine_.decoder;
+        decoder_.engine = engine;
+        decoder_.idle_loop_skip = idle_skip;
+        decoder_.blocks.dump_ir = dump_ir;
+        decoder_.fuse_pairs = fuse;
+        decoder_.bulk_loops = bulk;
+        decoder_.profile_pairs = stats;
+        decoder_.jit.fastmem = fastmem;
+        decoder_.tier_cached_threshold = tier_cached_threshold;
+        decoder_.tier_jit_threshold = tier_jit_threshold;
+
+        if (jit_cache_size != CODE_CACHE_DEFAULT_SIZE)
+        {
+            decoder_.jit.code_cache.resize(jit_cache_size);
+        }
+    };
 
-    if (load_binary)
+    // Every binary listed in the file (One per line) on a machine of its own, spread over -threads workers
+    if (!batch_file.empty())
     {
-        memory.load_binary(binary_file);
-        cpu.set_pc(0x00200000);
-        cpu.set_delay_pc(0x00200000 + 2);
+        std::ifstream list(batch_file);
+
+        if (!list.is_open())
+        {
+            std::cerr << "Couldn't open the batch list " << batch_file << "\n";
+            return 1;
+        }
+
+        // One copy for all of them
+        std::shared_ptr<const Bios_Image> shared_bios;
+
+        if (load_bios && !hle && !(shared_bios = Bios_Image::load(bios_file)))
+        {
+            return 1;
+        }
+
+        std::vector<Batch_Job> jobs;
+        std::string line;
+
+        while (std::getline(list, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            jobs.push_back({line, [&, line](Machine &machine_)
+            {
+                if (shared_bios) machine_.use_bios(shared_bios);
+                if (load_flash) machine_.load_flash(flash_file);
+
+                machine_.load_binary(line, hle);
+                machine_.scheduler.set_real_time(real_time);
+                machine_.decoder.stop_on_unimplemented = stop_unimplemented;
+                configure(machine_);
+            }, batch_cycles});
+        }
+
+        Batch_Runner runner;
+        runner.threads = batch_threads;
+
+        bool passed = true;
+
+        for (const Batch_Result &result : runner.run(jobs))
+        {
+            bool failed = result.status != Lucid_Status::Running && result.status != Lucid_Status::Exited;
+            passed = passed && !failed;
+
+            std::cout << (failed ? BOLDRED : BOLDGREEN) << result.name << ": " << lucid_status_name(result.status) << " after "
+                << result.cycles << " cycles, PC 0x" << format("{:08X}", result.state.pc) << ", state 0x"
+                << format("{:016X}", sh4_tcache_hash(&result.state, sizeof(result.state))) << RESET << "\n";
+
+            if (failed)
+            {
+                std::cout << result.log;
+            }
+        }
+
+        return passed ? 0 : 1;
     }
 
+    Machine machine;
+    std::cout << "CPU Initialized" << std::endl;
+
+    load(machine);
     std::cout << "Memory Map Initialized" << std::endl;
 
-    Sh4_Decode decoder(&cpu, &memory);
+    if (machine.status() != Lucid_Status::Running)
+    {
+        return 1;
+    }
+
+    configure(machine);
+
+    Sh4_Decode &decoder = machine.decoder;
+
+    if (perf_map) decoder.jit.perf_map.open_map();
+    if (jitdump) decoder.jit.perf_map.open_dump();
+
+    // Before the exit handlers below, the test children exit() through them otherwise
+    if (fuzzing)
+    {
+        Sh4_Fuzz fuzz(&decoder);
+        fuzz.cases = fuzz_cases;
+        fuzz.seed = fuzz_seed;
+        fuzz.slow_threshold = fuzz_slow;
+        fuzz.trace_path = fuzz_trace;
+
+        if (!fuzz.load(fuzz_csv))
+        {
+            return 1;
+        }
+
+        return (fuzz_golden.empty() ? fuzz.run() : fuzz.check(fuzz_golden)) ? 0 : 1;
+    }
+
+    // Only the block engines use it, after the BIOS is in (Part of the key)
+    if (!tcache_file.empty() && decoder.engine != Sh4_Engine::Interpreter)
+    {
+        tcache.open(tcache_file, &machine.memory);
+        decoder.blocks.tcache = &tcache;
+        std::atexit([]() { tcache.save(); });
+    }
+
+    if (stats)
+    {
+        stats_decoder = &decoder;
+        std::atexit([]() { if (stats_decoder) stats_decoder->print_stats(); });
+    }
+
+    if (diff)
+    {
+        // Reference interpreter on a machine of its own
+        Machine reference;
+        load(reference);
+
+        Sh4_Diff harness(&reference.decoder, &decoder);
+
+        diff_harness = &harness;
+        std::atexit([]() { if (diff_harness) diff_harness->print_stats(); });
+
+        bool matched = harness.run();
+
+        harness.print_stats();
+        diff_harness = nullptr;
+
+        if (stats) decoder.print_stats();
+        stats_decoder = nullptr;
+
+        return matched ? 0 : 1;
+    }
 
     decoder.run();
 
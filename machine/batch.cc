@@ -0,0 +1,60 @@
+#include <machine/batch.hh>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+Batch_Runner::Batch_Runner()
+{
+    threads = 0;
+}
+
+std::vector<Batch_Result> Batch_Runner::run(const std::vector<Batch_Job> &jobs)
+{
+    std::vector<Batch_Result> results(jobs.size());
+    std::atomic<std::size_t> next = 0;
+
+    auto worker = [&]()
+    {
+        for (std::size_t i = next++; i < jobs.size(); i = next++)
+        {
+            const Batch_Job &job = jobs[i];
+            Batch_Result &result = results[i];
+
+            std::ostringstream log;
+
+            // Too big for a worker's stack
+            auto machine = std::make_unique<Machine>(job.seed);
+            machine->log = &log;
+
+            if (job.setup)
+            {
+                job.setup(*machine);
+            }
+
+            result.name = job.name;
+            result.cycles = (machine->status() == Lucid_Status::Running) ? machine->run_cycles(job.cycles) : 0;
+            result.status = machine->status();
+            machine->save_state(result.state);
+            result.log = log.str();
+        }
+    };
+
+    unsigned count = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    count = static_cast<unsigned>(std::min<std::size_t>(count, jobs.size()));
+
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        workers.emplace_back(worker);
+    }
+
+    for (std::thread &thread : workers)
+    {
+        thread.join();
+    }
+
+    return results;
+}
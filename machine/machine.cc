@@ -0,0 +1,227 @@
+#include <machine/machine.hh>
+#include <cstring>
+
+Machine::Context::Context(Machine *machine)
+{
+    previous = lucid_context;
+
+    if (machine->log)
+    {
+        lucid_context.out = machine->log;
+        lucid_context.err = machine->log;
+    }
+
+    lucid_context.status = &machine->decoder.status;
+}
+
+Machine::Context::~Context()
+{
+    lucid_context = previous;
+}
+
+Machine::Machine(std::uint32_t seed) : cpu(seed), hle_bios(&cpu, &memory), decoder(&cpu, &memory, &scheduler)
+{
+    log = nullptr;
+}
+
+void Machine::load_bios(const std::string &bios_path)
+{
+    Context context(this);
+    memory.load_bios(bios_path);
+}
+
+void Machine::load_flash(const std::string &flash_path)
+{
+    Context context(this);
+    memory.load_flash(flash_path);
+}
+
+void Machine::use_bios(std::shared_ptr<const Bios_Image> image)
+{
+    memory.use_bios(std::move(image));
+}
+
+std::uint32_t Machine::load_binary(const std::string &binary_path, bool hle)
+{
+    Context context(this);
+
+    std::uint32_t entry = memory.load_binary(binary_path);
+
+    if (decoder.status != Lucid_Status::Running)
+    {
+        return 0;
+    }
+
+    if (hle)
+    {
+        hle_bios.boot(entry);
+        decoder.hle_bios = &hle_bios;
+    }
+    else
+    {
+        // Straight to the entry point, stack at the top of main memory
+        cpu.set_pc(entry);
+        cpu.set_delay_pc(entry + 2);
+        cpu.set_register(15, 0x8D000000);
+    }
+
+    decoder.resync();
+
+    return entry;
+}
+
+std::uint64_t Machine::run_cycles(std::uint64_t cycles)
+{
+    Context context(this);
+
+    // Idle loops and SLEEP skip ahead to the next event, this makes the end of the slice one
+    scheduler.schedule(cycles, MACHINE_SLICE_EVENT, []() {});
+
+    std::uint64_t ran = decoder.run_cycles(cycles);
+
+    // Still there if the slice was cut short, it would end the next one early
+    scheduler.cancel(MACHINE_SLICE_EVENT);
+
+    return ran;
+}
+
+bool Machine::run_until(std::uint32_t pc, std::uint64_t max_cycles)
+{
+    Context context(this);
+
+    scheduler.schedule(max_cycles, MACHINE_SLICE_EVENT, []() {});
+
+    bool reached = decoder.run_until(pc, max_cycles);
+
+    scheduler.cancel(MACHINE_SLICE_EVENT);
+
+    return reached;
+}
+
+std::uint32_t Machine::step()
+{
+    Context context(this);
+    return decoder.step();
+}
+
+std::uint64_t Machine::get_cycles()
+{
+    return scheduler.get_cycles();
+}
+
+void Machine::save_state(Sh4_Cpu_State &state) const
+{
+    cpu.save_state(state);
+}
+
+void Machine::load_state(const Sh4_Cpu_State &state)
+{
+    cpu.load_state(state);
+    decoder.resync();
+}
+
+std::uint32_t Machine::get_pc()
+{
+    return cpu.get_pc();
+}
+
+std::uint32_t Machine::get_register(std::uint8_t index)
+{
+    return cpu.get_register(index);
+}
+
+void Machine::set_register(std::uint8_t index, std::uint32_t value)
+{
+    cpu.set_register(index, value);
+}
+
+bool Machine::translate(std::uint32_t address, bool write, std::uint32_t &host_address)
+{
+    std::uint32_t p_addr;
+
+    host_address = address;
+
+    if (!cpu.mmu.probe(address, write, cpu.get_md_bit(), p_addr))
+    {
+        return false;
+    }
+
+    // U0/P3 with translation on, P2 so that Memory doesn't translate it again
+    if (cpu.mmu.translating() && (address < 0x80000000 || (address >> 29) == 6))
+    {
+        host_address = p_addr | 0xA0000000;
+    }
+
+    return true;
+}
+
+bool Machine::read_block(std::uint32_t address, void *data, std::uint32_t size)
+{
+    Context context(this);
+    std::uint8_t *bytes = static_cast<std::uint8_t *>(data);
+
+    if (!cpu.mmu.translating())
+    {
+        if (std::uint8_t *ram = memory.ram_pointer(address, size))
+        {
+            std::memcpy(bytes, ram, size);
+            return true;
+        }
+
+        if (std::uint8_t *video = memory.vram_pointer(address, size))
+        {
+            std::memcpy(bytes, video, size);
+            return true;
+        }
+    }
+
+    for (std::uint32_t i = 0; i < size; i++)
+    {
+        std::uint32_t host_address;
+
+        if (!translate(address + i, false, host_address))
+        {
+            return false;
+        }
+
+        bytes[i] = memory.read<std::uint8_t>(host_address, &cpu);
+    }
+
+    return true;
+}
+
+bool Machine::write_block(std::uint32_t address, const void *data, std::uint32_t size)
+{
+    Context context(this);
+    const std::uint8_t *bytes = static_cast<const std::uint8_t *>(data);
+
+    if (!cpu.mmu.translating())
+    {
+        if (std::uint8_t *ram = memory.ram_pointer(address, size))
+        {
+            std::memcpy(ram, bytes, size);
+            memory.ram_written(address, size);
+            return true;
+        }
+
+        if (std::uint8_t *video = memory.vram_pointer(address, size))
+        {
+            std::memcpy(video, bytes, size);
+            return true;
+        }
+    }
+
+    for (std::uint32_t i = 0; i < size; i++)
+    {
+        std::uint32_t host_address;
+
+        if (!translate(address + i, true, host_address))
+        {
+            return false;
+        }
+
+        memory.write<std::uint8_t>(host_address, bytes[i], &cpu);
+    }
+
+    return true;
+}
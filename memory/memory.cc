@@ -4,6 +4,8 @@
 #include <fstream>
 #include <cstring>
 #include <fstream>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #if __has_include(<format>)
     #include <format>
@@ -15,31 +17,296 @@
 
 Memory :: Memory()
 {
-    bios = new std::uint8_t[2 * 1024 * 1024];			// 2MB
+    bios_storage = new std::uint8_t[2 * 1024 * 1024];	// 2MB
+    memset(bios_storage, 0, sizeof(uint8_t) * 2 * 1024 * 1024);
+    bios = bios_storage;
     flash = new std::uint8_t[256 * 1024];				// 256KB
-	main_memory = new std::uint8_t[16 * 1024 * 1024];	// 16MB
+    memset(flash, 0xFF, sizeof(uint8_t) * 256 * 1024);	// Erased
+	main_memory = nullptr;								// 16MB
+	ram_fd = memfd_create("lucid-ram", MFD_CLOEXEC);
+	fastmem = nullptr;
+
+	if (ram_fd >= 0 && ftruncate(ram_fd, 16 * 1024 * 1024) == 0)
+	{
+		void *ram = mmap(nullptr, 16 * 1024 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, ram_fd, 0);
+		main_memory = (ram != MAP_FAILED) ? static_cast<std::uint8_t*>(ram) : nullptr;
+	}
+
+	// No fastmem without memfd
+	if (!main_memory)
+	{
+		if (ram_fd >= 0) close(ram_fd);
+		ram_fd = -1;
+		main_memory = new std::uint8_t[16 * 1024 * 1024];
+	}
+
 	memset(main_memory, 0, sizeof(uint8_t) * 16 * 1024 * 1024);
-	vram = new std::uint8_t[8 * 1024 * 1024];			// 8MB
+	vram = nullptr;										// 8MB
+	vram_fd = memfd_create("lucid-vram", MFD_CLOEXEC);
+
+	if (vram_fd >= 0 && ftruncate(vram_fd, VRAM_SIZE) == 0)
+	{
+		void *video = mmap(nullptr, VRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, vram_fd, 0);
+		vram = (video != MAP_FAILED) ? static_cast<std::uint8_t*>(video) : nullptr;
+	}
+
+	// The 64-bit area just isn't in the fastmem arena then
+	if (!vram)
+	{
+		if (vram_fd >= 0) close(vram_fd);
+		vram_fd = -1;
+		vram = new std::uint8_t[VRAM_SIZE];
+	}
+
+	memset(vram, 0, sizeof(uint8_t) * VRAM_SIZE);
+	code_pages = new std::uint8_t[(16 * 1024 * 1024) >> 12];	// 4KB pages of main memory
+	memset(code_pages, 0, sizeof(uint8_t) * ((16 * 1024 * 1024) >> 12));
+	dirty_pages = nullptr;
 }
 
 Memory::~Memory() {
-    delete[] bios;
+    delete[] bios_storage;
     delete[] flash;
-    delete[] main_memory;
-    delete[] vram;
+    if (fastmem)
+    {
+        munmap(fastmem, FASTMEM_SIZE);
+    }
+
+    if (ram_fd >= 0)
+    {
+        munmap(main_memory, 16 * 1024 * 1024);
+        close(ram_fd);
+    }
+    else
+    {
+        delete[] main_memory;
+    }
+
+    if (vram_fd >= 0)
+    {
+        munmap(vram, VRAM_SIZE);
+        close(vram_fd);
+    }
+    else
+    {
+        delete[] vram;
+    }
+
+    delete[] code_pages;
+    delete[] dirty_pages;
+}
+
+void Memory :: track_dirty_pages()
+{
+    if (!dirty_pages)
+    {
+        dirty_pages = new std::uint8_t[(16 * 1024 * 1024) >> 12];
+        memset(dirty_pages, 0, sizeof(uint8_t) * ((16 * 1024 * 1024) >> 12));
+    }
+}
+
+void Memory :: set_code_page(std::uint32_t p_addr)
+{
+    p_addr &= 0x1FFFFFFF;
+
+    // Only main memory can be written to
+    if (p_addr >= 0x0C000000 && p_addr <= 0x0FFFFFFF && !code_pages[(p_addr & 0x00FFFFFF) >> 12])
+    {
+        code_pages[(p_addr & 0x00FFFFFF) >> 12] = 1;
+        protect_code_page(p_addr, true);
+    }
+}
+
+void Memory :: code_written(std::uint32_t p_addr)
+{
+    code_pages[(p_addr & 0x00FFFFFF) >> 12] = 0;
+    protect_code_page(p_addr, false);
+
+    if (code_write_handler)
+    {
+        code_write_handler(p_addr);
+    }
+}
+
+/*
+    Reserves the arena somewhere below 2GB and maps main memory and the 64-bit
+    VRAM area into it. The 32-bit VRAM area stays inaccessible, its accesses
+    fault once and get patched into helper calls like any other MMIO.
+*/
+bool Memory :: map_fastmem()
+{
+    if (fastmem)
+    {
+        return true;
+    }
+
+    if (ram_fd < 0)
+    {
+        return false;
+    }
+
+    for (std::uintptr_t hint = 0x20000000; hint + FASTMEM_SIZE <= 0x80000000; hint += 0x10000000)
+    {
+        void *arena = mmap(reinterpret_cast<void*>(hint), FASTMEM_SIZE, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if (arena == MAP_FAILED)
+        {
+            continue;
+        }
+
+        // Old kernels treat the hint as just a hint
+        if (arena != reinterpret_cast<void*>(hint))
+        {
+            munmap(arena, FASTMEM_SIZE);
+            continue;
+        }
+
+        fastmem = static_cast<std::uint8_t*>(arena);
+        break;
+    }
+
+    if (!fastmem)
+    {
+        return false;
+    }
+
+    for (std::uint32_t mirror = 0x0C000000; mirror < 0x10000000; mirror += 0x01000000)
+    {
+        if (mmap(fastmem + mirror, 16 * 1024 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ram_fd, 0) == MAP_FAILED)
+        {
+            munmap(fastmem, FASTMEM_SIZE);
+            fastmem = nullptr;
+            return false;
+        }
+    }
+
+    // Both 8MB mirrors of the 64-bit area, and again at 0x06000000
+    for (std::uint32_t mirror = 0x04000000; vram_fd >= 0 && mirror < 0x08000000; mirror += VRAM_SIZE)
+    {
+        if (mirror & 0x01000000)
+        {
+            continue;
+        }
+
+        if (mmap(fastmem + mirror, VRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, vram_fd, 0) == MAP_FAILED)
+        {
+            munmap(fastmem, FASTMEM_SIZE);
+            fastmem = nullptr;
+            return false;
+        }
+    }
+
+    // Code that's already there
+    for (std::uint32_t page = 0; page < ((16 * 1024 * 1024) >> 12); page++)
+    {
+        if (code_pages[page])
+        {
+            protect_code_page(0x0C000000 | (page << 12), true);
+        }
+    }
+
+    return true;
+}
+
+void Memory :: protect_code_page(std::uint32_t p_addr, bool code)
+{
+    if (!fastmem)
+    {
+        return;
+    }
+
+    std::uint32_t page = p_addr & 0x00FFF000;
+
+    for (std::uint32_t mirror = 0x0C000000; mirror < 0x10000000; mirror += 0x01000000)
+    {
+        mprotect(fastmem + mirror + page, 1 << 12, code ? PROT_READ : (PROT_READ | PROT_WRITE));
+    }
+}
+
+std::uint8_t *Memory :: ram_pointer(std::uint32_t address, std::uint32_t size)
+{
+    if (size == 0)
+    {
+        return nullptr;
+    }
+
+    std::uint64_t end = static_cast<std::uint64_t>(address) + size - 1;
+
+    // Has to stay in the same area (P0-P4) for the physical range to be contiguous
+    if (end > 0xFFFFFFFF || ((address ^ static_cast<std::uint32_t>(end)) & 0xE0000000))
+    {
+        return nullptr;
+    }
+
+    std::uint32_t p_addr = address & 0x1FFFFFFF;
+
+    if (p_addr >= 0x0C000000 && (static_cast<std::uint64_t>(p_addr) + size) <= 0x0D000000)
+    {
+        return &main_memory[p_addr - 0x0C000000];
+    }
+
+    return nullptr;
+}
+
+std::uint8_t *Memory :: vram_pointer(std::uint32_t address, std::uint32_t size)
+{
+    if (size == 0 || size > VRAM_SIZE)
+    {
+        return nullptr;
+    }
+
+    std::uint64_t end = static_cast<std::uint64_t>(address) + size - 1;
+
+    if (end > 0xFFFFFFFF || ((address ^ static_cast<std::uint32_t>(end)) & 0xE0000000))
+    {
+        return nullptr;
+    }
+
+    std::uint32_t p_addr = address & 0x1FFFFFFF;
+    std::uint32_t p_end = static_cast<std::uint32_t>(end) & 0x1FFFFFFF;
+
+    // Not the 32-bit area, and not wrapping around into the next mirror
+    if (!is_vram(p_addr) || (p_addr & 0x01000000) || (p_addr & ~(VRAM_SIZE - 1)) != (p_end & ~(VRAM_SIZE - 1)))
+    {
+        return nullptr;
+    }
+
+    return &vram[p_addr & (VRAM_SIZE - 1)];
+}
+
+void Memory :: ram_written(std::uint32_t address, std::uint32_t size)
+{
+    std::uint32_t p_addr = address & 0x1FFFFFFF;
+
+    for (std::uint32_t page = p_addr >> 12; page <= ((p_addr + size - 1) >> 12); page++)
+    {
+        if (dirty_pages)
+        {
+            dirty_pages[page & 0xFFF] = 1;
+        }
+
+        if (code_pages[page & 0xFFF])
+        {
+            code_written(page << 12);
+        }
+    }
 }
 
 void Memory :: load_bios(const std::string& bios_path)
 {
+	bios = bios_storage;
+	shared_bios.reset();
+
 	std::ifstream bios_file(bios_path, std::ios::binary);
 
 	if (!bios_file.is_open()) {
-		std::cerr << BOLDRED << "Failed to open the BIOS file: " << bios_path << RESET << "\n";
+		lucid_err() << BOLDRED << "Failed to open the BIOS file: " << bios_path << RESET << "\n";
 		return;
 	}
 	else
 	{
-		std::cout << BOLDBLUE << "BIOS file opened successfully...!" << RESET "\n";
+		lucid_out() << BOLDBLUE << "BIOS file opened successfully...!" << RESET "\n";
 	}
 
 	const uint32_t bios_base_addr = 0x00000000;
@@ -56,17 +323,64 @@ void Memory :: load_bios(const std::string& bios_path)
 	bios_file.close();
 }
 
+void Memory :: use_bios(std::shared_ptr<const Bios_Image> image)
+{
+    // Nothing ever writes through it, see Bios_Image
+    bios = const_cast<std::uint8_t*>(image->data());
+    shared_bios = std::move(image);
+}
+
+Bios_Image :: Bios_Image()
+{
+    pages = nullptr;
+}
+
+Bios_Image :: ~Bios_Image()
+{
+    if (pages)
+    {
+        munmap(pages, 2 * 1024 * 1024);
+    }
+}
+
+std::shared_ptr<const Bios_Image> Bios_Image :: load(const std::string& bios_path)
+{
+    std::ifstream bios_file(bios_path, std::ios::binary);
+
+    if (!bios_file.is_open())
+    {
+        lucid_err() << BOLDRED << "Failed to open the BIOS file: " << bios_path << RESET << "\n";
+        return nullptr;
+    }
+
+    void *pages = mmap(nullptr, 2 * 1024 * 1024, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (pages == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<Bios_Image> image(new Bios_Image());
+    image->pages = static_cast<std::uint8_t*>(pages);
+
+    // Anything past the end of the file stays zero, same as load_bios
+    bios_file.read(reinterpret_cast<char*>(image->pages), 2 * 1024 * 1024);
+    mprotect(image->pages, 2 * 1024 * 1024, PROT_READ);
+
+    return image;
+}
+
 void Memory :: load_flash(const std::string& flash_path)
 {
 	std::ifstream flash_file(flash_path, std::ios::binary);
 
 	if (!flash_file.is_open()) {
-		std::cerr << BOLDRED << "Failed to open the Flash file: " << flash_path << RESET << "\n";
+		lucid_err() << BOLDRED << "Failed to open the Flash file: " << flash_path << RESET << "\n";
 		return;
 	}
 	else
 	{
-		std::cout << BOLDBLUE << "Flash file opened successfully...!" << RESET "\n";
+		lucid_out() << BOLDBLUE << "Flash file opened successfully...!" << RESET "\n";
 	}
 
 	const uint32_t flash_base_addr = 0x00000000;
@@ -83,31 +397,160 @@ void Memory :: load_flash(const std::string& flash_path)
 	flash_file.close();
 }
 
-void Memory :: load_binary(const std::string& binary_path)
+/*
+    Just the ELF32 fields the loader needs, laid out as in the file (Little endian SH)
+*/
+namespace
 {
-    std::ifstream binary_file(binary_path, std::ios::binary);
+    struct Elf32_Header
+    {
+        std::uint8_t ident[16];
+        std::uint16_t type;
+        std::uint16_t machine;
+        std::uint32_t version;
+        std::uint32_t entry;
+        std::uint32_t phoff;
+        std::uint32_t shoff;
+        std::uint32_t flags;
+        std::uint16_t ehsize;
+        std::uint16_t phentsize;
+        std::uint16_t phnum;
+        std::uint16_t shentsize;
+        std::uint16_t shnum;
+        std::uint16_t shstrndx;
+    };
+
+    struct Elf32_Program_Header
+    {
+        std::uint32_t type;
+        std::uint32_t offset;
+        std::uint32_t vaddr;
+        std::uint32_t paddr;
+        std::uint32_t filesz;
+        std::uint32_t memsz;
+        std::uint32_t flags;
+        std::uint32_t align;
+    };
+
+    constexpr std::uint16_t ELF_MACHINE_SH = 42;
+    constexpr std::uint32_t ELF_PT_LOAD = 1;
+}
+
+/*
+    Loads an ELF32 SH executable, or a raw 1ST_READ.BIN at BINARY_LOAD_ADDRESS, straight
+    into main memory and returns its entry point (0 if it couldn't, see lucid_stop).
+    Segments are read from the file into ram_pointer() in one go, BSS (memsz past filesz)
+    gets zeroed.
+*/
+std::uint32_t Memory :: load_binary(const std::string& binary_path)
+{
+    std::ifstream binary_file(binary_path, std::ios::binary | std::ios::ate);
 
     if (!binary_file.is_open()) {
-        std::cerr << BOLDRED << "Failed to open the binary file: " << binary_path << RESET << "\n";
-        return;
+        lucid_err() << BOLDRED << "Failed to open the binary file: " << binary_path << RESET << "\n";
+        lucid_stop(Lucid_Status::Load_Failed);
+        return 0;
     }
     else
     {
-        std::cout << BOLDBLUE << "Binary file opened successfully...!" << RESET "\n";
+        lucid_out() << BOLDBLUE << "Binary file opened successfully...!" << RESET "\n";
     }
 
-    const uint32_t binary_base_addr = 0x00000000;
-    const uint32_t binary_end_addr = binary_base_addr + 0x0003FFFF;
-    uint32_t offset = binary_base_addr;
+    std::uint64_t file_size = binary_file.tellg();
+    binary_file.seekg(0);
+
+    Elf32_Header header = {};
+    binary_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    bool elf = binary_file.gcount() == sizeof(header) && !memcmp(header.ident, "\x7F" "ELF", 4);
+
+    if (!elf)
+    {
+        std::uint8_t *to = ram_pointer(BINARY_LOAD_ADDRESS, file_size);
+
+        if (!to)
+        {
+            lucid_err() << BOLDRED << "load_binary: " << binary_path << " (" << file_size << " bytes) doesn't fit in main memory at 0x"
+                << format("{:08X}", BINARY_LOAD_ADDRESS) << RESET << "\n";
+            lucid_stop(Lucid_Status::Load_Failed);
+            return 0;
+        }
+
+        // A file shorter than the ELF header left EOF set
+        binary_file.clear();
+        binary_file.seekg(0);
+        binary_file.read(reinterpret_cast<char*>(to), file_size);
+        ram_written(BINARY_LOAD_ADDRESS, file_size);
+
+        if (static_cast<std::uint64_t>(binary_file.gcount()) != file_size)
+        {
+            lucid_err() << BOLDRED << "load_binary: Short read from " << binary_path << " (" << binary_file.gcount() << " of "
+                << file_size << " bytes)" << RESET << "\n";
+            lucid_stop(Lucid_Status::Load_Failed);
+            return 0;
+        }
+
+        lucid_out() << BOLDBLUE << "Loaded " << file_size << " bytes at 0x" << format("{:08X}", BINARY_LOAD_ADDRESS) << RESET << "\n";
+
+        return BINARY_LOAD_ADDRESS;
+    }
+
+    // ELFCLASS32, ELFDATA2LSB
+    if (header.ident[4] != 1 || header.ident[5] != 1 || header.machine != ELF_MACHINE_SH
+        || header.phentsize != sizeof(Elf32_Program_Header))
+    {
+        lucid_err() << BOLDRED << "load_binary: " << binary_path << " isn't a 32-bit little endian SH ELF" << RESET << "\n";
+        lucid_stop(Lucid_Status::Load_Failed);
+        return 0;
+    }
+
+    for (std::uint16_t i = 0; i < header.phnum; i++)
+    {
+        Elf32_Program_Header segment = {};
+        binary_file.clear();
+        binary_file.seekg(header.phoff + i * sizeof(Elf32_Program_Header));
+        binary_file.read(reinterpret_cast<char*>(&segment), sizeof(segment));
+
+        if (binary_file.gcount() != sizeof(segment))
+        {
+            lucid_err() << BOLDRED << "load_binary: Program header " << i << " is past the end of " << binary_path << RESET << "\n";
+            lucid_stop(Lucid_Status::Load_Failed);
+            return 0;
+        }
+
+        if (segment.type != ELF_PT_LOAD || segment.memsz == 0)
+        {
+            continue;
+        }
+
+        std::uint8_t *to = ram_pointer(segment.vaddr, segment.memsz);
+
+        if (!to || segment.filesz > segment.memsz || static_cast<std::uint64_t>(segment.offset) + segment.filesz > file_size)
+        {
+            lucid_err() << BOLDRED << "load_binary: Can't load segment " << i << " (0x" << format("{:08X}", segment.vaddr)
+                << ", 0x" << format("{:X}", segment.memsz) << " bytes) into main memory" << RESET << "\n";
+            lucid_stop(Lucid_Status::Load_Failed);
+            return 0;
+        }
+
+        binary_file.clear();
+        binary_file.seekg(segment.offset);
+        binary_file.read(reinterpret_cast<char*>(to), segment.filesz);
+        memset(to + segment.filesz, 0, segment.memsz - segment.filesz);
+        ram_written(segment.vaddr, segment.memsz);
+
+        if (binary_file.gcount() != static_cast<std::streamsize>(segment.filesz))
+        {
+            lucid_err() << BOLDRED << "load_binary: Short read for segment " << i << " of " << binary_path << RESET << "\n";
+            lucid_stop(Lucid_Status::Load_Failed);
+            return 0;
+        }
 
-    while (!binary_file.eof() && offset <= binary_end_addr) {
-        char byte;
-        binary_file.read(&byte, 1);
-        flash[offset] = static_cast<uint8_t>(byte);
-        offset++;
+        lucid_out() << BOLDBLUE << "Loaded segment at 0x" << format("{:08X}", segment.vaddr) << " (0x" << format("{:X}", segment.filesz)
+            << " bytes, 0x" << format("{:X}", segment.memsz - segment.filesz) << " bytes of BSS)" << RESET << "\n";
     }
 
-    binary_file.close();
+    return header.entry;
 }
 
 void Memory :: dump_ram()
@@ -0,0 +1,118 @@
+#include <scheduler/scheduler.hh>
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+struct Event_Compare {
+    template <typename T>
+    bool operator()(const T &a, const T &b) const
+    {
+        return a.cycle > b.cycle;
+    }
+};
+
+}
+
+Scheduler::Scheduler()
+{
+    cycles = 0;
+    next_event = UINT64_MAX;
+
+    real_time = false;
+    sync_time = std::chrono::steady_clock::now();
+    sync_cycles = 0;
+}
+
+void Scheduler::set_real_time(bool real_time_)
+{
+    real_time = real_time_;
+
+    sync_time = std::chrono::steady_clock::now();
+    sync_cycles = cycles;
+}
+
+/*
+    Whole seconds and the rest are converted apart, multiplying the full count
+    would overflow after a minute and a half
+*/
+std::chrono::steady_clock::time_point Scheduler::cycles_to_host_time(std::uint64_t cycle)
+{
+    std::uint64_t elapsed = (cycle > sync_cycles) ? (cycle - sync_cycles) : 0;
+    std::uint64_t ns = (elapsed / SH4_CLOCK_HZ) * 1000000000ull + ((elapsed % SH4_CLOCK_HZ) * 1000000000ull) / SH4_CLOCK_HZ;
+
+    return sync_time + std::chrono::nanoseconds(ns);
+}
+
+std::uint64_t Scheduler::host_time_to_cycles(std::chrono::steady_clock::time_point time)
+{
+    if (time <= sync_time)
+    {
+        return sync_cycles;
+    }
+
+    std::uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(time - sync_time).count();
+    return sync_cycles + (elapsed / 1000000000ull) * SH4_CLOCK_HZ + ((elapsed % 1000000000ull) * SH4_CLOCK_HZ) / 1000000000ull;
+}
+
+void Scheduler::schedule(std::uint64_t delay, const std::string &name, std::function<void()> callback)
+{
+    // A delay too far out to ever come (UINT64_MAX...) stays at the end of time
+    std::uint64_t cycle = (delay > UINT64_MAX - cycles) ? UINT64_MAX : cycles + delay;
+
+    events.push_back({cycle, name, std::move(callback)});
+    std::push_heap(events.begin(), events.end(), Event_Compare());
+
+    next_event = events.front().cycle;
+}
+
+void Scheduler::cancel(const std::string &name)
+{
+    std::erase_if(events, [&name](const Event &event) { return event.name == name; });
+    std::make_heap(events.begin(), events.end(), Event_Compare());
+
+    next_event = events.empty() ? UINT64_MAX : events.front().cycle;
+}
+
+/*
+    Runs every event that's due, callbacks are free to schedule new ones
+*/
+void Scheduler::run_events()
+{
+    while (!events.empty() && events.front().cycle <= cycles)
+    {
+        std::pop_heap(events.begin(), events.end(), Event_Compare());
+        Event event = std::move(events.back());
+        events.pop_back();
+
+        event.callback();
+    }
+
+    next_event = events.empty() ? UINT64_MAX : events.front().cycle;
+}
+
+/*
+    Fast-forwards emulated time to the next event, used when the guest is known
+    to be idling. Never moves more than max_cycles so that an idle guest with
+    nothing scheduled still hands control back periodically.
+
+    In real-time mode the host thread sleeps until the event is due instead of
+    spinning. Events only come from the emulation thread itself, so nothing can
+    show up in the meantime.
+*/
+void Scheduler::skip_to_next_event(std::uint64_t max_cycles)
+{
+    std::uint64_t target = std::min(next_event, (max_cycles > UINT64_MAX - cycles) ? UINT64_MAX : cycles + max_cycles);
+
+    if (target > cycles)
+    {
+        if (real_time)
+        {
+            std::this_thread::sleep_until(cycles_to_host_time(target));
+        }
+
+        cycles = target;
+    }
+
+    run_events();
+}
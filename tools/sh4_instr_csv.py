@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+#
+# Exports the instruction table in resources/sh4_instr.xlsx to CSV, the
+# instruction test generator (-fuzz) reads its opcode coverage from it.
+# Only needs the standard library, run by CMake at build time.
+#
+# Usage: sh4_instr_csv.py <sh4_instr.xlsx> <output.csv>
+
+import csv
+import re
+import sys
+import zipfile
+import xml.etree.ElementTree as ET
+
+NS = {'m': 'http://schemas.openxmlformats.org/spreadsheetml/2006/main'}
+
+
+def column_index(reference):
+    letters = re.match(r'[A-Z]+', reference).group(0)
+    index = 0
+
+    for letter in letters:
+        index = index * 26 + (ord(letter) - ord('A') + 1)
+
+    return index - 1
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('Usage: sh4_instr_csv.py <sh4_instr.xlsx> <output.csv>')
+
+    with zipfile.ZipFile(sys.argv[1]) as xlsx:
+        strings = []
+
+        if 'xl/sharedStrings.xml' in xlsx.namelist():
+            for item in ET.fromstring(xlsx.read('xl/sharedStrings.xml')).findall('m:si', NS):
+                strings.append(''.join(text.text or '' for text in item.iter('{%s}t' % NS['m'])))
+
+        sheet = ET.fromstring(xlsx.read('xl/worksheets/sheet1.xml'))
+        rows = []
+
+        for row in sheet.findall('.//m:row', NS):
+            values = []
+
+            for cell in row.findall('m:c', NS):
+                index = column_index(cell.get('r'))
+                value = cell.find('m:v', NS)
+                text = '' if value is None else value.text
+
+                if cell.get('t') == 's' and value is not None:
+                    text = strings[int(text)]
+                elif cell.get('t') == 'inlineStr':
+                    text = ''.join(t.text or '' for t in cell.iter('{%s}t' % NS['m']))
+
+                values += [''] * (index - len(values))
+                values.append(' '.join(text.split()))
+
+            if any(values):
+                rows.append(values)
+
+    with open(sys.argv[2], 'w', newline='') as output:
+        csv.writer(output).writerows(rows)
+
+
+if __name__ == '__main__':
+    main()